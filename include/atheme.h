@@ -44,6 +44,8 @@
 #include <atheme/inline.h>
 #include <atheme/instpaths.h>
 #include <atheme/linker.h>
+#include <atheme/literalset.h>
+#include <atheme/maskindex.h>
 #include <atheme/match.h>
 #include <atheme/memory.h>
 #include <atheme/module.h>
@@ -71,5 +73,7 @@
 #include <atheme/uid.h>
 #include <atheme/uplink.h>
 #include <atheme/users.h>
+#include <atheme/userscan.h>
+#include <atheme/workqueue.h>
 
 #endif /* !ATHEME_INC_ATHEME_H */
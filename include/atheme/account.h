@@ -12,6 +12,8 @@
 
 #include <atheme/attributes.h>
 #include <atheme/entity.h>
+#include <atheme/maskindex.h>
+#include <atheme/match.h>
 #include <atheme/object.h>
 #include <atheme/stdheaders.h>
 #include <atheme/structures.h>
@@ -21,36 +23,45 @@ struct kline
 {
 	char *          user;
 	char *          host;
+	struct compiled_mask cuser;     // user and host, compiled
+	struct compiled_mask chost;
 	char *          reason;
 	char *          setby;
 	unsigned long   number;
 	long            duration;
 	time_t          settime;
 	time_t          expires;
+	struct in6_addr ipaddr;         // network of host, if it is an address or CIDR mask
+	unsigned int    ipbits;         // prefix length of ipaddr, 0 if host is not indexed
+	mowgli_node_t   inode;          // for the address tree or the glob list
 };
 
 /* xline list struct */
 struct xline
 {
 	char *          realname;
+	struct compiled_mask cmask;     // realname, compiled
 	char *          reason;
 	char *          setby;
 	unsigned int    number;
 	long            duration;
 	time_t          settime;
 	time_t          expires;
+	struct mask_index_entry ient;   // for xline_find() and xline_find_user()
 };
 
 /* qline list struct */
 struct qline
 {
 	char *          mask;
+	struct compiled_mask cmask;     // mask, compiled
 	char *          reason;
 	char *          setby;
 	unsigned int    number;
 	long            duration;
 	time_t          settime;
 	time_t          expires;
+	struct mask_index_entry ient;   // for qline_find_match() and qline_find_user()
 };
 
 /* services ignore struct */
@@ -58,6 +69,7 @@ struct svsignore
 {
 	struct svsignore *      svsignore;
 	char *                  mask;
+	struct compiled_mask    cmask;
 	time_t                  settime;
 	char *                  setby;
 	char *                  reason;
@@ -70,6 +82,7 @@ struct myuser
 	char                    pass[PASSLEN + 1];
 	stringref               email;
 	stringref               email_canonical;
+	mowgli_node_t           email_node;             // in the accounts list for email_canonical
 	mowgli_list_t           logins;                 // 'struct user's currently logged in to this
 	time_t                  registered;
 	time_t                  lastlogin;
@@ -84,6 +97,7 @@ struct myuser
 	mowgli_list_t           nicks;                  // registered nicks, must include mu->name if nonempty
 	struct language *       language;
 	mowgli_list_t           cert_fingerprints;
+	mowgli_list_t           authcookies;            // 'struct authcookie's issued for this
 };
 
 /* Keep this synchronized with mu_flags in libathemecore/flags.c */
@@ -149,6 +163,7 @@ struct mychan
 	unsigned int            mlock_limit;
 	char *                  mlock_key;
 	unsigned int            flags;
+	struct chanacs_index *  acsindex;       // built on demand, see chanacs_user_flags()
 };
 
 /* Keep this synchronized with mc_flags in libathemecore/flags.c */
@@ -182,6 +197,7 @@ struct chanacs
 	struct myentity *       entity;
 	struct mychan *         mychan;
 	char *                  host;
+	struct compiled_mask    chost;          // host, compiled; unused for entity entries
 	unsigned int            level;
 	time_t                  tmodified;
 	mowgli_node_t           cnode;
@@ -330,6 +346,7 @@ extern mowgli_list_t xlnlist;
 
 struct xline *xline_add(const char *realname, const char *reason, long duration, const char *setby);
 void xline_delete(const char *realname);
+void xline_set_number(struct xline *x, unsigned int number);
 struct xline *xline_find(const char *realname);
 struct xline *xline_find_num(unsigned int number);
 struct xline *xline_find_user(struct user *u);
@@ -339,6 +356,7 @@ extern mowgli_list_t qlnlist;
 
 struct qline *qline_add(const char *mask, const char *reason, long duration, const char *setby);
 void qline_delete(const char *mask);
+void qline_set_number(struct qline *q, unsigned int number);
 struct qline *qline_find(const char *mask);
 struct qline *qline_find_match(const char *mask);
 struct qline *qline_find_num(unsigned int number);
@@ -388,6 +406,7 @@ struct myuser *mychan_pick_successor(struct mychan *mc);
 const char *mychan_get_mlock(struct mychan *mc);
 const char *mychan_get_sts_mlock(struct mychan *mc);
 
+void chanacs_index_invalidate(struct mychan *mychan);
 struct chanacs *chanacs_add(struct mychan *mychan, struct myentity *myuser, unsigned int level, time_t ts, struct myentity *setter);
 struct chanacs *chanacs_add_host(struct mychan *mychan, const char *host, unsigned int level, time_t ts, struct myentity *setter);
 
@@ -398,6 +417,8 @@ struct chanacs *chanacs_find_host(struct mychan *mychan, const char *host, unsig
 unsigned int chanacs_host_flags(struct mychan *mychan, const char *host);
 struct chanacs *chanacs_find_host_literal(struct mychan *mychan, const char *host, unsigned int level);
 struct chanacs *chanacs_find_host_by_user(struct mychan *mychan, struct user *u, unsigned int level);
+unsigned int chanacs_foreach_host_by_user(struct mychan *mychan, struct user *u,
+                                          bool (*cb)(struct chanacs *ca, void *privdata), void *privdata);
 struct chanacs *chanacs_find_by_mask(struct mychan *mychan, const char *mask, unsigned int level);
 bool chanacs_user_has_flag(struct mychan *mychan, struct user *u, unsigned int level);
 unsigned int chanacs_user_flags(struct mychan *mychan, struct user *u);
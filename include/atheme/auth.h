@@ -14,9 +14,43 @@
 #include <atheme/stdheaders.h>
 #include <atheme/structures.h>
 
+// Results passed to a password_async_cb
+enum password_async_result
+{
+	PWASYNC_FAILED          = 0,    // Wrong password, or the account was dropped meanwhile
+	PWASYNC_OK              = 1,    // The password was verified or set
+	PWASYNC_ERROR           = 2,    // The crypt worker failed; not the client's fault
+	PWASYNC_CANCELLED       = 3,    // The request was cancelled; do not touch its owner
+};
+
+// Return values of verify_password_async() and set_password_async()
+enum password_async_status
+{
+	PWASYNC_QUEUED          = 0,    // The callback will be called later from the event loop
+	PWASYNC_BUSY            = 1,    // The queue, or this source's share of it, is full
+	PWASYNC_SYNC            = 2,    // Not handled by the crypt workers; use the synchronous function
+};
+
+typedef void (*password_async_cb)(struct myuser *mu, enum password_async_result result, void *priv);
+
 bool set_password(struct myuser *mu, const char *password) ATHEME_FATTR_WUR;
 bool verify_password(struct myuser *mu, const char *password) ATHEME_FATTR_WUR;
 
+/* These hand the hashing to the crypt worker processes (general::crypt_workers).
+ * The owner is an opaque pointer (a user, connection, SASL session ...) used to
+ * cancel the request when it goes away; users and connections are taken care of
+ * by the core. The source (normally an IP address) is used to share the queue
+ * fairly. The callback is never called before these return.
+ */
+enum password_async_status set_password_async(struct myuser *mu, const char *password, const void *owner,
+                                              const char *source, password_async_cb cb, void *priv)
+    ATHEME_FATTR_WUR;
+enum password_async_status verify_password_async(struct myuser *mu, const char *password, const void *owner,
+                                                 const char *source, password_async_cb cb, void *priv)
+    ATHEME_FATTR_WUR;
+bool password_async_pending(const void *owner);
+void password_async_cancel(const void *owner, password_async_cb cb);
+
 extern bool auth_module_loaded;
 extern bool (*auth_user_custom)(struct myuser *mu, const char *password) ATHEME_FATTR_WUR;
 
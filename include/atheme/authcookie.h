@@ -20,7 +20,8 @@ struct authcookie
 	char *          ticket;
 	struct myuser * myuser;
 	time_t          expire;
-	mowgli_node_t   node;
+	mowgli_node_t   node;           // in authcookie_list, oldest first
+	mowgli_node_t   unode;          // in myuser->authcookies
 };
 
 void authcookie_init(void);
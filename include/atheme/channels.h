@@ -10,6 +10,7 @@
 #ifndef ATHEME_INC_CHANNELS_H
 #define ATHEME_INC_CHANNELS_H 1
 
+#include <atheme/match.h>
 #include <atheme/stdheaders.h>
 #include <atheme/structures.h>
 
@@ -49,6 +50,7 @@ struct chanban
 {
 	struct channel *chan;
 	char *          mask;
+	struct compiled_mask cmask;
 	int             type;   // 'b', 'e', 'I', etc -- jilles
 	mowgli_node_t   node;   // for struct channel -> bans
 	unsigned int    flags;
@@ -135,6 +137,8 @@ struct chanuser *chanuser_find(struct channel *chan, struct user *user);
 struct chanban *chanban_add(struct channel *chan, const char *mask, int type);
 void chanban_delete(struct chanban *c);
 struct chanban *chanban_find(struct channel *chan, const char *mask, int type);
+unsigned int chanban_foreach_matching(struct channel *chan, struct user *u, int type,
+                                      bool (*cb)(struct chanban *c, void *privdata), void *privdata);
 //inline void chanban_clear(struct channel *chan);
 
 #endif /* !ATHEME_INC_CHANNELS_H */
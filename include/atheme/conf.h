@@ -22,6 +22,7 @@ void init_newconf(void);
 /* XXX Unstable module api to add things to the standard conf blocks */
 extern mowgli_list_t conf_si_table; /* serverinfo{} */
 extern mowgli_list_t conf_gi_table; /* general{} */
+extern mowgli_list_t conf_db_table; /* database{} */
 extern mowgli_list_t conf_la_table; /* language{} */
 
 #endif /* !ATHEME_INC_CONF_H */
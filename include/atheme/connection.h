@@ -62,6 +62,14 @@ struct connection
 	connection_evhandler            close_handler;
 	connection_evhandler            recvq_handler;
 	size_t                          sendq_limit;
+	size_t                          sendq_len;      // bytes queued in sendq
+	size_t                          sendq_peak;
+	size_t                          recvq_len;      // bytes queued in recvq
+	size_t                          recvq_peak;
+	unsigned long                   send_bytes;
+	unsigned long                   send_calls;     // writev()/send() system calls
+	unsigned long                   recv_bytes;
+	unsigned long                   recv_calls;     // recv() system calls
 	time_t                          first_recv;
 	time_t                          last_recv;
 	unsigned int                    flags;
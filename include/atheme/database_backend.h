@@ -55,6 +55,51 @@ struct database_handle
 	unsigned int                    token;
 };
 
+// Statistics about the most recent database save, passed to the db_saved hook
+struct db_save_stats
+{
+	time_t                          finished;       // when the save completed
+	unsigned int                    msecs;          // how long it took
+	unsigned int                    stall_msecs;    // how much of that services could not do anything else
+	unsigned long                   bytes;          // size of the database written (0 if unknown or failed)
+	unsigned long                   raw_bytes;      // its size before compression (0 if not compressed)
+	unsigned int                    compress_msecs; // CPU time spent compressing it
+	bool                            background;     // written by a forked child or from the event loop
+};
+
+/* A save that the backend serialized into memory, to be written out on the
+ * work queue a slice at a time (general::db_save_snapshot). The caller
+ * points db_snapshot at one of these before db_open(); a backend that
+ * supports it then keeps everything in memory and hands the result to
+ * db_snapshot_commit() from its db_close(), instead of writing it itself.
+ *
+ * If the backend sets encode, every slice goes through it on its way to the
+ * file (to compress it, for example); it points out at what is to be written
+ * for the slice, which stays valid until the next call, and is told when a
+ * slice is the last one. encode() runs on a worker thread, see workqueue.h.
+ * encode_free() is called from the event loop once the file is written, but
+ * before the callback.
+ */
+struct db_snapshot
+{
+	char *                          buf;            // the serialized database
+	size_t                          len;
+	size_t                          done;           // bytes of buf written out so far
+	unsigned long                   written;        // bytes that went into the file
+	int                             fd;             // open on tmppath
+	int                             lockfd;         // released once written, or -1
+	char                            tmppath[BUFSIZE];
+	char                            path[BUFSIZE];  // what tmppath is renamed to once written
+	bool                            error;
+	int                             write_errno;    // of the write that failed, or 0
+	struct workqueue_job *          job;            // writing the next slice
+	void                          (*callback)(bool ok);
+	bool                          (*encode)(struct db_snapshot *snap, const char *in, size_t len, bool last,
+	                                        const char **out, size_t *outlen);
+	void                          (*encode_free)(struct db_snapshot *snap);
+	void *                          encode_priv;
+};
+
 struct database_module
 {
 	struct database_handle *      (*db_open)(const char *filename, enum database_transaction txn);
@@ -62,6 +107,9 @@ struct database_module
 	void                          (*db_parse)(struct database_handle *db);
 };
 
+void db_snapshot_commit(struct db_snapshot *snap);
+void db_snapshot_finish(void);
+
 struct database_handle *db_open(const char *filename, enum database_transaction txn);
 void db_close(struct database_handle *db);
 void db_parse(struct database_handle *db);
@@ -96,5 +144,7 @@ void db_unregister_type_handler(const char *type);
 void db_process(struct database_handle *db, const char *type);
 void db_init(void);
 extern const struct database_module *db_mod;
+extern struct db_save_stats db_save_stats;
+extern struct db_snapshot *db_snapshot;
 
 #endif /* !ATHEME_INC_DATABASE_BACKEND_H */
@@ -23,6 +23,8 @@ int recvq_length(struct connection *cptr);
 void recvq_put(struct connection *cptr);
 int recvq_get(struct connection *cptr, char *buf, size_t len);
 int recvq_getline(struct connection *cptr, char *buf, size_t len);
+char *recvq_peekline(struct connection *cptr, size_t maxlen, size_t *len);
+void recvq_skip(struct connection *cptr, size_t len);
 
 void sendqrecvq_free(struct connection *cptr);
 
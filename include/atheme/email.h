@@ -38,5 +38,6 @@ void canonicalize_email_case(char email[static (EMAILLEN + 1)], void *user_data)
 void register_email_canonicalizer(email_canonicalizer_fn func, void *user_data);
 void unregister_email_canonicalizer(email_canonicalizer_fn func, void *user_data);
 bool email_within_limits(const char *email);
+const mowgli_list_t *email_index_find(stringref email_canonical);
 
 #endif /* !ATHEME_INC_EMAIL_H */
@@ -72,6 +72,10 @@ struct ConfOption
 	unsigned int    clone_time;             // default expire for clone exemptions
 	unsigned int    commit_interval;        // interval between commits
 	bool            db_save_blocking;       // whether to always use a blocking database commit
+	bool            db_save_snapshot;       // serialize saves into memory and write them from the event loop
+	unsigned int    journal_interval;       // how often to write out the change journal; 0 disables it
+	unsigned int    db_compression;         // how to compress the database (DB_COMPRESSION_*)
+	unsigned int    db_compression_level;   // compression level, 1 (fastest) to 9 (smallest)
 	bool            silent;                 // stop sending WALLOPS?
 	bool            join_chans;             // join registered channels?
 	bool            leave_chans;            // leave channels when empty?
@@ -90,6 +94,8 @@ struct ConfOption
 	unsigned int    default_clone_warn;     // default clone warn
 	bool            clone_increase;         // If the clone limit will increase based on # of identified clones
 	unsigned int    uplink_sendq_limit;
+	unsigned int    log_flush_interval;     // how long log lines may sit in memory before being written
+	unsigned int    log_buffer_size;        // size of each log file's write buffer
 	char *          language;               // default language
 	mowgli_list_t   exempts;                // List of masks never to automatically kline
 	bool            allow_taint;            // allow tainted operation
@@ -100,10 +106,18 @@ struct ConfOption
 	bool            masks_through_vhost;    // whether masks match the host/IP behind a vhost
 	unsigned int    default_pass_length;    // the default length for services-generated passwords (resetpass,
 	                                        // sendpass, return)
+	unsigned int    crypt_workers;          // processes hashing passwords off the event loop; 0 disables them
+	unsigned int    crypt_queue_max;        // password hashing requests that may be outstanding
+	unsigned int    crypt_queue_per_source; // ... of which from one IP address
+	unsigned int    workqueue_threads;      // threads running CPU-heavy jobs; 0 runs them in the event loop
 };
 
 extern struct ConfOption config_options;
 
+/* values for config_options.db_compression */
+#define DB_COMPRESSION_NONE 0
+#define DB_COMPRESSION_GZIP 1
+
 /* keep track of how many of what we have */
 struct cnt
 {
@@ -11,6 +11,7 @@
 #define ATHEME_INC_HOOK_H 1
 
 #include <atheme/common.h>
+#include <atheme/hooktypes.h>
 #include <atheme/stdheaders.h>
 #include <atheme/structures.h>
 
@@ -20,6 +21,8 @@ struct hook
 {
 	stringref       name;
 	mowgli_list_t   hooks;
+	unsigned long   calls;          // Times called with at least one handler
+	unsigned long   usecs;          // Cumulative time spent in its handlers
 };
 
 struct hook_channel_acl_req
@@ -258,6 +261,8 @@ void hook_del_hook(const char *, hook_fn);
 void hook_add_hook(const char *, hook_fn);
 void hook_add_hook_first(const char *, hook_fn);
 void hook_call_event(const char *, void *);
+void hook_call_event_id(enum hook_id, void *);
+void hook_stats(void (*cb)(const char *line, void *privdata), void *privdata);
 
 void hook_stop(void);
 void hook_continue(void *newptr);
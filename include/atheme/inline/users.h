@@ -8,6 +8,7 @@
 #ifndef ATHEME_INC_INLINE_USERS_H
 #define ATHEME_INC_INLINE_USERS_H 1
 
+#include <atheme/match.h>
 #include <atheme/stdheaders.h>
 #include <atheme/users.h>
 
@@ -20,4 +21,21 @@ user_is_channel_banned(struct user *const restrict u, const char ban_type)
 	return false;
 }
 
+// compiled_mask_match() against one of a user's cached mask forms
+static inline bool
+user_mask_form_match(const struct compiled_mask *const restrict cm, const struct user_mask_form *const restrict form)
+{
+	return compiled_mask_match_folded(cm, form->str, form->folded, form->len);
+}
+
+// match_cidr() against a user's cached IP, without formatting or parsing it
+static inline bool
+user_masks_match_cidr(const struct user_masks *const restrict um, const char *const restrict mask)
+{
+	if (um->ipaddr == NULL)
+		return false;
+
+	return !match_cidr_addr(mask, um->nickuser, um->ipaddr);
+}
+
 #endif /* !ATHEME_INC_INLINE_USERS_H */
@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Finding every occurrence of a set of literal strings in one pass over a
+ * text (Aho-Corasick).
+ *
+ * Literals are added, then the set is compiled, then it can be searched
+ * until the next literal_set_add() or literal_set_clear(). Each distinct
+ * literal gets an ID with a data pointer for the caller to use; the
+ * search reports the data of every literal found, once per occurrence.
+ * Matching is byte for byte, so callers fold case themselves.
+ */
+
+#ifndef ATHEME_INC_LITERALSET_H
+#define ATHEME_INC_LITERALSET_H 1
+
+#include <atheme/attributes.h>
+#include <atheme/stdheaders.h>
+
+struct literal_set;
+
+typedef void (*literal_set_hit_fn)(void *data, void *privdata);
+
+struct literal_set *literal_set_create(void) ATHEME_FATTR_MALLOC ATHEME_FATTR_RETURNS_NONNULL;
+void literal_set_destroy(struct literal_set *ls);
+void literal_set_clear(struct literal_set *ls);
+unsigned int literal_set_add(struct literal_set *ls, const char *lit, size_t len);
+void *literal_set_get(const struct literal_set *ls, unsigned int id);
+void literal_set_set(struct literal_set *ls, unsigned int id, void *data);
+bool literal_set_empty(const struct literal_set *ls);
+void literal_set_compile(struct literal_set *ls);
+void literal_set_search(const struct literal_set *ls, const char *text, size_t len, literal_set_hit_fn hit,
+                        void *privdata);
+
+#endif /* !ATHEME_INC_LITERALSET_H */
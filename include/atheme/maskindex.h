@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Finding the first of many glob masks that matches a name.
+ *
+ * Masks without wildcards are looked up by their case-folded form. Every
+ * other mask is filed under the longest run of literal characters in it,
+ * and one pass of an Aho-Corasick automaton over the name finds the masks
+ * whose literal it contains; only those are matched in full. Masks with no
+ * literal, or which need match(), are always tried.
+ */
+
+#ifndef ATHEME_INC_MASKINDEX_H
+#define ATHEME_INC_MASKINDEX_H 1
+
+#include <atheme/attributes.h>
+#include <atheme/match.h>
+#include <atheme/stdheaders.h>
+
+struct mask_index;
+
+/* Embedded in whatever is being indexed; the fields belong to maskindex.c */
+struct mask_index_entry
+{
+	struct compiled_mask *          cm;
+	void *                          data;
+	unsigned long                   seq;            // order added in; the lowest match wins
+	unsigned long                   seen;           // lookup that last tried this entry
+	struct mask_index_entry *       next;           // in its exact, literal or fallback chain
+	mowgli_node_t                   node;           // in the list of all entries
+};
+
+/* Called for a matching entry's data; return false to keep looking */
+typedef bool (*mask_index_accept_fn)(void *data, void *privdata);
+
+struct mask_index *mask_index_create(void) ATHEME_FATTR_MALLOC ATHEME_FATTR_RETURNS_NONNULL;
+void mask_index_destroy(struct mask_index *mi);
+void mask_index_add(struct mask_index *mi, struct mask_index_entry *ie, struct compiled_mask *cm, void *data);
+void mask_index_delete(struct mask_index *mi, struct mask_index_entry *ie);
+void *mask_index_find(struct mask_index *mi, const char *name, mask_index_accept_fn accept, void *privdata);
+
+#endif /* !ATHEME_INC_MASKINDEX_H */
@@ -12,6 +12,7 @@
 #define ATHEME_INC_MATCH_H 1
 
 #include <atheme/attributes.h>
+#include <atheme/constants.h>
 #include <atheme/stdheaders.h>
 
 #ifdef HAVE_LIBPCRE
@@ -25,6 +26,44 @@ enum atheme_regex_type
 	at_pcre = 2
 };
 
+enum compiled_mask_type
+{
+	CMASK_MATCH     = 0,    // escapes or character classes; matched with match()
+	CMASK_LITERAL   = 1,    // no '*'
+	CMASK_PREFIX    = 2,    // one '*', at the end
+	CMASK_SUFFIX    = 3,    // one '*', at the start
+	CMASK_GLOB      = 4,    // anything else made of literals, '*' and '?'
+};
+
+/* A glob mask compiled for repeated matching; see compiled_mask_init().
+ * The case-folded pattern is split into a literal head (before the first
+ * '*'), a literal tail (after the last '*') and the segments in between,
+ * which are searched for left to right.
+ */
+struct compiled_mask
+{
+	const char *            mask;           // what it was compiled from; not owned
+	char *                  folded;         // case-folded mask, runs of '*' collapsed
+	size_t                  len;            // length of folded
+	size_t                  minlen;         // shortest name that can match
+	size_t                  head;           // length of folded before the first '*'
+	size_t                  tail;           // length of folded after the last '*'
+	enum compiled_mask_type type;
+	int                     mapping;        // match_mapping folded was made with
+	bool                    wildone;        // folded contains '?'
+};
+
+/* A name folded once with match_fold(), to be matched against many compiled
+ * masks with compiled_mask_match_name().
+ */
+struct folded_name
+{
+	const char *            name;
+	const char *            folded;         // NULL if name is too long to fold
+	size_t                  len;
+	char                    buf[BUFSIZE];
+};
+
 struct atheme_regex
 {
 	enum atheme_regex_type  type;
@@ -34,11 +73,17 @@ struct atheme_regex
 		pcre2_code *    pcre;
 #endif
 	} un;
+#ifdef HAVE_LIBPCRE
+	pcre2_match_data *      md;             // for regex_match(); makes the regex unsafe to share between threads
+#endif
 };
 
 /* cidr.c */
 int match_ips(const char *mask, const char *address);
 int match_cidr(const char *mask, const char *address);
+int match_cidr_addr(const char *mask, const char *nickuser, const struct in6_addr *addr);
+bool ipaddr_parse(const char *src, struct in6_addr *dst);
+bool ipmask_parse(const char *src, struct in6_addr *dst, unsigned int *bits);
 
 /* match.c */
 #define MATCH_RFC1459   0
@@ -81,6 +126,14 @@ void noopcanon(char *);
 int match(const char *, const char *);
 char *collapse(char *);
 
+size_t match_fold(char *dst, const char *src, size_t size);
+void compiled_mask_init(struct compiled_mask *cm, const char *mask);
+void compiled_mask_free(struct compiled_mask *cm);
+bool compiled_mask_match(const struct compiled_mask *cm, const char *name);
+bool compiled_mask_match_folded(const struct compiled_mask *cm, const char *name, const char *folded, size_t len);
+void folded_name_init(struct folded_name *fn, const char *name);
+bool compiled_mask_match_name(const struct compiled_mask *cm, const struct folded_name *fn);
+
 /* regex_create() flags */
 #define AREGEX_ICASE	1 /* case insensitive */
 #define AREGEX_PCRE	2 /* use libpcre engine */
@@ -88,7 +141,9 @@ char *collapse(char *);
 
 struct atheme_regex *regex_create(char *pattern, int flags) ATHEME_FATTR_MALLOC;
 char *regex_extract(char *pattern, char **pend, int *pflags);
-bool regex_match(struct atheme_regex *preg, char *string);
+bool regex_match(struct atheme_regex *preg, const char *string);
+size_t regex_fold(char *dst, const char *src, size_t size);
+size_t regex_required_literal(const char *pattern, int flags, char *buf, size_t size);
 bool regex_destroy(struct atheme_regex *preg);
 
 #endif /* !ATHEME_INC_MATCH_H */
@@ -24,20 +24,51 @@ echo '#ifndef ATHEME_INC_HOOKTYPES_H'
 echo '#define ATHEME_INC_HOOKTYPES_H 1'
 echo
 
+# Every hook listed in the specfile gets a compile-time ID, so that calling it
+# is an array index instead of a by-name lookup (see hook_call_event_id()).
+echo '#define ATHEME_HOOK_LIST(X) \'
+while read hook type; do
+	case $hook:$type in
+	[#]*|:)
+		continue
+		;;
+	*)
+		echo "    X($hook) \\"
+		;;
+	esac
+done < "$1"
+echo '    /* end of list */'
+echo
+echo 'enum hook_id'
+echo '{'
+while read hook type; do
+	case $hook:$type in
+	[#]*|:)
+		continue
+		;;
+	*)
+		echo "	HOOK_ID_$hook,"
+		;;
+	esac
+done < "$1"
+echo '	HOOK_ID_COUNT'
+echo '};'
+echo
+
 while read hook type; do
 	case $hook:$type in
 	[#]*|:)
 		continue
 		;;
 	*:void)
-		echo "#define hook_call_$hook() hook_call_event(\"$hook\", NULL)"
+		echo "#define hook_call_$hook() hook_call_event_id(HOOK_ID_$hook, NULL)"
 		# Still require a dummy void * function parameter here.
 		echo "#define hook_add_$hook(f) hook_add_hook(\"$hook\", f)"
 		echo "#define hook_add_first_$hook(f) hook_add_hook_first(\"$hook\", f)"
 		echo "#define hook_del_$hook(f) hook_del_hook(\"$hook\", f)"
 		;;
 	*)
-		echo "#define hook_call_$hook(x) hook_call_event(\"$hook\", ENSURE_TYPE(x, $type))"
+		echo "#define hook_call_$hook(x) hook_call_event_id(HOOK_ID_$hook, ENSURE_TYPE(x, $type))"
 		echo "#define hook_add_$hook(f) hook_add_hook(\"$hook\", (void (*)(void *))ENSURE_TYPE(f, void (*)($type)))"
 		echo "#define hook_add_first_$hook(f) hook_add_hook_first(\"$hook\", (void (*)(void *))ENSURE_TYPE(f, void (*)($type)))"
 		echo "#define hook_del_$hook(f) hook_del_hook(\"$hook\", (void (*)(void *))ENSURE_TYPE(f, void (*)($type)))"
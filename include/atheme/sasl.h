@@ -34,8 +34,8 @@
 
 // Flags for sasl_session->flags
 #define ASASL_SFLAG_NONE                0x00000000U // Nothing special
-#define ASASL_SFLAG_MARKED_FOR_DELETION 0x00000001U // See sasl_delete_stale() in modules/saslserv/main.c
 #define ASASL_SFLAG_CLIENT_SECURE       0x00000002U // The client is connected to the network securely
+#define ASASL_SFLAG_RESULT_PENDING      0x00000004U // The mechanism returned ASASL_MRESULT_ASYNC
 
 // Flags for sasl_input_buf->flags
 #define ASASL_INFLAG_NONE               0x00000000U // Nothing special
@@ -49,6 +49,7 @@
 struct sasl_session
 {
 	mowgli_node_t                   node;                   // Node for entry into the active sessions list
+	mowgli_node_t                   expnode;                // Node for entry into the expiry timer wheel
 	const struct sasl_mechanism *   mechptr;                // Mechanism they're using
 	struct server *                 server;                 // Server they're on
 	struct sourceinfo *             si;                     // The source info for logcommand(), bad_password(), and login hooks
@@ -59,6 +60,7 @@ struct sasl_session
 	char *                          buf;                    // Buffered Base-64 data from them (so far)
 	size_t                          len;                    // Length of buffered Base-64 data
 	unsigned int                    flags;                  // Flags (described above)
+	unsigned int                    expslot;                // Slot of the expiry timer wheel expnode is in
 	char                            authcid[NICKLEN + 1];   // Authentication identity (user having credentials verified)
 	char                            authzid[NICKLEN + 1];   // Authorization identity (user being logged in)
 	char                            authceid[IDLEN + 1];    // Entity ID for authcid
@@ -102,6 +104,7 @@ enum sasl_mechanism_result
 	ASASL_MRESULT_FAILURE   = 2,    // Client supplied invalid credentials; run bad_password() on the target
 	ASASL_MRESULT_CONTINUE  = 3,    // Everything looks good so far, but we need more data from the client
 	ASASL_MRESULT_SUCCESS   = 4,    // The client has successfully authenticated
+	ASASL_MRESULT_ASYNC     = 5,    // The result will be passed to sasl_core_functions->mech_resume() later
 };
 
 typedef enum sasl_mechanism_result (*sasl_mech_start_fn)(struct sasl_session *restrict,
@@ -130,6 +133,7 @@ struct sasl_core_functions
 	sasl_authxid_can_login_fn   authcid_can_login;
 	sasl_authxid_can_login_fn   authzid_can_login;
 	void                      (*recalc_mechlist)(const struct sasl_session *, const char **);
+	void                      (*mech_resume)(struct sasl_session *, enum sasl_mechanism_result);
 };
 
 #endif /* !ATHEME_INC_SASL_H */
@@ -97,6 +97,7 @@ bool bad_password(struct sourceinfo *si, struct myuser *mu);
 bool ircd_logout_or_kill(struct user *u, const char *login);
 
 struct sourceinfo *sourceinfo_create(void);
+struct sourceinfo *sourceinfo_recycle(struct sourceinfo *si);
 void command_fail(struct sourceinfo *si, enum cmd_faultcode code, const char *fmt, ...) ATHEME_FATTR_PRINTF(3, 4);
 void command_success_nodata(struct sourceinfo *si, const char *fmt, ...) ATHEME_FATTR_PRINTF(2, 3);
 void command_success_string(struct sourceinfo *si, const char *result, const char *fmt, ...) ATHEME_FATTR_PRINTF(3, 4);
@@ -133,6 +133,11 @@
 #  include <sys/time.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+// struct iovec, readv(), writev()
+#  include <sys/uio.h>
+#endif
+
 #ifdef HAVE_SYS_WAIT_H
 // W*, wait(), waitpid(), ...
 #  include <sys/wait.h>
@@ -12,6 +12,7 @@
 
 // Defined in atheme/account.h
 struct chanacs;
+struct chanacs_index;   // opaque, private to libathemecore/account.c
 struct groupacs;
 struct mychan;
 struct mygroup;
@@ -42,6 +43,7 @@ struct translation;
 struct database_handle;
 struct database_module;
 struct database_vtable;
+struct db_save_stats;
 
 // Defined in atheme/digest*.h
 struct digest_context;
@@ -140,5 +142,6 @@ struct uplink;
 
 // Defined in atheme/users.h
 struct user;
+struct user_masks;
 
 #endif /* !ATHEME_INC_STRUCTURES_H */
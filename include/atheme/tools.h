@@ -41,10 +41,15 @@ struct logfile
 	unsigned int            log_mask;
 	log_write_func_fn       write_func;
 	enum log_type           log_type;
+	char *                  wbuf;           // pending output for file streams, flushed by log_flush()
+	size_t                  wbuf_len;
+	size_t                  wbuf_size;
+	unsigned int            wbuf_lines;
 };
 
 extern char *log_path; /* contains path to default log. */
 extern int log_force;
+extern unsigned int log_active_mask; /* union of every registered logfile's log_mask */
 
 struct logfile *logfile_new(const char *log_path_, unsigned int log_mask) ATHEME_FATTR_MALLOC_UNCHECKED;
 void logfile_register(struct logfile *lf);
@@ -88,10 +93,14 @@ void logfile_unregister(struct logfile *lf);
 
 void log_open(void);
 void log_shutdown(void);
+void log_flush(void);
+void log_stats(void (*cb)(const char *line, void *privdata), void *privdata);
 bool log_debug_enabled(void);
 void log_master_set_mask(unsigned int mask);
 struct logfile *logfile_find_mask(unsigned int log_mask);
 void slog(unsigned int level, const char *fmt, ...) ATHEME_FATTR_PRINTF(2, 3);
+/* don't evaluate the arguments or format the message if nothing would log it */
+#define slog(level, ...) ((((level) & log_active_mask) != 0) ? slog((level), __VA_ARGS__) : (void) 0)
 void logcommand(struct sourceinfo *si, int level, const char *fmt, ...) ATHEME_FATTR_PRINTF(3, 4);
 void logcommand_user(struct service *svs, struct user *source, int level, const char *fmt, ...) ATHEME_FATTR_PRINTF(4, 5);
 void logcommand_external(struct service *svs, const char *type, struct connection *source, const char *sourcedesc, struct myuser *login, int level, const char *fmt, ...) ATHEME_FATTR_PRINTF(7, 8);
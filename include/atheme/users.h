@@ -26,6 +26,8 @@ struct user
 	stringref               vhost;          // Visible host
 	stringref               uid;            // Used for TS6, P10, IRCNet ircd
 	stringref               ip;
+	struct in6_addr         ipaddr;         // Parsed ip (IPv4 as IPv4-mapped), if ipaddr_valid
+	bool                    ipaddr_valid;
 	mowgli_list_t           channels;
 	struct server *         server;
 	struct myuser *         myuser;
@@ -36,6 +38,39 @@ struct user
 	time_t                  ts;
 	mowgli_node_t           snode;          // for struct server -> userlist
 	char *                  certfp;         // client certificate fingerprint
+	struct user_masks *     masks;          // built by user_masks(), NULL until first needed
+};
+
+/* One nick!user@host form of a user, as is and case-folded with match_fold()
+ * for compiled_mask_match_folded().
+ */
+struct user_mask_form
+{
+	const char *    str;
+	const char *    folded;
+	size_t          len;
+};
+
+/* The nick!user@host forms of a user that bans and host access entries are
+ * matched against. They are built once by user_masks() and rebuilt only when
+ * the nick, username or one of the hosts changes; the stringrefs they were
+ * built from are held, so a changed field can never have the same address
+ * as the one it replaced.
+ */
+struct user_masks
+{
+	stringref               nick;
+	stringref               user;
+	stringref               host;
+	stringref               chost;
+	stringref               vhost;
+	int                     mapping;        // match_mapping the forms were folded with
+	const char *            nickuser;       // nick!user, for match_cidr_addr()
+	struct user_mask_form   vhostmask;      // nick!user@vhost
+	struct user_mask_form   chostmask;      // nick!user@chost
+	struct user_mask_form   hostmask;       // nick!user@host
+	struct user_mask_form   ipmask;         // nick!user@ip (nick!user@ if the ip is unknown)
+	const struct in6_addr * ipaddr;         // the parsed ip, or NULL if it is unknown
 };
 
 #define UF_AWAY        0x00000002U
@@ -80,6 +115,7 @@ void user_mode(struct user *user, const char *modes);
 void user_sethost(struct user *source, struct user *target, const char *host);
 const char *user_get_umodestr(struct user *u);
 struct chanuser *find_user_banned_channel(struct user *u, char ban_type);
+const struct user_masks *user_masks(struct user *u);
 
 /* uid.c */
 void init_uid(void);
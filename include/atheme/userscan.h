@@ -0,0 +1,67 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Scanning the network's users on the work queue.
+ *
+ * A scan starts by copying what it looks at of every user into one arena,
+ * so that worker threads never touch the user list. A regex scan splits
+ * this snapshot into chunks, matches each on the work queue with its own
+ * copy of the regex, and hands the matches back from the event loop in
+ * snapshot order, a chunk at a time, as soon as the chunks before it are
+ * in. user_scan_run() runs one function over the whole snapshot instead.
+ *
+ * The snapshot is freed after done() is called.
+ */
+
+#ifndef ATHEME_INC_USERSCAN_H
+#define ATHEME_INC_USERSCAN_H 1
+
+#include <atheme/stdheaders.h>
+
+/* Offsets into the arena. The mask is "nick!user@host gecos", which ends
+ * with the gecos; the IP address is empty if the ircd did not send one.
+ */
+struct user_snapshot_user
+{
+	unsigned int            mask;
+	unsigned int            gecos;
+	unsigned int            ip;
+};
+
+struct user_snapshot
+{
+	char *                          arena;
+	size_t                          arenalen;
+	size_t                          arenasize;
+	struct user_snapshot_user *     users;
+	unsigned int                    count;
+};
+
+#define USER_SNAPSHOT_MASK(snap, i)     ((snap)->arena + (snap)->users[(i)].mask)
+#define USER_SNAPSHOT_GECOS(snap, i)    ((snap)->arena + (snap)->users[(i)].gecos)
+#define USER_SNAPSHOT_IP(snap, i)       ((snap)->arena + (snap)->users[(i)].ip)
+
+// Called on a worker thread, see workqueue.h; the result is handed to done()
+typedef void *(*user_scan_run_fn)(const struct user_snapshot *snap);
+
+// Called from the event loop for every user a regex scan matched, in snapshot order
+typedef void (*user_scan_match_fn)(const struct user_snapshot *snap, unsigned int user, void *priv);
+
+/* Called from the event loop once the scan is over, with the result of run()
+ * (always NULL for regex scans, and for cancelled scans whose run() never
+ * started). If cancelled is true, the owner may be gone, and the callback
+ * should do nothing but free the result and priv.
+ */
+typedef void (*user_scan_done_fn)(const struct user_snapshot *snap, void *result, bool cancelled, void *priv);
+
+bool user_scan_regex(const char *pattern, int flags, const void *owner, user_scan_match_fn match,
+                     user_scan_done_fn done, void *priv);
+void user_scan_run(const char *name, user_scan_run_fn run, const void *owner, user_scan_done_fn done, void *priv);
+void user_scan_cancel(const void *owner, user_scan_done_fn done);
+void user_scan_cancel_wait(const void *owner, user_scan_done_fn done);
+unsigned int user_scan_pending(const void *owner);
+
+#endif /* !ATHEME_INC_USERSCAN_H */
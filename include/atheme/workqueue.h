@@ -0,0 +1,62 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Running CPU-heavy jobs on worker threads.
+ *
+ * A job is a pure function of its input: run() is called on a worker thread
+ * with the input and returns a result, and done() is later called from the
+ * event loop with that result. Services itself is not thread-safe, so run()
+ * may only use:
+ *
+ *   - its input, which must not be modified by anyone until done() is called,
+ *     and anything it allocates itself;
+ *   - smalloc(), scalloc(), srealloc(), sfree() and the other functions in
+ *     memory.h;
+ *   - reentrant libc functions, such as string formatting and regexec(3);
+ *   - match(), match_ips(), match_cidr(), irccasecmp() and ToLower(); they
+ *     only read the casemapping, which is set when the protocol module loads;
+ *   - regex_fold(), and regex_match() with a non-NULL string on a pattern
+ *     compiled before submitting that no other job uses at the same time.
+ *
+ * In particular run() must not log, call hooks, send anything, touch any
+ * object's reference count, or read or write users, channels, accounts,
+ * lists, dictionaries or configuration. Copy whatever it needs into the
+ * input before submitting.
+ *
+ * Jobs tied to a user or a connection should use it as the owner; they are
+ * cancelled automatically when it goes away.
+ */
+
+#ifndef ATHEME_INC_WORKQUEUE_H
+#define ATHEME_INC_WORKQUEUE_H 1
+
+#include <atheme/stdheaders.h>
+
+struct workqueue_job;
+
+// Called on a worker thread; returns the result handed to workqueue_done_fn
+typedef void *(*workqueue_run_fn)(const void *input);
+
+/* Called from the event loop exactly once per job, with the result of run()
+ * (or NULL if it never ran); the input is freed afterwards. If cancelled is
+ * true, the owner may be gone, and the callback should do nothing but free
+ * the result and priv.
+ */
+typedef void (*workqueue_done_fn)(void *result, const void *input, void *priv, bool cancelled);
+
+struct workqueue_job *workqueue_submit(const char *name, workqueue_run_fn run, void *input,
+                                       void (*input_free)(void *), workqueue_done_fn done,
+                                       const void *owner, void *priv);
+void workqueue_cancel(const void *owner, workqueue_done_fn done);
+void workqueue_cancel_wait(const void *owner, workqueue_done_fn done);
+void workqueue_cancel_job(struct workqueue_job *job);
+void workqueue_cancel_job_wait(struct workqueue_job *job);
+void workqueue_wait_job(struct workqueue_job *job);
+bool workqueue_job_finished(const struct workqueue_job *job);
+unsigned int workqueue_pending(const void *owner);
+void workqueue_stats(void (*cb)(const char *line, void *privdata), void *privdata);
+
+#endif /* !ATHEME_INC_WORKQUEUE_H */
@@ -29,6 +29,207 @@ static mowgli_heap_t *myuser_name_heap;	/* HEAP_USER / 2 */
 static mowgli_heap_t *mychan_heap;	/* HEAP_CHANNEL */
 static mowgli_heap_t *chanacs_heap;	/* HEAP_CHANACS */
 
+/* Per-channel access list index, built the first time a channel's access
+ * list is queried and thrown away whenever an entry on it is added, removed
+ * or modified (see chanacs_index_invalidate()).
+ *
+ * Entries on plain accounts, which only ever match themselves, are hashed
+ * by entity pointer. Entries on groups and exttargets (entities with their
+ * own match functions) and hostmask entries are kept on separate lists, so
+ * a lookup no longer has to walk the whole access list.
+ *
+ * On top of that sits a small cache of each online user's effective flags.
+ * It is only used on channels without group or exttarget entries, because
+ * whether those match can change without the access list changing.
+ */
+#define CHANACS_INDEX_MINSIZE   16U
+#define CHANACS_CACHE_SIZE      32U
+#define CHANACS_MATCHES_LOCAL   16U     // host matches collected without allocating
+
+struct chanacs_cache_entry
+{
+	const struct user *     u;
+	const struct myuser *   mu;
+	stringref               nick;
+	stringref               user;
+	stringref               host;
+	stringref               vhost;
+	stringref               chost;
+	stringref               ip;
+	bool                    waitauth;
+	unsigned int            epoch;
+	unsigned int            flags;
+};
+
+struct chanacs_index
+{
+	struct chanacs **               entities;
+	size_t                          entities_size;
+	mowgli_list_t                   exttargets;
+	mowgli_list_t                   hosts;
+	struct chanacs_cache_entry      cache[CHANACS_CACHE_SIZE];
+};
+
+// Cache entries from an older epoch are stale (0 is never valid)
+static unsigned int chanacs_cache_epoch = 1;
+
+static inline size_t
+chanacs_index_hash(const void *const ptr)
+{
+	uint64_t h = ((uint64_t) (uintptr_t) ptr) * UINT64_C(0x9E3779B97F4A7C15);
+
+	return (size_t) (h ^ (h >> 32));
+}
+
+static struct chanacs_index *
+chanacs_index_get(struct mychan *const mc)
+{
+	struct chanacs_index *idx;
+	mowgli_node_t *n;
+	size_t size = CHANACS_INDEX_MINSIZE;
+
+	if (mc->acsindex != NULL)
+		return mc->acsindex;
+
+	while (size < (MOWGLI_LIST_LENGTH(&mc->chanacs) * 2U))
+		size *= 2U;
+
+	idx = smalloc(sizeof *idx);
+	idx->entities = scalloc(size, sizeof *idx->entities);
+	idx->entities_size = size;
+
+	MOWGLI_ITER_FOREACH(n, mc->chanacs.head)
+	{
+		struct chanacs *const ca = n->data;
+
+		if (ca->entity == NULL)
+			mowgli_node_add(ca, mowgli_node_create(), &idx->hosts);
+		else if (ca->entity->vtable != NULL)
+			mowgli_node_add(ca, mowgli_node_create(), &idx->exttargets);
+		else
+		{
+			size_t slot = chanacs_index_hash(ca->entity) & (size - 1U);
+
+			while (idx->entities[slot] != NULL)
+				slot = (slot + 1U) & (size - 1U);
+
+			idx->entities[slot] = ca;
+		}
+	}
+
+	mc->acsindex = idx;
+
+	return idx;
+}
+
+/* next hashed entry on entity mt, starting the probe at *slot */
+static struct chanacs *
+chanacs_index_next_entity(const struct chanacs_index *const idx, const struct myentity *const mt, size_t *const slot)
+{
+	const size_t mask = idx->entities_size - 1U;
+	struct chanacs *ca;
+
+	while ((ca = idx->entities[*slot]) != NULL)
+	{
+		*slot = (*slot + 1U) & mask;
+
+		if (ca->entity == mt)
+			return ca;
+	}
+
+	return NULL;
+}
+
+static unsigned int
+chanacs_index_entity_level(const struct chanacs_index *const idx, const struct myentity *const mt)
+{
+	size_t slot = chanacs_index_hash(mt) & (idx->entities_size - 1U);
+	unsigned int result = 0;
+	struct chanacs *ca;
+
+	while ((ca = chanacs_index_next_entity(idx, mt, &slot)) != NULL)
+		result |= ca->level;
+
+	return result;
+}
+
+void
+chanacs_index_invalidate(struct mychan *mc)
+{
+	struct chanacs_index *const idx = mc->acsindex;
+	mowgli_node_t *n, *tn;
+
+	if (idx == NULL)
+		return;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, idx->exttargets.head)
+	{
+		mowgli_node_delete(n, &idx->exttargets);
+		mowgli_node_free(n);
+	}
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, idx->hosts.head)
+	{
+		mowgli_node_delete(n, &idx->hosts);
+		mowgli_node_free(n);
+	}
+
+	sfree(idx->entities);
+	sfree(idx);
+
+	mc->acsindex = NULL;
+}
+
+static struct chanacs_cache_entry *
+chanacs_cache_slot(struct chanacs_index *const idx, const struct user *const u)
+{
+	return &idx->cache[chanacs_index_hash(u) & (CHANACS_CACHE_SIZE - 1U)];
+}
+
+static bool
+chanacs_cache_valid(const struct chanacs_cache_entry *const ce, const struct user *const u)
+{
+	/* everything the result depends on; stringrefs are shared, so a
+	 * changed nick, ident or host always has a different pointer
+	 */
+	return ce->epoch == chanacs_cache_epoch && ce->u == u && ce->mu == u->myuser &&
+	       ce->nick == u->nick && ce->user == u->user && ce->host == u->host &&
+	       ce->vhost == u->vhost && ce->chost == u->chost && ce->ip == u->ip &&
+	       ce->waitauth == (u->myuser != NULL && (u->myuser->flags & MU_WAITAUTH));
+}
+
+static void
+chanacs_cache_store(struct chanacs_cache_entry *const ce, const struct user *const u, const unsigned int flags)
+{
+	ce->u = u;
+	ce->mu = u->myuser;
+	ce->nick = u->nick;
+	ce->user = u->user;
+	ce->host = u->host;
+	ce->vhost = u->vhost;
+	ce->chost = u->chost;
+	ce->ip = u->ip;
+	ce->waitauth = (u->myuser != NULL && (u->myuser->flags & MU_WAITAUTH));
+	ce->epoch = chanacs_cache_epoch;
+	ce->flags = flags;
+}
+
+/* mask matching may depend on configuration */
+static void
+chanacs_cache_flush(void ATHEME_VATTR_UNUSED *unused)
+{
+	if (++chanacs_cache_epoch == 0)
+		chanacs_cache_epoch = 1;
+}
+
+/* modules may modify ->level directly before calling the channel_acl_change hook */
+static void
+chanacs_acl_changed(struct hook_channel_acl_req *req)
+{
+	if (req->ca != NULL && req->ca->mychan != NULL)
+		chanacs_index_invalidate(req->ca->mychan);
+}
+
 /*
  * init_accounts()
  *
@@ -64,6 +265,9 @@ init_accounts(void)
 	oldnameslist = mowgli_patricia_create(irccasecanon);
 	mclist = mowgli_patricia_create(irccasecanon);
 	certfplist = mowgli_patricia_create(strcasecanon);
+
+	hook_add_first_channel_acl_change(chanacs_acl_changed);
+	hook_add_config_ready(chanacs_cache_flush);
 }
 
 /*
@@ -121,6 +325,7 @@ myuser_add_id(const char *id, const char *name, const char *pass, const char *em
 	entity(mu)->name = strshare_get(name);
 	mu->email = strshare_get(email);
 	mu->email_canonical = canonicalize_email(email);
+	email_index_add(mu);
 	if (id)
 	{
 		if (myentity_find_uid(id) == NULL)
@@ -311,6 +516,7 @@ myuser_delete(struct myuser *mu)
 	/* entity(mu)->name is the index for this dtree */
 	myentity_del(entity(mu));
 
+	email_index_del(mu);
 	strshare_unref(mu->email);
 	strshare_unref(mu->email_canonical);
 	strshare_unref(entity(mu)->name);
@@ -402,11 +608,13 @@ myuser_set_email(struct myuser *mu, const char *newemail)
 	return_if_fail(mu != NULL);
 	return_if_fail(newemail != NULL);
 
+	email_index_del(mu);
 	strshare_unref(mu->email);
 	strshare_unref(mu->email_canonical);
 
 	mu->email = strshare_get(newemail);
 	mu->email_canonical = canonicalize_email(newemail);
+	email_index_add(mu);
 }
 
 /*
@@ -980,6 +1188,8 @@ mychan_delete(struct mychan *mc)
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, mc->chanacs.head)
 		atheme_object_unref(n->data);
 
+	chanacs_index_invalidate(mc);
+
 	metadata_delete_all(mc);
 
 	mowgli_patricia_delete(mclist, mc->name);
@@ -1382,6 +1592,7 @@ chanacs_delete(struct chanacs *ca)
 		slog(LG_DEBUG, "chanacs_delete(): %s -> %s [%s]", ca->mychan->name,
 			ca->entity != NULL ? entity(ca->entity)->name : ca->host,
 			ca->entity != NULL ? "entity" : "hostmask");
+	chanacs_index_invalidate(ca->mychan);
 	mowgli_node_delete(&ca->cnode, &ca->mychan->chanacs);
 
 	if (ca->entity != NULL)
@@ -1394,6 +1605,7 @@ chanacs_delete(struct chanacs *ca)
 
 	metadata_delete_all(ca);
 
+	compiled_mask_free(&ca->chost);
 	sfree(ca->host);
 
 	mowgli_heap_free(chanacs_heap, ca);
@@ -1448,6 +1660,7 @@ chanacs_add(struct mychan *mychan, struct myentity *mt, unsigned int level, time
 	else
 		ca->setter_uid[0] = '\0';
 
+	chanacs_index_invalidate(mychan);
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
 	mowgli_node_add(ca, &ca->unode, &mt->chanacs);
 
@@ -1498,11 +1711,14 @@ chanacs_add_host(struct mychan *mychan, const char *host, unsigned int level, ti
 	ca->level = level & ca_all;
 	ca->tmodified = ts;
 
+	compiled_mask_init(&ca->chost, ca->host);
+
 	if (setter != NULL)
 		mowgli_strlcpy(ca->setter_uid, setter->id, sizeof ca->setter_uid);
 	else
 		ca->setter_uid[0] = '\0';
 
+	chanacs_index_invalidate(mychan);
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
 
 	cnt.chanacs++;
@@ -1521,15 +1737,15 @@ chanacs_find(struct mychan *mychan, struct myentity *mt, unsigned int level)
 	if ((ca = chanacs_find_literal(mychan, mt, level)) != NULL)
 		return ca;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	/* plain account entries only match themselves, which the literal
+	 * lookup above already covered
+	 */
+	MOWGLI_ITER_FOREACH(n, chanacs_index_get(mychan)->exttargets.head)
 	{
 		const struct entity_vtable *vt;
 
 		ca = (struct chanacs *)n->data;
 
-		if (ca->entity == NULL)
-			continue;
-
 		vt = myentity_get_vtable(ca->entity);
 		if (level != 0x0)
 		{
@@ -1548,18 +1764,20 @@ chanacs_entity_flags(struct mychan *mychan, struct myentity *mt)
 {
 	mowgli_node_t *n;
 	struct chanacs *ca;
+	struct chanacs_index *idx;
 	unsigned int result = 0;
 
 	return_val_if_fail(mychan != NULL && mt != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	idx = chanacs_index_get(mychan);
+	result |= chanacs_index_entity_level(idx, mt);
+
+	MOWGLI_ITER_FOREACH(n, idx->exttargets.head)
 	{
 		const struct entity_vtable *vt;
 
 		ca = (struct chanacs *)n->data;
 
-		if (ca->entity == NULL)
-			continue;
 		if (ca->entity == mt)
 			result |= ca->level;
 		else
@@ -1580,19 +1798,23 @@ chanacs_find_literal(struct mychan *mychan, struct myentity *mt, unsigned int le
 {
 	mowgli_node_t *n;
 	struct chanacs *ca;
+	struct chanacs_index *idx;
+	size_t slot;
 
 	return_val_if_fail(mychan != NULL && mt != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	idx = chanacs_index_get(mychan);
+	slot = chanacs_index_hash(mt) & (idx->entities_size - 1U);
+
+	while ((ca = chanacs_index_next_entity(idx, mt, &slot)) != NULL)
+		if ((ca->level & level) == level)
+			return ca;
+
+	MOWGLI_ITER_FOREACH(n, idx->exttargets.head)
 	{
 		ca = (struct chanacs *)n->data;
 
-		if (level != 0x0)
-		{
-			if (ca->entity == mt && ((ca->level & level) == level))
-				return ca;
-		}
-		else if (ca->entity == mt)
+		if (ca->entity == mt && ((ca->level & level) == level))
 			return ca;
 	}
 
@@ -1604,19 +1826,19 @@ chanacs_find_host(struct mychan *mychan, const char *host, unsigned int level)
 {
 	mowgli_node_t *n;
 	struct chanacs *ca;
+	struct folded_name fn;
 
 	return_val_if_fail(mychan != NULL && host != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	folded_name_init(&fn, host);
+
+	MOWGLI_ITER_FOREACH(n, chanacs_index_get(mychan)->hosts.head)
 	{
 		ca = (struct chanacs *)n->data;
 
-		if (level != 0x0)
-		{
-			if ((ca->entity == NULL) && (!match(ca->host, host)) && ((ca->level & level) == level))
-				return ca;
-		}
-		else if ((ca->entity == NULL) && (!match(ca->host, host)))
+		if ((ca->level & level) != level)
+			continue;
+		if (compiled_mask_match_name(&ca->chost, &fn))
 			return ca;
 	}
 
@@ -1629,14 +1851,17 @@ chanacs_host_flags(struct mychan *mychan, const char *host)
 	mowgli_node_t *n;
 	struct chanacs *ca;
 	unsigned int result = 0;
+	struct folded_name fn;
 
 	return_val_if_fail(mychan != NULL && host != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	folded_name_init(&fn, host);
+
+	MOWGLI_ITER_FOREACH(n, chanacs_index_get(mychan)->hosts.head)
 	{
 		ca = (struct chanacs *)n->data;
 
-		if (ca->entity == NULL && !match(ca->host, host))
+		if (compiled_mask_match_name(&ca->chost, &fn))
 			result |= ca->level;
 	}
 
@@ -1652,58 +1877,135 @@ chanacs_find_host_literal(struct mychan *mychan, const char *host, unsigned int
 	if ((!mychan) || (!host))
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, chanacs_index_get(mychan)->hosts.head)
 	{
 		ca = (struct chanacs *)n->data;
 
 		if (level != 0x0)
 		{
-			if ((ca->entity == NULL) && (!strcasecmp(ca->host, host)) && ((ca->level & level) == level))
+			if ((!strcasecmp(ca->host, host)) && ((ca->level & level) == level))
 				return ca;
 		}
-		else if ((ca->entity == NULL) && (!strcasecmp(ca->host, host)))
+		else if (!strcasecmp(ca->host, host))
 			return ca;
 	}
 
 	return NULL;
 }
 
-struct chanacs *
-chanacs_find_host_by_user(struct mychan *mychan, struct user *u, unsigned int level)
+/*
+ * chanacs_foreach_host_by_user(struct mychan *mychan, struct user *u,
+ *                              cb, privdata)
+ *
+ * Tests a user against every host access entry of a channel in one pass,
+ * calling cb for each entry that matches until it returns false. The
+ * matches are collected first, and held until cb has been called for all
+ * of them, so cb may delete entries (which also throws the index away).
+ *
+ * Returns the number of matching entries cb was called for.
+ */
+unsigned int
+chanacs_foreach_host_by_user(struct mychan *mychan, struct user *u,
+                             bool (*cb)(struct chanacs *ca, void *privdata), void *privdata)
 {
+	struct chanacs *local[CHANACS_MATCHES_LOCAL];
+	struct chanacs **matches = local;
+	size_t nmatches = 0, size = ARRAY_SIZE(local);
 	mowgli_node_t *n;
-	struct chanacs *ca;
+	mowgli_list_t *hosts;
+	unsigned int count = 0;
 
-	return_val_if_fail(mychan != NULL && u != NULL, NULL);
+	return_val_if_fail(mychan != NULL && u != NULL && cb != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	hosts = &chanacs_index_get(mychan)->hosts;
+
+	for (n = next_matching_host_chanacs(mychan, u, hosts->head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
-		ca = n->data;
-		if ((ca->level & level) == level)
-			return ca;
+		if (nmatches == size)
+		{
+			size *= 2;
+
+			if (matches == local)
+			{
+				matches = smalloc(size * sizeof *matches);
+				memcpy(matches, local, sizeof local);
+			}
+			else
+				matches = srealloc(matches, size * sizeof *matches);
+		}
+
+		matches[nmatches++] = atheme_object_ref(n->data);
 	}
 
-	return NULL;
+	for (size_t i = 0; i < nmatches; i++)
+	{
+		count++;
+
+		if (!cb(matches[i], privdata))
+			break;
+	}
+
+	for (size_t i = 0; i < nmatches; i++)
+		atheme_object_unref(matches[i]);
+
+	if (matches != local)
+		sfree(matches);
+
+	return count;
+}
+
+struct chanacs_host_match
+{
+	unsigned int    level;
+	unsigned int    flags;
+	struct chanacs *ca;
+};
+
+static bool
+chanacs_find_host_by_user_cb(struct chanacs *const restrict ca, void *const restrict privdata)
+{
+	struct chanacs_host_match *const hm = privdata;
+
+	if ((ca->level & hm->level) != hm->level)
+		return true;
+
+	hm->ca = ca;
+	return false;
+}
+
+struct chanacs *
+chanacs_find_host_by_user(struct mychan *mychan, struct user *u, unsigned int level)
+{
+	struct chanacs_host_match hm = { .level = level };
+
+	return_val_if_fail(mychan != NULL && u != NULL, NULL);
+
+	(void) chanacs_foreach_host_by_user(mychan, u, &chanacs_find_host_by_user_cb, &hm);
+
+	return hm.ca;
+}
+
+static bool
+chanacs_host_flags_by_user_cb(struct chanacs *const restrict ca, void *const restrict privdata)
+{
+	struct chanacs_host_match *const hm = privdata;
+
+	hm->flags |= ca->level;
+	return true;
 }
 
 static unsigned int
 chanacs_host_flags_by_user(struct mychan *mychan, struct user *u)
 {
-	mowgli_node_t *n;
-	unsigned int result = 0;
-	struct chanacs *ca;
+	struct chanacs_host_match hm = { .flags = 0 };
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
-	{
-		ca = n->data;
-		result |= ca->level;
-	}
+	(void) chanacs_foreach_host_by_user(mychan, u, &chanacs_host_flags_by_user_cb, &hm);
 
-	slog(LG_DEBUG, "chanacs_host_flags_by_user(%s, %s): return %s", mychan->name, u->nick, bitmask_to_flags(result));
+	slog(LG_DEBUG, "chanacs_host_flags_by_user(%s, %s): return %s", mychan->name, u->nick, bitmask_to_flags(hm.flags));
 
-	return result;
+	return hm.flags;
 }
 
 struct chanacs *
@@ -1750,20 +2052,24 @@ static unsigned int
 chanacs_entity_flags_by_user(struct mychan *mychan, struct user *u)
 {
 	mowgli_node_t *n;
+	struct chanacs_index *idx;
 	unsigned int result = 0;
 
 	return_val_if_fail(mychan != NULL, 0);
 	return_val_if_fail(u != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	idx = chanacs_index_get(mychan);
+
+	// plain account entries match the account the user is logged in to
+	if (u->myuser != NULL)
+		result |= chanacs_index_entity_level(idx, entity(u->myuser));
+
+	MOWGLI_ITER_FOREACH(n, idx->exttargets.head)
 	{
 		struct chanacs *ca = n->data;
 		struct myentity *mt;
 		const struct entity_vtable *vt;
 
-		if (ca->entity == NULL)
-			continue;
-
 		mt = ca->entity;
 		vt = myentity_get_vtable(mt);
 
@@ -1780,10 +2086,22 @@ unsigned int
 chanacs_user_flags(struct mychan *mychan, struct user *u)
 {
 	struct myentity *mt;
+	struct chanacs_index *idx;
+	struct chanacs_cache_entry *ce = NULL;
 	unsigned int result = 0;
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
+	idx = chanacs_index_get(mychan);
+
+	if (MOWGLI_LIST_LENGTH(&idx->exttargets) == 0)
+	{
+		ce = chanacs_cache_slot(idx, u);
+
+		if (chanacs_cache_valid(ce, u))
+			return ce->flags;
+	}
+
 	mt = entity(u->myuser);
 	if (mt != NULL)
 		result |= chanacs_entity_flags(mychan, mt);
@@ -1798,6 +2116,9 @@ chanacs_user_flags(struct mychan *mychan, struct user *u)
 
 	result |= chanacs_host_flags_by_user(mychan, u);
 
+	if (ce != NULL)
+		chanacs_cache_store(ce, u, result);
+
 	slog(LG_DEBUG, "chanacs_user_flags(%s, %s): return %s", mychan->name, u->nick, bitmask_to_flags(result));
 
 	return result;
@@ -1880,6 +2201,7 @@ chanacs_modify(struct chanacs *ca, unsigned int *addflags, unsigned int *removef
 		return false;
 	ca->level = (ca->level | *addflags) & ~*removeflags;
 	ca->tmodified = CURRTIME;
+	chanacs_index_invalidate(ca->mychan);
 	if (setter != NULL)
 		mowgli_strlcpy(ca->setter_uid, entity(setter)->id, sizeof ca->setter_uid);
 	else
@@ -1949,6 +2271,7 @@ chanacs_change(struct mychan *mychan, struct myentity *mt, const char *hostmask,
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
 			ca->tmodified = CURRTIME;
+			chanacs_index_invalidate(mychan);
 			if (setter != NULL)
 				mowgli_strlcpy(ca->setter_uid, setter->id, sizeof ca->setter_uid);
 			else
@@ -1990,6 +2313,7 @@ chanacs_change(struct mychan *mychan, struct myentity *mt, const char *hostmask,
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
 			ca->tmodified = CURRTIME;
+			chanacs_index_invalidate(mychan);
 			if (setter != NULL)
 				mowgli_strlcpy(ca->setter_uid, setter->id, sizeof ca->setter_uid);
 			else
@@ -121,6 +121,9 @@ daemonize(int *daemonize_pipe)
 	/* fork into the background */
 	if (!(runflags & RF_LIVE))
 	{
+		// Otherwise both processes would write out what's buffered so far
+		log_flush();
+
 		if (pipe(daemonize_pipe) < 0)
 		{
 			slog(LG_ERROR, "can't create a pipe");
@@ -374,6 +377,8 @@ atheme_setup(void)
 
 	authcookie_init();
 	common_ctcp_init();
+	cryptpool_init();
+	workqueue_init();
 }
 
 void
@@ -16,7 +16,12 @@
 #include <atheme.h>
 #include "internal.h"
 
+/* Every authcookie lives for the same time from its creation, so keeping
+ * them in creation order also keeps them in expiry order; authcookie_expire()
+ * only has to look at the head of the list.
+ */
 static mowgli_list_t authcookie_list;
+static mowgli_patricia_t *authcookie_tree = NULL;
 static mowgli_heap_t *authcookie_heap = NULL;
 
 void
@@ -29,6 +34,8 @@ authcookie_init(void)
 		slog(LG_ERROR, "authcookie_init(): cannot initialize block allocator.");
 		exit(EXIT_FAILURE);
 	}
+
+	authcookie_tree = mowgli_patricia_create(noopcanon);
 }
 
 /*
@@ -47,11 +54,22 @@ struct authcookie *
 authcookie_create(struct myuser *mu)
 {
 	struct authcookie *const au = mowgli_heap_alloc(authcookie_heap);
+
 	au->ticket = random_string(AUTHCOOKIE_LENGTH);
+
+	/* tickets are random, but they are also the key */
+	while (mowgli_patricia_retrieve(authcookie_tree, au->ticket))
+	{
+		sfree(au->ticket);
+		au->ticket = random_string(AUTHCOOKIE_LENGTH);
+	}
+
 	au->myuser = mu;
 	au->expire = CURRTIME + SECONDS_PER_HOUR;
 
 	mowgli_node_add(au, &au->node, &authcookie_list);
+	mowgli_node_add(au, &au->unode, &mu->authcookies);
+	mowgli_patricia_add(authcookie_tree, au->ticket, au);
 
 	return au;
 }
@@ -71,45 +89,20 @@ authcookie_create(struct myuser *mu)
 struct authcookie *
 authcookie_find(const char *ticket, struct myuser *myuser)
 {
-	mowgli_node_t *n;
 	struct authcookie *ac;
 
 	/* at least one must be specified */
 	return_val_if_fail(ticket != NULL || myuser != NULL, NULL);
 
-	if (!myuser)		/* must have ticket */
-	{
-		MOWGLI_ITER_FOREACH(n, authcookie_list.head)
-		{
-			ac = n->data;
+	if (!ticket)		/* must have myuser */
+		return myuser->authcookies.head ? myuser->authcookies.head->data : NULL;
 
-			if (!strcmp(ac->ticket, ticket))
-				return ac;
-		}
-	}
-	else if (!ticket)	/* must have myuser */
-	{
-		MOWGLI_ITER_FOREACH(n, authcookie_list.head)
-		{
-			ac = n->data;
+	ac = mowgli_patricia_retrieve(authcookie_tree, ticket);
 
-			if (ac->myuser == myuser)
-				return ac;
-		}
-	}
-	else			/* must have both */
-	{
-		MOWGLI_ITER_FOREACH(n, authcookie_list.head)
-		{
-			ac = n->data;
-
-			if (ac->myuser == myuser
-				&& !strcmp(ac->ticket, ticket))
-				return ac;
-		}
-	}
+	if (ac != NULL && myuser != NULL && ac->myuser != myuser)
+		return NULL;
 
-	return NULL;
+	return ac;
 }
 
 /*
@@ -130,6 +123,8 @@ authcookie_destroy(struct authcookie * ac)
 	return_if_fail(ac != NULL);
 
 	mowgli_node_delete(&ac->node, &authcookie_list);
+	mowgli_node_delete(&ac->unode, &ac->myuser->authcookies);
+	mowgli_patricia_delete(authcookie_tree, ac->ticket);
 	sfree(ac->ticket);
 	mowgli_heap_free(authcookie_heap, ac);
 }
@@ -150,15 +145,9 @@ void
 authcookie_destroy_all(struct myuser *mu)
 {
 	mowgli_node_t *n, *tn;
-	struct authcookie *ac;
-
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, authcookie_list.head)
-	{
-		ac = n->data;
 
-		if (ac->myuser == mu)
-			authcookie_destroy(ac);
-	}
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, mu->authcookies.head)
+		authcookie_destroy(n->data);
 }
 
 /*
@@ -177,15 +166,18 @@ void
 authcookie_expire(void *arg)
 {
 	struct authcookie *ac;
-	mowgli_node_t *n, *tn;
 
 	(void)arg;
-        MOWGLI_ITER_FOREACH_SAFE(n, tn, authcookie_list.head)
+
+	while (authcookie_list.head != NULL)
 	{
-		ac = n->data;
+		ac = authcookie_list.head->data;
 
-		if (ac->expire <= CURRTIME)
-			authcookie_destroy(ac);
+		/* the rest expire later still */
+		if (ac->expire > CURRTIME)
+			break;
+
+		authcookie_destroy(ac);
 	}
 }
 
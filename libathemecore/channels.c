@@ -22,6 +22,122 @@ static mowgli_heap_t *chan_heap = NULL;
 static mowgli_heap_t *chanuser_heap = NULL;
 static mowgli_heap_t *chanban_heap = NULL;
 
+/* Membership index: an open-addressing (linear probing) hash table of
+ * chanuser objects keyed on the (channel, user) pointer pair, so that
+ * chanuser_find() does not have to walk either membership list. It is
+ * kept in step with the cnode/unode links. The table size is always a
+ * power of two, and the table is kept at most half full.
+ */
+#define CHANUSER_INDEX_MINSIZE  1024U
+
+static struct chanuser **chanuser_index = NULL;
+static size_t chanuser_index_size = 0;
+static size_t chanuser_index_count = 0;
+
+static inline size_t
+chanuser_index_hash(const struct channel *const chan, const struct user *const user)
+{
+	uint64_t h = ((uint64_t) (uintptr_t) chan) * UINT64_C(0x9E3779B97F4A7C15);
+
+	h ^= (uint64_t) (uintptr_t) user;
+	h ^= h >> 33;
+	h *= UINT64_C(0xFF51AFD7ED558CCD);
+	h ^= h >> 33;
+
+	return (size_t) h;
+}
+
+static void
+chanuser_index_resize(const size_t newsize)
+{
+	struct chanuser **const oldtable = chanuser_index;
+	const size_t oldsize = chanuser_index_size;
+
+	chanuser_index = scalloc(newsize, sizeof *chanuser_index);
+	chanuser_index_size = newsize;
+
+	for (size_t i = 0; i < oldsize; i++)
+	{
+		struct chanuser *const cu = oldtable[i];
+
+		if (cu == NULL)
+			continue;
+
+		size_t slot = chanuser_index_hash(cu->chan, cu->user) & (newsize - 1U);
+
+		while (chanuser_index[slot] != NULL)
+			slot = (slot + 1U) & (newsize - 1U);
+
+		chanuser_index[slot] = cu;
+	}
+
+	sfree(oldtable);
+}
+
+static void
+chanuser_index_add(struct chanuser *const cu)
+{
+	if (((chanuser_index_count + 1U) * 2U) > chanuser_index_size)
+		chanuser_index_resize(chanuser_index_size ? (chanuser_index_size * 2U) : CHANUSER_INDEX_MINSIZE);
+
+	const size_t mask = chanuser_index_size - 1U;
+	size_t slot = chanuser_index_hash(cu->chan, cu->user) & mask;
+
+	while (chanuser_index[slot] != NULL)
+		slot = (slot + 1U) & mask;
+
+	chanuser_index[slot] = cu;
+	chanuser_index_count++;
+}
+
+static void
+chanuser_index_delete(const struct chanuser *const cu)
+{
+	return_if_fail(chanuser_index != NULL);
+
+	const size_t mask = chanuser_index_size - 1U;
+	size_t slot = chanuser_index_hash(cu->chan, cu->user) & mask;
+
+	while (chanuser_index[slot] != cu)
+	{
+		if (chanuser_index[slot] == NULL)
+		{
+			slog(LG_ERROR, "chanuser_index_delete(): %s -> %s is not indexed", cu->chan->name, cu->user->nick);
+			return;
+		}
+
+		slot = (slot + 1U) & mask;
+	}
+
+	/* Backward-shift deletion: move any following entries of the same
+	 * probe run into the hole, so lookups never need tombstones.
+	 */
+	size_t hole = slot;
+	size_t next = slot;
+
+	for (;;)
+	{
+		next = (next + 1U) & mask;
+
+		struct chanuser *const ncu = chanuser_index[next];
+
+		if (ncu == NULL)
+			break;
+
+		const size_t home = chanuser_index_hash(ncu->chan, ncu->user) & mask;
+
+		// Leave it alone if its home slot lies cyclically in (hole, next]
+		if (((next - home) & mask) < ((next - hole) & mask))
+			continue;
+
+		chanuser_index[hole] = ncu;
+		hole = next;
+	}
+
+	chanuser_index[hole] = NULL;
+	chanuser_index_count--;
+}
+
 /*
  * init_channels()
  *
@@ -164,6 +280,7 @@ channel_delete(struct channel *c)
 	{
 		cu = n->data;
 		soft_assert(is_internal_client(cu->user) && !me.connected);
+		chanuser_index_delete(cu);
 		mowgli_node_delete(&cu->cnode, &c->members);
 		mowgli_node_delete(&cu->unode, &cu->user->channels);
 		mowgli_heap_free(chanuser_heap, cu);
@@ -240,6 +357,8 @@ chanban_add(struct channel *chan, const char *mask, int type)
 	c->mask = sstrdup(mask);
 	c->type = type;
 
+	compiled_mask_init(&c->cmask, c->mask);
+
 	mowgli_node_add(c, &c->node, &chan->bans);
 
 	return c;
@@ -266,6 +385,7 @@ chanban_delete(struct chanban * c)
 
 	mowgli_node_delete(&c->node, &c->chan->bans);
 
+	compiled_mask_free(&c->cmask);
 	sfree(c->mask);
 	mowgli_heap_free(chanban_heap, c);
 }
@@ -307,6 +427,49 @@ chanban_find(struct channel *chan, const char *mask, int type)
 	return NULL;
 }
 
+/*
+ * chanban_foreach_matching(struct channel *chan, struct user *u, int type,
+ *                          cb, privdata)
+ *
+ * Tests a user against every ban of one type on a channel in one pass.
+ *
+ * Inputs:
+ *     - channel whose bans are tested
+ *     - user to test
+ *     - type of ban to test
+ *     - callback, called for each matching ban until it returns false;
+ *       it may delete the ban it is given
+ *     - opaque data passed to the callback
+ *
+ * Outputs:
+ *     - the number of matching bans the callback was called for
+ *
+ * Side Effects:
+ *     - whatever the callback does
+ */
+unsigned int
+chanban_foreach_matching(struct channel *chan, struct user *u, int type,
+                         bool (*cb)(struct chanban *c, void *privdata), void *privdata)
+{
+	mowgli_node_t *n, *tn;
+	unsigned int count = 0;
+
+	return_val_if_fail(chan != NULL, 0);
+	return_val_if_fail(u != NULL, 0);
+	return_val_if_fail(cb != NULL, 0);
+
+	for (n = next_matching_ban(chan, u, type, chan->bans.head); n != NULL; n = next_matching_ban(chan, u, type, tn))
+	{
+		tn = n->next;
+		count++;
+
+		if (!cb(n->data, privdata))
+			break;
+	}
+
+	return count;
+}
+
 /*
  * chanuser_add(struct channel *chan, const char *nick)
  *
@@ -402,6 +565,7 @@ chanuser_add(struct channel *chan, const char *nick)
 
 	mowgli_node_add(cu, &cu->cnode, &chan->members);
 	mowgli_node_add(cu, &cu->unode, &u->channels);
+	chanuser_index_add(cu);
 
 	cnt.chanuser++;
 
@@ -451,6 +615,7 @@ chanuser_delete(struct channel *chan, struct user *user)
 
 	slog(LG_DEBUG, "chanuser_delete(): %s -> %s (%u)", cu->chan->name, cu->user->nick, cu->chan->nummembers - 1);
 
+	chanuser_index_delete(cu);
 	mowgli_node_delete(&cu->cnode, &chan->members);
 	mowgli_node_delete(&cu->unode, &user->channels);
 
@@ -490,32 +655,22 @@ chanuser_delete(struct channel *chan, struct user *user)
 struct chanuser *
 chanuser_find(struct channel *chan, struct user *user)
 {
-	mowgli_node_t *n;
-	struct chanuser *cu;
-
 	return_val_if_fail(chan != NULL, NULL);
 	return_val_if_fail(user != NULL, NULL);
 
-	/* choose shortest list to search -- jilles */
-	if (MOWGLI_LIST_LENGTH(&user->channels) < MOWGLI_LIST_LENGTH(&chan->members))
-	{
-		MOWGLI_ITER_FOREACH(n, user->channels.head)
-		{
-			cu = (struct chanuser *)n->data;
+	if (chanuser_index_count == 0)
+		return NULL;
 
-			if (cu->chan == chan)
-				return cu;
-		}
-	}
-	else
+	const size_t mask = chanuser_index_size - 1U;
+	size_t slot = chanuser_index_hash(chan, user) & mask;
+	struct chanuser *cu;
+
+	while ((cu = chanuser_index[slot]) != NULL)
 	{
-		MOWGLI_ITER_FOREACH(n, chan->members.head)
-		{
-			cu = (struct chanuser *)n->data;
+		if (cu->chan == chan && cu->user == user)
+			return cu;
 
-			if (cu->user == user)
-				return cu;
-		}
+		slot = (slot + 1U) & mask;
 	}
 
 	return NULL;
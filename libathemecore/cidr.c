@@ -360,6 +360,51 @@ match_cidr(const char *s1, const char *s2)
 		return 1;
 }
 
+/*
+ * match_cidr_addr()
+ *
+ * Input - nick!user@ip/cidrlen mask, the nick!user of a client and its
+ *         address as returned by ipaddr_parse()
+ * Output - 0 if the mask matches, like match_cidr(), without formatting
+ *          or parsing the client's address again
+ */
+int
+match_cidr_addr(const char *s1, const char *nickuser, const struct in6_addr *addr)
+{
+	char mask[BUFSIZE];
+	struct in6_addr ipaddr, maskaddr;
+	unsigned int bits;
+	char *ipmask;
+
+	return_val_if_fail(s1 != NULL, 1);
+	return_val_if_fail(nickuser != NULL, 1);
+	return_val_if_fail(addr != NULL, 1);
+
+	ipaddr = *addr;
+
+	mowgli_strlcpy(mask, s1, sizeof mask);
+
+	ipmask = strrchr(mask, '@');
+	if (ipmask == NULL)
+		return 1;
+
+	*ipmask++ = '\0';
+
+	if (strchr(ipmask, '/') == NULL)
+		return 1;
+	if (!ipmask_parse(ipmask, &maskaddr, &bits))
+		return 1;
+
+	// Both halves must agree on the family, as in match_cidr()
+	const bool v4addr = IN6_IS_ADDR_V4MAPPED(&ipaddr);
+	const bool v4mask = (strchr(ipmask, ':') == NULL);
+
+	if (v4addr != v4mask)
+		return 1;
+
+	return !comp_with_mask(ipaddr.s6_addr, maskaddr.s6_addr, bits) || match(mask, nickuser);
+}
+
 int
 valid_ip_or_mask(const char *src)
 {
@@ -394,6 +439,89 @@ valid_ip_or_mask(const char *src)
 		return inet_pton4(ipaddr, buf);
 }
 
+/*
+ * ipaddr_parse()
+ *
+ * Input - textual IPv4 or IPv6 address
+ * Output - true and the binary address in dst (IPv4 addresses are stored
+ *          in their IPv4-mapped IPv6 form), or false if src is not an
+ *          address
+ */
+bool
+ipaddr_parse(const char *src, struct in6_addr *dst)
+{
+	unsigned char v4addr[INADDRSZ];
+
+	return_val_if_fail(src != NULL, false);
+	return_val_if_fail(dst != NULL, false);
+
+	if (strchr(src, ':'))
+		return inet_pton6(src, dst->s6_addr) == 1;
+
+	if (!inet_pton4(src, v4addr))
+		return false;
+
+	(void) memset(dst->s6_addr, 0x00, IN6ADDRSZ);
+	dst->s6_addr[10] = 0xFF;
+	dst->s6_addr[11] = 0xFF;
+	(void) memcpy(dst->s6_addr + 12, v4addr, INADDRSZ);
+
+	return true;
+}
+
+/*
+ * ipmask_parse()
+ *
+ * Input - address or CIDR mask (e.g. "192.0.2.1", "2001:db8::/32")
+ * Output - true, the binary network address in dst and its prefix length
+ *          in bits (counted in the IPv4-mapped space for IPv4 masks), or
+ *          false if src is not an address or a usable mask
+ *
+ * A prefix length of zero is rejected, as match_ips() never matches it.
+ */
+bool
+ipmask_parse(const char *src, struct in6_addr *dst, unsigned int *bits)
+{
+	char ipaddr[HOSTLEN + 7];
+	char *mask, *end;
+	unsigned long cidrlen;
+
+	return_val_if_fail(src != NULL, false);
+	return_val_if_fail(dst != NULL, false);
+	return_val_if_fail(bits != NULL, false);
+
+	if (mowgli_strlcpy(ipaddr, src, sizeof ipaddr) >= sizeof ipaddr)
+		return false;
+
+	const bool is_ipv6 = (strchr(ipaddr, ':') != NULL);
+	const unsigned long maxlen = is_ipv6 ? 128 : 32;
+
+	cidrlen = maxlen;
+
+	if ((mask = strchr(ipaddr, '/')))
+	{
+		*mask++ = '\0';
+
+		if (!isdigit((unsigned char)*mask))
+			return false;
+
+		cidrlen = strtoul(mask, &end, 10);
+		if (*end != '\0' || cidrlen == 0 || cidrlen > maxlen)
+			return false;
+	}
+
+	if (!ipaddr_parse(ipaddr, dst))
+		return false;
+
+	*bits = (unsigned int) (cidrlen + (128 - maxlen));
+
+	// Clear the host part, so equal networks compare equal
+	for (unsigned int i = *bits; i < (IN6ADDRSZ * 8); i++)
+		dst->s6_addr[i / 8] &= (unsigned char) ~(0x80U >> (i % 8));
+
+	return true;
+}
+
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
  * vim:ts=8
  * vim:sw=8
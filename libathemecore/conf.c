@@ -33,6 +33,8 @@ static int c_gi_cflags(mowgli_config_file_entry_t *);
 static int c_gi_exempts(mowgli_config_file_entry_t *);
 static int c_gi_immune_level(mowgli_config_file_entry_t *);
 
+static int c_db_compression(mowgli_config_file_entry_t *);
+
 /* *INDENT-OFF* */
 
 static struct Token uflags[] = {
@@ -99,6 +101,7 @@ static struct Token logflags[] = {
 
 mowgli_list_t conf_si_table;
 mowgli_list_t conf_gi_table;
+mowgli_list_t conf_db_table;
 mowgli_list_t conf_la_table;
 
 /* *INDENT-ON* */
@@ -220,6 +223,7 @@ conf_init(void)
 
 	config_options.defuflags = config_options.defcflags = 0x00000000;
 	config_options.immune_level = UF_IMMUNE;
+	config_options.db_compression = DB_COMPRESSION_NONE;
 
 	me.auth = AUTH_NONE;
 
@@ -242,6 +246,7 @@ init_newconf(void)
 	add_subblock_top_conf("SERVERINFO", &conf_si_table);
 	add_top_conf("UPLINK", c_uplink);
 	add_subblock_top_conf("GENERAL", &conf_gi_table);
+	add_subblock_top_conf("DATABASE", &conf_db_table);
 	add_top_conf("LOADMODULE", c_loadmodule);
 	add_top_conf("OPERCLASS", c_operclass);
 	add_top_conf("OPERATOR", c_operator);
@@ -295,10 +300,16 @@ init_newconf(void)
 	add_duration_conf_item("CLONE_TIME", &conf_gi_table, 0, &config_options.clone_time, "m", 0);
 	add_duration_conf_item("COMMIT_INTERVAL", &conf_gi_table, 0, &config_options.commit_interval, "m", 300);
 	add_bool_conf_item("DB_SAVE_BLOCKING", &conf_gi_table, 0, &config_options.db_save_blocking, false);
+	add_bool_conf_item("DB_SAVE_SNAPSHOT", &conf_gi_table, 0, &config_options.db_save_snapshot, false);
+	add_duration_conf_item("JOURNAL_INTERVAL", &conf_gi_table, 0, &config_options.journal_interval, "s", 0);
 	add_dupstr_conf_item("OPERSTRING", &conf_gi_table, 0, &config_options.operstring, "is an IRC Operator");
 	add_dupstr_conf_item("SERVICESTRING", &conf_gi_table, 0, &config_options.servicestring, "is a Network Service");
 	add_bool_conf_item("MATCH_MASKS_THROUGH_VHOST", &conf_gi_table, 0, &config_options.masks_through_vhost, true);
 	add_uint_conf_item("DEFAULT_PASSWORD_LENGTH", &conf_gi_table, 0, &config_options.default_pass_length, 16, 64, 16);
+	add_uint_conf_item("CRYPT_WORKERS", &conf_gi_table, 0, &config_options.crypt_workers, 0, 64, 0);
+	add_uint_conf_item("CRYPT_QUEUE_MAX", &conf_gi_table, 0, &config_options.crypt_queue_max, 1, INT_MAX, 256);
+	add_uint_conf_item("CRYPT_QUEUE_PER_SOURCE", &conf_gi_table, 0, &config_options.crypt_queue_per_source, 1, INT_MAX, 4);
+	add_uint_conf_item("WORKQUEUE_THREADS", &conf_gi_table, 0, &config_options.workqueue_threads, 0, 64, 2);
 
 	/* XXX: These 3 options should probably move into operserv/clones eventually */
 	add_uint_conf_item("DEFAULT_CLONE_ALLOWED", &conf_gi_table, 0, &config_options.default_clone_allowed, 1, INT_MAX, 5);
@@ -306,6 +317,8 @@ init_newconf(void)
 	add_bool_conf_item("CLONE_IDENTIFIED_INCREASE_LIMIT", &conf_gi_table, 0, &config_options.clone_increase, false);
 
 	add_uint_conf_item("UPLINK_SENDQ_LIMIT", &conf_gi_table, 0, &config_options.uplink_sendq_limit, 10240, INT_MAX, 1048576);
+	add_duration_conf_item("LOG_FLUSH_INTERVAL", &conf_gi_table, 0, &config_options.log_flush_interval, "s", 1);
+	add_uint_conf_item("LOG_BUFFER_SIZE", &conf_gi_table, 0, &config_options.log_buffer_size, 4096, INT_MAX, 65536);
 	add_dupstr_conf_item("LANGUAGE", &conf_gi_table, 0, &config_options.language, "en");
 	add_conf_item("EXEMPTS", &conf_gi_table, c_gi_exempts);
 	add_bool_conf_item("ALLOW_TAINT", &conf_gi_table, 0, &config_options.allow_taint, false);
@@ -314,6 +327,10 @@ init_newconf(void)
 	add_bool_conf_item("LOAD_DATABASE_MDEPS", &conf_gi_table, 0, &config_options.load_database_mdeps, false);
 	add_bool_conf_item("HIDE_OPERS", &conf_gi_table, 0, &config_options.hide_opers, false);
 
+	/* database{} block */
+	add_conf_item("COMPRESSION", &conf_db_table, c_db_compression);
+	add_uint_conf_item("LEVEL", &conf_db_table, 0, &config_options.db_compression_level, 1, 9, 6);
+
 	/* language:: stuff */
 	add_dupstr_conf_item("NAME", &conf_la_table, 0, &me.language_name, NULL);
 	add_dupstr_conf_item("TRANSLATOR", &conf_la_table, 0, &me.language_translator, NULL);
@@ -885,6 +902,37 @@ c_gi_exempts(mowgli_config_file_entry_t *ce)
 	return 0;
 }
 
+static int
+c_db_compression(mowgli_config_file_entry_t *ce)
+{
+	if (ce->vardata == NULL)
+	{
+		conf_report_warning(ce, "no parameter for configuration option");
+		return 0;
+	}
+
+	if (!strcasecmp("NONE", ce->vardata))
+		config_options.db_compression = DB_COMPRESSION_NONE;
+
+	else if (!strcasecmp("GZIP", ce->vardata) || !strcasecmp("ZLIB", ce->vardata))
+	{
+#ifdef HAVE_LIBZ
+		config_options.db_compression = DB_COMPRESSION_GZIP;
+#else
+		conf_report_warning(ce, "services was built without zlib; the database will not be compressed");
+		config_options.db_compression = DB_COMPRESSION_NONE;
+#endif
+	}
+
+	else
+	{
+		conf_report_warning(ce, "unknown compression method (expected 'none' or 'gzip')");
+		config_options.db_compression = DB_COMPRESSION_NONE;
+	}
+
+	return 0;
+}
+
 static int
 c_logfile(mowgli_config_file_entry_t *ce)
 {
@@ -1086,6 +1134,12 @@ conf_check(void)
 		fix_global_template_flags();
 	}
 
+	if (config_options.journal_interval > SECONDS_PER_MINUTE)
+	{
+		slog(LG_INFO, "conf_check(): invalid `journal_interval' set in %s; defaulting to 1 second", config_file);
+		config_options.journal_interval = 1;
+	}
+
 	if (config_options.commit_interval < SECONDS_PER_MINUTE || config_options.commit_interval > SECONDS_PER_HOUR)
 	{
 		slog(LG_INFO, "conf_check(): invalid `commit_interval' set in %s; defaulting to 5 minutes", config_file);
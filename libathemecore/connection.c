@@ -226,6 +226,9 @@ connection_close(struct connection *const restrict cptr)
 		(void) slog(CF_IS_UPLINK(cptr) ? LG_ERROR : LG_DEBUG, "%s: fd %d ('%s') closed due to error %d (%s)",
 		            MOWGLI_FUNC_NAME, cptr->fd, cptr->name, errsv, strerror(errsv));
 
+	(void) password_async_cancel(cptr, NULL);
+	(void) workqueue_cancel(cptr, NULL);
+
 	if (cptr->close_handler)
 		(void) cptr->close_handler(cptr);
 
@@ -672,5 +675,12 @@ connection_stats(void (*const stats_cb)(const char *, void *), void *const restr
 		}
 
 		(void) stats_cb(buf, privdata);
+
+		(void) snprintf(buf, sizeof buf, "fd %d sendq %zu (peak %zu) sent %lu bytes in %lu calls, "
+		                "recvq %zu (peak %zu) received %lu bytes in %lu calls", cptr->fd,
+		                cptr->sendq_len, cptr->sendq_peak, cptr->send_bytes, cptr->send_calls,
+		                cptr->recvq_len, cptr->recvq_peak, cptr->recv_bytes, cptr->recv_calls);
+
+		(void) stats_cb(buf, privdata);
 	}
 }
@@ -59,6 +59,7 @@ crypt_register(const struct crypt_impl *const restrict impl)
 	 */
 	(void) mowgli_node_add((void *) ((uintptr_t) impl), n, &crypt_impl_list);
 	(void) crypt_log_modchg(MOWGLI_FUNC_NAME, "registered", impl);
+	(void) cryptpool_restart();
 }
 
 void
@@ -80,6 +81,7 @@ crypt_unregister(const struct crypt_impl *const restrict impl)
 			(void) mowgli_node_free(n);
 
 			(void) crypt_log_modchg(MOWGLI_FUNC_NAME, "unregistered", impl);
+			(void) cryptpool_restart();
 			return;
 		}
 	}
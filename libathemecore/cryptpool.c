@@ -0,0 +1,789 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * atheme-services: A collection of minimalist IRC services
+ * cryptpool.c: Password hashing off the main event loop.
+ *
+ * The crypto providers keep results in static buffers and log as they go,
+ * so they cannot run on threads. Instead, a small pool of worker processes
+ * is forked from services; each is handed one request at a time over a
+ * socketpair and sends back the verification result and, if the password
+ * should be rehashed or was being set, the new hash. Everything touching
+ * accounts happens here, in the main process, when the reply arrives.
+ *
+ * Workers are forked lazily and are replaced after a rehash or when a crypto
+ * module is loaded or unloaded, so that they always hash with the current
+ * configuration.
+ */
+
+#include <atheme.h>
+#include "internal.h"
+
+#define CRYPTPOOL_OP_VERIFY     1U
+#define CRYPTPOOL_OP_CRYPT      2U
+
+#define CRYPTPOOL_IDLEN         32U
+
+struct cryptpool_request
+{
+	unsigned int                    op;
+	char                            password[PASSLEN + 1];
+	char                            parameters[PASSLEN + 1];
+};
+
+struct cryptpool_reply
+{
+	bool                            success;
+	char                            verified_id[CRYPTPOOL_IDLEN];   // provider that verified the password
+	char                            default_id[CRYPTPOOL_IDLEN];    // provider that made the new hash
+	char                            hash[PASSLEN + 1];              // new hash, if any
+};
+
+struct cryptpool_worker
+{
+	mowgli_node_t                   node;
+	pid_t                           pid;
+	int                             fd;
+	mowgli_eventloop_pollable_t *   pollable;
+	struct cryptpool_job *          job;            // request being worked on, or NULL if idle
+	struct cryptpool_reply          reply;          // reply being read
+	size_t                          replylen;
+	bool                            retiring;       // exit as soon as idle
+};
+
+// All outstanding requests from one source
+struct cryptpool_source
+{
+	mowgli_node_t                   node;           // in cryptpool_ready, while jobs is not empty
+	mowgli_list_t                   jobs;           // queued requests, oldest first
+	unsigned int                    count;          // queued plus running requests
+	char *                          name;
+};
+
+struct cryptpool_job
+{
+	mowgli_node_t                   node;           // in source->jobs while queued
+	mowgli_node_t                   allnode;        // in cryptpool_jobs until completed or cancelled
+	struct cryptpool_source *       source;
+	struct myuser *                 mu;             // NULL if the account was dropped meanwhile
+	const void *                    owner;
+	password_async_cb               cb;
+	void *                          priv;
+	bool                            running;        // handed to a worker
+	bool                            cancelled;      // still running, but nobody wants the result
+	struct cryptpool_request        req;
+};
+
+static mowgli_list_t cryptpool_workers = { NULL, NULL, 0 };
+static mowgli_list_t cryptpool_jobs = { NULL, NULL, 0 };
+static mowgli_list_t cryptpool_ready = { NULL, NULL, 0 };
+static mowgli_patricia_t *cryptpool_sources = NULL;
+static mowgli_eventloop_timer_t *cryptpool_stall_timer = NULL;
+static unsigned int cryptpool_count = 0;
+
+static bool ATHEME_FATTR_WUR
+cryptpool_read_full(const int fd, void *const restrict buf, const size_t len)
+{
+	size_t done = 0;
+
+	while (done < len)
+	{
+		const ssize_t ret = read(fd, ((char *) buf) + done, len - done);
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return false;
+
+		done += (size_t) ret;
+	}
+
+	return true;
+}
+
+static bool ATHEME_FATTR_WUR
+cryptpool_write_full(const int fd, const void *const restrict buf, const size_t len)
+{
+	size_t done = 0;
+
+	while (done < len)
+	{
+		const ssize_t ret = write(fd, ((const char *) buf) + done, len - done);
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return false;
+
+		done += (size_t) ret;
+	}
+
+	return true;
+}
+
+static void
+cryptpool_worker_process(const struct cryptpool_request *const restrict req, struct cryptpool_reply *const restrict reply)
+{
+	const struct crypt_impl *ci, *ci_default;
+	const char *hash = NULL;
+
+	if (req->op == CRYPTPOOL_OP_CRYPT)
+	{
+		if ((hash = crypt_password(req->password)) != NULL)
+		{
+			reply->success = true;
+			(void) mowgli_strlcpy(reply->hash, hash, sizeof reply->hash);
+		}
+
+		return;
+	}
+
+	unsigned int verify_flags = PWVERIFY_FLAG_NONE;
+
+	if (! (ci = crypt_verify_password(req->password, req->parameters, &verify_flags)))
+		return;
+
+	reply->success = true;
+	(void) mowgli_strlcpy(reply->verified_id, ci->id, sizeof reply->verified_id);
+
+	if (! (ci_default = crypt_get_default_provider()))
+		return;
+
+	if (ci == ci_default && ! (verify_flags & PWVERIFY_FLAG_RECRYPT))
+		return;
+
+	(void) mowgli_strlcpy(reply->default_id, ci_default->id, sizeof reply->default_id);
+
+	if ((hash = ci_default->crypt(req->password, NULL)) != NULL)
+		(void) mowgli_strlcpy(reply->hash, hash, sizeof reply->hash);
+}
+
+static void ATHEME_FATTR_NORETURN
+cryptpool_worker_main(const int fd)
+{
+	struct cryptpool_request req;
+	struct cryptpool_reply reply;
+	mowgli_node_t *n;
+
+	// Don't hold on to the uplink or clients, or they wouldn't see it when services closes them
+	MOWGLI_ITER_FOREACH(n, connection_list.head)
+		(void) close(((struct connection *) n->data)->fd);
+
+	MOWGLI_ITER_FOREACH(n, cryptpool_workers.head)
+		(void) close(((struct cryptpool_worker *) n->data)->fd);
+
+	/* Nor on a database snapshot that is being written out; its flock(2) would
+	 * outlive services closing the lock, and the next save would wait forever
+	 */
+	if (db_snapshot)
+	{
+		if (db_snapshot->fd != -1)
+			(void) close(db_snapshot->fd);
+
+		if (db_snapshot->lockfd != -1)
+			(void) close(db_snapshot->lockfd);
+	}
+
+	// Signals are for services; we exit when it closes our socket
+#ifdef SIGHUP
+	(void) signal(SIGHUP, SIG_IGN);
+#endif
+#ifdef SIGINT
+	(void) signal(SIGINT, SIG_IGN);
+#endif
+#ifdef SIGUSR1
+	(void) signal(SIGUSR1, SIG_IGN);
+#endif
+#ifdef SIGUSR2
+	(void) signal(SIGUSR2, SIG_IGN);
+#endif
+#ifdef SIGTERM
+	(void) signal(SIGTERM, SIG_DFL);
+#endif
+
+	while (cryptpool_read_full(fd, &req, sizeof req))
+	{
+		(void) memset(&reply, 0x00, sizeof reply);
+		(void) cryptpool_worker_process(&req, &reply);
+		(void) smemzero(&req, sizeof req);
+
+		// Anything the crypto modules logged must hit the disk before we go away
+		(void) log_flush();
+
+		const bool sent = cryptpool_write_full(fd, &reply, sizeof reply);
+
+		(void) smemzero(&reply, sizeof reply);
+
+		if (! sent)
+			break;
+	}
+
+	_exit(EXIT_SUCCESS);
+}
+
+static void
+cryptpool_worker_exited(pid_t pid, int status, void ATHEME_VATTR_UNUSED *data)
+{
+	if (WIFSIGNALED(status))
+		(void) slog(LG_ERROR, "cryptpool: crypt worker %ld was killed by signal %d", (long) pid, WTERMSIG(status));
+	else if (WIFEXITED(status) && WEXITSTATUS(status) != EXIT_SUCCESS)
+		(void) slog(LG_ERROR, "cryptpool: crypt worker %ld exited with status %d", (long) pid, WEXITSTATUS(status));
+}
+
+static void cryptpool_dispatch(void);
+static void cryptpool_worker_readable(mowgli_eventloop_t *, mowgli_eventloop_io_t *, mowgli_eventloop_io_dir_t, void *);
+
+static struct cryptpool_worker *
+cryptpool_worker_spawn(void)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+	{
+		(void) slog(LG_ERROR, "%s: socketpair(2): %s", MOWGLI_FUNC_NAME, strerror(errno));
+		return NULL;
+	}
+
+	// The worker exits normally, so don't let it inherit unwritten log lines
+	(void) log_flush();
+
+	const pid_t pid = fork();
+
+	switch (pid)
+	{
+		case -1:
+			(void) slog(LG_ERROR, "%s: fork(2): %s", MOWGLI_FUNC_NAME, strerror(errno));
+			(void) close(fds[0]);
+			(void) close(fds[1]);
+			return NULL;
+
+		case 0:
+			(void) close(fds[0]);
+			(void) cryptpool_worker_main(fds[1]);
+	}
+
+	(void) close(fds[1]);
+
+	const int flags = fcntl(fds[0], F_GETFL, 0);
+
+	if (flags == -1 || fcntl(fds[0], F_SETFL, flags | O_NONBLOCK) == -1)
+		(void) slog(LG_ERROR, "%s: fcntl(2): %s", MOWGLI_FUNC_NAME, strerror(errno));
+
+	// Workers must see EOF if services restarts itself
+	(void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+	struct cryptpool_worker *const w = smalloc(sizeof *w);
+
+	w->pid = pid;
+	w->fd = fds[0];
+	w->pollable = mowgli_pollable_create(base_eventloop, w->fd, w);
+
+	(void) mowgli_pollable_setselect(base_eventloop, w->pollable, MOWGLI_EVENTLOOP_IO_READ, &cryptpool_worker_readable);
+	(void) mowgli_node_add(w, &w->node, &cryptpool_workers);
+	(void) childproc_add(pid, "crypt worker", &cryptpool_worker_exited, NULL);
+
+	(void) slog(LG_DEBUG, "%s: started crypt worker %ld", MOWGLI_FUNC_NAME, (long) pid);
+
+	return w;
+}
+
+static void
+cryptpool_worker_destroy(struct cryptpool_worker *const restrict w)
+{
+	(void) mowgli_pollable_destroy(base_eventloop, w->pollable);
+	(void) mowgli_node_delete(&w->node, &cryptpool_workers);
+	(void) close(w->fd);
+	(void) smemzero(&w->reply, sizeof w->reply);
+	(void) sfree(w);
+}
+
+static unsigned int
+cryptpool_workers_live(void)
+{
+	mowgli_node_t *n;
+	unsigned int live = 0;
+
+	MOWGLI_ITER_FOREACH(n, cryptpool_workers.head)
+		if (! ((struct cryptpool_worker *) n->data)->retiring)
+			live++;
+
+	return live;
+}
+
+static void
+cryptpool_job_free(struct cryptpool_job *const restrict job)
+{
+	struct cryptpool_source *const src = job->source;
+
+	if (--src->count == 0)
+	{
+		(void) mowgli_patricia_delete(cryptpool_sources, src->name);
+		(void) sfree(src->name);
+		(void) sfree(src);
+	}
+
+	cryptpool_count--;
+
+	(void) smemzero(&job->req, sizeof job->req);
+	(void) sfree(job);
+}
+
+static void
+cryptpool_job_unqueue(struct cryptpool_job *const restrict job)
+{
+	struct cryptpool_source *const src = job->source;
+
+	(void) mowgli_node_delete(&job->node, &src->jobs);
+
+	if (! MOWGLI_LIST_LENGTH(&src->jobs))
+		(void) mowgli_node_delete(&src->node, &cryptpool_ready);
+}
+
+static void
+cryptpool_job_finish(struct cryptpool_job *const restrict job, const enum password_async_result result)
+{
+	if (! job->cancelled)
+	{
+		(void) mowgli_node_delete(&job->allnode, &cryptpool_jobs);
+		(void) job->cb(job->mu, result, job->priv);
+	}
+
+	(void) cryptpool_job_free(job);
+}
+
+static void
+cryptpool_job_complete(struct cryptpool_job *const restrict job, const struct cryptpool_reply *const restrict reply)
+{
+	struct myuser *const mu = job->mu;
+	enum password_async_result result = reply->success ? PWASYNC_OK : PWASYNC_FAILED;
+
+	if (job->cancelled || ! mu)
+	{
+		(void) cryptpool_job_finish(job, PWASYNC_FAILED);
+		return;
+	}
+
+	if (job->req.op == CRYPTPOOL_OP_CRYPT)
+	{
+		if (! reply->success)
+			(void) slog(LG_DEBUG, "%s: failed to encrypt password for account '%s'",
+			                      MOWGLI_FUNC_NAME, entity(mu)->name);
+	}
+	else if (strcmp(mu->pass, job->req.parameters) != 0)
+	{
+		/* The password was changed or rehashed (perhaps by another login) while we were
+		 * verifying against the old hash; check again against the new one.
+		 */
+		struct cryptpool_source *const src = job->source;
+
+		(void) mowgli_strlcpy(job->req.parameters, mu->pass, sizeof job->req.parameters);
+
+		if (MOWGLI_LIST_LENGTH(&src->jobs))
+			(void) mowgli_node_delete(&src->node, &cryptpool_ready);
+
+		(void) mowgli_node_add_head(src, &src->node, &cryptpool_ready);
+		(void) mowgli_node_add_head(job, &job->node, &src->jobs);
+
+		job->running = false;
+		return;
+	}
+	else if (reply->success && reply->default_id[0])
+	{
+		if (strcmp(reply->verified_id, reply->default_id) != 0)
+			(void) slog(LG_INFO, "%s: transitioning from crypt scheme '%s' to '%s' for account '%s'",
+			                     MOWGLI_FUNC_NAME, reply->verified_id, reply->default_id, entity(mu)->name);
+		else
+			(void) slog(LG_INFO, "%s: re-encrypting password for account '%s'",
+			                     MOWGLI_FUNC_NAME, entity(mu)->name);
+
+		if (! reply->hash[0])
+			(void) slog(LG_DEBUG, "%s: failed to re-encrypt password for account '%s'",
+			                      MOWGLI_FUNC_NAME, entity(mu)->name);
+	}
+
+	if (result == PWASYNC_OK && reply->hash[0])
+	{
+		mu->flags |= MU_CRYPTPASS;
+
+		(void) smemzero(mu->pass, sizeof mu->pass);
+		(void) mowgli_strlcpy(mu->pass, reply->hash, sizeof mu->pass);
+		(void) hook_call_myuser_changed_password_or_hash(mu);
+	}
+
+	(void) cryptpool_job_finish(job, result);
+}
+
+static void
+cryptpool_stalled(void ATHEME_VATTR_UNUSED *const restrict unused)
+{
+	mowgli_node_t *n, *tn;
+	mowgli_list_t failed = { NULL, NULL, 0 };
+
+	cryptpool_stall_timer = NULL;
+
+	if (cryptpool_workers.count || ! cryptpool_ready.count)
+		return;
+
+	if (cryptpool_worker_spawn())
+	{
+		(void) cryptpool_dispatch();
+		return;
+	}
+
+	(void) slog(LG_ERROR, "%s: unable to start any crypt workers; failing %u queued request(s)",
+	                      MOWGLI_FUNC_NAME, cryptpool_count);
+
+	while (cryptpool_ready.head)
+	{
+		struct cryptpool_source *const src = cryptpool_ready.head->data;
+		struct cryptpool_job *const job = src->jobs.head->data;
+
+		(void) cryptpool_job_unqueue(job);
+		(void) mowgli_node_add(job, &job->node, &failed);
+	}
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, failed.head)
+		(void) cryptpool_job_finish(n->data, PWASYNC_ERROR);
+}
+
+static void
+cryptpool_dispatch(void)
+{
+	// Queued requests still need a worker if the pool was just disabled
+	const unsigned int wanted = config_options.crypt_workers ? config_options.crypt_workers : 1U;
+
+	while (cryptpool_ready.head)
+	{
+		struct cryptpool_worker *w = NULL;
+		mowgli_node_t *n;
+
+		MOWGLI_ITER_FOREACH(n, cryptpool_workers.head)
+		{
+			struct cryptpool_worker *const cw = n->data;
+
+			if (! cw->job && ! cw->retiring)
+			{
+				w = cw;
+				break;
+			}
+		}
+
+		if (! w && (cryptpool_workers_live() >= wanted || ! (w = cryptpool_worker_spawn())))
+			break;
+
+		// Serve sources round-robin, so one address cannot starve the others
+		struct cryptpool_source *const src = cryptpool_ready.head->data;
+		struct cryptpool_job *const job = src->jobs.head->data;
+
+		(void) mowgli_node_delete(&src->node, &cryptpool_ready);
+		(void) mowgli_node_delete(&job->node, &src->jobs);
+
+		if (MOWGLI_LIST_LENGTH(&src->jobs))
+			(void) mowgli_node_add(src, &src->node, &cryptpool_ready);
+
+		if (! cryptpool_write_full(w->fd, &job->req, sizeof job->req))
+		{
+			(void) slog(LG_ERROR, "%s: lost crypt worker %ld: %s", MOWGLI_FUNC_NAME, (long) w->pid,
+			                      strerror(errno));
+			(void) cryptpool_worker_destroy(w);
+
+			// Give it to another worker
+			if (MOWGLI_LIST_LENGTH(&src->jobs))
+				(void) mowgli_node_delete(&src->node, &cryptpool_ready);
+
+			(void) mowgli_node_add_head(src, &src->node, &cryptpool_ready);
+			(void) mowgli_node_add_head(job, &job->node, &src->jobs);
+			continue;
+		}
+
+		w->job = job;
+		job->running = true;
+	}
+
+	if (cryptpool_ready.head && ! cryptpool_workers.count && ! cryptpool_stall_timer)
+		cryptpool_stall_timer = mowgli_timer_add_once(base_eventloop, "cryptpool_stalled", &cryptpool_stalled,
+		                                              NULL, 1);
+}
+
+static void
+cryptpool_worker_readable(mowgli_eventloop_t ATHEME_VATTR_UNUSED *const restrict eventloop,
+                          mowgli_eventloop_io_t ATHEME_VATTR_UNUSED *const restrict io,
+                          const mowgli_eventloop_io_dir_t ATHEME_VATTR_UNUSED dir, void *const restrict userdata)
+{
+	struct cryptpool_worker *const w = userdata;
+
+	const ssize_t ret = read(w->fd, ((char *) &w->reply) + w->replylen, sizeof w->reply - w->replylen);
+
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+
+	if (ret <= 0)
+	{
+		struct cryptpool_job *const job = w->job;
+
+		(void) slog(LG_ERROR, "%s: crypt worker %ld went away%s", MOWGLI_FUNC_NAME, (long) w->pid,
+		                      job ? " in the middle of a request" : "");
+		(void) cryptpool_worker_destroy(w);
+
+		if (job)
+			(void) cryptpool_job_finish(job, PWASYNC_ERROR);
+
+		(void) cryptpool_dispatch();
+		return;
+	}
+
+	if ((w->replylen += (size_t) ret) < sizeof w->reply)
+		return;
+
+	struct cryptpool_job *const job = w->job;
+	struct cryptpool_reply reply;
+
+	(void) memcpy(&reply, &w->reply, sizeof reply);
+	(void) smemzero(&w->reply, sizeof w->reply);
+
+	w->replylen = 0;
+	w->job = NULL;
+
+	if (w->retiring || cryptpool_workers_live() > config_options.crypt_workers)
+		(void) cryptpool_worker_destroy(w);
+
+	if (job)
+		(void) cryptpool_job_complete(job, &reply);
+	else
+		(void) slog(LG_ERROR, "%s: crypt worker %ld replied to nothing (BUG)", MOWGLI_FUNC_NAME, (long) w->pid);
+
+	(void) smemzero(&reply, sizeof reply);
+	(void) cryptpool_dispatch();
+}
+
+static enum password_async_status ATHEME_FATTR_WUR
+cryptpool_submit(const unsigned int op, struct myuser *const restrict mu, const char *const restrict password,
+                 const void *const restrict owner, const char *source, const password_async_cb cb, void *const priv)
+{
+	if (! config_options.crypt_workers)
+		return PWASYNC_SYNC;
+
+	if (! source)
+		source = "";
+
+	struct cryptpool_source *src = mowgli_patricia_retrieve(cryptpool_sources, source);
+
+	if (cryptpool_count >= config_options.crypt_queue_max ||
+	    (src && src->count >= config_options.crypt_queue_per_source))
+	{
+		(void) slog(LG_DEBUG, "%s: refusing request for account '%s' from '%s' (%u queued, %u from there)",
+		                      MOWGLI_FUNC_NAME, entity(mu)->name, source, cryptpool_count, src ? src->count : 0);
+		return PWASYNC_BUSY;
+	}
+
+	// Don't accept anything if nothing could ever pick it up
+	if (! cryptpool_workers_live() && ! cryptpool_worker_spawn())
+		return PWASYNC_SYNC;
+
+	if (! src)
+	{
+		src = smalloc(sizeof *src);
+		src->name = sstrdup(source);
+
+		(void) mowgli_patricia_add(cryptpool_sources, src->name, src);
+	}
+
+	struct cryptpool_job *const job = smalloc(sizeof *job);
+
+	job->source = src;
+	job->mu = mu;
+	job->owner = owner;
+	job->cb = cb;
+	job->priv = priv;
+	job->req.op = op;
+
+	(void) mowgli_strlcpy(job->req.password, password, sizeof job->req.password);
+
+	if (op == CRYPTPOOL_OP_VERIFY)
+		(void) mowgli_strlcpy(job->req.parameters, mu->pass, sizeof job->req.parameters);
+
+	if (! MOWGLI_LIST_LENGTH(&src->jobs))
+		(void) mowgli_node_add(src, &src->node, &cryptpool_ready);
+
+	(void) mowgli_node_add(job, &job->node, &src->jobs);
+	(void) mowgli_node_add(job, &job->allnode, &cryptpool_jobs);
+
+	src->count++;
+	cryptpool_count++;
+
+	(void) cryptpool_dispatch();
+
+	return PWASYNC_QUEUED;
+}
+
+enum password_async_status ATHEME_FATTR_WUR
+set_password_async(struct myuser *const restrict mu, const char *const restrict password, const void *const owner,
+                   const char *const restrict source, const password_async_cb cb, void *const priv)
+{
+	return_val_if_fail(mu != NULL, PWASYNC_SYNC);
+	return_val_if_fail(password != NULL, PWASYNC_SYNC);
+	return_val_if_fail(cb != NULL, PWASYNC_SYNC);
+
+	if (! crypt_get_default_provider())
+		return PWASYNC_SYNC;
+
+	return cryptpool_submit(CRYPTPOOL_OP_CRYPT, mu, password, owner, source, cb, priv);
+}
+
+enum password_async_status ATHEME_FATTR_WUR
+verify_password_async(struct myuser *const restrict mu, const char *const restrict password, const void *const owner,
+                      const char *const restrict source, const password_async_cb cb, void *const priv)
+{
+	return_val_if_fail(mu != NULL, PWASYNC_SYNC);
+	return_val_if_fail(password != NULL, PWASYNC_SYNC);
+	return_val_if_fail(cb != NULL, PWASYNC_SYNC);
+
+	// Custom authentication and unencrypted passwords are for verify_password() to deal with
+	if ((auth_module_loaded && auth_user_custom) || ! (mu->flags & MU_CRYPTPASS))
+		return PWASYNC_SYNC;
+
+	return cryptpool_submit(CRYPTPOOL_OP_VERIFY, mu, password, owner, source, cb, priv);
+}
+
+bool
+password_async_pending(const void *const owner)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, cryptpool_jobs.head)
+		if (((struct cryptpool_job *) n->data)->owner == owner)
+			return true;
+
+	return false;
+}
+
+/*
+ * password_async_cancel(const void *owner, password_async_cb cb)
+ *
+ * Cancels outstanding requests.
+ *
+ * Inputs:
+ *       - the owner of the requests to cancel, or NULL for any owner
+ *       - the callback of the requests to cancel, or NULL for any callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - the callbacks are called with PWASYNC_CANCELLED
+ */
+void
+password_async_cancel(const void *const owner, const password_async_cb cb)
+{
+	mowgli_node_t *n, *tn;
+	mowgli_list_t cancelled = { NULL, NULL, 0 };
+
+	// Take them all out first; the callbacks may well submit or cancel other requests
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cryptpool_jobs.head)
+	{
+		struct cryptpool_job *const job = n->data;
+
+		if ((owner && job->owner != owner) || (cb && job->cb != cb))
+			continue;
+
+		(void) mowgli_node_delete(&job->allnode, &cryptpool_jobs);
+		(void) mowgli_node_add(job, &job->allnode, &cancelled);
+	}
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cancelled.head)
+	{
+		struct cryptpool_job *const job = n->data;
+
+		(void) mowgli_node_delete(&job->allnode, &cancelled);
+
+		if (! job->running)
+			(void) cryptpool_job_unqueue(job);
+
+		job->cancelled = true;
+
+		(void) job->cb(job->mu, PWASYNC_CANCELLED, job->priv);
+
+		// A running request is freed when its worker replies
+		if (! job->running)
+			(void) cryptpool_job_free(job);
+	}
+}
+
+/*
+ * cryptpool_restart(void)
+ *
+ * Replaces all crypt workers, e.g. after the crypto providers or their
+ * configuration changed. Workers that are busy finish their current request
+ * first.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - idle workers are told to exit
+ */
+void
+cryptpool_restart(void)
+{
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cryptpool_workers.head)
+	{
+		struct cryptpool_worker *const w = n->data;
+
+		w->retiring = true;
+
+		if (! w->job)
+			(void) cryptpool_worker_destroy(w);
+	}
+
+	(void) cryptpool_dispatch();
+}
+
+static void
+cryptpool_user_delete(struct user *const restrict u)
+{
+	(void) password_async_cancel(u, NULL);
+}
+
+static void
+cryptpool_myuser_delete(struct myuser *const restrict mu)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, cryptpool_jobs.head)
+	{
+		struct cryptpool_job *const job = n->data;
+
+		if (job->mu == mu)
+			job->mu = NULL;
+	}
+}
+
+static void
+cryptpool_config_ready(void ATHEME_VATTR_UNUSED *const restrict unused)
+{
+	(void) cryptpool_restart();
+}
+
+void
+cryptpool_init(void)
+{
+	cryptpool_sources = mowgli_patricia_create(NULL);
+
+	(void) hook_add_user_delete(&cryptpool_user_delete);
+	(void) hook_add_myuser_delete(&cryptpool_myuser_delete);
+	(void) hook_add_config_ready(&cryptpool_config_ready);
+}
@@ -13,7 +13,12 @@
 
 static mowgli_patricia_t *db_types = NULL;
 
+// How much of a snapshot to encode and write out per work queue job
+#define DB_SNAPSHOT_SLICE       (4U * 1024U * 1024U)
+
 const struct database_module *db_mod = NULL;
+struct db_save_stats db_save_stats;
+struct db_snapshot *db_snapshot = NULL;
 
 struct database_handle *
 db_open(const char *filename, enum database_transaction txn)
@@ -24,6 +29,182 @@ db_open(const char *filename, enum database_transaction txn)
 	return db_mod->db_open(filename, txn);
 }
 
+// may run on a worker thread, so errors are logged by db_snapshot_complete()
+static void
+db_snapshot_write_out(struct db_snapshot *snap, const char *data, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len && ! snap->error)
+	{
+		const ssize_t n = write(snap->fd, data + done, len - done);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			snap->write_errno = errno;
+			snap->error = true;
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	snap->written += done;
+}
+
+// write up to max more bytes of snap; true once there is nothing left to do
+static bool
+db_snapshot_write(struct db_snapshot *snap, size_t max)
+{
+	const size_t end = (snap->len - snap->done > max) ? snap->done + max : snap->len;
+
+	if (snap->encode != NULL)
+	{
+		const char *out;
+		size_t outlen;
+
+		if (snap->encode(snap, snap->buf + snap->done, end - snap->done, end == snap->len, &out, &outlen))
+			db_snapshot_write_out(snap, out, outlen);
+		else
+			snap->error = true;
+	}
+	else
+		db_snapshot_write_out(snap, snap->buf + snap->done, end - snap->done);
+
+	snap->done = end;
+
+	return snap->error || snap->done == snap->len;
+}
+
+static void
+db_snapshot_complete(struct db_snapshot *snap)
+{
+	if (snap->write_errno != 0)
+		slog(LG_ERROR, "db_save(): cannot write to %s: %s", snap->tmppath, strerror(snap->write_errno));
+
+	if (close(snap->fd) < 0 && ! snap->error)
+	{
+		slog(LG_ERROR, "db_save(): cannot close %s: %s", snap->tmppath, strerror(errno));
+		snap->error = true;
+	}
+
+	db_save_stats.bytes = 0;
+
+	// a partial database must never replace the previous one
+	if (snap->error)
+	{
+		wallops("\2DATABASE ERROR\2: db_save(): cannot write %s, keeping the previous database", snap->tmppath);
+	}
+	else if (srename(snap->tmppath, snap->path) < 0)
+	{
+		const int errno1 = errno;
+
+		slog(LG_ERROR, "db_save(): cannot rename %s to %s: %s", snap->tmppath, snap->path, strerror(errno1));
+		wallops("\2DATABASE ERROR\2: db_save(): cannot rename %s to %s: %s", snap->tmppath, snap->path, strerror(errno1));
+		snap->error = true;
+	}
+	else
+		db_save_stats.bytes = snap->written;
+
+	if (snap->lockfd != -1)
+		(void) close(snap->lockfd);
+
+	db_snapshot = NULL;
+
+	// before the callback, which reports the save; the encoder may have something to add to it
+	if (snap->encode_free != NULL)
+		snap->encode_free(snap);
+
+	if (snap->callback != NULL)
+		snap->callback(! snap->error);
+
+	sfree(snap->buf);
+	sfree(snap);
+}
+
+// Runs on a worker thread; nothing else touches the snapshot until db_snapshot_job_done()
+static void *
+db_snapshot_job_run(const void *input)
+{
+	(void) db_snapshot_write((struct db_snapshot *) input, DB_SNAPSHOT_SLICE);
+
+	return NULL;
+}
+
+static void
+db_snapshot_job_done(void ATHEME_VATTR_UNUSED *result, const void ATHEME_VATTR_UNUSED *input, void *priv,
+                     bool cancelled)
+{
+	struct db_snapshot *const snap = priv;
+
+	snap->job = NULL;
+
+	// db_snapshot_finish() takes over
+	if (cancelled)
+		return;
+
+	if (snap->error || snap->done == snap->len)
+	{
+		db_snapshot_complete(snap);
+		return;
+	}
+
+	snap->job = workqueue_submit("db_snapshot_write", &db_snapshot_job_run, snap, NULL, &db_snapshot_job_done,
+	                             NULL, snap);
+}
+
+/*
+ * db_snapshot_commit(struct db_snapshot *snap)
+ *
+ * Called by a backend's db_close() with a snapshot it has filled in. The
+ * snapshot is encoded and written out a slice per work queue job, so that
+ * compressing it does not hold up the event loop, renamed into place and
+ * then passed to its callback; it is freed afterwards. Without worker
+ * threads, the work queue runs a job per pass of the event loop.
+ */
+void
+db_snapshot_commit(struct db_snapshot *snap)
+{
+	return_if_fail(snap != NULL);
+	return_if_fail(snap == db_snapshot);
+
+	if (base_eventloop == NULL)
+	{
+		db_snapshot_finish();
+		return;
+	}
+
+	snap->job = workqueue_submit("db_snapshot_write", &db_snapshot_job_run, snap, NULL, &db_snapshot_job_done,
+	                             NULL, snap);
+}
+
+/*
+ * db_snapshot_finish(void)
+ *
+ * Writes out the rest of the snapshot in progress, if any, right away;
+ * for saves that cannot wait for it. A slice that is being written out
+ * on a worker thread is waited for first.
+ */
+void
+db_snapshot_finish(void)
+{
+	struct db_snapshot *const snap = db_snapshot;
+
+	if (snap == NULL || snap->buf == NULL)
+		return;
+
+	if (snap->job != NULL)
+		workqueue_cancel_job_wait(snap->job);
+
+	if (! snap->error && snap->done < snap->len)
+		(void) db_snapshot_write(snap, SIZE_MAX);
+
+	db_snapshot_complete(snap);
+}
+
 void
 db_close(struct database_handle *db)
 {
@@ -18,6 +18,12 @@
 
 #define SENDQSIZE (4096 - 40)
 
+/* how many spare chunks to keep around instead of freeing them */
+#define SENDQ_POOL_MAX 256
+
+/* how many chunks to hand to one writev() call */
+#define SENDQ_IOV_MAX 64
+
 #ifdef MOWGLI_OS_WIN
 # define EWOULDBLOCK	WSAEWOULDBLOCK
 # define EALREADY	WSAEALREADY
@@ -32,6 +38,67 @@ struct sendq {
 	char buf[SENDQSIZE];
 };
 
+static mowgli_list_t sendq_pool;
+
+static struct sendq *
+sendq_chunk_new(mowgli_list_t *list)
+{
+	struct sendq *sq;
+
+	if (sendq_pool.head != NULL)
+	{
+		sq = sendq_pool.head->data;
+		mowgli_node_delete(&sq->node, &sendq_pool);
+		sq->firstused = sq->firstfree = 0;
+	}
+	else
+		sq = smalloc(sizeof *sq);
+
+	mowgli_node_add(sq, &sq->node, list);
+	return sq;
+}
+
+static void
+sendq_chunk_free(struct sendq *sq, mowgli_list_t *list)
+{
+	mowgli_node_delete(&sq->node, list);
+
+	if (MOWGLI_LIST_LENGTH(&sendq_pool) < SENDQ_POOL_MAX)
+		mowgli_node_add(sq, &sq->node, &sendq_pool);
+	else
+		sfree(sq);
+}
+
+/* account for len bytes having been taken from the front of a queue */
+static void
+sendq_consume(mowgli_list_t *list, size_t len)
+{
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list->head)
+	{
+		struct sendq *const sq = n->data;
+		size_t l = sq->firstfree - sq->firstused;
+
+		if (l > len)
+			l = len;
+		sq->firstused += l;
+		len -= l;
+
+		if (sq->firstused != sq->firstfree)
+			break;
+
+		if (MOWGLI_LIST_LENGTH(list) > 1)
+			sendq_chunk_free(sq, list);
+		else
+			/* keep one struct sendq */
+			sq->firstused = sq->firstfree = 0;
+
+		if (len == 0)
+			break;
+	}
+}
+
 void
 sendq_add(struct connection * cptr, char *buf, size_t len)
 {
@@ -51,8 +118,7 @@ sendq_add(struct connection * cptr, char *buf, size_t len)
 	if (len == 0)
 		return;
 
-	if (cptr->sendq_limit != 0 &&
-			MOWGLI_LIST_LENGTH(&cptr->sendq) * SENDQSIZE + len > cptr->sendq_limit)
+	if (cptr->sendq_limit != 0 && cptr->sendq_len + len > cptr->sendq_limit)
 	{
 		slog(LG_INFO, "sendq_add(): sendq limit exceeded on connection %s[%d]",
 				cptr->name, cptr->fd);
@@ -63,6 +129,10 @@ sendq_add(struct connection * cptr, char *buf, size_t len)
 	if (!sendq_nonempty(cptr))
 		connection_setselect_write(cptr, sendq_flush);
 
+	cptr->sendq_len += len;
+	if (cptr->sendq_len > cptr->sendq_peak)
+		cptr->sendq_peak = cptr->sendq_len;
+
 	n = cptr->sendq.tail;
 	if (n != NULL)
 	{
@@ -78,8 +148,7 @@ sendq_add(struct connection * cptr, char *buf, size_t len)
 
 	while (len > 0)
 	{
-		sq = smalloc(sizeof *sq);
-		mowgli_node_add(sq, &sq->node, &cptr->sendq);
+		sq = sendq_chunk_new(&cptr->sendq);
 		l = SENDQSIZE;
 		if (l > len)
 			l = len;
@@ -108,24 +177,47 @@ sendq_add_eof(struct connection * cptr)
 void
 sendq_flush(struct connection * cptr)
 {
-        mowgli_node_t *n, *tn;
-        struct sendq *sq;
-        int l;
-
 	return_if_fail(cptr != NULL);
 
-        MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->sendq.head)
-        {
-                sq = (struct sendq *)n->data;
+	while (cptr->sendq_len > 0)
+	{
+		size_t want = 0;
+		ssize_t l;
 
-                if (sq->firstused == sq->firstfree)
-                        break;
+#ifndef MOWGLI_OS_WIN
+		mowgli_node_t *n;
+		struct iovec iov[SENDQ_IOV_MAX];
+		int iovcnt = 0;
 
-                if ((l = send(cptr->fd, sq->buf + sq->firstused, sq->firstfree - sq->firstused, 0)) == -1)
-                {
-                        int err = ioerrno();
+		MOWGLI_ITER_FOREACH(n, cptr->sendq.head)
+		{
+			struct sendq *const sq = n->data;
+
+			if (iovcnt == SENDQ_IOV_MAX)
+				break;
+			if (sq->firstused == sq->firstfree)
+				continue;
+
+			iov[iovcnt].iov_base = sq->buf + sq->firstused;
+			iov[iovcnt].iov_len = sq->firstfree - sq->firstused;
+			want += iov[iovcnt].iov_len;
+			iovcnt++;
+		}
+
+		l = writev(cptr->fd, iov, iovcnt);
+#else
+		struct sendq *const sq = cptr->sendq.head->data;
 
-                        if (!mowgli_eventloop_ignore_errno(err))
+		want = sq->firstfree - sq->firstused;
+		l = send(cptr->fd, sq->buf + sq->firstused, want, 0);
+#endif
+		cptr->send_calls++;
+
+		if (l == -1)
+		{
+			int err = ioerrno();
+
+			if (!mowgli_eventloop_ignore_errno(err))
 			{
 				slog(LG_DEBUG, "sendq_flush(): write error %d (%s) on connection %s[%d]",
 						err, strerror(err),
@@ -133,24 +225,17 @@ sendq_flush(struct connection * cptr)
 				cptr->flags |= CF_DEAD;
 			}
 
-                        return;
-                }
+			return;
+		}
 
-                sq->firstused += l;
-                if (sq->firstused == sq->firstfree)
-                {
-			if (MOWGLI_LIST_LENGTH(&cptr->sendq) > 1)
-			{
-                        	mowgli_node_delete(&sq->node, &cptr->sendq);
-				sfree(sq);
-			}
-			else
-				/* keep one struct sendq */
-				sq->firstused = sq->firstfree = 0;
-                }
-                else
-                        return;
-        }
+		sendq_consume(&cptr->sendq, l);
+		cptr->sendq_len -= l;
+		cptr->send_bytes += l;
+
+		/* the socket buffer is full; wait to be called again */
+		if ((size_t) l < want)
+			return;
+	}
 	if (CF_IS_SEND_EOF(cptr))
 	{
 		/* shut down write end, kill entire connection
@@ -168,18 +253,11 @@ sendq_flush(struct connection * cptr)
 bool
 sendq_nonempty(struct connection *cptr)
 {
-	mowgli_node_t *n;
-	struct sendq *sq;
-
 	if (CF_IS_SEND_DEAD(cptr))
 		return false;
 	if (CF_IS_SEND_EOF(cptr))
 		return true;
-	n = cptr->sendq.head;
-	if (n == NULL)
-		return false;
-	sq = n->data;
-	return sq->firstfree > sq->firstused;
+	return cptr->sendq_len > 0;
 }
 
 void
@@ -191,16 +269,7 @@ sendq_set_limit(struct connection *cptr, size_t len)
 int
 recvq_length(struct connection *cptr)
 {
-	int l = 0;
-	mowgli_node_t *n;
-	struct sendq *sq;
-
-	MOWGLI_ITER_FOREACH(n, cptr->recvq.head)
-	{
-		sq = n->data;
-		l += sq->firstfree - sq->firstused;
-	}
-	return l;
+	return cptr->recvq_len;
 }
 
 void
@@ -236,13 +305,13 @@ recvq_put(struct connection *cptr)
 	}
 	if (sq == NULL)
 	{
-		sq = smalloc(sizeof *sq);
-		mowgli_node_add(sq, &sq->node, &cptr->recvq);
+		sq = sendq_chunk_new(&cptr->recvq);
 		l = SENDQSIZE;
 	}
 	errno = 0;
 
 	l = recv(cptr->fd, sq->buf + sq->firstfree, l, 0);
+	cptr->recv_calls++;
 	if (l == 0 || (l < 0 && !mowgli_eventloop_ignore_errno(ioerrno())))
 	{
 		if (l == 0)
@@ -253,7 +322,13 @@ recvq_put(struct connection *cptr)
 		return;
 	}
 	else if (l > 0)
+	{
 		sq->firstfree += l;
+		cptr->recvq_len += l;
+		cptr->recv_bytes += l;
+		if (cptr->recvq_len > cptr->recvq_peak)
+			cptr->recvq_peak = cptr->recvq_len;
+	}
 
 	if (cptr->recvq_handler)
 	{
@@ -292,21 +367,14 @@ recvq_get(struct connection *cptr, char *buf, size_t len)
 
 		p += l;
 		len -= l;
-		sq->firstused += l;
-		if (sq->firstused == sq->firstfree)
+		if (sq->firstused + (int) l != sq->firstfree)
 		{
-			if (MOWGLI_LIST_LENGTH(&cptr->recvq) > 1)
-			{
-				mowgli_node_delete(&sq->node, &cptr->recvq);
-				sfree(sq);
-			}
-			else
-				/* keep one struct sendq */
-				sq->firstused = sq->firstfree = 0;
+			sq->firstused += l;
+			break;
 		}
-		else
-			return p - buf;
+		sendq_consume(&cptr->recvq, l);
 	}
+	cptr->recvq_len -= p - buf;
 	return p - buf;
 }
 
@@ -352,45 +420,66 @@ recvq_getline(struct connection *cptr, char *buf, size_t len)
 
 		p += l;
 		len -= l;
-		sq->firstused += l;
-		if (sq->firstused == sq->firstfree)
+		if (sq->firstused + (int) l != sq->firstfree)
 		{
-			if (MOWGLI_LIST_LENGTH(&cptr->recvq) > 1)
-			{
-				mowgli_node_delete(&sq->node, &cptr->recvq);
-				sfree(sq);
-			}
-			else
-				/* keep one struct sendq */
-				sq->firstused = sq->firstfree = 0;
+			sq->firstused += l;
+			break;
 		}
-		else
-			return p - buf;
+		sendq_consume(&cptr->recvq, l);
 	}
+	cptr->recvq_len -= p - buf;
 	return p - buf;
 }
 
+/* Returns the next line without copying it, if it sits entirely in the
+ * first recvq chunk and is at most maxlen bytes including the newline.
+ * *len is set to that length; the caller may modify the line in place and
+ * must then recvq_skip() it. Otherwise returns NULL and recvq_getline()
+ * should be used.
+ */
+char *
+recvq_peekline(struct connection *cptr, size_t maxlen, size_t *len)
+{
+	struct sendq *sq;
+	char *newline;
+
+	return_val_if_fail(cptr != NULL, NULL);
+
+	if (cptr->recvq.head == NULL)
+		return NULL;
+
+	sq = cptr->recvq.head->data;
+	newline = memchr(sq->buf + sq->firstused, '\n', sq->firstfree - sq->firstused);
+	if (newline == NULL || (size_t) (newline - sq->buf - sq->firstused + 1) > maxlen)
+		return NULL;
+
+	cptr->flags &= ~CF_NONEWLINE;
+	*len = newline - sq->buf - sq->firstused + 1;
+	return sq->buf + sq->firstused;
+}
+
+void
+recvq_skip(struct connection *cptr, size_t len)
+{
+	return_if_fail(cptr != NULL);
+	return_if_fail(len <= cptr->recvq_len);
+
+	sendq_consume(&cptr->recvq, len);
+	cptr->recvq_len -= len;
+}
+
 void
 sendqrecvq_free(struct connection *cptr)
 {
 	mowgli_node_t *nptr, *nptr2;
-	struct sendq *sq;
 
 	MOWGLI_ITER_FOREACH_SAFE(nptr, nptr2, cptr->recvq.head)
-	{
-		sq = nptr->data;
-
-		mowgli_node_delete(&sq->node, &cptr->recvq);
-		sfree(sq);
-	}
+		sendq_chunk_free(nptr->data, &cptr->recvq);
 
 	MOWGLI_ITER_FOREACH_SAFE(nptr, nptr2, cptr->sendq.head)
-	{
-		sq = nptr->data;
+		sendq_chunk_free(nptr->data, &cptr->sendq);
 
-		mowgli_node_delete(&sq->node, &cptr->sendq);
-		sfree(sq);
-	}
+	cptr->recvq_len = cptr->sendq_len = 0;
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -14,9 +14,16 @@
  */
 
 #include <atheme.h>
+#include "internal.h"
 
 static mowgli_list_t email_canonicalizers;
 
+/* Accounts by canonical email address; each entry is a list of the accounts
+ * using that address, linked through mu->email_node, and is removed when the
+ * last of them goes.
+ */
+static mowgli_patricia_t *email_index = NULL;
+
 static const char *
 sendemail_urlencode(const char *const restrict src)
 {
@@ -70,11 +77,86 @@ canonicalize_emails(void)
 	{
 		struct myuser *mu = user(mt);
 
+		email_index_del(mu);
 		strshare_unref(mu->email_canonical);
 		mu->email_canonical = canonicalize_email(mu->email);
+		email_index_add(mu);
+	}
+}
+
+/*
+ * email_index_add(struct myuser *mu)
+ * email_index_del(struct myuser *mu)
+ *
+ * Add an account to, or remove it from, the index of accounts by canonical
+ * email address. Call these around every change of mu->email_canonical.
+ */
+void
+email_index_add(struct myuser *mu)
+{
+	mowgli_list_t *accounts;
+
+	return_if_fail(mu != NULL);
+
+	if (mu->email_canonical == NULL)
+		return;
+
+	if (email_index == NULL)
+		email_index = mowgli_patricia_create(noopcanon);
+
+	if ((accounts = mowgli_patricia_retrieve(email_index, mu->email_canonical)) == NULL)
+	{
+		accounts = smalloc(sizeof *accounts);
+		mowgli_patricia_add(email_index, mu->email_canonical, accounts);
+	}
+
+	mowgli_node_add(mu, &mu->email_node, accounts);
+}
+
+void
+email_index_del(struct myuser *mu)
+{
+	mowgli_list_t *accounts;
+
+	return_if_fail(mu != NULL);
+
+	if (mu->email_canonical == NULL || email_index == NULL)
+		return;
+
+	if ((accounts = mowgli_patricia_retrieve(email_index, mu->email_canonical)) == NULL)
+		return;
+
+	mowgli_node_delete(&mu->email_node, accounts);
+
+	if (MOWGLI_LIST_LENGTH(accounts) == 0)
+	{
+		mowgli_patricia_delete(email_index, mu->email_canonical);
+		sfree(accounts);
 	}
 }
 
+/*
+ * email_index_find(stringref email_canonical)
+ *
+ * Inputs:
+ *       a canonical email address, as returned by canonicalize_email()
+ *
+ * Outputs:
+ *       the list of accounts using that address (node data is a
+ *       struct myuser), or NULL if there are none
+ *
+ * Side Effects:
+ *       none
+ */
+const mowgli_list_t *
+email_index_find(stringref email_canonical)
+{
+	if (email_canonical == NULL || email_index == NULL)
+		return NULL;
+
+	return mowgli_patricia_retrieve(email_index, email_canonical);
+}
+
 void
 register_email_canonicalizer(email_canonicalizer_fn func, void *user_data)
 {
@@ -201,9 +283,7 @@ bool
 email_within_limits(const char *email)
 {
 	mowgli_node_t *n;
-	struct myentity_iteration_state state;
-	struct myentity *mt;
-	unsigned int tcnt = 0;
+	const mowgli_list_t *accounts;
 	stringref email_canonical;
 	bool result = true;
 
@@ -218,19 +298,8 @@ email_within_limits(const char *email)
 
 	email_canonical = canonicalize_email(email);
 
-	MYENTITY_FOREACH_T(mt, &state, ENT_USER)
-	{
-		struct myuser *mu = user(mt);
-
-		if (mu->email_canonical == email_canonical)
-			tcnt++;
-
-		/* optimization: if tcnt >= me.maxusers, quit iterating. -nenolod */
-		if (tcnt >= me.maxusers) {
-			result = false;
-			break;
-		}
-	}
+	if ((accounts = email_index_find(email_canonical)) != NULL && MOWGLI_LIST_LENGTH(accounts) >= me.maxusers)
+		result = false;
 
 	strshare_unref(email_canonical);
 	return result;
@@ -18,6 +18,7 @@
 #include "internal.h"
 
 static mowgli_patricia_t *hooks = NULL;
+static struct hook hook_static[HOOK_ID_COUNT];
 static mowgli_heap_t *hook_heap = NULL;
 static mowgli_heap_t *hook_privfn_heap = NULL;
 
@@ -38,6 +39,12 @@ typedef struct {
 
 static mowgli_list_t hook_run_stack = { NULL, NULL, 0 };
 
+static const char *const hook_static_names[HOOK_ID_COUNT] = {
+#define HOOK_STATIC_NAME(name) #name,
+	ATHEME_HOOK_LIST(HOOK_STATIC_NAME)
+#undef HOOK_STATIC_NAME
+};
+
 void
 hooks_init(void)
 {
@@ -50,6 +57,16 @@ hooks_init(void)
 		slog(LG_INFO, "hooks_init(): block allocator failed.");
 		exit(EXIT_SUCCESS);
 	}
+
+	/* Hooks from hooktypes.in are dispatched by ID, but must also be
+	 * found by name, for modules and scripts using the string API.
+	 */
+	for (unsigned int i = 0; i < HOOK_ID_COUNT; i++)
+	{
+		hook_static[i].name = strshare_get(hook_static_names[i]);
+
+		mowgli_patricia_add(hooks, hook_static[i].name, &hook_static[i]);
+	}
 }
 
 static inline struct hook *
@@ -152,24 +169,24 @@ hook_add_hook_first(const char *event, hook_fn handler)
 	hook_create_and_add(h, handler, mowgli_node_add_head);
 }
 
-void
-hook_call_event(const char *event, void *dptr)
+static void
+hook_run(struct hook *hook, void *dptr)
 {
 	hook_run_ctx_t ctx;
 	mowgli_node_t *n, *tn;
-	void (*func)(void *data);
+	struct timeval ts, te;
 
-	return_if_fail(event != NULL);
-
-	ctx.hook = hook_find(event);
-	if (ctx.hook == NULL)
+	if (MOWGLI_LIST_LENGTH(&hook->hooks) == 0)
 		return;
 
+	ctx.hook = hook;
 	ctx.dptr = dptr;
 	ctx.flags = HF_RUN;
 
 	mowgli_node_add_head(&ctx, &ctx.node, &hook_run_stack);
 
+	s_time(&ts);
+
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, ctx.hook->hooks.head)
 	{
 		hook_privfn_ctx_t *priv = n->data;
@@ -180,9 +197,56 @@ hook_call_event(const char *event, void *dptr)
 	}
 
 out:
+	e_time(ts, &te);
+
+	hook->calls++;
+	hook->usecs += (unsigned long) te.tv_sec * 1000000UL + (unsigned long) te.tv_usec;
+
 	mowgli_node_delete(&ctx.node, &hook_run_stack);
 }
 
+void
+hook_call_event(const char *event, void *dptr)
+{
+	struct hook *h;
+
+	return_if_fail(event != NULL);
+
+	h = hook_find(event);
+	if (h == NULL)
+		return;
+
+	hook_run(h, dptr);
+}
+
+void
+hook_call_event_id(enum hook_id id, void *dptr)
+{
+	return_if_fail(id < HOOK_ID_COUNT);
+
+	hook_run(&hook_static[id], dptr);
+}
+
+void
+hook_stats(void (*cb)(const char *line, void *privdata), void *privdata)
+{
+	mowgli_patricia_iteration_state_t state;
+	struct hook *h;
+	char buf[BUFSIZE];
+
+	return_if_fail(cb != NULL);
+
+	MOWGLI_PATRICIA_FOREACH(h, &state, hooks)
+	{
+		if (h->calls == 0)
+			continue;
+
+		snprintf(buf, sizeof buf, "%-32s handlers %2zu calls %10lu time %8lu ms avg %6lu us",
+			h->name, MOWGLI_LIST_LENGTH(&h->hooks), h->calls, h->usecs / 1000UL, h->usecs / h->calls);
+		cb(buf, privdata);
+	}
+}
+
 static inline hook_run_ctx_t *
 hook_run_stack_highest(void)
 {
@@ -14,6 +14,11 @@
 #include <atheme/stdheaders.h>
 
 /* internal functions */
+void cryptpool_init(void);
+void cryptpool_restart(void);
+void workqueue_init(void);
+void email_index_add(struct myuser *mu);
+void email_index_del(struct myuser *mu);
 void event_init(void);
 void hooks_init(void);
 void init_dlink_nodes(void);
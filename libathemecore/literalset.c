@@ -0,0 +1,241 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * atheme-services: A collection of minimalist IRC services
+ * literalset.c: Finding a set of literal strings in one pass (Aho-Corasick).
+ *
+ * The literals form a trie stored in one array; a literal's ID is the index
+ * of the node it ends at. The root's children are looked up in a table and
+ * everyone else's in a sibling list, which keeps sets of a few thousand
+ * literals small at the cost of a short walk per character.
+ */
+
+#include <atheme.h>
+#include "internal.h"
+
+// Node 0 is the root, and 0 also means none
+struct literal_set_node
+{
+	unsigned int            child;          // first child
+	unsigned int            sibling;        // next child of the parent
+	unsigned int            fail;           // longest proper suffix in the trie
+	unsigned int            out;            // nearest literal on the fail chain
+	void *                  data;
+	bool                    terminal;       // a literal ends here
+	unsigned char           c;
+};
+
+struct literal_set
+{
+	struct literal_set_node *       nodes;
+	unsigned int                    nodecount;
+	unsigned int                    nodealloc;
+	unsigned int                    root[UCHAR_MAX + 1];
+	bool                            compiled;
+};
+
+struct literal_set *
+literal_set_create(void)
+{
+	struct literal_set *const ls = smalloc(sizeof *ls);
+
+	ls->nodealloc = 64;
+	ls->nodes = smalloc(ls->nodealloc * sizeof *ls->nodes);
+	ls->nodecount = 1;
+	ls->compiled = true;
+
+	return ls;
+}
+
+void
+literal_set_destroy(struct literal_set *const restrict ls)
+{
+	return_if_fail(ls != NULL);
+
+	sfree(ls->nodes);
+	sfree(ls);
+}
+
+void
+literal_set_clear(struct literal_set *const restrict ls)
+{
+	return_if_fail(ls != NULL);
+
+	(void) memset(ls->root, 0x00, sizeof ls->root);
+	(void) memset(&ls->nodes[0], 0x00, sizeof ls->nodes[0]);
+
+	ls->nodecount = 1;
+	ls->compiled = true;
+}
+
+static unsigned int
+literal_set_child(const struct literal_set *const restrict ls, const unsigned int node, const unsigned char c)
+{
+	if (node == 0)
+		return ls->root[c];
+
+	for (unsigned int n = ls->nodes[node].child; n != 0; n = ls->nodes[n].sibling)
+		if (ls->nodes[n].c == c)
+			return n;
+
+	return 0;
+}
+
+// The state after reading c in state node, following fail links as needed
+static unsigned int
+literal_set_step(const struct literal_set *const restrict ls, unsigned int node, const unsigned char c)
+{
+	unsigned int next;
+
+	while ((next = literal_set_child(ls, node, c)) == 0 && node != 0)
+		node = ls->nodes[node].fail;
+
+	return next;
+}
+
+/*
+ * literal_set_add()
+ *
+ * Adds a literal, if it is not in the set yet, and returns its ID. Returns
+ * 0 (which is never an ID) for an empty literal.
+ */
+unsigned int
+literal_set_add(struct literal_set *const restrict ls, const char *const restrict lit, const size_t len)
+{
+	unsigned int node = 0;
+
+	return_val_if_fail(ls != NULL, 0);
+
+	for (size_t i = 0; i < len; i++)
+	{
+		const unsigned char c = (unsigned char) lit[i];
+		unsigned int next = literal_set_child(ls, node, c);
+
+		if (next == 0)
+		{
+			if (ls->nodecount == ls->nodealloc)
+			{
+				ls->nodealloc *= 2;
+				ls->nodes = sreallocarray(ls->nodes, ls->nodealloc, sizeof *ls->nodes);
+			}
+
+			next = ls->nodecount++;
+
+			(void) memset(&ls->nodes[next], 0x00, sizeof ls->nodes[next]);
+			ls->nodes[next].c = c;
+
+			if (node == 0)
+				ls->root[c] = next;
+			else
+			{
+				ls->nodes[next].sibling = ls->nodes[node].child;
+				ls->nodes[node].child = next;
+			}
+		}
+
+		node = next;
+	}
+
+	if (node != 0)
+	{
+		ls->nodes[node].terminal = true;
+		ls->compiled = false;
+	}
+
+	return node;
+}
+
+void *
+literal_set_get(const struct literal_set *const restrict ls, const unsigned int id)
+{
+	return_val_if_fail(ls != NULL, NULL);
+	return_val_if_fail(id != 0 && id < ls->nodecount, NULL);
+
+	return ls->nodes[id].data;
+}
+
+void
+literal_set_set(struct literal_set *const restrict ls, const unsigned int id, void *const restrict data)
+{
+	return_if_fail(ls != NULL);
+	return_if_fail(id != 0 && id < ls->nodecount);
+
+	ls->nodes[id].data = data;
+}
+
+bool
+literal_set_empty(const struct literal_set *const restrict ls)
+{
+	return ls->nodecount == 1;
+}
+
+// Breadth-first, so that a node's fail target is done before the node
+void
+literal_set_compile(struct literal_set *const restrict ls)
+{
+	return_if_fail(ls != NULL);
+
+	if (ls->compiled)
+		return;
+
+	unsigned int *const queue = smalloc(ls->nodecount * sizeof *queue);
+	unsigned int head = 0, tail = 0;
+
+	for (unsigned int c = 0; c <= UCHAR_MAX; c++)
+	{
+		const unsigned int s = ls->root[c];
+
+		if (s == 0)
+			continue;
+
+		ls->nodes[s].fail = 0;
+		ls->nodes[s].out = 0;
+		queue[tail++] = s;
+	}
+
+	while (head < tail)
+	{
+		const unsigned int r = queue[head++];
+
+		for (unsigned int s = ls->nodes[r].child; s != 0; s = ls->nodes[s].sibling)
+		{
+			const unsigned int f = literal_set_step(ls, ls->nodes[r].fail, ls->nodes[s].c);
+
+			ls->nodes[s].fail = f;
+			ls->nodes[s].out = ls->nodes[f].terminal ? f : ls->nodes[f].out;
+
+			queue[tail++] = s;
+		}
+	}
+
+	sfree(queue);
+
+	ls->compiled = true;
+}
+
+void
+literal_set_search(const struct literal_set *const restrict ls, const char *const restrict text, const size_t len,
+                   const literal_set_hit_fn hit, void *const restrict privdata)
+{
+	unsigned int state = 0;
+
+	return_if_fail(ls != NULL);
+	return_if_fail(ls->compiled);
+
+	for (size_t i = 0; i < len; i++)
+	{
+		state = literal_set_step(ls, state, (unsigned char) text[i]);
+
+		unsigned int o = ls->nodes[state].terminal ? state : ls->nodes[state].out;
+
+		for (; o != 0; o = ls->nodes[o].out)
+			hit(ls->nodes[o].data, privdata);
+	}
+}
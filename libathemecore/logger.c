@@ -19,8 +19,23 @@
 static struct logfile *log_file;
 int log_force;
 
+/* Until the master log is opened, errors and info still go to stderr. */
+unsigned int log_active_mask = LG_ERROR | LG_INFO;
+
 static mowgli_list_t log_files = { NULL, NULL, 0 };
 
+static mowgli_eventloop_timer_t *log_flush_timer = NULL;
+
+static struct
+{
+	unsigned long   queued;                 // lines accepted into a write buffer
+	unsigned long   written;                // lines written out to their file
+	unsigned long   dropped;                // lines lost to write errors
+	unsigned long   flushes;                // write buffers emptied
+} log_wstats;
+
+static void logfile_flush(struct logfile *lf);
+
 /* private destructor function for struct logfile. */
 static void
 logfile_delete_file(void *vdata)
@@ -28,8 +43,10 @@ logfile_delete_file(void *vdata)
 	struct logfile *lf = (struct logfile *) vdata;
 
 	logfile_unregister(lf);
+	logfile_flush(lf);
 
 	fclose(lf->log_file);
+	sfree(lf->wbuf);
 	sfree(lf->log_path);
 	metadata_delete_all(lf);
 	sfree(lf);
@@ -47,6 +64,42 @@ logfile_delete_channel(void *vdata)
 	sfree(lf);
 }
 
+/*
+ * log_update_active_mask(void)
+ *
+ * Recomputes log_active_mask, the set of levels that at least one
+ * log stream (or the controlling terminal) is interested in.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - log_active_mask is updated.
+ */
+static void
+log_update_active_mask(void)
+{
+	mowgli_node_t *n;
+	unsigned int mask = 0;
+
+	if (log_force)
+		mask |= LG_ALL;
+	if (log_file == NULL)
+		mask |= LG_ERROR | LG_INFO;
+
+	MOWGLI_ITER_FOREACH(n, log_files.head)
+	{
+		const struct logfile *const lf = n->data;
+
+		mask |= lf->log_mask;
+	}
+
+	log_active_mask = mask;
+}
+
 static void
 logfile_join_channels(struct channel *c)
 {
@@ -184,10 +237,98 @@ logfile_strip_control_codes(const char *buf)
 	return outbuf;
 }
 
+/*
+ * logfile_timestamp(void)
+ *
+ * Returns the "[date time]" prefix for log lines. It is only reformatted
+ * when the second changes.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - the timestamp prefix for the current second
+ *
+ * Side Effects:
+ *       - none
+ */
+static const char *
+logfile_timestamp(void)
+{
+	static char datetime[BUFSIZE];
+	static time_t last = (time_t) -1;
+	const time_t now = time(NULL);
+
+	if (now != last)
+	{
+		(void) strftime(datetime, sizeof datetime, "[%Y-%m-%d %H:%M:%S]", localtime(&now));
+		last = now;
+	}
+
+	return datetime;
+}
+
+/*
+ * logfile_flush(struct logfile *lf)
+ *
+ * Writes out everything buffered for a file stream.
+ *
+ * Inputs:
+ *       - struct logfile representing the I/O stream.
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - the write buffer of the stream is emptied; if the file can't
+ *         be written to, the buffered lines are dropped.
+ */
+static void
+logfile_flush(struct logfile *lf)
+{
+	return_if_fail(lf != NULL);
+
+	if (lf->log_file == NULL || lf->wbuf_len == 0)
+		return;
+
+	const int fd = fileno((FILE *) lf->log_file);
+	size_t done = 0;
+
+	while (done < lf->wbuf_len)
+	{
+		const ssize_t ret = write(fd, lf->wbuf + done, lf->wbuf_len - done);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		done += (size_t) ret;
+	}
+
+	if (done < lf->wbuf_len)
+		log_wstats.dropped += lf->wbuf_lines;
+	else
+		log_wstats.written += lf->wbuf_lines;
+
+	log_wstats.flushes++;
+	lf->wbuf_len = 0;
+	lf->wbuf_lines = 0;
+}
+
+static void
+logfile_flush_timer_cb(void ATHEME_VATTR_UNUSED *unused)
+{
+	log_flush_timer = NULL;
+	log_flush();
+}
+
 /*
  * logfile_write(struct logfile *lf, const char *buf)
  *
- * Writes an I/O stream to a static file.
+ * Writes an I/O stream to a static file. Lines are collected in a buffer
+ * and written out in one go when it fills up, when an error is logged,
+ * or when general::log_flush_interval has passed.
  *
  * Inputs:
  *       - struct logfile representing the I/O stream.
@@ -197,25 +338,43 @@ logfile_strip_control_codes(const char *buf)
  *       - none
  *
  * Side Effects:
- *       - none
+ *       - a flush may be scheduled
  */
 static void
 logfile_write(struct logfile *lf, const char *buf)
 {
-	char datetime[BUFSIZE];
-	time_t t;
-	struct tm *tm;
-
 	return_if_fail(lf != NULL);
 	return_if_fail(lf->log_file != NULL);
 	return_if_fail(buf != NULL);
 
-	time(&t);
-	tm = localtime(&t);
-	strftime(datetime, sizeof datetime, "[%Y-%m-%d %H:%M:%S]", tm);
+	const char *const stamp = logfile_timestamp();
+	const char *const line = logfile_strip_control_codes(buf);
+	const size_t len = strlen(stamp) + 1 + strlen(line) + 1;
 
-	fprintf((FILE *) lf->log_file, "%s %s\n", datetime, logfile_strip_control_codes(buf));
-	fflush((FILE *) lf->log_file);
+	if (lf->wbuf == NULL)
+	{
+		// Large enough for any single line, even before the configuration is read
+		lf->wbuf_size = config_options.log_buffer_size;
+		if (lf->wbuf_size < BUFSIZE * 4)
+			lf->wbuf_size = BUFSIZE * 4;
+
+		lf->wbuf = smalloc(lf->wbuf_size);
+	}
+
+	// Leave room for the terminating NUL snprintf() writes
+	if (lf->wbuf_len + len >= lf->wbuf_size)
+		logfile_flush(lf);
+
+	(void) snprintf(lf->wbuf + lf->wbuf_len, lf->wbuf_size - lf->wbuf_len, "%s %s\n", stamp, line);
+	lf->wbuf_len += len;
+	lf->wbuf_lines++;
+	log_wstats.queued++;
+
+	if (!config_options.log_flush_interval || base_eventloop == NULL)
+		logfile_flush(lf);
+	else if (log_flush_timer == NULL)
+		log_flush_timer = mowgli_timer_add_once(base_eventloop, "log_flush", logfile_flush_timer_cb, NULL,
+		                                        config_options.log_flush_interval);
 }
 
 /*
@@ -330,6 +489,7 @@ void
 logfile_register(struct logfile *lf)
 {
 	mowgli_node_add(lf, &lf->node, &log_files);
+	log_update_active_mask();
 }
 
 /*
@@ -350,6 +510,7 @@ void
 logfile_unregister(struct logfile *lf)
 {
 	mowgli_node_delete(&lf->node, &log_files);
+	log_update_active_mask();
 }
 
 /*
@@ -477,10 +638,19 @@ logfile_new(const char *path, unsigned int log_mask)
  * Side Effects:
  *       - the log_files list is populated with the master
  *         atheme.log reference.
+ *       - buffered log lines will be written out at exit().
  */
 void
 log_open(void)
 {
+	static bool registered = false;
+
+	if (!registered)
+	{
+		(void) atexit(&log_flush);
+		registered = true;
+	}
+
 	log_file = logfile_new(log_path, LG_ERROR | LG_INFO | LG_CMD_ADMIN);
 }
 
@@ -507,6 +677,74 @@ log_shutdown(void)
 		atheme_object_unref(n->data);
 }
 
+/*
+ * log_flush(void)
+ *
+ * Writes out everything buffered for file streams. This must be called
+ * before forking a process that may exit() normally, or the buffered
+ * lines would be written twice.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - the write buffers of all file streams are emptied.
+ */
+void
+log_flush(void)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, log_files.head)
+	{
+		struct logfile *const lf = n->data;
+
+		if (lf->write_func == logfile_write)
+			logfile_flush(lf);
+	}
+}
+
+/*
+ * log_stats(void (*cb)(const char *line, void *privdata), void *privdata)
+ *
+ * Reports the state of the log write buffers.
+ *
+ * Inputs:
+ *       - callback to receive each line of output
+ *       - opaque data for the callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - none
+ */
+void
+log_stats(void (*cb)(const char *line, void *privdata), void *privdata)
+{
+	mowgli_node_t *n;
+	char buf[BUFSIZE];
+	unsigned int pending = 0;
+
+	MOWGLI_ITER_FOREACH(n, log_files.head)
+	{
+		const struct logfile *const lf = n->data;
+
+		pending += lf->wbuf_lines;
+	}
+
+	snprintf(buf, sizeof buf, "Log lines queued: %lu, written: %lu, dropped: %lu, pending: %u",
+	         log_wstats.queued, log_wstats.written, log_wstats.dropped, pending);
+	cb(buf, privdata);
+
+	snprintf(buf, sizeof buf, "Log buffer flushes: %lu (interval %u seconds, %u bytes per file)",
+	         log_wstats.flushes, config_options.log_flush_interval, config_options.log_buffer_size);
+	cb(buf, privdata);
+}
+
 /*
  * log_debug_enabled(void)
  *
@@ -559,6 +797,7 @@ log_master_set_mask(unsigned int mask)
 	if (log_file == NULL)
 		return;
 	log_file->log_mask = mask;
+	log_update_active_mask();
 }
 
 /*
@@ -611,6 +850,9 @@ vslog_ext(enum log_type type, unsigned int level, const char *fmt, va_list args)
 	if (in_vslog_ext)
 		return;
 
+	if (!(level & log_active_mask))
+		return;
+
 	in_vslog_ext = true;
 
 	char buf[BUFSIZE];
@@ -632,20 +874,17 @@ vslog_ext(enum log_type type, unsigned int level, const char *fmt, va_list args)
 		(void) lf->write_func(lf, buf);
 	}
 
+	// Don't let errors sit in a buffer; the next thing we do might be exit()
+	if (level & LG_ERROR)
+		log_flush();
+
 	/* If the event is in the default loglevel, and we are starting, then
 	 * display it in the controlling terminal.
 	 */
 	if (type != LOG_INTERACTIVE && ((runflags & (RF_LIVE | RF_STARTING) &&
 		(log_file != NULL ? log_file->log_mask : LG_ERROR | LG_INFO) & level) ||
 		(runflags & RF_LIVE && log_force)))
-	{
-		char datetime[BUFSIZE];
-		const time_t ts = time(NULL);
-		const struct tm *const tm = localtime(&ts);
-
-		(void) strftime(datetime, sizeof datetime, "[%Y-%m-%d %H:%M:%S]", tm);
-		(void) fprintf(stderr, "%s %s\n", datetime, logfile_strip_control_codes(buf));
-	}
+		(void) fprintf(stderr, "%s %s\n", logfile_timestamp(), logfile_strip_control_codes(buf));
 
 	in_vslog_ext = false;
 }
@@ -679,7 +918,7 @@ slog_ext(enum log_type type, unsigned int level, const char *fmt, ...)
  *       - logfiles are updated depending on how they are configured.
  */
 void ATHEME_FATTR_PRINTF(2, 3)
-slog(unsigned int level, const char *fmt, ...)
+(slog)(unsigned int level, const char *fmt, ...)
 {
 	va_list args;
 
@@ -769,6 +1008,9 @@ logcommand(struct sourceinfo *si, int level, const char *fmt, ...)
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!((unsigned int) level & log_active_mask))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -806,6 +1048,9 @@ logcommand_user(struct service *svs, struct user *source, int level, const char
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!((unsigned int) level & log_active_mask))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -848,6 +1093,9 @@ logcommand_external(struct service *svs, const char *type, struct connection *so
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!((unsigned int) level & log_active_mask))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -0,0 +1,304 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * atheme-services: A collection of minimalist IRC services
+ * maskindex.c: Finding the first of many glob masks that matches a name.
+ *
+ * The exact table, the literal set and the fallback chain are derived from the
+ * list of entries, and are rebuilt by the first lookup after an entry was
+ * added or deleted or the casemapping changed. Masks are added and deleted
+ * rarely and in batches (loading the database, expiry), and rebuilding
+ * takes time linear in the total length of the masks.
+ *
+ * Every chain is kept in the order entries were added, and a lookup keeps
+ * the earliest matching entry it has found so far, so it returns what a
+ * walk over the list would have returned first.
+ */
+
+#include <atheme.h>
+#include "internal.h"
+
+struct mask_index
+{
+	mowgli_list_t                   entries;
+	mowgli_patricia_t *             exact;          // folded mask -> chain of entries
+	struct literal_set *            literals;       // literal -> chain of entries
+	struct mask_index_entry *       fallback;
+	unsigned long                   seq;
+	unsigned long                   generation;
+	int                             mapping;
+	bool                            dirty;
+};
+
+struct mask_index *
+mask_index_create(void)
+{
+	struct mask_index *const mi = smalloc(sizeof *mi);
+
+	mi->exact = mowgli_patricia_create(noopcanon);
+	mi->literals = literal_set_create();
+	mi->mapping = match_mapping;
+
+	return mi;
+}
+
+void
+mask_index_destroy(struct mask_index *const restrict mi)
+{
+	return_if_fail(mi != NULL);
+
+	if (MOWGLI_LIST_LENGTH(&mi->entries) != 0)
+		slog(LG_DEBUG, "%s: destroying index with %zu entries", MOWGLI_FUNC_NAME,
+		     MOWGLI_LIST_LENGTH(&mi->entries));
+
+	mowgli_patricia_destroy(mi->exact, NULL, NULL);
+	literal_set_destroy(mi->literals);
+	sfree(mi);
+}
+
+/*
+ * mask_index_add()
+ *
+ * Indexes cm, which must stay valid until the entry is deleted again; data
+ * is what mask_index_find() returns for it. The index recompiles cm if the
+ * casemapping changes.
+ */
+void
+mask_index_add(struct mask_index *const restrict mi, struct mask_index_entry *const restrict ie,
+               struct compiled_mask *const restrict cm, void *const restrict data)
+{
+	return_if_fail(mi != NULL);
+	return_if_fail(ie != NULL);
+	return_if_fail(cm != NULL);
+
+	ie->cm = cm;
+	ie->data = data;
+	ie->seq = ++mi->seq;
+	ie->seen = 0;
+	ie->next = NULL;
+
+	mowgli_node_add(ie, &ie->node, &mi->entries);
+	mi->dirty = true;
+}
+
+void
+mask_index_delete(struct mask_index *const restrict mi, struct mask_index_entry *const restrict ie)
+{
+	return_if_fail(mi != NULL);
+	return_if_fail(ie != NULL);
+
+	mowgli_node_delete(&ie->node, &mi->entries);
+	mi->dirty = true;
+}
+
+/* Finds the longest run of characters other than '*' and '?' in a folded mask */
+static size_t
+mask_index_literal(const struct compiled_mask *const restrict cm, size_t *const restrict offset)
+{
+	size_t best = 0, start = 0;
+
+	for (size_t i = 0; i <= cm->len; i++)
+	{
+		if (i < cm->len && cm->folded[i] != '*' && cm->folded[i] != '?')
+			continue;
+
+		if (i - start > best)
+		{
+			best = i - start;
+			*offset = start;
+		}
+
+		start = i + 1;
+	}
+
+	return best;
+}
+
+static void
+mask_index_rebuild(struct mask_index *const restrict mi)
+{
+	mowgli_node_t *n;
+
+	mowgli_patricia_destroy(mi->exact, NULL, NULL);
+	mi->exact = mowgli_patricia_create(noopcanon);
+	mi->fallback = NULL;
+
+	literal_set_clear(mi->literals);
+
+	// Backwards, so that prepending keeps every chain in the order of the list
+	MOWGLI_ITER_FOREACH_PREV(n, mi->entries.tail)
+	{
+		struct mask_index_entry *const ie = n->data;
+		struct compiled_mask *const cm = ie->cm;
+		size_t litoff = 0, litlen = 0;
+
+		if (cm->mapping != match_mapping)
+		{
+			const char *const mask = cm->mask;
+
+			compiled_mask_free(cm);
+			compiled_mask_init(cm, mask);
+		}
+
+		if (cm->type == CMASK_LITERAL && ! cm->wildone)
+		{
+			ie->next = mowgli_patricia_retrieve(mi->exact, cm->folded);
+
+			if (ie->next != NULL)
+				(void) mowgli_patricia_delete(mi->exact, cm->folded);
+
+			(void) mowgli_patricia_add(mi->exact, cm->folded, ie);
+			continue;
+		}
+
+		if (cm->type != CMASK_MATCH)
+			litlen = mask_index_literal(cm, &litoff);
+
+		if (litlen == 0)
+		{
+			ie->next = mi->fallback;
+			mi->fallback = ie;
+			continue;
+		}
+
+		const unsigned int id = literal_set_add(mi->literals, cm->folded + litoff, litlen);
+
+		ie->next = literal_set_get(mi->literals, id);
+		literal_set_set(mi->literals, id, ie);
+	}
+
+	literal_set_compile(mi->literals);
+
+	mi->mapping = match_mapping;
+	mi->dirty = false;
+}
+
+static inline bool
+mask_index_try(struct mask_index_entry *const restrict ie, const struct folded_name *const restrict fn,
+               const mask_index_accept_fn accept, void *const restrict privdata)
+{
+	if (! compiled_mask_match_name(ie->cm, fn))
+		return false;
+
+	return accept == NULL || accept(ie->data, privdata);
+}
+
+/* Whether an entry can still beat the best match found so far */
+static inline bool
+mask_index_earlier(const struct mask_index_entry *const restrict ie, const struct mask_index_entry *const restrict best)
+{
+	return ie != NULL && (best == NULL || ie->seq < best->seq);
+}
+
+struct mask_index_search
+{
+	const struct folded_name *      fn;
+	mask_index_accept_fn            accept;
+	void *                          privdata;
+	struct mask_index_entry *       best;
+	unsigned long                   generation;
+};
+
+/* Tries the entries filed under a literal found in the name; an entry whose
+ * literal occurs more than once is only tried once
+ */
+static void
+mask_index_hit(void *const restrict data, void *const restrict privdata)
+{
+	struct mask_index_search *const search = privdata;
+
+	for (struct mask_index_entry *ie = data; mask_index_earlier(ie, search->best); ie = ie->next)
+	{
+		if (ie->seen == search->generation)
+			continue;
+
+		ie->seen = search->generation;
+
+		if (mask_index_try(ie, search->fn, search->accept, search->privdata))
+		{
+			search->best = ie;
+			return;
+		}
+	}
+}
+
+/*
+ * mask_index_find()
+ *
+ * Returns the data of the earliest added entry whose mask matches name and
+ * which accept (if not NULL) agrees to, or NULL if there is none.
+ */
+void *
+mask_index_find(struct mask_index *const restrict mi, const char *const restrict name,
+                const mask_index_accept_fn accept, void *const restrict privdata)
+{
+	struct mask_index_entry *ie, *best = NULL;
+	struct folded_name fn;
+	mowgli_node_t *n;
+
+	return_val_if_fail(mi != NULL, NULL);
+
+	if (name == NULL || MOWGLI_LIST_LENGTH(&mi->entries) == 0)
+		return NULL;
+
+	if (mi->dirty || mi->mapping != match_mapping)
+		mask_index_rebuild(mi);
+
+	folded_name_init(&fn, name);
+
+	// Too long to fold; this is no time to be clever
+	if (fn.folded == NULL)
+	{
+		MOWGLI_ITER_FOREACH(n, mi->entries.head)
+		{
+			ie = n->data;
+
+			if (mask_index_try(ie, &fn, accept, privdata))
+				return ie->data;
+		}
+
+		return NULL;
+	}
+
+	for (ie = mowgli_patricia_retrieve(mi->exact, fn.folded); ie != NULL; ie = ie->next)
+	{
+		if (mask_index_try(ie, &fn, accept, privdata))
+		{
+			best = ie;
+			break;
+		}
+	}
+
+	for (ie = mi->fallback; mask_index_earlier(ie, best); ie = ie->next)
+	{
+		if (mask_index_try(ie, &fn, accept, privdata))
+		{
+			best = ie;
+			break;
+		}
+	}
+
+	if (! literal_set_empty(mi->literals))
+	{
+		struct mask_index_search search = {
+			.fn             = &fn,
+			.accept         = accept,
+			.privdata       = privdata,
+			.best           = best,
+			.generation     = ++mi->generation,
+		};
+
+		literal_set_search(mi->literals, fn.folded, fn.len, &mask_index_hit, &search);
+
+		best = search.best;
+	}
+
+	return (best != NULL) ? best->data : NULL;
+}
@@ -207,6 +207,247 @@ match(const char *mask, const char *name)
 	return 1;
 }
 
+/*
+ * match_fold()
+ *
+ * Copies src into dst (of size bytes) folded to lower case with the current
+ * casemapping, like mowgli_strlcpy(). Returns the length of src; if that is
+ * size or more, dst was truncated.
+ */
+size_t
+match_fold(char *const restrict dst, const char *const restrict src, const size_t size)
+{
+	size_t i;
+
+	for (i = 0; src[i] != '\0'; i++)
+		if (i + 1 < size)
+			dst[i] = (char) ToLower((unsigned char) src[i]);
+
+	if (size != 0)
+		dst[(i < size) ? i : (size - 1)] = '\0';
+
+	return i;
+}
+
+/*
+ * compiled_mask_init()
+ *
+ * Compiles a mask for compiled_mask_match(). The mask is not copied and
+ * must outlive the compiled form.
+ *
+ * Masks using escapes or the '&', '#' and '%' character classes are left
+ * to match(), as is everything when the casemapping changes afterwards.
+ */
+void
+compiled_mask_init(struct compiled_mask *const restrict cm, const char *const restrict mask)
+{
+	const char *p;
+	size_t stars = 0;
+
+	(void) memset(cm, 0x00, sizeof *cm);
+
+	cm->mask = mask;
+	cm->type = CMASK_MATCH;
+	cm->mapping = match_mapping;
+
+	if (mask == NULL)
+		return;
+
+	for (p = mask; *p != '\0'; p++)
+		if (*p == '\\' || *p == '&' || *p == '#' || *p == '%')
+			return;
+
+	cm->folded = smalloc(strlen(mask) + 1);
+
+	for (p = mask; *p != '\0'; p++)
+	{
+		if (*p == '*')
+		{
+			if (cm->len != 0 && cm->folded[cm->len - 1] == '*')
+				continue;
+
+			cm->folded[cm->len++] = '*';
+			stars++;
+			continue;
+		}
+
+		if (*p == '?')
+			cm->wildone = true;
+
+		cm->folded[cm->len++] = (char) ToLower((unsigned char) *p);
+		cm->minlen++;
+	}
+
+	cm->folded[cm->len] = '\0';
+
+	if (stars == 0)
+	{
+		cm->type = CMASK_LITERAL;
+		cm->head = cm->len;
+		return;
+	}
+
+	for (cm->head = 0; cm->folded[cm->head] != '*'; cm->head++)
+		;
+	for (cm->tail = 0; cm->folded[cm->len - cm->tail - 1] != '*'; cm->tail++)
+		;
+
+	if (stars == 1 && cm->tail == 0)
+		cm->type = CMASK_PREFIX;
+	else if (stars == 1 && cm->head == 0)
+		cm->type = CMASK_SUFFIX;
+	else
+		cm->type = CMASK_GLOB;
+}
+
+void
+compiled_mask_free(struct compiled_mask *const restrict cm)
+{
+	sfree(cm->folded);
+	cm->folded = NULL;
+}
+
+static inline bool
+cmask_segment_equal(const char *const restrict seg, const char *const restrict name, const size_t len,
+                    const bool wildone)
+{
+	if (! wildone)
+		return memcmp(seg, name, len) == 0;
+
+	for (size_t i = 0; i < len; i++)
+		if (seg[i] != name[i] && seg[i] != '?')
+			return false;
+
+	return true;
+}
+
+/* Finds the leftmost occurrence of a segment in name[0..len); memchr() for
+ * its first character does most of the work, and is vectorised in any libc
+ * worth the name.
+ */
+static const char *
+cmask_segment_find(const char *name, const size_t len, const char *const restrict seg, const size_t seglen,
+                   const bool wildone)
+{
+	if (seglen > len)
+		return NULL;
+
+	const char *const last = name + (len - seglen);
+
+	if (seg[0] == '?')
+	{
+		for (; name <= last; name++)
+			if (cmask_segment_equal(seg, name, seglen, wildone))
+				return name;
+
+		return NULL;
+	}
+
+	while (name <= last && (name = memchr(name, seg[0], (size_t) (last - name) + 1)) != NULL)
+	{
+		if (cmask_segment_equal(seg + 1, name + 1, seglen - 1, wildone))
+			return name;
+
+		name++;
+	}
+
+	return NULL;
+}
+
+/*
+ * compiled_mask_match_folded()
+ *
+ * Like compiled_mask_match(), for a name already folded with match_fold().
+ * name is only used if the mask has to be handed to match(), which is also
+ * done if folded is NULL.
+ */
+bool
+compiled_mask_match_folded(const struct compiled_mask *const restrict cm, const char *const restrict name,
+                           const char *const restrict folded, const size_t len)
+{
+	if (folded == NULL || cm->type == CMASK_MATCH || cm->mapping != match_mapping)
+		return !match(cm->mask, name);
+
+	if (len < cm->minlen)
+		return false;
+
+	switch (cm->type)
+	{
+		case CMASK_LITERAL:
+			return len == cm->len && cmask_segment_equal(cm->folded, folded, len, cm->wildone);
+
+		case CMASK_PREFIX:
+			return cmask_segment_equal(cm->folded, folded, cm->head, cm->wildone);
+
+		case CMASK_SUFFIX:
+			return cmask_segment_equal(cm->folded + 1, folded + (len - cm->tail), cm->tail, cm->wildone);
+
+		default:
+			break;
+	}
+
+	if (! cmask_segment_equal(cm->folded, folded, cm->head, cm->wildone))
+		return false;
+	if (! cmask_segment_equal(cm->folded + (cm->len - cm->tail), folded + (len - cm->tail), cm->tail, cm->wildone))
+		return false;
+
+	const char *pos = folded + cm->head;
+	const char *const end = folded + (len - cm->tail);
+	const char *seg = cm->folded + cm->head + 1;
+	const char *const segend = cm->folded + (cm->len - cm->tail - 1);
+
+	while (seg < segend)
+	{
+		const char *const star = memchr(seg, '*', (size_t) (segend - seg) + 1);
+		const size_t seglen = (size_t) (star - seg);
+
+		if ((pos = cmask_segment_find(pos, (size_t) (end - pos), seg, seglen, cm->wildone)) == NULL)
+			return false;
+
+		pos += seglen;
+		seg = star + 1;
+	}
+
+	return true;
+}
+
+/*
+ * compiled_mask_match()
+ *
+ * Returns true if name matches the compiled mask. This gives the same
+ * answer as match(), except that match() gives up on a name after 512
+ * steps of backtracking and a compiled mask does not.
+ */
+bool
+compiled_mask_match(const struct compiled_mask *const restrict cm, const char *const restrict name)
+{
+	struct folded_name fn;
+
+	if (name == NULL)
+		return false;
+
+	if (cm->type == CMASK_MATCH || cm->mapping != match_mapping)
+		return !match(cm->mask, name);
+
+	folded_name_init(&fn, name);
+
+	return compiled_mask_match_name(cm, &fn);
+}
+
+void
+folded_name_init(struct folded_name *const restrict fn, const char *const restrict name)
+{
+	fn->name = name;
+	fn->len = match_fold(fn->buf, name, sizeof fn->buf);
+	fn->folded = (fn->len < sizeof fn->buf) ? fn->buf : NULL;
+}
+
+bool
+compiled_mask_match_name(const struct compiled_mask *const restrict cm, const struct folded_name *const restrict fn)
+{
+	return compiled_mask_match_folded(cm, fn->name, fn->folded, fn->len);
+}
+
 
 /*
 ** collapse a pattern string into minimal components.
@@ -616,6 +857,19 @@ regex_create(char *pattern, int flags)
 			sfree(preg);
 			return NULL;
 		}
+		preg->md = pcre2_match_data_create(1, NULL);
+		if (preg->md == NULL)
+		{
+			slog(LG_ERROR, "regex_match(): out of memory compiling %s", pattern);
+			pcre2_code_free(preg->un.pcre);
+			sfree(preg);
+			return NULL;
+		}
+
+		// Not every build of PCRE has a JIT compiler; pcre2_match() falls back to the interpreter
+		if ((errcode = pcre2_jit_compile(preg->un.pcre, PCRE2_JIT_COMPLETE)) != 0)
+			slog(LG_DEBUG, "regex_create(): not JIT compiling %s (error %d)", pattern, errcode);
+
 		preg->type = at_pcre;
 #else
 		slog(LG_ERROR, "regex_match(): PCRE support is not compiled in");
@@ -680,6 +934,262 @@ regex_extract(char *pattern, char **pend, int *pflags)
 	return pattern + 1;
 }
 
+static inline char
+regex_fold_char(const char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char) (c - 'A' + 'a') : c;
+}
+
+/*
+ * regex_fold()
+ *  Copies `src' into `dst' (of `size' bytes) with ASCII letters folded to
+ *  lower case, like mowgli_strlcpy(); this is the folding that
+ *  regex_required_literal() applies to its result. Returns the length of
+ *  `src'.
+ */
+size_t
+regex_fold(char *const restrict dst, const char *const restrict src, const size_t size)
+{
+	size_t i;
+
+	for (i = 0; src[i] != '\0'; i++)
+		if (i + 1 < size)
+			dst[i] = regex_fold_char(src[i]);
+
+	if (size != 0)
+		dst[(i < size) ? i : (size - 1)] = '\0';
+
+	return i;
+}
+
+// Skips a bracket expression; p is just past the '['
+static const char *
+regex_skip_bracket(const char *p, const bool pcre)
+{
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+
+	for (; *p != '\0'; p++)
+	{
+		if (*p == ']')
+			return p + 1;
+
+		if (*p == '\\' && pcre)
+		{
+			if (*++p == '\0')
+				return NULL;
+		}
+		else if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+		{
+			const char term = p[1];
+
+			for (p += 2; *p != '\0' && ! (p[0] == term && p[1] == ']'); p++)
+				;
+
+			if (*p++ == '\0')
+				return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+// Skips a group; p is just past the '('
+static const char *
+regex_skip_group(const char *p, const bool pcre)
+{
+	unsigned int depth = 1;
+
+	while (*p != '\0')
+	{
+		if (*p == '\\')
+		{
+			if (*++p == '\0')
+				return NULL;
+		}
+		else if (*p == '[')
+		{
+			if ((p = regex_skip_bracket(p + 1, pcre)) == NULL)
+				return NULL;
+
+			continue;
+		}
+		else if (*p == '(')
+			depth++;
+		else if (*p == ')' && --depth == 0)
+			return p + 1;
+
+		p++;
+	}
+
+	return NULL;
+}
+
+/* Skips the quantifiers after an atom, and sets *optional if the atom may
+ * be left out and *repeated if it may occur more than once. Lazy and
+ * possessive suffixes are taken as quantifiers of their own, and any
+ * interval as optional, which errs on the safe side. A '{' that does not
+ * start an interval is left for the caller.
+ */
+static const char *
+regex_skip_quantifiers(const char *p, bool *const restrict optional, bool *const restrict repeated)
+{
+	*optional = false;
+	*repeated = false;
+
+	for (;;)
+	{
+		if (*p == '*' || *p == '?')
+		{
+			*optional = true;
+			*repeated = true;
+			p++;
+		}
+		else if (*p == '+')
+		{
+			*repeated = true;
+			p++;
+		}
+		else if (*p == '{' && p[1 + strspn(p + 1, "0123456789,")] == '}')
+		{
+			*optional = true;
+			*repeated = true;
+			p += strspn(p + 1, "0123456789,") + 2;
+		}
+		else
+			return p;
+	}
+}
+
+/*
+ * regex_required_literal()
+ *  Finds a string that every match of the regex `pattern' (compiled with
+ *  the AREGEX_* `flags') contains: the longest run of ordinary characters
+ *  outside any group or bracket expression that nothing makes optional.
+ *  It is written to `buf' (of `size' bytes) folded with regex_fold(), so
+ *  that a regex that matches a string implies that the folded string
+ *  contains it. Returns its length, 0 if no such string was found, in
+ *  which case the regex has to be tried on everything.
+ *
+ *  This only has to be right, not clever: anything it does not fully
+ *  understand (alternation at the top level, most escapes, PCRE inline
+ *  options) ends a run or gives up.
+ */
+size_t
+regex_required_literal(const char *const restrict pattern, const int flags, char *const restrict buf,
+                       const size_t size)
+{
+	const bool pcre = (flags & AREGEX_PCRE) != 0;
+	const bool icase = (flags & AREGEX_ICASE) != 0;
+	char run[BUFSIZE];
+	size_t best = 0, len = 0;
+	const char *p = pattern;
+
+	if (size == 0)
+		return 0;
+
+	buf[0] = '\0';
+
+	// Inline options, such as (?x), change what everything after them means
+	for (const char *opt = pattern; (opt = strstr(opt, "(?")) != NULL; opt += 2)
+		if (isalpha((unsigned char) opt[2]) || opt[2] == '-' || opt[2] == '^')
+			return 0;
+
+	while (*p != '\0')
+	{
+		bool literal = true, optional, repeated;
+		char c = '\0';
+
+		switch (*p)
+		{
+			case '|':
+			case ')':
+				return 0;
+
+			case '(':
+				if ((p = regex_skip_group(p + 1, pcre)) == NULL)
+					return 0;
+
+				literal = false;
+				break;
+
+			case '[':
+				if ((p = regex_skip_bracket(p + 1, pcre)) == NULL)
+					return 0;
+
+				literal = false;
+				break;
+
+			case '.':
+			case '^':
+			case '$':
+			case '*':
+			case '+':
+			case '?':
+			case '{':
+				p++;
+				literal = false;
+				break;
+
+			case '\\':
+				c = p[1];
+
+				if (c == '\0')
+					return 0;
+
+				// Character classes and word boundaries; any other letter or digit may be anything
+				if (isalnum((unsigned char) c) && strchr("dDwWsSbB", c) == NULL)
+					return 0;
+
+				// POSIX (GNU) word boundaries
+				if (isalnum((unsigned char) c) || (! pcre && strchr("<>`'", c) != NULL))
+					literal = false;
+
+				p += 2;
+				break;
+
+			default:
+				c = *p++;
+				break;
+		}
+
+		p = regex_skip_quantifiers(p, &optional, &repeated);
+
+		/* Case-insensitive matching in a multibyte locale may fold a
+		 * non-ASCII character to k, s or i (e.g. the Kelvin sign)
+		 */
+		if (literal && ! optional && ! ((unsigned char) c & 0x80U) &&
+		    ! (icase && strchr("kis", regex_fold_char(c)) != NULL))
+		{
+			if (len + 1 < sizeof run)
+				run[len++] = regex_fold_char(c);
+
+			if (! repeated)
+				continue;
+		}
+
+		if (len > best)
+		{
+			best = (len < size) ? len : (size - 1);
+			(void) memcpy(buf, run, best);
+			buf[best] = '\0';
+		}
+
+		len = 0;
+	}
+
+	if (len > best)
+	{
+		best = (len < size) ? len : (size - 1);
+		(void) memcpy(buf, run, best);
+		buf[best] = '\0';
+	}
+
+	return best;
+}
+
 /*
  * regex_match()
  *  Internal wrapper API for regex matching.
@@ -687,7 +1197,7 @@ regex_extract(char *pattern, char **pend, int *pflags)
  *  Returns `true' on match, `false' else.
  */
 bool
-regex_match(struct atheme_regex *preg, char *string)
+regex_match(struct atheme_regex *preg, const char *string)
 {
 	if (preg == NULL || string == NULL)
 	{
@@ -701,7 +1211,7 @@ regex_match(struct atheme_regex *preg, char *string)
 			return regexec(&preg->un.posix, string, 0, NULL, 0) == 0;
 		case at_pcre:
 #ifdef HAVE_LIBPCRE
-			return pcre2_match(preg->un.pcre, string, PCRE2_ZERO_TERMINATED, 0, 0, NULL, NULL) >= 0;
+			return pcre2_match(preg->un.pcre, string, PCRE2_ZERO_TERMINATED, 0, 0, preg->md, NULL) >= 0;
 #else
 			slog(LG_ERROR, "regex_match(): we were given a PCRE pattern without PCRE support!");
 			return false;
@@ -723,6 +1233,7 @@ regex_destroy(struct atheme_regex *preg)
 			break;
 		case at_pcre:
 #ifdef HAVE_LIBPCRE
+			pcre2_match_data_free(preg->md);
 			pcre2_code_free(preg->un.pcre);
 			break;
 #else
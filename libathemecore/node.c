@@ -24,6 +24,40 @@ static mowgli_heap_t *kline_heap = NULL;	/* 16 */
 static mowgli_heap_t *xline_heap = NULL;	/* 16 */
 static mowgli_heap_t *qline_heap = NULL;	/* 16 */
 
+/* K-lines on an address or CIDR mask live in a path-compressed binary
+ * radix tree keyed on the (IPv4-mapped) network, so kline_find_user()
+ * only has to glob match the K-lines on other hosts.
+ */
+struct kline_ipnode
+{
+	struct in6_addr         prefix;
+	unsigned int            bits;
+	struct kline_ipnode *   child[2];
+	mowgli_list_t           klines;
+};
+
+static mowgli_heap_t *kline_ipnode_heap = NULL;
+static struct kline_ipnode *kline_iptree = NULL;
+static mowgli_list_t kline_globlist;
+
+static struct mask_index *xline_index = NULL;
+static struct mask_index *qline_index = NULL;
+
+/* K-, X- and Q-lines by number, keyed on its decimal form */
+#define NUMKEY_BUFSIZE 24
+
+static mowgli_patricia_t *kline_numtree = NULL;
+static mowgli_patricia_t *xline_numtree = NULL;
+static mowgli_patricia_t *qline_numtree = NULL;
+
+static const char *
+numkey(char *const buf, const unsigned long number)
+{
+	(void) snprintf(buf, NUMKEY_BUFSIZE, "%lu", number);
+
+	return buf;
+}
+
 /*************
  * L I S T S *
  *************/
@@ -34,13 +68,20 @@ init_nodes(void)
 	kline_heap = sharedheap_get(sizeof(struct kline));
 	xline_heap = sharedheap_get(sizeof(struct xline));
 	qline_heap = sharedheap_get(sizeof(struct qline));
+	kline_ipnode_heap = sharedheap_get(sizeof(struct kline_ipnode));
 
-	if (kline_heap == NULL || xline_heap == NULL || qline_heap == NULL)
+	if (kline_heap == NULL || xline_heap == NULL || qline_heap == NULL || kline_ipnode_heap == NULL)
 	{
 		slog(LG_INFO, "init_nodes(): block allocator failed.");
 		exit(EXIT_FAILURE);
 	}
 
+	xline_index = mask_index_create();
+	qline_index = mask_index_create();
+	kline_numtree = mowgli_patricia_create(noopcanon);
+	xline_numtree = mowgli_patricia_create(noopcanon);
+	qline_numtree = mowgli_patricia_create(noopcanon);
+
 	init_uplinks();
 	init_servers();
 	init_metadata();
@@ -114,6 +155,190 @@ remove_illegals()
  * K L I N E *
  *************/
 
+static inline unsigned int
+ipaddr_bit(const struct in6_addr *const addr, const unsigned int bit)
+{
+	return (addr->s6_addr[bit / 8] >> (7 - (bit % 8))) & 1U;
+}
+
+/* number of leading bits (at most maxbits) that a and b have in common */
+static unsigned int
+ipaddr_common_bits(const struct in6_addr *const a, const struct in6_addr *const b, const unsigned int maxbits)
+{
+	unsigned int bits = 0;
+
+	for (unsigned int i = 0; i < sizeof a->s6_addr && bits < maxbits; i++)
+	{
+		unsigned int x = a->s6_addr[i] ^ b->s6_addr[i];
+
+		if (x == 0)
+		{
+			bits += 8;
+			continue;
+		}
+
+		while (!(x & 0x80U))
+		{
+			bits++;
+			x <<= 1;
+		}
+
+		break;
+	}
+
+	return (bits < maxbits) ? bits : maxbits;
+}
+
+static struct kline_ipnode *
+kline_ipnode_create(const struct in6_addr *const prefix, const unsigned int bits)
+{
+	struct kline_ipnode *const n = mowgli_heap_alloc(kline_ipnode_heap);
+
+	n->prefix = *prefix;
+	n->bits = bits;
+
+	return n;
+}
+
+/* find the tree node for addr/bits, creating (and splitting) as needed */
+static struct kline_ipnode *
+kline_iptree_node(const struct in6_addr *const addr, const unsigned int bits)
+{
+	struct kline_ipnode **pp = &kline_iptree;
+	struct kline_ipnode *n;
+
+	while ((n = *pp) != NULL)
+	{
+		const unsigned int common = ipaddr_common_bits(&n->prefix, addr, (n->bits < bits) ? n->bits : bits);
+
+		if (common < n->bits)
+		{
+			// addr/bits diverges from this node, or is a shorter prefix of it
+			struct kline_ipnode *const split = kline_ipnode_create(addr, common);
+
+			split->child[ipaddr_bit(&n->prefix, common)] = n;
+			*pp = split;
+
+			if (common == bits)
+				return split;
+
+			pp = &split->child[ipaddr_bit(addr, common)];
+			break;
+		}
+
+		if (n->bits == bits)
+			return n;
+
+		pp = &n->child[ipaddr_bit(addr, n->bits)];
+	}
+
+	*pp = kline_ipnode_create(addr, bits);
+
+	return *pp;
+}
+
+/* drop a node that no longer carries K-lines nor joins two subtrees */
+static struct kline_ipnode *
+kline_iptree_prune(struct kline_ipnode *const n)
+{
+	if (MOWGLI_LIST_LENGTH(&n->klines) != 0 || (n->child[0] != NULL && n->child[1] != NULL))
+		return n;
+
+	struct kline_ipnode *const child = (n->child[0] != NULL) ? n->child[0] : n->child[1];
+
+	mowgli_heap_free(kline_ipnode_heap, n);
+
+	return child;
+}
+
+static struct kline_ipnode *
+kline_iptree_delete(struct kline_ipnode *const n, struct kline *const k)
+{
+	if (n == NULL)
+		return NULL;
+
+	if (ipaddr_common_bits(&n->prefix, &k->ipaddr, n->bits) < n->bits)
+		return n;
+
+	if (n->bits == k->ipbits)
+		mowgli_node_delete(&k->inode, &n->klines);
+	else if (n->bits < k->ipbits)
+	{
+		const unsigned int bit = ipaddr_bit(&k->ipaddr, n->bits);
+
+		n->child[bit] = kline_iptree_delete(n->child[bit], k);
+	}
+	else
+		return n;
+
+	return kline_iptree_prune(n);
+}
+
+static struct kline *
+kline_iptree_find(const struct in6_addr *const addr, const struct folded_name *const user)
+{
+	struct kline_ipnode *n = kline_iptree;
+	mowgli_node_t *tn;
+	struct kline *k;
+
+	while (n != NULL && ipaddr_common_bits(&n->prefix, addr, n->bits) == n->bits)
+	{
+		MOWGLI_ITER_FOREACH(tn, n->klines.head)
+		{
+			k = tn->data;
+
+			if (k->duration != 0 && k->expires <= CURRTIME)
+				continue;
+			if (compiled_mask_match_name(&k->cuser, user))
+				return k;
+		}
+
+		if (n->bits == (sizeof addr->s6_addr * 8))
+			break;
+
+		n = n->child[ipaddr_bit(addr, n->bits)];
+	}
+
+	return NULL;
+}
+
+/* Numbers are not necessarily unique (older databases, or X-lines and Q-lines
+ * added before the database set their numbers), so the tree holds the first
+ * line added with a given number, which is what a walk over the list used to
+ * find. Deleting it promotes the next one in the list with that number.
+ */
+static void
+kline_numtree_add(struct kline *const k)
+{
+	char key[NUMKEY_BUFSIZE];
+
+	if (mowgli_patricia_retrieve(kline_numtree, numkey(key, k->number)) == NULL)
+		(void) mowgli_patricia_add(kline_numtree, key, k);
+}
+
+static void
+kline_numtree_delete(const struct kline *const k)
+{
+	char key[NUMKEY_BUFSIZE];
+	mowgli_node_t *n;
+
+	if (mowgli_patricia_retrieve(kline_numtree, numkey(key, k->number)) != k)
+		return;
+
+	(void) mowgli_patricia_delete(kline_numtree, key);
+
+	MOWGLI_ITER_FOREACH(n, klnlist.head)
+	{
+		struct kline *const other = n->data;
+
+		if (other != k && other->number == k->number)
+		{
+			(void) mowgli_patricia_add(kline_numtree, key, other);
+			return;
+		}
+	}
+}
+
 struct kline *
 kline_add_with_id(const char *user, const char *host, const char *reason, long duration, const char *setby, unsigned long id)
 {
@@ -128,6 +353,8 @@ kline_add_with_id(const char *user, const char *host, const char *reason, long d
 
 	k->user = sstrdup(user);
 	k->host = sstrdup(host);
+	compiled_mask_init(&k->cuser, k->user);
+	compiled_mask_init(&k->chost, k->host);
 	k->reason = sstrdup(reason);
 	k->setby = sstrdup(setby);
 	k->duration = duration;
@@ -135,6 +362,16 @@ kline_add_with_id(const char *user, const char *host, const char *reason, long d
 	k->expires = CURRTIME + duration;
 	k->number = id;
 
+	kline_numtree_add(k);
+
+	if (ipmask_parse(k->host, &k->ipaddr, &k->ipbits))
+		mowgli_node_add(k, &k->inode, &kline_iptree_node(&k->ipaddr, k->ipbits)->klines);
+	else
+	{
+		k->ipbits = 0;
+		mowgli_node_add(k, &k->inode, &kline_globlist);
+	}
+
 	cnt.kline++;
 
 
@@ -178,6 +415,15 @@ kline_delete(struct kline *k)
 	mowgli_node_delete(n, &klnlist);
 	mowgli_node_free(n);
 
+	kline_numtree_delete(k);
+
+	if (k->ipbits != 0)
+		kline_iptree = kline_iptree_delete(kline_iptree, k);
+	else
+		mowgli_node_delete(&k->inode, &kline_globlist);
+
+	compiled_mask_free(&k->cuser);
+	compiled_mask_free(&k->chost);
 	sfree(k->user);
 	sfree(k->host);
 	sfree(k->reason);
@@ -198,7 +444,7 @@ kline_find(const char *user, const char *host)
 	{
 		k = (struct kline *)n->data;
 
-		if ((!match(k->user, user)) && (!match(k->host, host)))
+		if (compiled_mask_match(&k->cuser, user) && compiled_mask_match(&k->chost, host))
 			return k;
 	}
 
@@ -208,33 +454,45 @@ kline_find(const char *user, const char *host)
 struct kline *
 kline_find_num(unsigned long number)
 {
-	struct kline *k;
-	mowgli_node_t *n;
+	char key[NUMKEY_BUFSIZE];
 
-	MOWGLI_ITER_FOREACH(n, klnlist.head)
-	{
-		k = (struct kline *)n->data;
-
-		if (k->number == number)
-			return k;
-	}
-
-	return NULL;
+	return mowgli_patricia_retrieve(kline_numtree, numkey(key, number));
 }
 
 struct kline *
 kline_find_user(struct user *u)
 {
 	struct kline *k;
+	struct in6_addr hostaddr;
+	struct folded_name user, host, ip;
 	mowgli_node_t *n;
 
-	MOWGLI_ITER_FOREACH(n, klnlist.head)
+	folded_name_init(&user, u->user);
+
+	if (u->ipaddr_valid && (k = kline_iptree_find(&u->ipaddr, &user)) != NULL)
+		return k;
+
+	/* the host may be an address too (e.g. no separate IP was sent) */
+	if ((u->ip == NULL || strcmp(u->host, u->ip)) && ipaddr_parse(u->host, &hostaddr) &&
+	    (k = kline_iptree_find(&hostaddr, &user)) != NULL)
+		return k;
+
+	if (kline_globlist.count == 0)
+		return NULL;
+
+	folded_name_init(&host, u->host);
+	folded_name_init(&ip, (u->ip != NULL) ? u->ip : "");
+
+	MOWGLI_ITER_FOREACH(n, kline_globlist.head)
 	{
 		k = (struct kline *)n->data;
 
 		if (k->duration != 0 && k->expires <= CURRTIME)
 			continue;
-		if (!match(k->user, u->user) && (!match(k->host, u->host) || !match(k->host, u->ip) || !match_ips(k->host, u->ip)))
+		if (!compiled_mask_match_name(&k->cuser, &user))
+			continue;
+		if (compiled_mask_match_name(&k->chost, &host) ||
+		    (u->ip != NULL && (compiled_mask_match_name(&k->chost, &ip) || !match_ips(k->host, u->ip))))
 			return k;
 	}
 
@@ -275,6 +533,38 @@ kline_expire(void *arg)
  * X L I N E *
  *************/
 
+static void
+xline_numtree_add(struct xline *const x)
+{
+	char key[NUMKEY_BUFSIZE];
+
+	if (mowgli_patricia_retrieve(xline_numtree, numkey(key, x->number)) == NULL)
+		(void) mowgli_patricia_add(xline_numtree, key, x);
+}
+
+static void
+xline_numtree_delete(const struct xline *const x)
+{
+	char key[NUMKEY_BUFSIZE];
+	mowgli_node_t *n;
+
+	if (mowgli_patricia_retrieve(xline_numtree, numkey(key, x->number)) != x)
+		return;
+
+	(void) mowgli_patricia_delete(xline_numtree, key);
+
+	MOWGLI_ITER_FOREACH(n, xlnlist.head)
+	{
+		struct xline *const other = n->data;
+
+		if (other != x && other->number == x->number)
+		{
+			(void) mowgli_patricia_add(xline_numtree, key, other);
+			return;
+		}
+	}
+}
+
 struct xline *
 xline_add(const char *realname, const char *reason, long duration, const char *setby)
 {
@@ -289,6 +579,7 @@ xline_add(const char *realname, const char *reason, long duration, const char *s
 	mowgli_node_add(x, n, &xlnlist);
 
 	x->realname = sstrdup(realname);
+	compiled_mask_init(&x->cmask, x->realname);
 	x->reason = sstrdup(reason);
 	x->setby = sstrdup(setby);
 	x->duration = duration;
@@ -296,6 +587,9 @@ xline_add(const char *realname, const char *reason, long duration, const char *s
 	x->expires = CURRTIME + duration;
 	x->number = ++xcnt;
 
+	mask_index_add(xline_index, &x->ient, &x->cmask, x);
+	xline_numtree_add(x);
+
 	cnt.xline++;
 
 	if (me.connected)
@@ -326,6 +620,10 @@ xline_delete(const char *realname)
 	mowgli_node_delete(n, &xlnlist);
 	mowgli_node_free(n);
 
+	mask_index_delete(xline_index, &x->ient);
+	xline_numtree_delete(x);
+
+	compiled_mask_free(&x->cmask);
 	sfree(x->realname);
 	sfree(x->reason);
 	sfree(x->setby);
@@ -335,58 +633,42 @@ xline_delete(const char *realname)
 	cnt.xline--;
 }
 
-struct xline *
-xline_find(const char *realname)
+void
+xline_set_number(struct xline *x, unsigned int number)
 {
-	struct xline *x;
-	mowgli_node_t *n;
+	return_if_fail(x != NULL);
 
-	MOWGLI_ITER_FOREACH(n, xlnlist.head)
-	{
-		x = (struct xline *)n->data;
-
-		if (!match(x->realname, realname))
-			return x;
-	}
+	xline_numtree_delete(x);
+	x->number = number;
+	xline_numtree_add(x);
+}
 
-	return NULL;
+struct xline *
+xline_find(const char *realname)
+{
+	return mask_index_find(xline_index, realname, NULL, NULL);
 }
 
 struct xline *
 xline_find_num(unsigned int number)
 {
-	struct xline *x;
-	mowgli_node_t *n;
+	char key[NUMKEY_BUFSIZE];
 
-	MOWGLI_ITER_FOREACH(n, xlnlist.head)
-	{
-		x = (struct xline *)n->data;
+	return mowgli_patricia_retrieve(xline_numtree, numkey(key, number));
+}
 
-		if (x->number == number)
-			return x;
-	}
+static bool
+xline_is_active(void *data, void *privdata)
+{
+	const struct xline *const x = data;
 
-	return NULL;
+	return x->duration == 0 || x->expires > CURRTIME;
 }
 
 struct xline *
 xline_find_user(struct user *u)
 {
-	struct xline *x;
-	mowgli_node_t *n;
-
-	MOWGLI_ITER_FOREACH(n, xlnlist.head)
-	{
-		x = (struct xline *)n->data;
-
-		if (x->duration != 0 && x->expires <= CURRTIME)
-			continue;
-
-		if (!match(x->realname, u->gecos))
-			return x;
-	}
-
-	return NULL;
+	return mask_index_find(xline_index, u->gecos, &xline_is_active, NULL);
 }
 
 void
@@ -419,6 +701,38 @@ xline_expire(void *arg)
  * Q L I N E *
  *************/
 
+static void
+qline_numtree_add(struct qline *const q)
+{
+	char key[NUMKEY_BUFSIZE];
+
+	if (mowgli_patricia_retrieve(qline_numtree, numkey(key, q->number)) == NULL)
+		(void) mowgli_patricia_add(qline_numtree, key, q);
+}
+
+static void
+qline_numtree_delete(const struct qline *const q)
+{
+	char key[NUMKEY_BUFSIZE];
+	mowgli_node_t *n;
+
+	if (mowgli_patricia_retrieve(qline_numtree, numkey(key, q->number)) != q)
+		return;
+
+	(void) mowgli_patricia_delete(qline_numtree, key);
+
+	MOWGLI_ITER_FOREACH(n, qlnlist.head)
+	{
+		struct qline *const other = n->data;
+
+		if (other != q && other->number == q->number)
+		{
+			(void) mowgli_patricia_add(qline_numtree, key, other);
+			return;
+		}
+	}
+}
+
 struct qline *
 qline_add(const char *mask, const char *reason, long duration, const char *setby)
 {
@@ -432,6 +746,7 @@ qline_add(const char *mask, const char *reason, long duration, const char *setby
 	mowgli_node_add(q, n, &qlnlist);
 
 	q->mask = sstrdup(mask);
+	compiled_mask_init(&q->cmask, q->mask);
 	q->reason = sstrdup(reason);
 	q->setby = sstrdup(setby);
 	q->duration = duration;
@@ -439,6 +754,9 @@ qline_add(const char *mask, const char *reason, long duration, const char *setby
 	q->expires = CURRTIME + duration;
 	q->number = ++qcnt;
 
+	mask_index_add(qline_index, &q->ient, &q->cmask, q);
+	qline_numtree_add(q);
+
 	cnt.qline++;
 
 	if (me.connected)
@@ -469,6 +787,10 @@ qline_delete(const char *mask)
 	mowgli_node_delete(n, &qlnlist);
 	mowgli_node_free(n);
 
+	mask_index_delete(qline_index, &q->ient);
+	qline_numtree_delete(q);
+
+	compiled_mask_free(&q->cmask);
 	sfree(q->mask);
 	sfree(q->reason);
 	sfree(q->setby);
@@ -478,6 +800,16 @@ qline_delete(const char *mask)
 	cnt.qline--;
 }
 
+void
+qline_set_number(struct qline *q, unsigned int number)
+{
+	return_if_fail(q != NULL);
+
+	qline_numtree_delete(q);
+	q->number = number;
+	qline_numtree_add(q);
+}
+
 struct qline *
 qline_find(const char *mask)
 {
@@ -495,61 +827,43 @@ qline_find(const char *mask)
 	return NULL;
 }
 
-struct qline *
-qline_find_match(const char *mask)
+static bool
+qline_is_active(void *data, void *privdata)
 {
-	struct qline *q;
-	mowgli_node_t *n;
+	const struct qline *const q = data;
 
-	MOWGLI_ITER_FOREACH(n, qlnlist.head)
-	{
-		q = (struct qline *)n->data;
+	return q->duration == 0 || q->expires > CURRTIME;
+}
 
-		if (q->duration != 0 && q->expires <= CURRTIME)
-			continue;
-		if (!match(q->mask, mask))
-			return q;
-	}
+static bool
+qline_is_active_nick(void *data, void *privdata)
+{
+	const struct qline *const q = data;
 
-	return NULL;
+	if (q->mask[0] == '#' || q->mask[0] == '&')
+		return false;
+
+	return qline_is_active(data, privdata);
 }
 
 struct qline *
-qline_find_num(unsigned int number)
+qline_find_match(const char *mask)
 {
-	struct qline *q;
-	mowgli_node_t *n;
-
-	MOWGLI_ITER_FOREACH(n, qlnlist.head)
-	{
-		q = (struct qline *)n->data;
+	return mask_index_find(qline_index, mask, &qline_is_active, NULL);
+}
 
-		if (q->number == number)
-			return q;
-	}
+struct qline *
+qline_find_num(unsigned int number)
+{
+	char key[NUMKEY_BUFSIZE];
 
-	return NULL;
+	return mowgli_patricia_retrieve(qline_numtree, numkey(key, number));
 }
 
 struct qline *
 qline_find_user(struct user *u)
 {
-	struct qline *q;
-	mowgli_node_t *n;
-
-	MOWGLI_ITER_FOREACH(n, qlnlist.head)
-	{
-		q = (struct qline *)n->data;
-
-		if (q->duration != 0 && q->expires <= CURRTIME)
-			continue;
-		if (q->mask[0] == '#' || q->mask[0] == '&')
-			continue;
-		if (!match(q->mask, u->nick))
-			return q;
-	}
-
-	return NULL;
+	return mask_index_find(qline_index, u->nick, &qline_is_active_nick, NULL);
 }
 
 struct qline *
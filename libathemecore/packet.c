@@ -27,9 +27,30 @@ irc_recvq_handler(struct connection *cptr)
 {
 	bool wasnonl;
 	char parsebuf[BUFSIZE + 1];
+	char *line;
+	size_t len;
 	int count;
 
 	wasnonl = CF_IS_NONEWLINE(cptr) ? true : false;
+
+	/* Most lines sit whole inside one recvq chunk; parse those where they
+	 * are instead of copying them out first.
+	 */
+	if (!wasnonl && (line = recvq_peekline(cptr, BUFSIZE, &len)) != NULL)
+	{
+		cnt.bin += len;
+		me.uplinkpong = CURRTIME;
+
+		count = len - 1;
+		if (count > 0 && line[count - 1] == '\r')
+			count--;
+		line[count] = '\0';
+		parse(line);
+
+		recvq_skip(cptr, len);
+		return;
+	}
+
 	count = recvq_getline(cptr, parsebuf, sizeof parsebuf - 1);
 	if (count <= 0)
 		return;
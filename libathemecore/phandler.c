@@ -337,26 +337,37 @@ generic_sasl_mechlist_sts(const char *mechlist)
 bool
 generic_mask_matches_user(const char *mask, struct user *u)
 {
-	char hostbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char cloakbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char realbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char ipbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
+	const struct user_masks *const um = user_masks(u);
 
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(cloakbuf, sizeof cloakbuf, "%s!%s@%s", u->nick, u->user, u->chost);
-
-	bool result = !match(mask, hostbuf) || !match(mask, cloakbuf);
+	bool result = !match(mask, um->vhostmask.str) || !match(mask, um->chostmask.str);
 
 	// return if configured not to check further, or if we already have a match
 	if ((!config_options.masks_through_vhost && u->host != u->vhost) || result)
 		return result;
 
-	snprintf(realbuf, sizeof realbuf, "%s!%s@%s", u->nick, u->user, u->host);
-	/* will be nick!user@ if ip unknown, doesn't matter */
-	snprintf(ipbuf, sizeof ipbuf, "%s!%s@%s", u->nick, u->user, u->ip);
+	/* ipmask will be nick!user@ if ip unknown, doesn't matter */
+	return !match(mask, um->hostmask.str) || !match(mask, um->ipmask.str) || (ircd->flags & IRCD_CIDR_BANS && user_masks_match_cidr(um, mask));
+}
+
+/* generic_mask_matches_user() for a mask compiled next to its string, unless
+ * the protocol module has its own mask_matches_user
+ */
+static bool
+generic_compiled_mask_matches_user(const struct compiled_mask *cm, struct user *u)
+{
+	if (mask_matches_user != &generic_mask_matches_user)
+		return mask_matches_user(cm->mask, u);
 
-	return !match(mask, realbuf) || !match(mask, ipbuf) || (ircd->flags & IRCD_CIDR_BANS && !match_cidr(mask, ipbuf));
+	const struct user_masks *const um = user_masks(u);
+
+	if (user_mask_form_match(cm, &um->vhostmask) || user_mask_form_match(cm, &um->chostmask))
+		return true;
+
+	if (!config_options.masks_through_vhost && u->host != u->vhost)
+		return false;
 
+	return user_mask_form_match(cm, &um->hostmask) || user_mask_form_match(cm, &um->ipmask) ||
+	       (ircd->flags & IRCD_CIDR_BANS && user_masks_match_cidr(um, cm->mask));
 }
 
 mowgli_node_t *
@@ -368,7 +379,7 @@ generic_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_no
 	{
 		struct chanban *cb = n->data;
 
-		if (cb->type == type && mask_matches_user(cb->mask, u))
+		if (cb->type == type && generic_compiled_mask_matches_user(&cb->cmask, u))
 			return n;
 	}
 	return NULL;
@@ -385,7 +396,7 @@ generic_next_matching_host_chanacs(struct mychan *mc, struct user *u, mowgli_nod
 
 		if (ca->entity != NULL)
 		       continue;
-		if (mask_matches_user(ca->host, u))
+		if (generic_compiled_mask_matches_user(&ca->chost, u))
 			return n;
 	}
 	return NULL;
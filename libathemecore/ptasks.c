@@ -107,6 +107,12 @@ connection_stats_cb(const char *line, void *privdata)
 	numeric_sts(me.me, 249, ((struct user *)privdata), "F :%s", line);
 }
 
+static void
+hook_stats_cb(const char *line, void *privdata)
+{
+	numeric_sts(me.me, 249, ((struct user *)privdata), "Z :%s", line);
+}
+
 void
 handle_stats(struct user *u, char req)
 {
@@ -339,6 +345,14 @@ handle_stats(struct user *u, char req)
 				  me.recontime, config_options.uplink_sendq_limit);
 		  break;
 
+	  case 'Z':
+	  case 'z':
+		  if (!has_priv_user(u, PRIV_SERVER_AUSPEX))
+			  break;
+
+		  hook_stats(hook_stats_cb, u);
+		  break;
+
 	  default:
 		  break;
 	}
@@ -54,28 +54,36 @@ ban(struct user *sender, struct channel *c, struct user *user)
 	return 1;
 }
 
+struct remove_banlike_ctx
+{
+	struct user *   source;
+	struct channel *chan;
+};
+
+static bool
+remove_banlike_cb(struct chanban *const restrict cb, void *const restrict privdata)
+{
+	const struct remove_banlike_ctx *const ctx = privdata;
+
+	modestack_mode_param(ctx->source->nick, ctx->chan, MTYPE_DEL, cb->type, cb->mask);
+	chanban_delete(cb);
+
+	return true;
+}
+
 /* returns number of modes removed -- jilles */
 unsigned int
 remove_banlike(struct user *source, struct channel *chan, int type, struct user *target)
 {
-	unsigned int count = 0;
-	mowgli_node_t *n, *tn;
-	struct chanban *cb;
+	struct remove_banlike_ctx ctx = { .source = source, .chan = chan };
+	unsigned int count;
 
 	if (type == 0)
 		return 0;
 	if (source == NULL || chan == NULL || target == NULL)
 		return 0;
 
-	for (n = next_matching_ban(chan, target, type, chan->bans.head); n != NULL; n = next_matching_ban(chan, target, type, tn))
-	{
-		tn = n->next;
-		cb = n->data;
-
-		modestack_mode_param(source->nick, chan, MTYPE_DEL, cb->type, cb->mask);
-		chanban_delete(cb);
-		count++;
-	}
+	count = chanban_foreach_matching(chan, target, type, &remove_banlike_cb, &ctx);
 
 	modestack_flush_now();
 
@@ -933,6 +941,30 @@ sourceinfo_create(void)
 	return out;
 }
 
+/* Hands out a cleared sourceinfo for the next protocol message, reusing
+ * the one from the previous message unless something still holds a
+ * reference to it (or attached data to it), in which case the caller's
+ * reference is dropped and a fresh one is allocated.
+ */
+struct sourceinfo *
+sourceinfo_recycle(struct sourceinfo *si)
+{
+	if (si == NULL)
+		return sourceinfo_create();
+
+	const struct atheme_object *const obj = atheme_object(si);
+
+	if (obj->refcount != 1 || obj->metadata != NULL || obj->privatedata != NULL)
+	{
+		atheme_object_unref(si);
+		return sourceinfo_create();
+	}
+
+	(void) memset((char *) si + sizeof si->parent, 0x00, sizeof *si - sizeof si->parent);
+
+	return si;
+}
+
 void ATHEME_FATTR_PRINTF(3, 4)
 command_fail(struct sourceinfo *si, enum cmd_faultcode code, const char *fmt, ...)
 {
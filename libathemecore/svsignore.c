@@ -42,6 +42,7 @@ svsignore_add(const char *mask, const char *reason)
         struct svsignore *const svsignore = smalloc(sizeof *svsignore);
 
         svsignore->mask = sstrdup(mask);
+        compiled_mask_init(&svsignore->cmask, svsignore->mask);
         svsignore->settime = CURRTIME;
         svsignore->reason = sstrdup(reason);
 
@@ -72,23 +73,18 @@ svsignore_find(struct user *source)
 {
         struct svsignore *svsignore;
         mowgli_node_t *n;
-        char host[BUFSIZE];
 
 	if (!use_svsignore)
 		return NULL;
 
-        *host = '\0';
-        mowgli_strlcpy(host, source->nick, BUFSIZE);
-        mowgli_strlcat(host, "!", BUFSIZE);
-        mowgli_strlcat(host, source->user, BUFSIZE);
-        mowgli_strlcat(host, "@", BUFSIZE);
-        mowgli_strlcat(host, source->host, BUFSIZE);
+        // nick!user@host
+        const struct user_mask_form *const host = &user_masks(source)->hostmask;
 
         MOWGLI_ITER_FOREACH(n, svs_ignore_list.head)
         {
                 svsignore = (struct svsignore *)n->data;
 
-                if (!match(svsignore->mask, host))
+                if (user_mask_form_match(&svsignore->cmask, host))
                         return svsignore;
         }
 
@@ -118,6 +114,7 @@ svsignore_delete(struct svsignore *svsignore)
 	mowgli_node_delete(n, &svs_ignore_list);
 	mowgli_node_free(n);
 
+	compiled_mask_free(&svsignore->cmask);
 	sfree(svsignore->mask);
 	sfree(svsignore->setby);
 	sfree(svsignore->reason);
@@ -21,6 +21,24 @@ static mowgli_heap_t *user_heap = NULL;
 mowgli_patricia_t *userlist;
 mowgli_patricia_t *uidlist;
 
+static void
+user_masks_free(struct user *u)
+{
+	struct user_masks *const um = u->masks;
+
+	if (um == NULL)
+		return;
+
+	strshare_unref(um->nick);
+	strshare_unref(um->user);
+	strshare_unref(um->host);
+	strshare_unref(um->chost);
+	strshare_unref(um->vhost);
+
+	sfree(um);
+	u->masks = NULL;
+}
+
 static void
 user_delete_cb(void *const restrict user)
 {
@@ -168,7 +186,10 @@ user_add(const char *nick, const char *user, const char *host,
 	u->vhost = strshare_get(vhost ? vhost : host);
 
 	if (ip && strcmp(ip, "0") && strcmp(ip, "0.0.0.0") && strcmp(ip, "255.255.255.255"))
+	{
 		u->ip = strshare_get(ip);
+		u->ipaddr_valid = ipaddr_parse(ip, &u->ipaddr);
+	}
 
 	u->server = server;
 	u->server->users++;
@@ -269,6 +290,8 @@ user_delete(struct user *u, const char *comment)
 		u->myuser = NULL;
 	}
 
+	user_masks_free(u);
+
 	strshare_unref(u->uid);
 	strshare_unref(u->nick);
 	strshare_unref(u->user);
@@ -627,6 +650,79 @@ user_sethost(struct user *source, struct user *target, stringref host)
 	hook_call_user_sethost(target);
 }
 
+static char *
+user_mask_form_build(struct user_mask_form *const restrict form, char *buf, const char *const restrict nickuser,
+                     const char *const restrict host)
+{
+	form->str = buf;
+	form->len = (size_t) sprintf(buf, "%s@%s", nickuser, host);
+	buf += form->len + 1;
+
+	form->folded = buf;
+	(void) match_fold(buf, form->str, form->len + 1);
+
+	return buf + form->len + 1;
+}
+
+/*
+ * user_masks(struct user *u)
+ *
+ * Returns the nick!user@host forms of a user, building them if this is the
+ * first call or if any field they are made of has changed since.
+ *
+ * Inputs:
+ *     - user
+ *
+ * Outputs:
+ *     - the user's masks, valid until the user is changed or deleted
+ *
+ * Side Effects:
+ *     - the masks are cached on the user
+ */
+const struct user_masks *
+user_masks(struct user *u)
+{
+	struct user_masks *um = u->masks;
+
+	if (um != NULL && um->nick == u->nick && um->user == u->user && um->host == u->host &&
+	    um->chost == u->chost && um->vhost == u->vhost && um->mapping == match_mapping)
+		return um;
+
+	user_masks_free(u);
+
+	const char *const ip = (u->ip != NULL) ? u->ip : "";
+	const size_t nulen = strlen(u->nick) + 1 + strlen(u->user);
+	const size_t vhlen = strlen(u->vhost);
+	const size_t chlen = strlen(u->chost);
+	const size_t hlen = strlen(u->host);
+	const size_t iplen = strlen(ip);
+
+	// nick!user, then the four host forms, each as is and folded and with its own NUL
+	char *buf = smalloc(sizeof *um + (nulen + 1) + (8 * (nulen + 2)) + (2 * (vhlen + chlen + hlen + iplen)));
+
+	um = (struct user_masks *) buf;
+	buf += sizeof *um;
+
+	um->nick = strshare_ref(u->nick);
+	um->user = strshare_ref(u->user);
+	um->host = strshare_ref(u->host);
+	um->chost = strshare_ref(u->chost);
+	um->vhost = strshare_ref(u->vhost);
+	um->mapping = match_mapping;
+
+	um->nickuser = buf;
+	buf += sprintf(buf, "%s!%s", u->nick, u->user) + 1;
+	buf = user_mask_form_build(&um->vhostmask, buf, um->nickuser, u->vhost);
+	buf = user_mask_form_build(&um->chostmask, buf, um->nickuser, u->chost);
+	buf = user_mask_form_build(&um->hostmask, buf, um->nickuser, u->host);
+	(void) user_mask_form_build(&um->ipmask, buf, um->nickuser, ip);
+
+	um->ipaddr = u->ipaddr_valid ? &u->ipaddr : NULL;
+
+	u->masks = um;
+	return um;
+}
+
 const char *
 user_get_umodestr(struct user *u)
 {
@@ -0,0 +1,589 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * atheme-services: A collection of minimalist IRC services
+ * userscan.c: Scanning the network's users on the work queue.
+ *
+ * Regex chunks only run code in this file and the regex library, so
+ * cancelling a regex scan calls its done() right away and leaves any chunks
+ * that are still running to be cleaned up here when they finish. The
+ * function of a user_scan_run() scan is the module's own code, though, and
+ * its done() is called once that function has returned, with its result;
+ * modules must use user_scan_cancel_wait() on unload.
+ *
+ * A scan is freed when its last chunk is done; pending counts the chunks
+ * that are not, plus one while a function here is still using the scan.
+ */
+
+#include <atheme.h>
+#include "internal.h"
+
+// Fewer users than this are not worth a job of their own
+#define USER_SCAN_CHUNK_MIN             2048U
+
+// Jobs per worker thread, so that a chunk of slow matches does not hold up the rest
+#define USER_SCAN_CHUNKS_PER_THREAD     4U
+
+struct user_scan;
+
+struct user_scan_matches
+{
+	unsigned int *                  users;
+	unsigned int                    count;
+};
+
+// The input of a job; everything but scan and job is left alone until done()
+struct user_scan_chunk
+{
+	struct user_scan *              scan;
+	const struct user_snapshot *    snap;
+	user_scan_run_fn                run;            // if NULL, match re against users first to first + count - 1
+	struct atheme_regex *           re;
+	const char *                    literal;        // see regex_required_literal(); NULL if there is none
+	unsigned int                    first;
+	unsigned int                    count;
+	struct workqueue_job *          job;            // until its done() is called
+	void *                          result;
+	bool                            finished;
+};
+
+struct user_scan
+{
+	mowgli_node_t                   node;           // in user_scans
+	struct user_snapshot *          snap;
+	const void *                    owner;
+	user_scan_match_fn              match;
+	user_scan_done_fn               done;           // NULL once it has been called
+	bool                            cancelled;
+	void *                          priv;
+	char *                          pattern;
+	char *                          literal;
+	struct user_scan_chunk *        chunks;
+	unsigned int                    nchunks;
+	unsigned int                    delivered;      // chunks whose matches have been handed to match()
+	unsigned int                    pending;
+};
+
+static mowgli_list_t user_scans = { NULL, NULL, 0 };
+
+static void
+user_snapshot_put(struct user_snapshot *const restrict snap, const char *const restrict str, const size_t len)
+{
+	if (snap->arenalen + len > snap->arenasize)
+	{
+		while (snap->arenalen + len > snap->arenasize)
+			snap->arenasize *= 2;
+
+		snap->arena = srealloc(snap->arena, snap->arenasize);
+	}
+
+	(void) memcpy(snap->arena + snap->arenalen, str, len);
+	snap->arenalen += len;
+}
+
+static inline void
+user_snapshot_put_str(struct user_snapshot *const restrict snap, const char *const restrict str)
+{
+	(void) user_snapshot_put(snap, str, strlen(str));
+}
+
+// Copies the nick, username, host, gecos and IP address of every user, in the order of the user list
+static struct user_snapshot *
+user_snapshot_create(void)
+{
+	mowgli_patricia_iteration_state_t state;
+	struct user *u;
+
+	struct user_snapshot *const snap = smalloc(sizeof *snap);
+	const unsigned int count = mowgli_patricia_size(userlist);
+
+	snap->users = smalloc((count + 1) * sizeof *snap->users);
+	snap->arenasize = (count + 1) * 64;
+	snap->arena = smalloc(snap->arenasize);
+
+	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
+	{
+		struct user_snapshot_user *const su = &snap->users[snap->count++];
+
+		su->mask = (unsigned int) snap->arenalen;
+
+		(void) user_snapshot_put_str(snap, u->nick);
+		(void) user_snapshot_put(snap, "!", 1);
+		(void) user_snapshot_put_str(snap, u->user);
+		(void) user_snapshot_put(snap, "@", 1);
+		(void) user_snapshot_put_str(snap, u->host);
+		(void) user_snapshot_put(snap, " ", 1);
+
+		su->gecos = (unsigned int) snap->arenalen;
+
+		(void) user_snapshot_put_str(snap, u->gecos);
+		(void) user_snapshot_put(snap, "", 1);
+
+		su->ip = (unsigned int) snap->arenalen;
+
+		(void) user_snapshot_put_str(snap, u->ip ? u->ip : "");
+		(void) user_snapshot_put(snap, "", 1);
+	}
+
+	return snap;
+}
+
+static void
+user_snapshot_free(struct user_snapshot *const restrict snap)
+{
+	(void) sfree(snap->arena);
+	(void) sfree(snap->users);
+	(void) sfree(snap);
+}
+
+static void
+user_scan_matches_free(struct user_scan_matches *const restrict matches)
+{
+	if (! matches)
+		return;
+
+	(void) sfree(matches->users);
+	(void) sfree(matches);
+}
+
+// Runs on a worker thread
+static void *
+user_scan_chunk_run(const void *const restrict input)
+{
+	const struct user_scan_chunk *const chunk = input;
+	const struct user_snapshot *const snap = chunk->snap;
+	char folded[BUFSIZE];
+
+	if (chunk->run)
+		return chunk->run(snap);
+
+	struct user_scan_matches *const matches = smalloc(sizeof *matches);
+
+	matches->users = smalloc((chunk->count + 1) * sizeof *matches->users);
+
+	for (unsigned int i = chunk->first; i < chunk->first + chunk->count; i++)
+	{
+		const char *const mask = USER_SNAPSHOT_MASK(snap, i);
+
+		// Masks too long to fold are left to the regex
+		if (chunk->literal && regex_fold(folded, mask, sizeof folded) < sizeof folded &&
+		    ! strstr(folded, chunk->literal))
+			continue;
+
+		if (regex_match(chunk->re, mask))
+			matches->users[matches->count++] = i;
+	}
+
+	return matches;
+}
+
+static void
+user_scan_free(struct user_scan *const restrict scan)
+{
+	for (unsigned int i = 0; i < scan->nchunks; i++)
+	{
+		struct user_scan_chunk *const chunk = &scan->chunks[i];
+
+		if (chunk->re)
+			(void) regex_destroy(chunk->re);
+
+		// Only left over if the scan was cancelled
+		if (! chunk->run)
+			(void) user_scan_matches_free(chunk->result);
+	}
+
+	(void) mowgli_node_delete(&scan->node, &user_scans);
+	(void) user_snapshot_free(scan->snap);
+	(void) sfree(scan->chunks);
+	(void) sfree(scan->pattern);
+	(void) sfree(scan->literal);
+	(void) sfree(scan);
+}
+
+static void
+user_scan_release(struct user_scan *const restrict scan)
+{
+	if (--scan->pending == 0)
+		(void) user_scan_free(scan);
+}
+
+// Hands over the matches of every chunk that is finished and has no unfinished chunk before it
+static void
+user_scan_deliver(struct user_scan *const restrict scan)
+{
+	while (scan->done && scan->delivered < scan->nchunks && scan->chunks[scan->delivered].finished)
+	{
+		struct user_scan_chunk *const chunk = &scan->chunks[scan->delivered++];
+		struct user_scan_matches *const matches = chunk->result;
+
+		// Its result is for done()
+		if (chunk->run)
+			continue;
+
+		// match() may cancel the scan
+		for (unsigned int i = 0; i < matches->count && scan->match; i++)
+			(void) scan->match(scan->snap, matches->users[i], scan->priv);
+
+		(void) user_scan_matches_free(matches);
+		chunk->result = NULL;
+	}
+
+	if (scan->done && scan->delivered == scan->nchunks)
+	{
+		const user_scan_done_fn done = scan->done;
+		void *result = NULL;
+
+		if (scan->nchunks == 1 && scan->chunks[0].run)
+		{
+			result = scan->chunks[0].result;
+			scan->chunks[0].result = NULL;
+		}
+
+		scan->done = NULL;
+		scan->match = NULL;
+
+		(void) done(scan->snap, result, false, scan->priv);
+	}
+}
+
+// Calls done() of a cancelled scan, unless its run() has not returned yet
+static void
+user_scan_cancelled(struct user_scan *const restrict scan)
+{
+	if (! scan->done || ! scan->cancelled)
+		return;
+
+	const user_scan_done_fn done = scan->done;
+	void *result = NULL;
+
+	if (scan->nchunks == 1 && scan->chunks[0].run)
+	{
+		if (scan->chunks[0].job)
+			return;
+
+		result = scan->chunks[0].result;
+		scan->chunks[0].result = NULL;
+	}
+
+	scan->done = NULL;
+
+	(void) done(scan->snap, result, true, scan->priv);
+}
+
+// Cancels the chunks that have not started yet and calls done() with cancelled set, see above
+static void
+user_scan_abort(struct user_scan *const restrict scan)
+{
+	if (! scan->done || scan->cancelled)
+		return;
+
+	scan->cancelled = true;
+	scan->match = NULL;
+	scan->pending++;
+
+	for (unsigned int i = 0; i < scan->nchunks; i++)
+		if (scan->chunks[i].job)
+			(void) workqueue_cancel_job(scan->chunks[i].job);
+
+	(void) user_scan_cancelled(scan);
+	(void) user_scan_release(scan);
+}
+
+static void
+user_scan_chunk_done(void *const result, const void ATHEME_VATTR_UNUSED *const input, void *const priv,
+                     const bool cancelled)
+{
+	struct user_scan_chunk *const chunk = priv;
+	struct user_scan *const scan = chunk->scan;
+
+	chunk->job = NULL;
+	chunk->result = result;
+	chunk->finished = true;
+
+	if (cancelled)
+		(void) user_scan_abort(scan);
+
+	if (scan->cancelled)
+		(void) user_scan_cancelled(scan);
+	else
+		(void) user_scan_deliver(scan);
+
+	(void) user_scan_release(scan);
+}
+
+static struct user_scan *
+user_scan_create(struct user_snapshot *const restrict snap, const void *const owner, const user_scan_done_fn done,
+                 void *const priv, const unsigned int nchunks)
+{
+	struct user_scan *const scan = smalloc(sizeof *scan);
+
+	scan->snap = snap;
+	scan->owner = owner;
+	scan->done = done;
+	scan->priv = priv;
+	scan->chunks = smalloc((nchunks + 1) * sizeof *scan->chunks);
+	scan->nchunks = nchunks;
+
+	for (unsigned int i = 0; i < nchunks; i++)
+	{
+		scan->chunks[i].scan = scan;
+		scan->chunks[i].snap = snap;
+	}
+
+	(void) mowgli_node_add(scan, &scan->node, &user_scans);
+
+	return scan;
+}
+
+// Queues every chunk, or runs them right here if there is nobody to send the results to later
+static void
+user_scan_start(struct user_scan *const restrict scan, const char *const restrict name)
+{
+	scan->pending = scan->nchunks + 1;
+
+	for (unsigned int i = 0; i < scan->nchunks; i++)
+	{
+		struct user_scan_chunk *const chunk = &scan->chunks[i];
+
+		if (scan->owner)
+			chunk->job = workqueue_submit(name, &user_scan_chunk_run, chunk, NULL, &user_scan_chunk_done,
+			                              scan->owner, chunk);
+		else
+			(void) user_scan_chunk_done(user_scan_chunk_run(chunk), chunk, chunk, false);
+	}
+
+	// For a snapshot without users
+	(void) user_scan_deliver(scan);
+	(void) user_scan_release(scan);
+}
+
+/* Chunks are smaller without worker threads, because then they run in the
+ * event loop, one per iteration.
+ */
+static unsigned int
+user_scan_chunk_size(const unsigned int count)
+{
+	const unsigned int threads = config_options.workqueue_threads;
+	unsigned int size = USER_SCAN_CHUNK_MIN;
+
+	if (threads && count / (threads * USER_SCAN_CHUNKS_PER_THREAD) >= size)
+		size = (count / (threads * USER_SCAN_CHUNKS_PER_THREAD)) + 1;
+
+	return size;
+}
+
+/*
+ * user_scan_regex(const char *pattern, int flags, const void *owner,
+ *                 user_scan_match_fn match, user_scan_done_fn done,
+ *                 void *priv)
+ *
+ * Takes a snapshot and matches the "nick!user@host gecos" of every user in
+ * it against a regex.
+ *
+ * Inputs:
+ *       - the pattern and AREGEX_* flags, as for regex_create()
+ *       - the user or other object the scan is for; if NULL, the scan runs
+ *         on the spot and done() has been called on return
+ *       - the function to call for every matching user
+ *       - the function to call when the scan is over
+ *       - opaque data for match() and done()
+ *
+ * Outputs:
+ *       - false if the pattern, or a copy of it for one of the chunks, does
+ *         not compile; match() and done() are not called then
+ *
+ * Side Effects:
+ *       - done() may be called before this returns
+ */
+bool
+user_scan_regex(const char *const restrict pattern, const int flags, const void *const owner,
+                const user_scan_match_fn match, const user_scan_done_fn done, void *const priv)
+{
+	char literal[BUFSIZE];
+	struct atheme_regex *re;
+
+	return_val_if_fail(pattern != NULL, false);
+	return_val_if_fail(match != NULL, false);
+	return_val_if_fail(done != NULL, false);
+
+	char *const copy = sstrdup(pattern);
+
+	if (! (re = regex_create(copy, flags)))
+	{
+		(void) sfree(copy);
+		return false;
+	}
+
+	struct user_snapshot *const snap = user_snapshot_create();
+	const unsigned int size = user_scan_chunk_size(snap->count);
+	struct user_scan *const scan = user_scan_create(snap, owner, done, priv, (snap->count + size - 1) / size);
+
+	scan->match = match;
+	scan->pattern = copy;
+
+	if (regex_required_literal(pattern, flags, literal, sizeof literal))
+		scan->literal = sstrdup(literal);
+
+	// Every chunk gets a regex of its own, so that neither PCRE match data nor regexec(3) locks are shared
+	for (unsigned int i = 0; i < scan->nchunks; i++)
+	{
+		struct user_scan_chunk *const chunk = &scan->chunks[i];
+
+		chunk->re = (i == 0) ? re : regex_create(scan->pattern, flags);
+		chunk->literal = scan->literal;
+		chunk->first = i * size;
+		chunk->count = (snap->count - chunk->first < size) ? (snap->count - chunk->first) : size;
+
+		// Out of memory, most likely; the chunk must not silently match nothing
+		if (! chunk->re)
+		{
+			(void) slog(LG_ERROR, "%s: failed to compile a copy of '%s' for chunk %u", MOWGLI_FUNC_NAME,
+			            scan->pattern, i);
+
+			(void) user_scan_free(scan);
+			return false;
+		}
+	}
+
+	if (! scan->nchunks)
+		(void) regex_destroy(re);
+
+	(void) user_scan_start(scan, "user_scan_regex");
+
+	return true;
+}
+
+/*
+ * user_scan_run(const char *name, user_scan_run_fn run, const void *owner,
+ *               user_scan_done_fn done, void *priv)
+ *
+ * Takes a snapshot and runs a function over it on the work queue.
+ *
+ * Inputs:
+ *       - a short name for the job, for debug logging
+ *       - the function to run on a worker thread
+ *       - the user or other object the job is for; if NULL, the function
+ *         runs on the spot and done() has been called on return
+ *       - the function to call with its result
+ *       - opaque data for done()
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - done() may be called before this returns
+ */
+void
+user_scan_run(const char *const restrict name, const user_scan_run_fn run, const void *const owner,
+              const user_scan_done_fn done, void *const priv)
+{
+	return_if_fail(name != NULL);
+	return_if_fail(run != NULL);
+	return_if_fail(done != NULL);
+
+	struct user_scan *const scan = user_scan_create(user_snapshot_create(), owner, done, priv, 1);
+
+	scan->chunks[0].run = run;
+
+	(void) user_scan_start(scan, name);
+}
+
+/*
+ * user_scan_cancel(const void *owner, user_scan_done_fn done)
+ *
+ * Cancels scans. Scans are also cancelled when a user that owns them quits.
+ *
+ * Inputs:
+ *       - the owner of the scans to cancel, or NULL for any owner
+ *       - the done() callback of the scans to cancel, or NULL for any
+ *         callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - done() is called with cancelled set before this returns, except
+ *         for user_scan_run() scans whose function is running; their done()
+ *         is called with its result when it returns
+ */
+void
+user_scan_cancel(const void *const owner, const user_scan_done_fn done)
+{
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, user_scans.head)
+	{
+		struct user_scan *const scan = n->data;
+
+		if (! scan->done || scan->cancelled || (owner && scan->owner != owner) || (done && scan->done != done))
+			continue;
+
+		scan->pending++;
+
+		(void) user_scan_abort(scan);
+		(void) user_scan_release(scan);
+	}
+}
+
+/*
+ * user_scan_cancel_wait(const void *owner, user_scan_done_fn done)
+ *
+ * Cancels scans like user_scan_cancel(), but waits for the functions of
+ * user_scan_run() scans that are running to return. Modules that use
+ * user_scan_run() must do this before they are unloaded. This blocks
+ * services for as long as the functions take.
+ *
+ * Inputs:
+ *       - the owner of the scans to cancel, or NULL for any owner
+ *       - the done() callback of the scans to cancel, or NULL for any
+ *         callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - done() is called with cancelled set before this returns
+ */
+void
+user_scan_cancel_wait(const void *const owner, const user_scan_done_fn done)
+{
+	mowgli_node_t *n, *tn;
+
+	(void) user_scan_cancel(owner, done);
+
+	// Only cancelled scans still waiting for their run() are left
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, user_scans.head)
+	{
+		struct user_scan *const scan = n->data;
+
+		if (! scan->done || (owner && scan->owner != owner) || (done && scan->done != done))
+			continue;
+
+		if (scan->chunks[0].job)
+			(void) workqueue_cancel_job_wait(scan->chunks[0].job);
+	}
+}
+
+unsigned int
+user_scan_pending(const void *const owner)
+{
+	mowgli_node_t *n;
+	unsigned int count = 0;
+
+	MOWGLI_ITER_FOREACH(n, user_scans.head)
+	{
+		const struct user_scan *const scan = n->data;
+
+		if (scan->owner == owner && scan->done)
+			count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,740 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * atheme-services: A collection of minimalist IRC services
+ * workqueue.c: Running CPU-heavy jobs on worker threads.
+ *
+ * Jobs are queued in submission order and picked up by a fixed pool of
+ * threads (general::workqueue_threads). A thread that finishes a job moves it
+ * to the finished list and, if the event loop has not been told yet, writes a
+ * byte into a pipe that the event loop watches; the event loop then calls the
+ * done() callbacks. The job lists and their state are the only things shared
+ * with the threads, and are protected by wq_lock; everything else here,
+ * including wq_jobs and the statistics, belongs to the main thread.
+ *
+ * Without POSIX threads, or with workqueue_threads set to 0, jobs are run
+ * from a timer in the event loop, one per loop iteration.
+ *
+ * See workqueue.h for what a job may do while it runs.
+ */
+
+#include <atheme.h>
+#include "internal.h"
+
+#ifdef HAVE_USABLE_PTHREAD
+#  include <pthread.h>
+#endif
+
+enum workqueue_state
+{
+	WQ_QUEUED       = 0,    // in wq_queue
+	WQ_RUNNING      = 1,    // on a worker thread
+	WQ_FINISHED     = 2,    // in wq_finished, or nowhere if it never ran
+};
+
+struct workqueue_job
+{
+	mowgli_node_t                   node;           // in wq_queue or wq_finished (wq_lock)
+	mowgli_node_t                   allnode;        // in wq_jobs until done() is called
+	char *                          name;
+	workqueue_run_fn                run;
+	void *                          input;
+	void                          (*input_free)(void *);
+	workqueue_done_fn               done;
+	const void *                    owner;
+	void *                          priv;
+	void *                          result;
+	enum workqueue_state            state;          // (wq_lock)
+	struct timeval                  submitted;
+	unsigned long                   wait_usec;      // from submission until a thread picked it up
+	unsigned long                   run_usec;       // spent in run()
+	bool                            ran;
+	bool                            cancelled;
+};
+
+static struct
+{
+	unsigned long                   submitted;
+	unsigned long                   completed;
+	unsigned long                   cancelled;
+	unsigned long                   ran;            // jobs the times below are for
+	unsigned long long              wait_usec;
+	unsigned long long              run_usec;
+	unsigned long                   wait_max_usec;
+	unsigned long                   run_max_usec;
+} wq_stats;
+
+static mowgli_list_t wq_jobs = { NULL, NULL, 0 };
+static mowgli_list_t wq_queue = { NULL, NULL, 0 };
+static mowgli_list_t wq_finished = { NULL, NULL, 0 };
+static mowgli_eventloop_timer_t *wq_inline_timer = NULL;
+static unsigned int wq_running = 0;
+
+#ifdef HAVE_USABLE_PTHREAD
+static pthread_mutex_t wq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wq_work_cond = PTHREAD_COND_INITIALIZER;        // a job was queued, or threads should exit
+static pthread_cond_t wq_finished_cond = PTHREAD_COND_INITIALIZER;    // a job was finished
+static unsigned int wq_threads = 0;
+static unsigned int wq_threads_target = 0;
+static bool wq_signalled = false;
+static int wq_pipe[2] = { -1, -1 };
+static mowgli_eventloop_pollable_t *wq_pollable = NULL;
+#endif /* HAVE_USABLE_PTHREAD */
+
+static inline void
+workqueue_lock(void)
+{
+#ifdef HAVE_USABLE_PTHREAD
+	(void) pthread_mutex_lock(&wq_lock);
+#endif
+}
+
+static inline void
+workqueue_unlock(void)
+{
+#ifdef HAVE_USABLE_PTHREAD
+	(void) pthread_mutex_unlock(&wq_lock);
+#endif
+}
+
+static void workqueue_kick(void);
+
+static unsigned long
+workqueue_usecs(const struct timeval *const restrict tv)
+{
+	return ((unsigned long) tv->tv_sec * 1000000UL) + (unsigned long) tv->tv_usec;
+}
+
+// Runs a job; called on a worker thread, or from the event loop without threads, with wq_lock unlocked
+static void
+workqueue_job_run(struct workqueue_job *const restrict job)
+{
+	struct timeval start, elapsed;
+
+	(void) s_time(&start);
+	timersub(&start, &job->submitted, &elapsed);
+
+	job->wait_usec = workqueue_usecs(&elapsed);
+	job->result = job->run(job->input);
+
+	(void) e_time(start, &elapsed);
+
+	job->run_usec = workqueue_usecs(&elapsed);
+	job->ran = true;
+}
+
+// Calls done() and frees the job; the job must not be in wq_jobs, wq_queue or wq_finished
+static void
+workqueue_job_done(struct workqueue_job *const restrict job)
+{
+	if (! job->cancelled)
+		wq_stats.completed++;
+
+	if (job->ran)
+	{
+		wq_stats.ran++;
+		wq_stats.wait_usec += job->wait_usec;
+		wq_stats.run_usec += job->run_usec;
+
+		if (job->wait_usec > wq_stats.wait_max_usec)
+			wq_stats.wait_max_usec = job->wait_usec;
+		if (job->run_usec > wq_stats.run_max_usec)
+			wq_stats.run_max_usec = job->run_usec;
+	}
+
+	(void) job->done(job->result, job->input, job->priv, job->cancelled);
+
+	if (job->input_free)
+		(void) job->input_free(job->input);
+
+	(void) sfree(job->name);
+	(void) sfree(job);
+}
+
+/* Hands every finished job to its done() callback. They are taken out of
+ * wq_finished one at a time, because a callback may cancel another finished
+ * job, which takes that one out of wq_finished itself.
+ */
+static void
+workqueue_complete(void)
+{
+	(void) workqueue_lock();
+
+#ifdef HAVE_USABLE_PTHREAD
+	wq_signalled = false;
+#endif
+
+	// Not the ones finished meanwhile; they have written to the pipe again
+	size_t count = MOWGLI_LIST_LENGTH(&wq_finished);
+
+	while (count-- && wq_finished.head)
+	{
+		struct workqueue_job *const job = wq_finished.head->data;
+
+		(void) mowgli_node_delete(&job->node, &wq_finished);
+		(void) workqueue_unlock();
+
+		(void) mowgli_node_delete(&job->allnode, &wq_jobs);
+		(void) workqueue_job_done(job);
+
+		(void) workqueue_lock();
+	}
+
+	(void) workqueue_unlock();
+}
+
+static void
+workqueue_run_inline(void ATHEME_VATTR_UNUSED *const restrict unused)
+{
+	struct workqueue_job *job = NULL;
+
+	wq_inline_timer = NULL;
+
+	(void) workqueue_lock();
+
+	if (wq_queue.head)
+	{
+		job = wq_queue.head->data;
+		job->state = WQ_RUNNING;
+		wq_running++;
+
+		(void) mowgli_node_delete(&job->node, &wq_queue);
+	}
+
+	(void) workqueue_unlock();
+
+	if (job)
+	{
+		(void) workqueue_job_run(job);
+
+		(void) workqueue_lock();
+
+		job->state = WQ_FINISHED;
+		wq_running--;
+
+		(void) mowgli_node_add(job, &job->node, &wq_finished);
+		(void) workqueue_unlock();
+	}
+
+	(void) workqueue_complete();
+
+	// One job per loop iteration, so that the rest of services keeps going
+	(void) workqueue_kick();
+}
+
+#ifdef HAVE_USABLE_PTHREAD
+
+static void *
+workqueue_thread(void ATHEME_VATTR_UNUSED *const restrict unused)
+{
+	(void) pthread_mutex_lock(&wq_lock);
+
+	for (;;)
+	{
+		while (! wq_queue.head && wq_threads <= wq_threads_target)
+			(void) pthread_cond_wait(&wq_work_cond, &wq_lock);
+
+		if (wq_threads > wq_threads_target)
+			break;
+
+		struct workqueue_job *const job = wq_queue.head->data;
+
+		job->state = WQ_RUNNING;
+		wq_running++;
+
+		(void) mowgli_node_delete(&job->node, &wq_queue);
+		(void) pthread_mutex_unlock(&wq_lock);
+
+		(void) workqueue_job_run(job);
+
+		(void) pthread_mutex_lock(&wq_lock);
+
+		job->state = WQ_FINISHED;
+		wq_running--;
+
+		(void) mowgli_node_add(job, &job->node, &wq_finished);
+		(void) pthread_cond_broadcast(&wq_finished_cond);
+
+		if (! wq_signalled && write(wq_pipe[1], "", 1) == 1)
+			wq_signalled = true;
+	}
+
+	wq_threads--;
+
+	(void) pthread_mutex_unlock(&wq_lock);
+
+	return NULL;
+}
+
+static void
+workqueue_readable(mowgli_eventloop_t ATHEME_VATTR_UNUSED *const restrict eventloop,
+                   mowgli_eventloop_io_t ATHEME_VATTR_UNUSED *const restrict io,
+                   const mowgli_eventloop_io_dir_t ATHEME_VATTR_UNUSED dir,
+                   void ATHEME_VATTR_UNUSED *const restrict userdata)
+{
+	char buf[BUFSIZE];
+
+	// Drain the pipe before looking at wq_finished; see workqueue_thread()
+	while (read(wq_pipe[0], buf, sizeof buf) > 0)
+		continue;
+
+	(void) workqueue_complete();
+}
+
+static bool
+workqueue_pipe_init(void)
+{
+	if (wq_pollable)
+		return true;
+
+	if (pipe(wq_pipe) == -1)
+	{
+		(void) slog(LG_ERROR, "%s: pipe(2): %s", MOWGLI_FUNC_NAME, strerror(errno));
+		return false;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(wq_pipe); i++)
+	{
+		const int flags = fcntl(wq_pipe[i], F_GETFL, 0);
+
+		if (flags == -1 || fcntl(wq_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1)
+			(void) slog(LG_ERROR, "%s: fcntl(2): %s", MOWGLI_FUNC_NAME, strerror(errno));
+
+		(void) fcntl(wq_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	wq_pollable = mowgli_pollable_create(base_eventloop, wq_pipe[0], NULL);
+
+	(void) mowgli_pollable_setselect(base_eventloop, wq_pollable, MOWGLI_EVENTLOOP_IO_READ, &workqueue_readable);
+
+	return true;
+}
+
+// Starts threads until there are as many as configured; called with wq_lock locked
+static void
+workqueue_spawn(void)
+{
+	pthread_attr_t attr;
+	sigset_t all, saved;
+
+	if (wq_threads >= wq_threads_target || ! workqueue_pipe_init())
+		return;
+
+	(void) pthread_attr_init(&attr);
+	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	// Signals are handled by the main thread; new threads inherit this mask
+	(void) sigfillset(&all);
+	(void) pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+	while (wq_threads < wq_threads_target)
+	{
+		pthread_t thread;
+		const int ret = pthread_create(&thread, &attr, &workqueue_thread, NULL);
+
+		if (ret != 0)
+		{
+			(void) slog(LG_ERROR, "%s: pthread_create(3): %s", MOWGLI_FUNC_NAME, strerror(ret));
+			break;
+		}
+
+		wq_threads++;
+	}
+
+	(void) pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	(void) pthread_attr_destroy(&attr);
+}
+
+#endif /* HAVE_USABLE_PTHREAD */
+
+// Makes sure somebody is going to run the queued jobs
+static void
+workqueue_kick(void)
+{
+	unsigned int threads = 0;
+
+	(void) workqueue_lock();
+
+#ifdef HAVE_USABLE_PTHREAD
+	wq_threads_target = config_options.workqueue_threads;
+
+	if (wq_queue.head)
+		(void) workqueue_spawn();
+
+	(void) pthread_cond_broadcast(&wq_work_cond);
+
+	threads = (wq_threads < wq_threads_target) ? wq_threads : wq_threads_target;
+#endif
+
+	const bool queued = (wq_queue.head != NULL);
+
+	(void) workqueue_unlock();
+
+	if (queued && ! threads && ! wq_inline_timer)
+		wq_inline_timer = mowgli_timer_add_once(base_eventloop, "workqueue_run_inline", &workqueue_run_inline,
+		                                        NULL, 0);
+}
+
+/*
+ * workqueue_submit(const char *name, workqueue_run_fn run, void *input,
+ *                  void (*input_free)(void *), workqueue_done_fn done,
+ *                  const void *owner, void *priv)
+ *
+ * Queues a job to be run on a worker thread.
+ *
+ * Inputs:
+ *       - a short name for the job, for debug logging
+ *       - the function to run on the worker thread
+ *       - its input, which nobody may modify until the job is done
+ *       - a function to free the input after done() is called, or NULL
+ *       - the function to call from the event loop with the result
+ *       - the user, connection or other object the job is for, or NULL
+ *       - opaque data for done()
+ *
+ * Outputs:
+ *       - the job, which may be passed to workqueue_cancel_job() until its
+ *         done() callback is called
+ *
+ * Side Effects:
+ *       - done() is called later, never from here
+ */
+struct workqueue_job *
+workqueue_submit(const char *const restrict name, const workqueue_run_fn run, void *const restrict input,
+                 void (*const input_free)(void *), const workqueue_done_fn done, const void *const owner,
+                 void *const restrict priv)
+{
+	return_val_if_fail(name != NULL, NULL);
+	return_val_if_fail(run != NULL, NULL);
+	return_val_if_fail(done != NULL, NULL);
+
+	struct workqueue_job *const job = smalloc(sizeof *job);
+
+	job->name = sstrdup(name);
+	job->run = run;
+	job->input = input;
+	job->input_free = input_free;
+	job->done = done;
+	job->owner = owner;
+	job->priv = priv;
+	job->state = WQ_QUEUED;
+
+	(void) s_time(&job->submitted);
+	(void) mowgli_node_add(job, &job->allnode, &wq_jobs);
+
+	(void) workqueue_lock();
+	(void) mowgli_node_add(job, &job->node, &wq_queue);
+
+	const size_t queued = MOWGLI_LIST_LENGTH(&wq_queue);
+
+	(void) workqueue_unlock();
+
+	wq_stats.submitted++;
+
+	(void) slog(LG_DEBUG, "%s: queued job %s (%p), %zu waiting", MOWGLI_FUNC_NAME, job->name, job, queued);
+
+	(void) workqueue_kick();
+
+	return job;
+}
+
+static void
+workqueue_cancel_matching(const void *const owner, const workqueue_done_fn done,
+                          const struct workqueue_job *const only, const bool wait)
+{
+	mowgli_node_t *n, *tn;
+	mowgli_list_t cancelled = { NULL, NULL, 0 };
+
+	// Take them all out first; the callbacks may well submit or cancel other jobs
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, wq_jobs.head)
+	{
+		struct workqueue_job *const job = n->data;
+
+		if ((only && job != only) || (owner && job->owner != owner) || (done && job->done != done))
+			continue;
+
+		// Already cancelled and still running; only of interest if we have to wait for it
+		if (job->cancelled && ! wait)
+			continue;
+
+		(void) mowgli_node_delete(&job->allnode, &wq_jobs);
+		(void) mowgli_node_add(job, &job->allnode, &cancelled);
+	}
+
+	if (! cancelled.count)
+		return;
+
+	(void) workqueue_lock();
+
+	MOWGLI_ITER_FOREACH(n, cancelled.head)
+	{
+		struct workqueue_job *const job = n->data;
+
+#ifdef HAVE_USABLE_PTHREAD
+		while (wait && job->state == WQ_RUNNING)
+			(void) pthread_cond_wait(&wq_finished_cond, &wq_lock);
+#endif
+
+		if (job->state == WQ_QUEUED)
+		{
+			(void) mowgli_node_delete(&job->node, &wq_queue);
+			job->state = WQ_FINISHED;
+		}
+		else if (job->state == WQ_FINISHED)
+		{
+			(void) mowgli_node_delete(&job->node, &wq_finished);
+		}
+	}
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cancelled.head)
+	{
+		struct workqueue_job *const job = n->data;
+
+		if (! job->cancelled)
+		{
+			job->cancelled = true;
+			wq_stats.cancelled++;
+		}
+
+		// Its thread hands it back to the event loop when it is done
+		if (job->state == WQ_RUNNING)
+		{
+			(void) mowgli_node_delete(&job->allnode, &cancelled);
+			(void) mowgli_node_add(job, &job->allnode, &wq_jobs);
+		}
+	}
+
+	(void) workqueue_unlock();
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, cancelled.head)
+	{
+		struct workqueue_job *const job = n->data;
+
+		(void) mowgli_node_delete(&job->allnode, &cancelled);
+		(void) workqueue_job_done(job);
+	}
+}
+
+/*
+ * workqueue_cancel(const void *owner, workqueue_done_fn done)
+ *
+ * Cancels jobs.
+ *
+ * Inputs:
+ *       - the owner of the jobs to cancel, or NULL for any owner
+ *       - the done() callback of the jobs to cancel, or NULL for any callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - done() is called with cancelled set, right away for jobs that were
+ *         not running, and when run() returns for those that were
+ */
+void
+workqueue_cancel(const void *const owner, const workqueue_done_fn done)
+{
+	(void) workqueue_cancel_matching(owner, done, NULL, false);
+}
+
+/*
+ * workqueue_cancel_wait(const void *owner, workqueue_done_fn done)
+ *
+ * Cancels jobs like workqueue_cancel(), but waits for running jobs to finish,
+ * so that done() has been called for all of them on return. Modules must do
+ * this for their jobs before they are unloaded. This blocks services for as
+ * long as the jobs take.
+ *
+ * Inputs:
+ *       - the owner of the jobs to cancel, or NULL for any owner
+ *       - the done() callback of the jobs to cancel, or NULL for any callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - done() is called with cancelled set
+ */
+void
+workqueue_cancel_wait(const void *const owner, const workqueue_done_fn done)
+{
+	(void) workqueue_cancel_matching(owner, done, NULL, true);
+}
+
+void
+workqueue_cancel_job(struct workqueue_job *const restrict job)
+{
+	return_if_fail(job != NULL);
+
+	(void) workqueue_cancel_matching(NULL, NULL, job, false);
+}
+
+// Like workqueue_cancel_wait(), for one job
+void
+workqueue_cancel_job_wait(struct workqueue_job *const restrict job)
+{
+	return_if_fail(job != NULL);
+
+	(void) workqueue_cancel_matching(NULL, NULL, job, true);
+}
+
+/*
+ * workqueue_wait_job(struct workqueue_job *job)
+ *
+ * Waits for a job to finish and calls its done() callback right away, for
+ * code that cannot go back to the event loop for the result, such as
+ * loading the database at startup. A job that no thread has picked up yet
+ * is run here. This blocks services for as long as the job takes.
+ *
+ * Inputs:
+ *       - a job whose done() has not been called yet
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - done() is called, with cancelled set only if the job was cancelled
+ */
+void
+workqueue_wait_job(struct workqueue_job *const restrict job)
+{
+	return_if_fail(job != NULL);
+
+	(void) workqueue_lock();
+
+	if (job->state == WQ_QUEUED)
+	{
+		(void) mowgli_node_delete(&job->node, &wq_queue);
+
+		job->state = WQ_RUNNING;
+		wq_running++;
+
+		(void) workqueue_unlock();
+		(void) workqueue_job_run(job);
+		(void) workqueue_lock();
+
+		job->state = WQ_FINISHED;
+		wq_running--;
+	}
+	else
+	{
+#ifdef HAVE_USABLE_PTHREAD
+		while (job->state == WQ_RUNNING)
+			(void) pthread_cond_wait(&wq_finished_cond, &wq_lock);
+#endif
+
+		(void) mowgli_node_delete(&job->node, &wq_finished);
+	}
+
+	(void) workqueue_unlock();
+
+	(void) mowgli_node_delete(&job->allnode, &wq_jobs);
+	(void) workqueue_job_done(job);
+}
+
+// Whether workqueue_wait_job() would return without waiting
+bool
+workqueue_job_finished(const struct workqueue_job *const restrict job)
+{
+	return_val_if_fail(job != NULL, false);
+
+	(void) workqueue_lock();
+
+	const bool finished = (job->state == WQ_FINISHED);
+
+	(void) workqueue_unlock();
+
+	return finished;
+}
+
+unsigned int
+workqueue_pending(const void *const owner)
+{
+	mowgli_node_t *n;
+	unsigned int count = 0;
+
+	MOWGLI_ITER_FOREACH(n, wq_jobs.head)
+	{
+		const struct workqueue_job *const job = n->data;
+
+		if (job->owner == owner && ! job->cancelled)
+			count++;
+	}
+
+	return count;
+}
+
+/*
+ * workqueue_stats(void (*cb)(const char *line, void *privdata), void *privdata)
+ *
+ * Reports the state of the work queue and how long jobs took.
+ *
+ * Inputs:
+ *       - callback to receive each line of output
+ *       - opaque data for the callback
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - none
+ */
+void
+workqueue_stats(void (*cb)(const char *line, void *privdata), void *privdata)
+{
+	char buf[BUFSIZE];
+	unsigned int threads = 0;
+
+	(void) workqueue_lock();
+
+#ifdef HAVE_USABLE_PTHREAD
+	threads = wq_threads;
+#endif
+
+	const size_t queued = MOWGLI_LIST_LENGTH(&wq_queue);
+	const unsigned int running = wq_running;
+
+	(void) workqueue_unlock();
+
+	(void) snprintf(buf, sizeof buf, "Work queue threads: %u (%u configured), jobs waiting: %zu, running: %u",
+	                threads, config_options.workqueue_threads, queued, running);
+	(void) cb(buf, privdata);
+
+	(void) snprintf(buf, sizeof buf, "Work queue jobs submitted: %lu, completed: %lu, cancelled: %lu",
+	                wq_stats.submitted, wq_stats.completed, wq_stats.cancelled);
+	(void) cb(buf, privdata);
+
+	if (! wq_stats.ran)
+		return;
+
+	(void) snprintf(buf, sizeof buf, "Work queue latency: %llu ms waiting, %llu ms running on average; "
+	                "longest %lu ms waiting, %lu ms running",
+	                wq_stats.wait_usec / wq_stats.ran / 1000U, wq_stats.run_usec / wq_stats.ran / 1000U,
+	                wq_stats.wait_max_usec / 1000U, wq_stats.run_max_usec / 1000U);
+	(void) cb(buf, privdata);
+}
+
+static void
+workqueue_user_delete(struct user *const restrict u)
+{
+	(void) workqueue_cancel(u, NULL);
+}
+
+static void
+workqueue_config_ready(void ATHEME_VATTR_UNUSED *const restrict unused)
+{
+	(void) workqueue_kick();
+}
+
+void
+workqueue_init(void)
+{
+	(void) hook_add_user_delete(&workqueue_user_delete);
+	(void) hook_add_config_ready(&workqueue_config_ready);
+}
@@ -46,6 +46,7 @@ AC_DEFUN([ATHEME_CHECK_BUILD_REQUIREMENTS], [
     AC_CHECK_HEADERS([sys/stat.h], [], [], [])
     AC_CHECK_HEADERS([sys/time.h], [], [], [])
     AC_CHECK_HEADERS([sys/types.h], [], [], [])
+    AC_CHECK_HEADERS([sys/uio.h], [], [], [])
     AC_CHECK_HEADERS([sys/wait.h], [], [], [])
     AC_CHECK_HEADERS([time.h], [], [], [])
     AC_CHECK_HEADERS([unistd.h], [], [], [])
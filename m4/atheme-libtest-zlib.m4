@@ -0,0 +1,97 @@
+# SPDX-License-Identifier: ISC
+# SPDX-URL: https://spdx.org/licenses/ISC.html
+#
+# Copyright (C) 2005-2009 Atheme Project (http://atheme.org/)
+# Copyright (C) 2018-2019 Atheme Development Group (https://atheme.github.io/)
+#
+# -*- Atheme IRC Services -*-
+# Atheme Build System Component
+
+AC_DEFUN([ATHEME_LIBTEST_ZLIB], [
+
+    CFLAGS_SAVED="${CFLAGS}"
+    LIBS_SAVED="${LIBS}"
+
+    LIBZ="No"
+    LIBZ_PATH=""
+
+    AC_ARG_WITH([zlib],
+        [AS_HELP_STRING([--without-zlib], [Do not attempt to detect zlib (for compressed OpenSEX databases)])],
+        [], [with_zlib="auto"])
+
+    AS_CASE(["x${with_zlib}"], [xno], [], [xyes], [], [xauto], [], [x/*], [
+        LIBZ_PATH="${with_zlib}"
+        with_zlib="yes"
+    ], [
+        AC_MSG_ERROR([invalid option for --with-zlib])
+    ])
+
+    AS_IF([test "${with_zlib}" != "no"], [
+        AS_IF([test -n "${LIBZ_PATH}"], [
+            # Allow for user to provide custom installation directory
+            AS_IF([test -d "${LIBZ_PATH}/include" -a -d "${LIBZ_PATH}/lib"], [
+                LIBZ_CFLAGS="-I${LIBZ_PATH}/include"
+                LIBZ_LIBS="-L${LIBZ_PATH}/lib -lz"
+            ], [
+                AC_MSG_ERROR([${LIBZ_PATH} is not a suitable directory for zlib])
+            ])
+        ], [test -n "${PKG_CONFIG}"], [
+            # Allow for the user to "override" pkg-config without it being installed
+            PKG_CHECK_MODULES([LIBZ], [zlib], [], [LIBZ="No"])
+        ])
+        AS_IF([test -n "${LIBZ_CFLAGS+set}" -a -n "${LIBZ_LIBS+set}"], [
+            # Only proceed with library tests if custom paths were given or pkg-config succeeded
+            LIBZ="Yes"
+        ], [
+            LIBZ="No"
+            AS_IF([test "${with_zlib}" != "no" && test "${with_zlib}" != "auto"], [
+                AC_MSG_FAILURE([--with-zlib was given but zlib could not be found])
+            ])
+        ])
+    ])
+
+    AS_IF([test "${LIBZ}" = "Yes"], [
+        CFLAGS="${LIBZ_CFLAGS} ${CFLAGS}"
+        LIBS="${LIBZ_LIBS} ${LIBS}"
+
+        AC_MSG_CHECKING([if zlib appears to be usable])
+        AC_LINK_IFELSE([
+            AC_LANG_PROGRAM([[
+                #ifdef HAVE_STDDEF_H
+                #  include <stddef.h>
+                #endif
+                #include <zlib.h>
+            ]], [[
+                z_stream zs;
+                (void) deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+                (void) inflateInit2(&zs, 15 + 32);
+                (void) deflateEnd(&zs);
+                (void) inflateEnd(&zs);
+            ]])
+        ], [
+            AC_MSG_RESULT([yes])
+            LIBZ="Yes"
+            AC_DEFINE([HAVE_LIBZ], [1], [Define to 1 if zlib appears to be usable])
+        ], [
+            AC_MSG_RESULT([no])
+            LIBZ="No"
+            AS_IF([test "${with_zlib}" != "no" && test "${with_zlib}" != "auto"], [
+                AC_MSG_FAILURE([--with-zlib was given but zlib does not appear to be usable])
+            ])
+        ])
+    ])
+
+    AS_IF([test "${LIBZ}" = "No"], [
+        LIBZ_CFLAGS=""
+        LIBZ_LIBS=""
+    ])
+
+    AC_SUBST([LIBZ_CFLAGS])
+    AC_SUBST([LIBZ_LIBS])
+
+    CFLAGS="${CFLAGS_SAVED}"
+    LIBS="${LIBS_SAVED}"
+
+    unset CFLAGS_SAVED
+    unset LIBS_SAVED
+])
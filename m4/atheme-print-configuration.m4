@@ -48,6 +48,7 @@ Configuration of ${PACKAGE_STRING}:
     Perl support ............: ${LIBPERL}
     QR Code support .........: ${LIBQRENCODE}
     Sodium support ..........: ${LIBSODIUM}
+    zlib support ............: ${LIBZ}
 
   Password Cryptography:
     Argon2 support ..........: ${LIBARGON2}
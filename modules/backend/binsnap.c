@@ -0,0 +1,981 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * This file contains the binary snapshot (binsnap) database backend.
+ *
+ * It stores the same rows as OpenSEX, but integers are written as fixed-width
+ * little-endian values instead of decimal text, and strings are length-prefixed.
+ * Short strings go through a string table of BINSNAP_SLOTS slots shared by
+ * the writer and the reader: the first time a string is written it is
+ * stored in the slot its hash selects, and afterwards it is referred to by
+ * slot number until something else takes the slot. Hosts, email domains,
+ * metadata keys, flags and row types therefore cost a few bytes each.
+ *
+ * Rows are loaded through the handlers registered with
+ * db_register_type_handler(), exactly like OpenSEX rows.
+ */
+
+#include <atheme.h>
+
+#define BINSNAP_MAGIC           "ATHMSNAP"
+#define BINSNAP_MAGIC_LEN       8U
+#define BINSNAP_VERSION         1U
+
+// Number of string table slots; a power of two, and part of the file format
+#define BINSNAP_SLOTS           65536U
+
+// Longer strings are written inline instead of going into the string table
+#define BINSNAP_SLOT_MAXLEN     255U
+
+// How much of the file to read or write at a time
+#define BINSNAP_BLOCK           (1024U * 1024U)
+
+enum binsnap_tag
+{
+	BINSNAP_ROW     = 0x01, // start of row; a string (the row type) follows
+	BINSNAP_WORD    = 0x02, // a string follows
+	BINSNAP_STR     = 0x03, // a string follows, which is the rest of the row
+	BINSNAP_INT     = 0x04, // 4 bytes, two's complement
+	BINSNAP_UINT    = 0x05, // 4 bytes
+	BINSNAP_TIME    = 0x06, // 8 bytes, two's complement
+	BINSNAP_END     = 0x0F, // end of row
+
+	BINSNAP_STRDEF  = 0x10, // slot (2 bytes), length (1 byte), bytes; store in the slot
+	BINSNAP_STRREF  = 0x11, // slot (2 bytes); the string currently in the slot
+	BINSNAP_STRLIT  = 0x12, // length (4 bytes), bytes; not stored
+};
+
+struct binsnap_slot
+{
+	char *          str;
+	size_t          len;
+};
+
+struct binsnap_cell
+{
+	enum binsnap_tag        type;
+	size_t                  offset;         // of the string in the row arena
+	char *                  str;
+	long long               num;
+	char                    numbuf[24];     // num formatted, if asked for as a word
+};
+
+struct binsnap
+{
+	int                     fd;
+	struct binsnap_slot *   slots;
+
+	// Reading state
+	unsigned char *         buf;
+	size_t                  bufsize;
+	size_t                  bufpos;
+	size_t                  buflen;
+	bool                    eof;
+
+	struct binsnap_cell *   cells;          // the current row; cell 0 is its type
+	unsigned int            ncells;
+	unsigned int            cellsize;
+	unsigned int            cur;
+	char *                  arena;          // the strings of the current row
+	size_t                  arenalen;
+	size_t                  arenasize;
+	char *                  strbuf;         // for read_str() over several cells
+	size_t                  strbufsize;
+
+	// Writing state
+	unsigned char *         wbuf;
+	size_t                  wlen;
+	size_t                  wsize;
+	struct db_snapshot *    snap;           // if set, wbuf grows to hold the whole database
+	unsigned long           written;
+	bool                    werror;
+};
+
+#ifdef HAVE_FLOCK
+static int lockfd;
+#endif
+
+static inline unsigned int
+binsnap_slot_hash(const char *str, size_t len)
+{
+	// FNV-1a
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= (unsigned char) str[i];
+		h *= 16777619U;
+	}
+
+	return h & (BINSNAP_SLOTS - 1U);
+}
+
+static void
+binsnap_slot_set(struct binsnap_slot *slot, const char *str, size_t len)
+{
+	if (slot->str == NULL || slot->len != len)
+	{
+		sfree(slot->str);
+		slot->str = smalloc(len + 1);
+	}
+
+	memcpy(slot->str, str, len);
+	slot->str[len] = '\0';
+	slot->len = len;
+}
+
+static void
+binsnap_slots_free(struct binsnap_slot *slots)
+{
+	if (slots == NULL)
+		return;
+
+	for (unsigned int i = 0; i < BINSNAP_SLOTS; i++)
+		sfree(slots[i].str);
+
+	sfree(slots);
+}
+
+/*
+ * Reading
+ */
+
+static void ATHEME_FATTR_NORETURN
+binsnap_read_fail(struct database_handle *db, const char *reason)
+{
+	slog(LG_ERROR, "binsnap-read: %s at %s row %u", reason, db->file, db->line);
+	slog(LG_ERROR, "binsnap-read: exiting to avoid data loss");
+	exit(EXIT_FAILURE);
+}
+
+// make sure len bytes are available at rs->buf + rs->bufpos; false at end of file
+static bool
+binsnap_need(struct database_handle *db, size_t len)
+{
+	struct binsnap *bs = db->priv;
+
+	while (bs->buflen - bs->bufpos < len)
+	{
+		if (bs->eof)
+			return false;
+
+		if (bs->bufpos != 0)
+		{
+			memmove(bs->buf, bs->buf + bs->bufpos, bs->buflen - bs->bufpos);
+			bs->buflen -= bs->bufpos;
+			bs->bufpos = 0;
+		}
+		while (bs->bufsize - bs->buflen < len)
+		{
+			bs->bufsize *= 2;
+			bs->buf = srealloc(bs->buf, bs->bufsize);
+		}
+
+		const ssize_t n = read(bs->fd, bs->buf + bs->buflen, bs->bufsize - bs->buflen);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			binsnap_read_fail(db, strerror(errno));
+		}
+
+		if (n == 0)
+			bs->eof = true;
+
+		bs->buflen += (size_t) n;
+	}
+
+	return true;
+}
+
+static uint64_t
+binsnap_get_le(struct database_handle *db, unsigned int width)
+{
+	struct binsnap *bs = db->priv;
+	uint64_t val = 0;
+
+	if (!binsnap_need(db, width))
+		binsnap_read_fail(db, "unexpected end of file");
+
+	const unsigned char *const p = bs->buf + bs->bufpos;
+
+	for (unsigned int i = 0; i < width; i++)
+		val |= (uint64_t) p[i] << (8U * i);
+
+	bs->bufpos += width;
+	return val;
+}
+
+// copies the next string into the row arena and returns its offset there
+static size_t
+binsnap_get_string(struct database_handle *db)
+{
+	struct binsnap *bs = db->priv;
+	const char *str;
+	size_t len;
+
+	const unsigned int tag = (unsigned int) binsnap_get_le(db, 1);
+
+	switch (tag)
+	{
+		case BINSNAP_STRDEF:
+		{
+			struct binsnap_slot *const slot = &bs->slots[binsnap_get_le(db, 2)];
+
+			len = (size_t) binsnap_get_le(db, 1);
+			if (!binsnap_need(db, len))
+				binsnap_read_fail(db, "unexpected end of file");
+
+			binsnap_slot_set(slot, (const char *) bs->buf + bs->bufpos, len);
+			bs->bufpos += len;
+			str = slot->str;
+			break;
+		}
+
+		case BINSNAP_STRREF:
+		{
+			const struct binsnap_slot *const slot = &bs->slots[binsnap_get_le(db, 2)];
+
+			if (slot->str == NULL)
+				binsnap_read_fail(db, "reference to an empty string table slot");
+
+			str = slot->str;
+			len = slot->len;
+			break;
+		}
+
+		case BINSNAP_STRLIT:
+			len = (size_t) binsnap_get_le(db, 4);
+			if (!binsnap_need(db, len))
+				binsnap_read_fail(db, "unexpected end of file");
+
+			str = (const char *) bs->buf + bs->bufpos;
+			bs->bufpos += len;
+			break;
+
+		default:
+			binsnap_read_fail(db, "bad string encoding");
+	}
+
+	while (bs->arenasize - bs->arenalen < len + 1)
+	{
+		bs->arenasize *= 2;
+		bs->arena = srealloc(bs->arena, bs->arenasize);
+	}
+
+	const size_t offset = bs->arenalen;
+
+	memcpy(bs->arena + offset, str, len);
+	bs->arena[offset + len] = '\0';
+	bs->arenalen += len + 1;
+
+	return offset;
+}
+
+static struct binsnap_cell *
+binsnap_new_cell(struct binsnap *bs, enum binsnap_tag type)
+{
+	if (bs->ncells == bs->cellsize)
+	{
+		bs->cellsize *= 2;
+		bs->cells = srealloc(bs->cells, bs->cellsize * sizeof *bs->cells);
+	}
+
+	struct binsnap_cell *const cell = &bs->cells[bs->ncells++];
+
+	cell->type = type;
+	cell->str = NULL;
+	cell->num = 0;
+	cell->numbuf[0] = '\0';
+
+	return cell;
+}
+
+/* Decodes a whole row up front, so that the strings it hands out stay
+ * valid while the handler reads the rest of the row, even if a later cell
+ * takes over a string table slot.
+ */
+static bool
+binsnap_read_next_row(struct database_handle *db)
+{
+	struct binsnap *bs = db->priv;
+	struct binsnap_cell *cell;
+
+	if (!binsnap_need(db, 1))
+		return false;
+
+	if (binsnap_get_le(db, 1) != BINSNAP_ROW)
+		binsnap_read_fail(db, "expected start of row");
+
+	bs->ncells = 0;
+	bs->cur = 0;
+	bs->arenalen = 0;
+
+	cell = binsnap_new_cell(bs, BINSNAP_WORD);
+	cell->offset = binsnap_get_string(db);
+
+	for (;;)
+	{
+		const enum binsnap_tag tag = (enum binsnap_tag) binsnap_get_le(db, 1);
+
+		if (tag == BINSNAP_END)
+			break;
+
+		cell = binsnap_new_cell(bs, tag);
+
+		switch (tag)
+		{
+			case BINSNAP_WORD:
+			case BINSNAP_STR:
+				cell->offset = binsnap_get_string(db);
+				break;
+
+			case BINSNAP_INT:
+				cell->num = (int32_t) (uint32_t) binsnap_get_le(db, 4);
+				break;
+
+			case BINSNAP_UINT:
+				cell->num = (long long) binsnap_get_le(db, 4);
+				break;
+
+			case BINSNAP_TIME:
+				cell->num = (long long) (int64_t) binsnap_get_le(db, 8);
+				break;
+
+			default:
+				binsnap_read_fail(db, "bad cell type");
+		}
+	}
+
+	// the arena has stopped moving; point the string cells into it
+	for (unsigned int i = 0; i < bs->ncells; i++)
+		if (bs->cells[i].type == BINSNAP_WORD || bs->cells[i].type == BINSNAP_STR)
+			bs->cells[i].str = bs->arena + bs->cells[i].offset;
+
+	db->line++;
+	db->token = 0;
+	return true;
+}
+
+static const char *
+binsnap_cell_string(struct binsnap_cell *cell)
+{
+	if (cell->str != NULL)
+		return cell->str;
+
+	if (cell->numbuf[0] == '\0')
+		(void) snprintf(cell->numbuf, sizeof cell->numbuf, "%lld", cell->num);
+
+	return cell->numbuf;
+}
+
+static const char *
+binsnap_read_word(struct database_handle *db)
+{
+	struct binsnap *bs = db->priv;
+
+	if (bs->cur >= bs->ncells)
+		return NULL;
+
+	struct binsnap_cell *const cell = &bs->cells[bs->cur];
+
+	db->token++;
+
+	// free text read back as words; split it the way OpenSEX would
+	if (cell->type == BINSNAP_STR)
+	{
+		char *const word = cell->str;
+		char *const sp = strchr(word, ' ');
+
+		if (sp != NULL)
+		{
+			*sp = '\0';
+			cell->str = sp + 1;
+			return word;
+		}
+	}
+
+	bs->cur++;
+	return binsnap_cell_string(cell);
+}
+
+static const char *
+binsnap_read_str(struct database_handle *db)
+{
+	struct binsnap *bs = db->priv;
+	size_t len = 0;
+
+	if (bs->cur >= bs->ncells)
+		return NULL;
+
+	db->token++;
+
+	if (bs->cur + 1 == bs->ncells)
+		return binsnap_cell_string(&bs->cells[bs->cur++]);
+
+	// a row written as several words but read as free text; join them like OpenSEX would
+	for (; bs->cur < bs->ncells; bs->cur++)
+	{
+		const char *const word = binsnap_cell_string(&bs->cells[bs->cur]);
+		const size_t wlen = strlen(word);
+
+		while (bs->strbufsize < len + wlen + 2)
+		{
+			bs->strbufsize *= 2;
+			bs->strbuf = srealloc(bs->strbuf, bs->strbufsize);
+		}
+
+		if (len != 0)
+			bs->strbuf[len++] = ' ';
+
+		memcpy(bs->strbuf + len, word, wlen);
+		len += wlen;
+	}
+
+	bs->strbuf[len] = '\0';
+	return bs->strbuf;
+}
+
+static bool
+binsnap_read_number(struct database_handle *db, long long *res)
+{
+	struct binsnap *bs = db->priv;
+
+	if (bs->cur >= bs->ncells)
+		return false;
+
+	struct binsnap_cell *const cell = &bs->cells[bs->cur++];
+
+	db->token++;
+
+	if (cell->str == NULL)
+	{
+		*res = cell->num;
+		return true;
+	}
+
+	// written as a word; parse it the way OpenSEX does
+	char *rp;
+
+	*res = strtoll(cell->str, &rp, 0);
+	return *cell->str && !*rp;
+}
+
+static bool
+binsnap_read_int(struct database_handle *db, int *res)
+{
+	long long num;
+
+	if (!binsnap_read_number(db, &num))
+		return false;
+
+	*res = (int) num;
+	return true;
+}
+
+static bool
+binsnap_read_uint(struct database_handle *db, unsigned int *res)
+{
+	long long num;
+
+	if (!binsnap_read_number(db, &num))
+		return false;
+
+	*res = (unsigned int) num;
+	return true;
+}
+
+static bool
+binsnap_read_time(struct database_handle *db, time_t *res)
+{
+	long long num;
+
+	if (!binsnap_read_number(db, &num))
+		return false;
+
+	*res = (time_t) num;
+	return true;
+}
+
+/*
+ * Writing
+ */
+
+static void
+binsnap_flush(struct database_handle *db)
+{
+	struct binsnap *bs = db->priv;
+	size_t done = 0;
+
+	while (done < bs->wlen && !bs->werror)
+	{
+		const ssize_t n = write(bs->fd, bs->wbuf + done, bs->wlen - done);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			slog(LG_ERROR, "binsnap-flush: cannot write to %s: %s", db->file, strerror(errno));
+			bs->werror = true;
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	bs->written += done;
+	bs->wlen = 0;
+}
+
+static void
+binsnap_put(struct database_handle *db, const void *data, size_t len)
+{
+	struct binsnap *bs = db->priv;
+	const unsigned char *p = data;
+
+	while (len > 0)
+	{
+		if (bs->wlen == bs->wsize)
+		{
+			if (bs->snap != NULL)
+			{
+				bs->wsize *= 2;
+				bs->wbuf = srealloc(bs->wbuf, bs->wsize);
+			}
+			else
+				binsnap_flush(db);
+		}
+
+		size_t l = bs->wsize - bs->wlen;
+		if (l > len)
+			l = len;
+
+		memcpy(bs->wbuf + bs->wlen, p, l);
+		bs->wlen += l;
+		p += l;
+		len -= l;
+	}
+}
+
+static void
+binsnap_put_le(struct database_handle *db, uint64_t val, unsigned int width)
+{
+	unsigned char buf[8];
+
+	for (unsigned int i = 0; i < width; i++)
+		buf[i] = (unsigned char) (val >> (8U * i));
+
+	binsnap_put(db, buf, width);
+}
+
+static void
+binsnap_put_string(struct database_handle *db, const char *str)
+{
+	struct binsnap *bs = db->priv;
+	const size_t len = strlen(str);
+
+	if (len > BINSNAP_SLOT_MAXLEN)
+	{
+		binsnap_put_le(db, BINSNAP_STRLIT, 1);
+		binsnap_put_le(db, len, 4);
+		binsnap_put(db, str, len);
+		return;
+	}
+
+	const unsigned int idx = binsnap_slot_hash(str, len);
+	struct binsnap_slot *const slot = &bs->slots[idx];
+
+	if (slot->str != NULL && slot->len == len && !memcmp(slot->str, str, len))
+	{
+		binsnap_put_le(db, BINSNAP_STRREF, 1);
+		binsnap_put_le(db, idx, 2);
+		return;
+	}
+
+	binsnap_slot_set(slot, str, len);
+
+	binsnap_put_le(db, BINSNAP_STRDEF, 1);
+	binsnap_put_le(db, idx, 2);
+	binsnap_put_le(db, len, 1);
+	binsnap_put(db, str, len);
+}
+
+static bool
+binsnap_start_row(struct database_handle *db, const char *type)
+{
+	return_val_if_fail(db != NULL, false);
+	return_val_if_fail(type != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_ROW, 1);
+	binsnap_put_string(db, type);
+
+	return true;
+}
+
+static bool
+binsnap_write_word(struct database_handle *db, const char *word)
+{
+	return_val_if_fail(db != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_WORD, 1);
+	binsnap_put_string(db, word != NULL ? word : "*");
+
+	return true;
+}
+
+static bool
+binsnap_write_str(struct database_handle *db, const char *str)
+{
+	return_val_if_fail(db != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_STR, 1);
+	binsnap_put_string(db, str != NULL ? str : "*");
+
+	return true;
+}
+
+static bool
+binsnap_write_int(struct database_handle *db, int num)
+{
+	return_val_if_fail(db != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_INT, 1);
+	binsnap_put_le(db, (uint32_t) num, 4);
+
+	return true;
+}
+
+static bool
+binsnap_write_uint(struct database_handle *db, unsigned int num)
+{
+	return_val_if_fail(db != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_UINT, 1);
+	binsnap_put_le(db, num, 4);
+
+	return true;
+}
+
+static bool
+binsnap_write_time(struct database_handle *db, time_t tm)
+{
+	return_val_if_fail(db != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_TIME, 1);
+	binsnap_put_le(db, (uint64_t) (int64_t) tm, 8);
+
+	return true;
+}
+
+static bool
+binsnap_commit_row(struct database_handle *db)
+{
+	return_val_if_fail(db != NULL, false);
+
+	binsnap_put_le(db, BINSNAP_END, 1);
+
+	return true;
+}
+
+static const struct database_vtable binsnap_vt = {
+	.name = "binsnap",
+	.read_next_row = binsnap_read_next_row,
+	.read_word = binsnap_read_word,
+	.read_str = binsnap_read_str,
+	.read_int = binsnap_read_int,
+	.read_uint = binsnap_read_uint,
+	.read_time = binsnap_read_time,
+	.start_row = binsnap_start_row,
+	.write_word = binsnap_write_word,
+	.write_str = binsnap_write_str,
+	.write_int = binsnap_write_int,
+	.write_uint = binsnap_write_uint,
+	.write_time = binsnap_write_time,
+	.commit_row = binsnap_commit_row
+};
+
+static struct database_handle * ATHEME_FATTR_MALLOC
+binsnap_db_open_read(const char *filename)
+{
+	struct database_handle *db;
+	struct binsnap *bs;
+	int fd;
+	char path[BUFSIZE];
+
+	snprintf(path, BUFSIZE, "%s/%s", datadir, filename != NULL ? filename : "services.bsnap");
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		const int errno1 = errno;
+
+		// ENOENT can happen if the database does not exist yet.
+		if (errno1 == ENOENT)
+		{
+			if (database_create)
+			{
+				slog(LG_INFO, "db-open-read: database '%s' does not yet exist; a new one will be created.", path);
+				return NULL;
+			}
+			else
+			{
+				slog(LG_ERROR, "db-open-read: database '%s' does not yet exist; please specify the -b option to create a new one.", path);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		slog(LG_ERROR, "db-open-read: cannot open '%s' for reading: %s", path, strerror(errno1));
+		wallops("\2DATABASE ERROR\2: db-open-read: cannot open '%s' for reading: %s", path, strerror(errno1));
+		exit(EXIT_FAILURE);
+	}
+	else if (database_create)
+	{
+		slog(LG_ERROR, "db-open-read: database '%s' already exists, but you specified the -b option to create a new one; please remove the old database first", path);
+		exit(EXIT_FAILURE);
+	}
+
+	bs = smalloc(sizeof *bs);
+	bs->fd = fd;
+	bs->slots = scalloc(BINSNAP_SLOTS, sizeof *bs->slots);
+	bs->bufsize = BINSNAP_BLOCK;
+	bs->buf = smalloc(bs->bufsize);
+	bs->cellsize = 16;
+	bs->cells = smalloc(bs->cellsize * sizeof *bs->cells);
+	bs->arenasize = BUFSIZE;
+	bs->arena = smalloc(bs->arenasize);
+	bs->strbufsize = BUFSIZE;
+	bs->strbuf = smalloc(bs->strbufsize);
+
+	db = smalloc(sizeof *db);
+	db->priv = bs;
+	db->vt = &binsnap_vt;
+	db->txn = DB_READ;
+	db->file = sstrdup(path);
+
+	if (!binsnap_need(db, BINSNAP_MAGIC_LEN) || memcmp(bs->buf, BINSNAP_MAGIC, BINSNAP_MAGIC_LEN) != 0)
+		binsnap_read_fail(db, "not a binsnap database");
+
+	bs->bufpos += BINSNAP_MAGIC_LEN;
+
+	const unsigned int version = (unsigned int) binsnap_get_le(db, 4);
+	const unsigned int nslots = (unsigned int) binsnap_get_le(db, 4);
+
+	if (version != BINSNAP_VERSION || nslots != BINSNAP_SLOTS)
+	{
+		slog(LG_ERROR, "db-open-read: '%s' is binsnap version %u with %u string slots; only version %u with %u slots is supported",
+		     path, version, nslots, BINSNAP_VERSION, BINSNAP_SLOTS);
+		exit(EXIT_FAILURE);
+	}
+
+	return db;
+}
+
+static struct database_handle * ATHEME_FATTR_MALLOC
+binsnap_db_open_write(const char *filename)
+{
+	struct database_handle *db;
+	struct binsnap *bs;
+	int fd;
+	char bpath[BUFSIZE], path[BUFSIZE];
+#ifdef HAVE_FLOCK
+	char lpath[BUFSIZE];
+#endif
+
+	snprintf(bpath, BUFSIZE, "%s/%s", datadir, filename != NULL ? filename : "services.bsnap");
+
+	mowgli_strlcpy(path, bpath, sizeof path);
+	mowgli_strlcat(path, ".new", sizeof path);
+
+#ifdef HAVE_FLOCK
+	mowgli_strlcpy(lpath, bpath, sizeof lpath);
+	mowgli_strlcat(lpath, ".lock", sizeof lpath);
+
+	lockfd = open(lpath, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+	flock(lockfd, LOCK_EX);
+#endif
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (fd < 0)
+	{
+		const int errno1 = errno;
+
+		slog(LG_ERROR, "db-open-write: cannot open '%s' for writing: %s", path, strerror(errno1));
+		wallops("\2DATABASE ERROR\2: db-open-write: cannot open '%s' for writing: %s", path, strerror(errno1));
+#ifdef HAVE_FLOCK
+		close(lockfd);
+#endif
+		return NULL;
+	}
+
+	bs = smalloc(sizeof *bs);
+	bs->fd = fd;
+	bs->slots = scalloc(BINSNAP_SLOTS, sizeof *bs->slots);
+	bs->wsize = BINSNAP_BLOCK;
+	bs->wbuf = smalloc(bs->wsize);
+	bs->snap = db_snapshot;
+
+	db = smalloc(sizeof *db);
+	db->priv = bs;
+	db->vt = &binsnap_vt;
+	db->txn = DB_WRITE;
+	db->file = sstrdup(bpath);
+
+	binsnap_put(db, BINSNAP_MAGIC, BINSNAP_MAGIC_LEN);
+	binsnap_put_le(db, BINSNAP_VERSION, 4);
+	binsnap_put_le(db, BINSNAP_SLOTS, 4);
+
+	return db;
+}
+
+static struct database_handle *
+binsnap_db_open(const char *filename, enum database_transaction txn)
+{
+	if (txn == DB_WRITE)
+		return binsnap_db_open_write(filename);
+	return binsnap_db_open_read(filename);
+}
+
+static void
+binsnap_db_close(struct database_handle *db)
+{
+	struct binsnap *bs;
+	char oldpath[BUFSIZE], newpath[BUFSIZE];
+
+	return_if_fail(db != NULL);
+	bs = db->priv;
+
+	mowgli_strlcpy(oldpath, db->file, sizeof oldpath);
+	mowgli_strlcat(oldpath, ".new", sizeof oldpath);
+
+	mowgli_strlcpy(newpath, db->file, sizeof newpath);
+
+	// binsnap is not compressed any further
+	db_save_stats.raw_bytes = 0;
+	db_save_stats.compress_msecs = 0;
+
+	if (db->txn == DB_WRITE && bs->snap != NULL)
+	{
+		struct db_snapshot *const snap = bs->snap;
+
+		snap->buf = (char *) bs->wbuf;
+		snap->len = bs->wlen;
+		snap->fd = bs->fd;
+#ifdef HAVE_FLOCK
+		snap->lockfd = lockfd;
+#else
+		snap->lockfd = -1;
+#endif
+		mowgli_strlcpy(snap->tmppath, oldpath, sizeof snap->tmppath);
+		mowgli_strlcpy(snap->path, newpath, sizeof snap->path);
+
+		bs->wbuf = NULL;
+		db_snapshot_commit(snap);
+	}
+	else if (db->txn == DB_WRITE)
+	{
+		binsnap_flush(db);
+
+		if (close(bs->fd) < 0 && !bs->werror)
+		{
+			slog(LG_ERROR, "db_save(): cannot close %s: %s", oldpath, strerror(errno));
+			bs->werror = true;
+		}
+
+		db_save_stats.bytes = 0;
+
+		// a partial database must never replace the previous one
+		if (bs->werror)
+		{
+			wallops("\2DATABASE ERROR\2: db_save(): cannot write %s, keeping the previous database", oldpath);
+		}
+		// now, replace the old database with the new one, using an atomic rename
+		else if (srename(oldpath, newpath) < 0)
+		{
+			const int errno1 = errno;
+
+			slog(LG_ERROR, "db_save(): cannot rename %s to %s: %s", oldpath, newpath, strerror(errno1));
+			wallops("\2DATABASE ERROR\2: db_save(): cannot rename %s to %s: %s", oldpath, newpath, strerror(errno1));
+		}
+		else
+			db_save_stats.bytes = bs->written;
+
+#ifdef HAVE_FLOCK
+		close(lockfd);
+#endif
+	}
+	else
+		close(bs->fd);
+
+	binsnap_slots_free(bs->slots);
+	sfree(bs->buf);
+	sfree(bs->cells);
+	sfree(bs->arena);
+	sfree(bs->strbuf);
+	sfree(bs->wbuf);
+	sfree(bs);
+	sfree(db->file);
+	sfree(db);
+}
+
+static void
+binsnap_db_parse(struct database_handle *db)
+{
+	const char *cmd;
+	struct timeval start, ts, te;
+	unsigned long applied = 0;      // usecs spent in the row handlers
+
+	s_time(&start);
+
+	while (db_read_next_row(db))
+	{
+		cmd = db_read_word(db);
+		if (!cmd || !*cmd)
+			continue;
+
+		s_time(&ts);
+		db_process(db, cmd);
+		e_time(ts, &te);
+
+		applied += (unsigned long) te.tv_sec * 1000000UL + (unsigned long) te.tv_usec;
+	}
+
+	e_time(start, &te);
+
+	// the rest is reading the file and decoding rows
+	const unsigned long total = (unsigned long) te.tv_sec * 1000000UL + (unsigned long) te.tv_usec;
+
+	slog(LG_INFO, "binsnap: loaded %u rows from %s in %d ms (decoding %lu ms, applying rows %lu ms)", db->line,
+	     db->file, tv2ms(&te), (total > applied ? total - applied : 0) / 1000UL, applied / 1000UL);
+}
+
+static const struct database_module binsnap_mod = {
+	.db_open = binsnap_db_open,
+	.db_close = binsnap_db_close,
+	.db_parse = binsnap_db_parse,
+};
+
+static void
+mod_init(struct module *const restrict m)
+{
+	MODULE_TRY_REQUEST_DEPENDENCY(m, "backend/corestorage")
+
+	db_mod = &binsnap_mod;
+
+	backend_loaded = true;
+
+	m->mflags |= MODFLAG_DBHANDLER;
+}
+
+static void
+mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
+{
+
+}
+
+SIMPLE_DECLARE_MODULE_V1("backend/binsnap", MODULE_UNLOAD_CAPABILITY_NEVER)
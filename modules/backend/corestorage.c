@@ -28,28 +28,262 @@ static unsigned int their_ca_all;
 
 static time_t db_time;
 
+/* The rows for an account or a channel follow each other in the database,
+ * so keep the last one looked up while loading instead of searching the
+ * trees (and calling the myentity_find hook) again for every row.
+ */
+static struct myuser *load_mu;
+static struct mychan *load_mc;
+
 static bool mdep_load_mdeps = true;
 
 #ifdef HAVE_FORK
 static pid_t child_pid;
+static int child_statfd = -1;           // the child reports its db_save_stats through this pipe
+static struct timeval child_start;
+static unsigned int child_stall;        // how long fork() took
+static unsigned int child_journal_gen;  // the journal generation the child's snapshot starts at
 #endif
 
+/* Change journal
+ *
+ * Between full saves, the changes reported through the hooks further down
+ * are appended to DATADIR/services.journal.<generation> and fsync()ed every
+ * general::journal_interval seconds. Every full save starts a new
+ * generation and records it in a JGEN row; on startup the journals from that
+ * generation on are replayed on top of the snapshot, and they are removed
+ * once a later save has completed.
+ *
+ * Only account registrations, drops, renames, passwords and properties, and
+ * channel registrations, drops and access lists are journaled. Everything
+ * else (nicknames and grouping, memos, channel settings and metadata,
+ * network bans, and so on) is only saved by the full saves, which is why
+ * the journal does not let commit_interval go any higher.
+ *
+ * Events only carry names (account UIDs, which survive renames); their rows
+ * are built from the state at the time the journal is flushed, so a burst of
+ * changes to one object costs little.
+ */
+enum journal_event_type
+{
+	JOURNAL_MYUSER_REGISTER,
+	JOURNAL_MYUSER_DROP,
+	JOURNAL_MYUSER_PASSWORD,
+	JOURNAL_MYUSER_METADATA,
+	JOURNAL_MYUSER_RENAME,
+	JOURNAL_MYCHAN_REGISTER,
+	JOURNAL_MYCHAN_DROP,
+	JOURNAL_CHANACS,
+};
+
+struct journal_event
+{
+	mowgli_node_t                   node;
+	enum journal_event_type         type;
+	char *                          name;   // account UID or channel name
+	char *                          arg;    // metadata key or access list target, see corestorage_journal_target()
+};
+
+// priv of a journal's struct database_handle
+struct journal
+{
+	char *                          buf;
+	size_t                          len;
+	size_t                          size;
+	char *                          pos;    // next row, when reading
+	char *                          token;
+};
+
+static unsigned int journal_gen;        // generation being written, or 0 if not journaling
+static unsigned int journal_oldest;     // oldest generation that may still be on disk
+static unsigned int journal_replay_gen; // from the snapshot's JGEN row
+static unsigned int journal_stale_gen;  // first generation not on disk, while not journaling
+static int journal_fd = -1;
+static mowgli_list_t journal_events;
+static mowgli_eventloop_timer_t *journal_timer = NULL;
+
+// write an account and everything hanging off it
+static void
+corestorage_write_myuser(struct database_handle *db, struct myuser *mu)
+{
+	struct metadata *md;
+	mowgli_node_t *tn;
+	mowgli_patricia_iteration_state_t state;
+
+	/* MU <name> <pass> <email> <registered> <lastlogin> <failnum*> <lastfail*>
+	 * <lastfailon*> <flags> <language>
+	 *
+	 *  * failnum, lastfail, and lastfailon are deprecated (moved to metadata)
+	 */
+	char *flags = gflags_tostr(mu_flags, MOWGLI_LIST_LENGTH(&mu->logins) ? mu->flags & ~MU_NOBURSTLOGIN : mu->flags);
+	db_start_row(db, "MU");
+	db_write_word(db, entity(mu)->id);
+	db_write_word(db, entity(mu)->name);
+	db_write_word(db, mu->pass);
+	db_write_word(db, mu->email);
+	db_write_time(db, mu->registered);
+
+	if (MOWGLI_LIST_LENGTH(&mu->logins))
+		db_write_time(db, 0);
+	else
+		db_write_time(db, mu->lastlogin);
+
+	db_write_word(db, flags);
+	db_write_word(db, language_get_name(mu->language));
+	db_commit_row(db);
+
+	if (atheme_object(mu)->metadata)
+	{
+		MOWGLI_PATRICIA_FOREACH(md, &state, atheme_object(mu)->metadata)
+		{
+			db_start_row(db, "MDU");
+			db_write_word(db, entity(mu)->name);
+			db_write_word(db, md->name);
+			db_write_str(db, md->value);
+			db_commit_row(db);
+		}
+	}
+
+	MOWGLI_ITER_FOREACH(tn, mu->memos.head)
+	{
+		struct mymemo *mz = (struct mymemo *)tn->data;
+
+		db_start_row(db, "ME");
+		db_write_word(db, entity(mu)->name);
+		db_write_word(db, mz->sender);
+		db_write_time(db, mz->sent);
+		db_write_uint(db, mz->status);
+		db_write_str(db, mz->text);
+		db_commit_row(db);
+	}
+
+	MOWGLI_ITER_FOREACH(tn, mu->memo_ignores.head)
+	{
+		db_start_row(db, "MI");
+		db_write_word(db, entity(mu)->name);
+		db_write_word(db, (char *)tn->data);
+		db_commit_row(db);
+	}
+
+	MOWGLI_ITER_FOREACH(tn, mu->access_list.head)
+	{
+		db_start_row(db, "AC");
+		db_write_word(db, entity(mu)->name);
+		db_write_word(db, (char *)tn->data);
+		db_commit_row(db);
+	}
+
+	MOWGLI_ITER_FOREACH(tn, mu->nicks.head)
+	{
+		struct mynick *mn = tn->data;
+
+		db_start_row(db, "MN");
+		db_write_word(db, entity(mu)->name);
+		db_write_word(db, mn->nick);
+		db_write_time(db, mn->registered);
+
+		struct user *u = user_find_named(mn->nick);
+		if (u != NULL && u->myuser == mn->owner)
+			db_write_time(db, 0);
+		else
+			db_write_time(db, mn->lastseen);
+
+		db_commit_row(db);
+	}
+
+	MOWGLI_ITER_FOREACH(tn, mu->cert_fingerprints.head)
+	{
+		struct mycertfp *mcfp = tn->data;
+
+		db_start_row(db, "MCFP");
+		db_write_word(db, entity(mu)->name);
+		db_write_word(db, mcfp->certfp);
+		db_commit_row(db);
+	}
+}
+
+// write a channel registration, its access list and their metadata
+static void
+corestorage_write_mychan(struct database_handle *db, struct mychan *mc)
+{
+	struct metadata *md;
+	struct chanacs *ca;
+	mowgli_node_t *tn;
+	mowgli_patricia_iteration_state_t state2;
+
+	char *flags = gflags_tostr(mc_flags, mc->flags);
+
+	// MC <name> <registered> <used> <flags> <mlock_on> <mlock_off> <mlock_limit> [mlock_key]
+	db_start_row(db, "MC");
+	db_write_word(db, mc->name);
+	db_write_time(db, mc->registered);
+	db_write_time(db, mc->used);
+	db_write_word(db, flags);
+	db_write_uint(db, mc->mlock_on);
+	db_write_uint(db, mc->mlock_off);
+	db_write_uint(db, mc->mlock_limit);
+	db_write_word(db, mc->mlock_key ? mc->mlock_key : "");
+	db_commit_row(db);
+
+	MOWGLI_ITER_FOREACH(tn, mc->chanacs.head)
+	{
+		struct myentity *setter = NULL;
+		ca = (struct chanacs *)tn->data;
+
+		db_start_row(db, "CA");
+		db_write_word(db, ca->mychan->name);
+		db_write_word(db, ca->entity ? ca->entity->name : ca->host);
+		db_write_word(db, bitmask_to_flags(ca->level));
+		db_write_time(db, ca->tmodified);
+
+		if (*ca->setter_uid != '\0' && (setter = myentity_find_uid(ca->setter_uid)))
+			db_write_word(db, setter->name);
+		else
+			db_write_word(db, "*");
+
+		db_commit_row(db);
+
+		if (atheme_object(ca)->metadata)
+		{
+			MOWGLI_PATRICIA_FOREACH(md, &state2, atheme_object(ca)->metadata)
+			{
+				db_start_row(db, "MDA");
+				db_write_word(db, ca->mychan->name);
+				db_write_word(db, (ca->entity) ? ca->entity->name : ca->host);
+				db_write_word(db, md->name);
+				db_write_str(db, md->value);
+				db_commit_row(db);
+			}
+		}
+	}
+
+	if (atheme_object(mc)->metadata)
+	{
+		MOWGLI_PATRICIA_FOREACH(md, &state2, atheme_object(mc)->metadata)
+		{
+			db_start_row(db, "MDC");
+			db_write_word(db, mc->name);
+			db_write_word(db, md->name);
+			db_write_str(db, md->value);
+			db_commit_row(db);
+		}
+	}
+}
+
 // write atheme.db (core fields)
 static void
 corestorage_db_save(struct database_handle *db)
 {
 	struct metadata *md;
-	struct myuser *mu;
 	struct myentity *ment;
 	struct myuser_name *mun;
 	struct mychan *mc;
-	struct chanacs *ca;
 	struct kline *k;
 	struct xline *x;
 	struct qline *q;
 	struct svsignore *svsignore;
 	struct soper *soper;
-	mowgli_node_t *n, *tn;
+	mowgli_node_t *n;
 	mowgli_patricia_iteration_state_t state;
 	struct myentity_iteration_state mestate;
 
@@ -84,102 +318,18 @@ corestorage_db_save(struct database_handle *db)
 	db_write_time(db, CURRTIME);
 	db_commit_row(db);
 
-	slog(LG_DEBUG, "db_save(): saving myusers");
-
-	MYENTITY_FOREACH_T(ment, &mestate, ENT_USER)
+	// changes after this snapshot are in this generation of the journal and later ones
+	if (journal_gen != 0)
 	{
-		mu = user(ment);
-		/* MU <name> <pass> <email> <registered> <lastlogin> <failnum*> <lastfail*>
-		 * <lastfailon*> <flags> <language>
-		 *
-		 *  * failnum, lastfail, and lastfailon are deprecated (moved to metadata)
-		 */
-		char *flags = gflags_tostr(mu_flags, MOWGLI_LIST_LENGTH(&mu->logins) ? mu->flags & ~MU_NOBURSTLOGIN : mu->flags);
-		db_start_row(db, "MU");
-		db_write_word(db, entity(mu)->id);
-		db_write_word(db, entity(mu)->name);
-		db_write_word(db, mu->pass);
-		db_write_word(db, mu->email);
-		db_write_time(db, mu->registered);
-
-		if (MOWGLI_LIST_LENGTH(&mu->logins))
-			db_write_time(db, 0);
-		else
-			db_write_time(db, mu->lastlogin);
-
-		db_write_word(db, flags);
-		db_write_word(db, language_get_name(mu->language));
+		db_start_row(db, "JGEN");
+		db_write_uint(db, journal_gen);
 		db_commit_row(db);
+	}
 
-		if (atheme_object(mu)->metadata)
-		{
-			MOWGLI_PATRICIA_FOREACH(md, &state, atheme_object(mu)->metadata)
-			{
-				db_start_row(db, "MDU");
-				db_write_word(db, entity(mu)->name);
-				db_write_word(db, md->name);
-				db_write_str(db, md->value);
-				db_commit_row(db);
-			}
-		}
-
-		MOWGLI_ITER_FOREACH(tn, mu->memos.head)
-		{
-			struct mymemo *mz = (struct mymemo *)tn->data;
-
-			db_start_row(db, "ME");
-			db_write_word(db, entity(mu)->name);
-			db_write_word(db, mz->sender);
-			db_write_time(db, mz->sent);
-			db_write_uint(db, mz->status);
-			db_write_str(db, mz->text);
-			db_commit_row(db);
-		}
-
-		MOWGLI_ITER_FOREACH(tn, mu->memo_ignores.head)
-		{
-			db_start_row(db, "MI");
-			db_write_word(db, entity(mu)->name);
-			db_write_word(db, (char *)tn->data);
-			db_commit_row(db);
-		}
-
-		MOWGLI_ITER_FOREACH(tn, mu->access_list.head)
-		{
-			db_start_row(db, "AC");
-			db_write_word(db, entity(mu)->name);
-			db_write_word(db, (char *)tn->data);
-			db_commit_row(db);
-		}
-
-		MOWGLI_ITER_FOREACH(tn, mu->nicks.head)
-		{
-			struct mynick *mn = tn->data;
-
-			db_start_row(db, "MN");
-			db_write_word(db, entity(mu)->name);
-			db_write_word(db, mn->nick);
-			db_write_time(db, mn->registered);
-
-			struct user *u = user_find_named(mn->nick);
-			if (u != NULL && u->myuser == mn->owner)
-				db_write_time(db, 0);
-			else
-				db_write_time(db, mn->lastseen);
-
-			db_commit_row(db);
-		}
-
-		MOWGLI_ITER_FOREACH(tn, mu->cert_fingerprints.head)
-		{
-			struct mycertfp *mcfp = tn->data;
+	slog(LG_DEBUG, "db_save(): saving myusers");
 
-			db_start_row(db, "MCFP");
-			db_write_word(db, entity(mu)->name);
-			db_write_word(db, mcfp->certfp);
-			db_commit_row(db);
-		}
-	}
+	MYENTITY_FOREACH_T(ment, &mestate, ENT_USER)
+		corestorage_write_myuser(db, user(ment));
 
 	// XXX: groupserv hack.  remove when we have proper dependency resolution. --nenolod
 	hook_call_db_write_pre_ca(db);
@@ -187,79 +337,7 @@ corestorage_db_save(struct database_handle *db)
 	slog(LG_DEBUG, "db_save(): saving mychans");
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
-	{
-		mowgli_patricia_iteration_state_t state2;
-
-		char *flags = gflags_tostr(mc_flags, mc->flags);
-
-		// find a founder
-		mu = NULL;
-		MOWGLI_ITER_FOREACH(tn, mc->chanacs.head)
-		{
-			ca = (struct chanacs *)tn->data;
-			if (ca->entity != NULL && ca->level & CA_FOUNDER)
-			{
-				mu = user(ca->entity);
-				break;
-			}
-		}
-
-		// MC <name> <registered> <used> <flags> <mlock_on> <mlock_off> <mlock_limit> [mlock_key]
-		db_start_row(db, "MC");
-		db_write_word(db, mc->name);
-		db_write_time(db, mc->registered);
-		db_write_time(db, mc->used);
-		db_write_word(db, flags);
-		db_write_uint(db, mc->mlock_on);
-		db_write_uint(db, mc->mlock_off);
-		db_write_uint(db, mc->mlock_limit);
-		db_write_word(db, mc->mlock_key ? mc->mlock_key : "");
-		db_commit_row(db);
-
-		MOWGLI_ITER_FOREACH(tn, mc->chanacs.head)
-		{
-			struct myentity *setter = NULL;
-			ca = (struct chanacs *)tn->data;
-
-			db_start_row(db, "CA");
-			db_write_word(db, ca->mychan->name);
-			db_write_word(db, ca->entity ? ca->entity->name : ca->host);
-			db_write_word(db, bitmask_to_flags(ca->level));
-			db_write_time(db, ca->tmodified);
-
-			if (*ca->setter_uid != '\0' && (setter = myentity_find_uid(ca->setter_uid)))
-				db_write_word(db, setter->name);
-			else
-				db_write_word(db, "*");
-
-			db_commit_row(db);
-
-			if (atheme_object(ca)->metadata)
-			{
-				MOWGLI_PATRICIA_FOREACH(md, &state2, atheme_object(ca)->metadata)
-				{
-					db_start_row(db, "MDA");
-					db_write_word(db, ca->mychan->name);
-					db_write_word(db, (ca->entity) ? ca->entity->name : ca->host);
-					db_write_word(db, md->name);
-					db_write_str(db, md->value);
-					db_commit_row(db);
-				}
-			}
-		}
-
-		if (atheme_object(mc)->metadata)
-		{
-			MOWGLI_PATRICIA_FOREACH(md, &state2, atheme_object(mc)->metadata)
-			{
-				db_start_row(db, "MDC");
-				db_write_word(db, mc->name);
-				db_write_word(db, md->name);
-				db_write_str(db, md->value);
-				db_commit_row(db);
-			}
-		}
-	}
+		corestorage_write_mychan(db, mc);
 
 	// Old names
 	MOWGLI_PATRICIA_FOREACH(mun, &state, oldnameslist)
@@ -386,6 +464,24 @@ corestorage_db_save(struct database_handle *db)
 	}
 }
 
+static struct myuser *
+corestorage_load_myuser(const char *name)
+{
+	if (load_mu == NULL || irccasecmp(entity(load_mu)->name, name) != 0)
+		load_mu = myuser_find(name);
+
+	return load_mu;
+}
+
+static struct mychan *
+corestorage_load_mychan(const char *name)
+{
+	if (load_mc == NULL || irccasecmp(load_mc->name, name) != 0)
+		load_mc = mychan_find(name);
+
+	return load_mc;
+}
+
 static void ATHEME_FATTR_NORETURN
 corestorage_h_unknown(struct database_handle *db, const char *type)
 {
@@ -485,7 +581,7 @@ corestorage_h_mu(struct database_handle *db, const char *type)
 
 	name = db_sread_word(db);
 
-	if (myuser_find(name))
+	if (corestorage_load_myuser(name))
 	{
 		slog(LG_INFO, "db-h-mu: line %u: skipping duplicate account %s", db->line, name);
 		return;
@@ -511,7 +607,7 @@ corestorage_h_mu(struct database_handle *db, const char *type)
 	language = db_read_word(db);
 
 
-	mu = myuser_add_id(uid, name, pass, email, flags);
+	mu = load_mu = myuser_add_id(uid, name, pass, email, flags);
 	mu->registered = reg;
 
 	if (login != 0)
@@ -541,7 +637,7 @@ corestorage_h_me(struct database_handle *db, const char *type)
 	status = db_sread_uint(db);
 	text = db_sread_str(db);
 
-	if (!(mu = myuser_find(dest)))
+	if (!(mu = corestorage_load_myuser(dest)))
 	{
 		slog(LG_DEBUG, "db-h-me: line %u: memo for unknown account %s", db->line, dest);
 		return;
@@ -568,7 +664,7 @@ corestorage_h_mi(struct database_handle *db, const char *type)
 	user = db_sread_word(db);
 	target = db_sread_word(db);
 
-	mu = myuser_find(user);
+	mu = corestorage_load_myuser(user);
 	if (!mu)
 	{
 		slog(LG_DEBUG, "db-h-mi: line %u: ignore for unknown account %s", db->line, user);
@@ -587,7 +683,7 @@ corestorage_h_ac(struct database_handle *db, const char *type)
 	user = db_sread_word(db);
 	mask = db_sread_word(db);
 
-	mu = myuser_find(user);
+	mu = corestorage_load_myuser(user);
 	if (!mu)
 	{
 		slog(LG_DEBUG, "db-h-ac: line %u: access entry for unknown account %s", db->line, user);
@@ -610,7 +706,7 @@ corestorage_h_mn(struct database_handle *db, const char *type)
 	reg = db_sread_time(db);
 	seen = db_sread_time(db);
 
-	mu = myuser_find(user);
+	mu = corestorage_load_myuser(user);
 	if (!mu)
 	{
 		slog(LG_DEBUG, "db-h-mn: line %u: registered nick %s for unknown account %s", db->line, nick, user);
@@ -644,7 +740,7 @@ corestorage_h_mcfp(struct database_handle *db, const char *type)
 	user = db_sread_word(db);
 	certfp = db_sread_word(db);
 
-	mu = myuser_find(user);
+	mu = corestorage_load_myuser(user);
 	if (!mu)
 	{
 		slog(LG_DEBUG, "db-h-mcfp: certfp %s for unknown account %s", certfp, user);
@@ -714,7 +810,7 @@ corestorage_h_mc(struct database_handle *db, const char *type)
 	unsigned int flags = 0;
 
 	mowgli_strlcpy(buf, name, sizeof buf);
-	struct mychan *mc = mychan_add(buf);
+	struct mychan *mc = load_mc = mychan_add(buf);
 
 	mc->registered = db_sread_time(db);
 	mc->used = db_sread_time(db);
@@ -780,11 +876,11 @@ corestorage_h_md(struct database_handle *db, const char *type)
 
 	if (!strcmp(type, "MDU"))
 	{
-		obj = myuser_find(name);
+		obj = corestorage_load_myuser(name);
 	}
 	else if (!strcmp(type, "MDC"))
 	{
-		obj = mychan_find(name);
+		obj = corestorage_load_mychan(name);
 		if (!(their_ca_all & CA_EXEMPT) &&
 				!strcmp(prop, "private:templates"))
 		{
@@ -798,7 +894,7 @@ corestorage_h_md(struct database_handle *db, const char *type)
 		if (mask != NULL)
 		{
 			*mask++ = '\0';
-			obj = chanacs_find_by_mask(mychan_find(name), mask, CA_NONE);
+			obj = chanacs_find_by_mask(corestorage_load_mychan(name), mask, CA_NONE);
 		}
 	}
 	else if (!strcmp(type, "MDN"))
@@ -837,7 +933,7 @@ corestorage_h_mda(struct database_handle *db, const char *type)
 	prop = db_sread_word(db);
 	value = db_sread_str(db);
 
-	obj = chanacs_find_by_mask(mychan_find(name), mask, CA_NONE);
+	obj = chanacs_find_by_mask(corestorage_load_mychan(name), mask, CA_NONE);
 
 	if (obj == NULL)
 	{
@@ -869,7 +965,7 @@ corestorage_h_ca(struct database_handle *db, const char *type)
 
 	tmod = db_sread_time(db);
 
-	mc = mychan_find(chan);
+	mc = corestorage_load_mychan(chan);
 	mt = myentity_find(target);
 
 	setter = NULL;
@@ -989,7 +1085,7 @@ corestorage_h_xl(struct database_handle *db, const char *type)
 	x->expires = x->settime + x->duration;
 
 	if (id)
-		x->number = id;
+		xline_set_number(x, id);
 }
 
 static void
@@ -1025,117 +1121,1153 @@ corestorage_h_ql(struct database_handle *db, const char *type)
 	q->expires = q->settime + q->duration;
 
 	if (id)
-		q->number = id;
+		qline_set_number(q, id);
 }
 
 static void
-corestorage_ignore_row(struct database_handle *db, const char *type)
+corestorage_h_jgen(struct database_handle *db, const char *type)
 {
-	return;
+	journal_replay_gen = db_sread_uint(db);
 }
 
 static void
-corestorage_db_load(const char *filename)
+corestorage_h_jdu(struct database_handle *db, const char *type)
 {
-	struct database_handle *db;
-
-	db = db_open(filename, DB_READ);
-	if (db == NULL)
-		return;
+	struct myuser *const mu = myuser_find_uid(db_sread_word(db));
 
-	db_time = 0;
+	load_mu = NULL;
 
-	db_parse(db);
-	db_close(db);
+	if (mu != NULL)
+		atheme_object_unref(mu);
 }
 
 static void
-corestorage_db_write_blocking(void *filename)
+corestorage_h_jpw(struct database_handle *db, const char *type)
 {
-	struct database_handle *db;
+	struct myuser *const mu = myuser_find_uid(db_sread_word(db));
+	const char *const pass = db_sread_word(db);
 
-	db = db_open(filename, DB_WRITE);
+	if (mu != NULL)
+		mowgli_strlcpy(mu->pass, pass, sizeof mu->pass);
+}
 
-	if (! db)
-	{
-		slog(LG_ERROR, "db_write_blocking(): db_open() failed, aborting save");
-		return;
-	}
+static void
+corestorage_h_jmdu(struct database_handle *db, const char *type)
+{
+	struct myuser *const mu = myuser_find_uid(db_sread_word(db));
+	const char *const prop = db_sread_word(db);
+	const char *const value = db_read_str(db);
 
-	corestorage_db_save(db);
-	hook_call_db_write(db);
+	if (mu == NULL)
+		return;
 
-	db_close(db);
+	if (value != NULL)
+		metadata_add(mu, prop, value);
+	else
+		metadata_delete(mu, prop);
 }
 
-#ifdef HAVE_FORK
 static void
-corestorage_db_saved_cb(pid_t pid, int status, void *data)
+corestorage_h_jnu(struct database_handle *db, const char *type)
 {
-	if (child_pid != pid)
-		return; // probably killed our child for a forced write
-	else
-	{
-		child_pid = 0;
-		slog(LG_DEBUG, "db_save(): finished asynchronous DB write");
-	}
+	struct myuser *const mu = myuser_find_uid(db_sread_word(db));
+	const char *const name = db_sread_word(db);
+
+	if (mu != NULL && strcmp(entity(mu)->name, name) != 0)
+		myuser_rename(mu, name);
 }
-#endif
 
 static void
-corestorage_db_write(void *filename, enum db_save_strategy strategy)
+corestorage_h_jdc(struct database_handle *db, const char *type)
 {
-#ifndef HAVE_FORK
-	corestorage_db_write_blocking(filename);
-#else
-	if (child_pid && strategy == DB_SAVE_BG_REGULAR)
-	{
-		slog(LG_DEBUG, "db_save(): previous save unfinished, skipping save");
-		return;
-	}
+	struct mychan *const mc = mychan_find(db_sread_word(db));
 
-	if (child_pid)
-	{
-		slog(LG_DEBUG, "db_save(): interrupting unfinished previous save for forced save");
-		if (kill(child_pid, SIGKILL) == -1 && errno != ESRCH)
-		{
-			slog(LG_ERROR, "db_save(): kill() on previous save failed; trying to carry on somehow...");
-			waitpid(child_pid, NULL, 0);
-		}
-	}
+	load_mc = NULL;
 
-	if (config_options.db_save_blocking)
-		strategy = DB_SAVE_BLOCKING;
+	if (mc != NULL)
+		atheme_object_unref(mc);
+}
 
-	if (strategy == DB_SAVE_BLOCKING)
-	{
-		corestorage_db_write_blocking(filename);
-		return;
-	}
+/* Access list entries go by the UID of their entity in the journal, so that
+ * renaming an account in the same window cannot make the rows miss it or hit
+ * another one. Exttargets have no UID and keep their names, which start with
+ * '$'; host entries are their masks, which contain '@'.
+ */
+static const char *
+corestorage_journal_target(const struct chanacs *ca)
+{
+	if (ca->entity == NULL)
+		return ca->host;
 
-	pid_t pid = fork();
-	switch (pid)
-	{
-		case -1:
-			slog(LG_ERROR, "db_save(): fork() failed; writing database synchronously");
-			corestorage_db_write_blocking(filename);
-			return;
+	if (*ca->entity->name == '$')
+		return ca->entity->name;
 
-		case 0:
-			corestorage_db_write_blocking(filename);
-			exit(EXIT_SUCCESS);
+	return ca->entity->id;
+}
+
+static struct myentity *
+corestorage_journal_entity(const char *target)
+{
+	if (*target == '$')
+		return myentity_find(target);
+
+	if (strchr(target, '@') != NULL)
+		return NULL;
+
+	return myentity_find_uid(target);
+}
+
+static struct chanacs *
+corestorage_journal_chanacs(struct mychan *mc, const char *target)
+{
+	struct myentity *const mt = corestorage_journal_entity(target);
+
+	if (mt != NULL)
+		return chanacs_find_literal(mc, mt, 0);
+
+	if (strchr(target, '@') == NULL)
+		return NULL;
+
+	return chanacs_find_host_literal(mc, target, 0);
+}
+
+static void
+corestorage_h_jca(struct database_handle *db, const char *type)
+{
+	const char *const chan = db_sread_word(db);
+	const char *const target = db_sread_word(db);
+	const unsigned int flags = flags_to_bitmask(db_sread_word(db), 0);
+	const time_t tmod = db_sread_time(db);
+	struct myentity *const setter = myentity_find_uid(db_sread_word(db));
+	struct mychan *mc;
+	struct myentity *mt;
+	struct chanacs *ca;
+
+	if (! (mc = mychan_find(chan)))
+		return;
+
+	if ((ca = corestorage_journal_chanacs(mc, target)) != NULL)
+	{
+		ca->level = flags;
+		ca->tmodified = tmod;
+
+		if (setter != NULL)
+			mowgli_strlcpy(ca->setter_uid, setter->id, sizeof ca->setter_uid);
+		else
+			ca->setter_uid[0] = '\0';
+
+		chanacs_index_invalidate(mc);
+	}
+	else if ((mt = corestorage_journal_entity(target)) != NULL)
+		chanacs_add(mc, mt, flags, tmod, setter);
+	else if (validhostmask(target))
+		chanacs_add_host(mc, target, flags, tmod, setter);
+}
+
+static void
+corestorage_h_jcad(struct database_handle *db, const char *type)
+{
+	struct mychan *const mc = mychan_find(db_sread_word(db));
+	const char *const target = db_sread_word(db);
+	struct chanacs *ca;
+
+	if (mc != NULL && (ca = corestorage_journal_chanacs(mc, target)) != NULL)
+		atheme_object_unref(ca);
+}
+
+static void
+corestorage_ignore_row(struct database_handle *db, const char *type)
+{
+	return;
+}
+
+static void
+journal_put(struct journal *j, const char *str, size_t len)
+{
+	if (j->size - j->len < len)
+	{
+		while (j->size - j->len < len)
+			j->size = j->size ? j->size * 2 : BUFSIZE * 4;
+
+		j->buf = srealloc(j->buf, j->size);
+	}
+
+	memcpy(j->buf + j->len, str, len);
+	j->len += len;
+}
+
+static bool
+journal_read_next_row(struct database_handle *db)
+{
+	struct journal *const j = db->priv;
+	char *const end = j->buf + j->len;
+	char *nl;
+
+	if (j->pos >= end)
+		return false;
+
+	if (! (nl = memchr(j->pos, '\n', (size_t) (end - j->pos))))
+	{
+		// the last write before a crash may have been cut short
+		slog(LG_INFO, "corestorage: %s: ignoring incomplete last row", db->file);
+		j->pos = end;
+		return false;
+	}
+
+	*nl = '\0';
+	j->token = j->pos;
+	j->pos = nl + 1;
+
+	db->line++;
+	db->token = 0;
+	return true;
+}
+
+static const char *
+journal_read_word(struct database_handle *db)
+{
+	struct journal *const j = db->priv;
+	char *const res = j->token;
+	char *ptr;
+
+	if (res == NULL)
+		return NULL;
+
+	if ((ptr = strchr(res, ' ')) != NULL)
+	{
+		*ptr++ = '\0';
+		j->token = ptr;
+	}
+	else
+		j->token = NULL;
+
+	db->token++;
+	return res;
+}
+
+static const char *
+journal_read_str(struct database_handle *db)
+{
+	struct journal *const j = db->priv;
+	char *const res = j->token;
+
+	j->token = NULL;
+	db->token++;
+	return res;
+}
+
+static bool
+journal_read_int(struct database_handle *db, int *res)
+{
+	const char *const s = journal_read_word(db);
+	char *rp;
+
+	if (s == NULL)
+		return false;
+
+	*res = (int) strtol(s, &rp, 0);
+	return *s && ! *rp;
+}
+
+static bool
+journal_read_uint(struct database_handle *db, unsigned int *res)
+{
+	const char *const s = journal_read_word(db);
+	char *rp;
+
+	if (s == NULL)
+		return false;
+
+	*res = (unsigned int) strtoul(s, &rp, 0);
+	return *s && ! *rp;
+}
+
+static bool
+journal_read_time(struct database_handle *db, time_t *res)
+{
+	const char *const s = journal_read_word(db);
+	char *rp;
+
+	if (s == NULL)
+		return false;
+
+	*res = (time_t) strtoll(s, &rp, 0);
+	return *s && ! *rp;
+}
+
+static bool
+journal_start_row(struct database_handle *db, const char *type)
+{
+	journal_put(db->priv, type, strlen(type));
+	return true;
+}
+
+static bool
+journal_write_word(struct database_handle *db, const char *word)
+{
+	if (word == NULL)
+		word = "*";
+
+	journal_put(db->priv, " ", 1);
+	journal_put(db->priv, word, strlen(word));
+	return true;
+}
+
+static bool
+journal_write_int(struct database_handle *db, int num)
+{
+	char buf[BUFSIZE];
+
+	(void) snprintf(buf, sizeof buf, "%d", num);
+	return journal_write_word(db, buf);
+}
+
+static bool
+journal_write_uint(struct database_handle *db, unsigned int num)
+{
+	char buf[BUFSIZE];
+
+	(void) snprintf(buf, sizeof buf, "%u", num);
+	return journal_write_word(db, buf);
+}
+
+static bool
+journal_write_time(struct database_handle *db, time_t tm)
+{
+	char buf[BUFSIZE];
+
+	(void) snprintf(buf, sizeof buf, "%lld", (long long) tm);
+	return journal_write_word(db, buf);
+}
+
+static bool
+journal_commit_row(struct database_handle *db)
+{
+	journal_put(db->priv, "\n", 1);
+	return true;
+}
+
+// rows in OpenSEX syntax, collected in memory
+static const struct database_vtable journal_vt = {
+	.name = "journal",
+	.read_next_row = journal_read_next_row,
+	.read_word = journal_read_word,
+	.read_str = journal_read_str,
+	.read_int = journal_read_int,
+	.read_uint = journal_read_uint,
+	.read_time = journal_read_time,
+	.start_row = journal_start_row,
+	.write_word = journal_write_word,
+	.write_str = journal_write_word,
+	.write_int = journal_write_int,
+	.write_uint = journal_write_uint,
+	.write_time = journal_write_time,
+	.commit_row = journal_commit_row
+};
+
+static void
+corestorage_journal_path(char *buf, size_t bufsize, unsigned int gen)
+{
+	(void) snprintf(buf, bufsize, "%s/services.journal.%u", datadir, gen);
+}
+
+// write out everything in db's buffer, and wait for it to reach the disk
+static void
+corestorage_journal_write(struct database_handle *db)
+{
+	struct journal *const j = db->priv;
+	size_t done = 0;
+
+	while (done < j->len)
+	{
+		const ssize_t n = write(journal_fd, j->buf + done, j->len - done);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			slog(LG_ERROR, "corestorage: cannot write to %s: %s", db->file, strerror(errno));
+			wallops("\2DATABASE ERROR\2: cannot write to %s: %s", db->file, strerror(errno));
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+#ifdef HAVE_FSYNC
+	if (done != 0 && fsync(journal_fd) < 0)
+		slog(LG_ERROR, "corestorage: cannot fsync %s: %s", db->file, strerror(errno));
+#endif
+
+	j->len = 0;
+}
+
+static void
+corestorage_journal_emit(struct database_handle *db, const struct journal_event *ev)
+{
+	struct myuser *mu;
+	struct mychan *mc;
+	struct chanacs *ca;
+	struct metadata *md;
+	struct myentity *setter;
+
+	switch (ev->type)
+	{
+		case JOURNAL_MYUSER_REGISTER:
+			if (! (mu = myuser_find_uid(ev->name)))
+				break;
+
+			// the MU row keeps its UID when replayed; don't let later registrations hand it out again
+			db_start_row(db, "LUID");
+			db_write_word(db, myentity_get_last_uid());
+			db_commit_row(db);
+
+			corestorage_write_myuser(db, mu);
+			break;
+
+		case JOURNAL_MYUSER_DROP:
+			db_start_row(db, "JDU");
+			db_write_word(db, ev->name);
+			db_commit_row(db);
+			break;
+
+		case JOURNAL_MYUSER_PASSWORD:
+			if (! (mu = myuser_find_uid(ev->name)))
+				break;
+
+			db_start_row(db, "JPW");
+			db_write_word(db, ev->name);
+			db_write_word(db, mu->pass);
+			db_commit_row(db);
+			break;
+
+		case JOURNAL_MYUSER_METADATA:
+			if (! (mu = myuser_find_uid(ev->name)))
+				break;
+
+			// JMDU <account UID> <property> [value]; no value means deleted
+			db_start_row(db, "JMDU");
+			db_write_word(db, ev->name);
+			db_write_word(db, ev->arg);
+			if ((md = metadata_find(mu, ev->arg)) != NULL)
+				db_write_str(db, md->value);
+			db_commit_row(db);
+			break;
+
+		case JOURNAL_MYUSER_RENAME:
+			if (! (mu = myuser_find_uid(ev->name)))
+				break;
+
+			db_start_row(db, "JNU");
+			db_write_word(db, ev->name);
+			db_write_word(db, entity(mu)->name);
+			db_commit_row(db);
+			break;
+
+		case JOURNAL_MYCHAN_REGISTER:
+			if ((mc = mychan_find(ev->name)) != NULL)
+				corestorage_write_mychan(db, mc);
+			break;
+
+		case JOURNAL_MYCHAN_DROP:
+			db_start_row(db, "JDC");
+			db_write_word(db, ev->name);
+			db_commit_row(db);
+			break;
+
+		case JOURNAL_CHANACS:
+			if (! (mc = mychan_find(ev->name)))
+				break;
+
+			if (! (ca = corestorage_journal_chanacs(mc, ev->arg)))
+			{
+				db_start_row(db, "JCAD");
+				db_write_word(db, ev->name);
+				db_write_word(db, ev->arg);
+				db_commit_row(db);
+				break;
+			}
+
+			// JCA <channel> <target> <flags> <modified> <setter UID>, like CA but by UID
+			db_start_row(db, "JCA");
+			db_write_word(db, ev->name);
+			db_write_word(db, ev->arg);
+			db_write_word(db, bitmask_to_flags(ca->level));
+			db_write_time(db, ca->tmodified);
+
+			if (*ca->setter_uid != '\0' && (setter = myentity_find_uid(ca->setter_uid)))
+				db_write_word(db, setter->id);
+			else
+				db_write_word(db, "*");
+
+			db_commit_row(db);
+			break;
+	}
+}
+
+static void
+corestorage_journal_flush(void)
+{
+	struct journal j = { .buf = NULL };
+	struct database_handle db = { .priv = &j, .vt = &journal_vt, .txn = DB_WRITE };
+	char path[BUFSIZE];
+	mowgli_node_t *n, *tn;
+
+	if (journal_timer != NULL)
+	{
+		(void) mowgli_timer_destroy(base_eventloop, journal_timer);
+		journal_timer = NULL;
+	}
+
+	if (! MOWGLI_LIST_LENGTH(&journal_events))
+		return;
+
+	corestorage_journal_path(path, sizeof path, journal_gen);
+	db.file = path;
+
+	db_start_row(&db, "TS");
+	db_write_time(&db, CURRTIME);
+	db_commit_row(&db);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, journal_events.head)
+	{
+		struct journal_event *const ev = n->data;
+
+		corestorage_journal_emit(&db, ev);
+
+		mowgli_node_delete(&ev->node, &journal_events);
+		sfree(ev->name);
+		sfree(ev->arg);
+		sfree(ev);
+	}
+
+	if (journal_fd != -1)
+		corestorage_journal_write(&db);
+
+	sfree(j.buf);
+}
+
+static void
+corestorage_journal_timer_cb(void ATHEME_VATTR_UNUSED *arg)
+{
+	// one-shot timers free themselves
+	journal_timer = NULL;
+	corestorage_journal_flush();
+}
+
+static void
+corestorage_journal_event(enum journal_event_type type, const char *name, const char *arg)
+{
+	if (journal_gen == 0)
+		return;
+
+	struct journal_event *const ev = smalloc(sizeof *ev);
+
+	ev->type = type;
+	ev->name = sstrdup(name);
+	ev->arg = arg ? sstrdup(arg) : NULL;
+
+	mowgli_node_add(ev, &ev->node, &journal_events);
+
+	// journal_interval is only read at startup, but may have been rehashed to 0 since
+	if (journal_timer == NULL)
+		journal_timer = mowgli_timer_add_once(base_eventloop, "journal_flush", corestorage_journal_timer_cb,
+		                                      NULL, config_options.journal_interval ? config_options.journal_interval : 1);
+}
+
+static bool
+corestorage_journal_open(unsigned int gen)
+{
+	struct journal j = { .buf = NULL };
+	struct database_handle db = { .priv = &j, .vt = &journal_vt, .txn = DB_WRITE };
+	char path[BUFSIZE];
+
+	corestorage_journal_path(path, sizeof path, gen);
+	db.file = path;
+
+	journal_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (journal_fd == -1)
+	{
+		slog(LG_ERROR, "corestorage: cannot open %s for writing: %s", path, strerror(errno));
+		wallops("\2DATABASE ERROR\2: cannot open %s for writing: %s", path, strerror(errno));
+		return false;
+	}
+
+	// the handlers need these to read the rows that follow
+	db_start_row(&db, "DBV");
+	db_write_uint(&db, 12);
+	db_commit_row(&db);
+
+	db_start_row(&db, "CF");
+	db_write_word(&db, bitmask_to_flags(ca_all));
+	db_commit_row(&db);
+
+	corestorage_journal_write(&db);
+	sfree(j.buf);
+
+	journal_gen = gen;
+	return true;
+}
+
+static void
+corestorage_journal_close(void)
+{
+	corestorage_journal_flush();
+
+	if (journal_fd != -1)
+	{
+		(void) close(journal_fd);
+		journal_fd = -1;
+	}
+}
+
+/* Start a new generation for the changes made after the snapshot about to
+ * be written. Returns the generation that snapshot starts at, for
+ * corestorage_journal_prune() once it is on disk.
+ */
+static unsigned int
+corestorage_journal_rotate(void)
+{
+	// a tool may be writing somewhere else; leave the journals alone
+	if (journal_gen == 0)
+		return offline_mode ? 0 : journal_stale_gen;
+
+	const unsigned int gen = journal_gen + 1;
+
+	corestorage_journal_close();
+
+	if (! corestorage_journal_open(gen))
+	{
+		journal_gen = 0;
+		journal_stale_gen = gen;
+	}
+
+	return gen;
+}
+
+// a snapshot starting at generation gen is safely on disk; the older journals are obsolete
+static void
+corestorage_journal_prune(unsigned int gen)
+{
+	char path[BUFSIZE];
+
+	for (; journal_oldest != 0 && journal_oldest < gen; journal_oldest++)
+	{
+		corestorage_journal_path(path, sizeof path, journal_oldest);
+
+		if (unlink(path) < 0 && errno != ENOENT)
+			slog(LG_ERROR, "corestorage: cannot remove %s: %s", path, strerror(errno));
+	}
+}
+
+static bool
+corestorage_journal_replay_one(unsigned int gen)
+{
+	struct journal j = { .buf = NULL };
+	struct database_handle db = { .priv = &j, .vt = &journal_vt, .txn = DB_READ };
+	char path[BUFSIZE];
+	struct stat sb;
+	struct timeval ts, te;
+	int fd;
+
+	s_time(&ts);
+	corestorage_journal_path(path, sizeof path, gen);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+	{
+		if (errno != ENOENT)
+		{
+			slog(LG_ERROR, "corestorage: cannot open %s for reading: %s", path, strerror(errno));
+			slog(LG_ERROR, "corestorage: exiting to avoid data loss");
+			exit(EXIT_FAILURE);
+		}
+
+		return false;
+	}
+
+	if (fstat(fd, &sb) == 0 && sb.st_size > 0)
+	{
+		j.size = (size_t) sb.st_size;
+		j.buf = smalloc(j.size);
+
+		while (j.len < j.size)
+		{
+			const ssize_t n = read(fd, j.buf + j.len, j.size - j.len);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n < 0)
+			{
+				slog(LG_ERROR, "corestorage: cannot read %s: %s", path, strerror(errno));
+				slog(LG_ERROR, "corestorage: exiting to avoid data loss");
+				exit(EXIT_FAILURE);
+			}
+
+			if (n == 0)
+				break;
+
+			j.len += (size_t) n;
+		}
+	}
+
+	(void) close(fd);
+
+	j.pos = j.buf;
+	db.file = path;
+
+	while (db_read_next_row(&db))
+	{
+		const char *const cmd = db_read_word(&db);
+
+		if (cmd != NULL && *cmd)
+			db_process(&db, cmd);
+	}
+
+	e_time(ts, &te);
+	slog(LG_INFO, "corestorage: replayed %u rows from %s in %d ms", db.line, path, tv2ms(&te));
+
+	sfree(j.buf);
+	return true;
+}
+
+/* Apply the journals written since the snapshot that was just loaded, then
+ * start a new generation for this run.
+ */
+static void
+corestorage_journal_replay(void)
+{
+	unsigned int gen = journal_replay_gen;
+
+	if (gen != 0)
+	{
+		journal_oldest = gen;
+
+		while (corestorage_journal_replay_one(gen))
+			gen++;
+	}
+	else
+		gen = 1;
+
+	if (journal_oldest == 0)
+		journal_oldest = gen;
+
+	// journals left over from an earlier run go with the next save
+	journal_stale_gen = gen;
+
+	if (config_options.journal_interval == 0 || readonly || offline_mode)
+		return;
+
+	if (journal_replay_gen == 0)
+		slog(LG_INFO, "corestorage: the journal will only be replayed after the next database save");
+
+	(void) corestorage_journal_open(gen);
+}
+
+static void
+corestorage_journal_user_register(struct myuser *mu)
+{
+	corestorage_journal_event(JOURNAL_MYUSER_REGISTER, entity(mu)->id, NULL);
+}
+
+static void
+corestorage_journal_myuser_delete(struct myuser *mu)
+{
+	if (mu == load_mu)
+		load_mu = NULL;
+
+	corestorage_journal_event(JOURNAL_MYUSER_DROP, entity(mu)->id, NULL);
+}
+
+static void
+corestorage_journal_password(struct myuser *mu)
+{
+	corestorage_journal_event(JOURNAL_MYUSER_PASSWORD, entity(mu)->id, NULL);
+}
+
+static void
+corestorage_journal_rename(struct hook_user_rename *data)
+{
+	corestorage_journal_event(JOURNAL_MYUSER_RENAME, entity(data->mu)->id, NULL);
+}
+
+static void
+corestorage_journal_metadata(struct hook_metadata_change *mdchange)
+{
+	corestorage_journal_event(JOURNAL_MYUSER_METADATA, entity(mdchange->target)->id, mdchange->name);
+}
+
+static void
+corestorage_journal_channel_register(struct hook_channel_req *hdata)
+{
+	corestorage_journal_event(JOURNAL_MYCHAN_REGISTER, hdata->mc->name, NULL);
+}
+
+static void
+corestorage_journal_channel_drop(struct mychan *mc)
+{
+	if (mc == load_mc)
+		load_mc = NULL;
+
+	corestorage_journal_event(JOURNAL_MYCHAN_DROP, mc->name, NULL);
+}
+
+static void
+corestorage_journal_acl_change(struct hook_channel_acl_req *req)
+{
+	struct chanacs *const ca = req->ca;
+
+	if (ca == NULL || ca->mychan == NULL)
+		return;
+
+	corestorage_journal_event(JOURNAL_CHANACS, ca->mychan->name, corestorage_journal_target(ca));
+}
+
+static void
+corestorage_journal_shutdown(void)
+{
+	corestorage_journal_close();
+}
+
+static void
+corestorage_db_load(const char *filename)
+{
+	struct database_handle *db;
+
+	db = db_open(filename, DB_READ);
+	if (db == NULL)
+		return;
+
+	db_time = 0;
+	journal_replay_gen = 0;
+
+	db_parse(db);
+	db_close(db);
+
+	corestorage_journal_replay();
+
+	load_mu = NULL;
+	load_mc = NULL;
+}
+
+static bool
+corestorage_db_write_blocking(void *filename)
+{
+	struct database_handle *db;
+	struct timeval ts, te;
+
+	s_time(&ts);
+
+	db = db_open(filename, DB_WRITE);
+
+	if (! db)
+	{
+		slog(LG_ERROR, "db_write_blocking(): db_open() failed, aborting save");
+		return false;
+	}
+
+	corestorage_db_save(db);
+	hook_call_db_write(db);
+
+	db_close(db);
+
+	e_time(ts, &te);
+	db_save_stats.finished = time(NULL);
+	db_save_stats.msecs = tv2ms(&te);
+	db_save_stats.stall_msecs = db_save_stats.msecs;
+	db_save_stats.background = false;
+
+	return true;
+}
+
+static void
+corestorage_db_write_foreground(void *filename, unsigned int journal_snapgen)
+{
+	if (! corestorage_db_write_blocking(filename))
+		return;
+
+	corestorage_journal_prune(journal_snapgen);
+	hook_call_db_saved(&db_save_stats);
+}
+
+static struct timeval snapshot_start;
+static unsigned int snapshot_stall;
+static unsigned int snapshot_journal_gen;
+
+static void
+corestorage_db_snapshot_done(bool ok)
+{
+	struct timeval te;
+
+	if (! ok)
+		return;
+
+	e_time(snapshot_start, &te);
+
+	db_save_stats.finished = CURRTIME;
+	db_save_stats.msecs = tv2ms(&te);
+	db_save_stats.stall_msecs = snapshot_stall;
+	db_save_stats.background = true;
+
+	slog(LG_DEBUG, "db_save(): finished snapshot write");
+
+	corestorage_journal_prune(snapshot_journal_gen);
+	hook_call_db_saved(&db_save_stats);
+}
+
+/* Serialize the database into memory, which is all services has to wait
+ * for, and leave the writing to the work queue; no fork() and none of the
+ * copy-on-write that comes with it.
+ */
+static void
+corestorage_db_write_snapshot(void *filename, unsigned int journal_snapgen)
+{
+	struct database_handle *db;
+	struct db_snapshot *snap;
+	struct timeval te;
+
+	s_time(&snapshot_start);
+	snapshot_journal_gen = journal_snapgen;
+
+	snap = smalloc(sizeof *snap);
+	snap->fd = -1;
+	snap->lockfd = -1;
+	snap->callback = &corestorage_db_snapshot_done;
+	db_snapshot = snap;
+
+	if (! (db = db_open(filename, DB_WRITE)))
+	{
+		slog(LG_ERROR, "db_write_snapshot(): db_open() failed, aborting save");
+		db_snapshot = NULL;
+		sfree(snap);
+		return;
+	}
+
+	corestorage_db_save(db);
+	hook_call_db_write(db);
+
+	db_close(db);
+
+	e_time(snapshot_start, &te);
+	snapshot_stall = tv2ms(&te);
+
+	if (db_snapshot != snap)
+		return;                 // already written out and freed
+
+	if (snap->buf != NULL)
+	{
+		slog(LG_DEBUG, "db_save(): serialized %zu bytes in %u ms, writing them in the background", snap->len,
+		     snapshot_stall);
+		return;
+	}
+
+	// this backend does not do snapshots, and has written the database out itself
+	db_snapshot = NULL;
+	sfree(snap);
+
+	if (db_save_stats.bytes == 0)
+		return;
+
+	db_save_stats.finished = CURRTIME;
+	db_save_stats.msecs = snapshot_stall;
+	db_save_stats.stall_msecs = snapshot_stall;
+	db_save_stats.background = false;
+
+	corestorage_journal_prune(journal_snapgen);
+	hook_call_db_saved(&db_save_stats);
+}
+
+#ifdef HAVE_FORK
+static void
+corestorage_db_saved_cb(pid_t pid, int status, void *data)
+{
+	if (child_pid != pid)
+		return; // probably killed our child for a forced write
+	else
+	{
+		struct timeval te;
+		struct db_save_stats stats;
+
+		child_pid = 0;
+		slog(LG_DEBUG, "db_save(): finished asynchronous DB write");
+
+		e_time(child_start, &te);
+
+		if (child_statfd != -1)
+		{
+			const bool ok = read(child_statfd, &stats, sizeof stats) == (ssize_t) sizeof stats;
+
+			close(child_statfd);
+			child_statfd = -1;
+
+			if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+				return;
+
+			db_save_stats = stats;
+		}
+		else
+			db_save_stats.bytes = 0;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+			corestorage_journal_prune(child_journal_gen);
+
+		// time it from the fork, as the rest of services saw it
+		db_save_stats.finished = CURRTIME;
+		db_save_stats.msecs = tv2ms(&te);
+		db_save_stats.stall_msecs = child_stall;
+		db_save_stats.background = true;
+
+		hook_call_db_saved(&db_save_stats);
+	}
+}
+#endif
+
+static void
+corestorage_db_write(void *filename, enum db_save_strategy strategy)
+{
+	if (db_snapshot != NULL)
+	{
+		if (strategy == DB_SAVE_BG_REGULAR)
+		{
+			slog(LG_DEBUG, "db_save(): previous save unfinished, skipping save");
+			return;
+		}
+
+		slog(LG_DEBUG, "db_save(): finishing previous save for forced save");
+		db_snapshot_finish();
+	}
+
+#ifndef HAVE_FORK
+	const unsigned int journal_snapgen = corestorage_journal_rotate();
+
+	if (strategy != DB_SAVE_BLOCKING && config_options.db_save_snapshot && ! config_options.db_save_blocking)
+		corestorage_db_write_snapshot(filename, journal_snapgen);
+	else
+		corestorage_db_write_foreground(filename, journal_snapgen);
+#else
+	if (child_pid && strategy == DB_SAVE_BG_REGULAR)
+	{
+		slog(LG_DEBUG, "db_save(): previous save unfinished, skipping save");
+		return;
+	}
+
+	if (child_pid)
+	{
+		slog(LG_DEBUG, "db_save(): interrupting unfinished previous save for forced save");
+		if (kill(child_pid, SIGKILL) == -1 && errno != ESRCH)
+		{
+			slog(LG_ERROR, "db_save(): kill() on previous save failed; trying to carry on somehow...");
+			waitpid(child_pid, NULL, 0);
+		}
+
+		if (child_statfd != -1)
+		{
+			close(child_statfd);
+			child_statfd = -1;
+		}
+	}
+
+	if (config_options.db_save_blocking)
+		strategy = DB_SAVE_BLOCKING;
+
+	const unsigned int journal_snapgen = corestorage_journal_rotate();
+
+	if (strategy == DB_SAVE_BLOCKING)
+	{
+		corestorage_db_write_foreground(filename, journal_snapgen);
+		return;
+	}
+
+	if (config_options.db_save_snapshot)
+	{
+		corestorage_db_write_snapshot(filename, journal_snapgen);
+		return;
+	}
+
+	int statpipe[2];
+
+	if (pipe(statpipe) == -1)
+		statpipe[0] = statpipe[1] = -1;
+
+	// The child exits normally, so don't let it inherit unwritten log lines
+	log_flush();
+
+	s_time(&child_start);
+
+	pid_t pid = fork();
+
+	if (pid > 0)
+	{
+		struct timeval te;
+
+		// copying the page tables is what services waits for
+		e_time(child_start, &te);
+		child_stall = tv2ms(&te);
+	}
+
+	switch (pid)
+	{
+		case -1:
+			slog(LG_ERROR, "db_save(): fork() failed; writing database synchronously");
+			if (statpipe[0] != -1)
+			{
+				close(statpipe[0]);
+				close(statpipe[1]);
+			}
+			corestorage_db_write_foreground(filename, journal_snapgen);
+			return;
+
+		case 0:
+			if (!corestorage_db_write_blocking(filename))
+				exit(EXIT_FAILURE);
+			if (statpipe[1] != -1)
+				(void) write(statpipe[1], &db_save_stats, sizeof db_save_stats);
+			exit(EXIT_SUCCESS);
 
 		default:
+			if (statpipe[1] != -1)
+				close(statpipe[1]);
 			child_pid = pid;
+			child_statfd = statpipe[0];
+			child_journal_gen = journal_snapgen;
 			childproc_add(pid, "db_save", corestorage_db_saved_cb, NULL);
 			return;
 	}
 #endif
 }
 
+static void
+corestorage_operserv_info(struct sourceinfo *si)
+{
+	if (db_save_stats.finished == 0)
+		return;
+
+	command_success_nodata(si, _("Last database save: %s ago, took %u ms (%u ms blocking), %lu bytes written (%s)"),
+	                       time_ago(db_save_stats.finished), db_save_stats.msecs, db_save_stats.stall_msecs,
+	                       db_save_stats.bytes, db_save_stats.background ? _("in the background") : _("blocking"));
+
+	if (db_save_stats.raw_bytes != 0)
+		command_success_nodata(si, _("Database compression: %lu bytes before compression (%lu%% after), took %u ms "
+		                             "of CPU time"), db_save_stats.raw_bytes,
+		                       (db_save_stats.bytes * 100UL) / db_save_stats.raw_bytes, db_save_stats.compress_msecs);
+}
+
 static void
 mod_init(struct module *const restrict m)
 {
+	hook_add_operserv_info(corestorage_operserv_info);
+
+	hook_add_user_register(corestorage_journal_user_register);
+	hook_add_myuser_delete(corestorage_journal_myuser_delete);
+	hook_add_myuser_changed_password_or_hash(corestorage_journal_password);
+	hook_add_user_rename(corestorage_journal_rename);
+	hook_add_metadata_change(corestorage_journal_metadata);
+	hook_add_channel_register(corestorage_journal_channel_register);
+	hook_add_channel_drop(corestorage_journal_channel_drop);
+	hook_add_channel_acl_change(corestorage_journal_acl_change);
+	hook_add_shutdown(corestorage_journal_shutdown);
+
 	db_load = &corestorage_db_load;
 	db_save = &corestorage_db_write;
 
@@ -1168,6 +2300,15 @@ mod_init(struct module *const restrict m)
 	db_register_type_handler("QID", corestorage_h_qid);
 	db_register_type_handler("QL", corestorage_h_ql);
 
+	db_register_type_handler("JGEN", corestorage_h_jgen);
+	db_register_type_handler("JDU", corestorage_h_jdu);
+	db_register_type_handler("JPW", corestorage_h_jpw);
+	db_register_type_handler("JMDU", corestorage_h_jmdu);
+	db_register_type_handler("JNU", corestorage_h_jnu);
+	db_register_type_handler("JDC", corestorage_h_jdc);
+	db_register_type_handler("JCA", corestorage_h_jca);
+	db_register_type_handler("JCAD", corestorage_h_jcad);
+
 	db_register_type_handler("DE", corestorage_ignore_row);
 
 	db_register_type_handler("???", corestorage_h_unknown);
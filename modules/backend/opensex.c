@@ -12,32 +12,171 @@
 
 #include <atheme.h>
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif /* HAVE_LIBZ */
+
+// How much of the database to read at a time; a batch of rows is about this big
+#define OPENSEX_READ_BLOCK      (1024U * 1024U)
+
+// How many batches may be read ahead of the row being applied
+#define OPENSEX_READ_AHEAD      16U
+
+// How often (in rows) to check whether the next batch can be read meanwhile
+#define OPENSEX_READ_POLL       4096U
+
+// How much output to collect before writing it out
+#define OPENSEX_WRITE_BLOCK     (1024U * 1024U)
+
+// Compressed databases are gzip streams, so that zcat(1) can read them
+#define OPENSEX_GZIP_MAGIC      "\x1F\x8B"
+
+/* A database is loaded in batches of whole rows. The file is read (and
+ * decompressed) into a batch on the work queue, one batch at a time, and
+ * another job then splits the batch into rows and words. The rows are
+ * applied on the main thread in file order, while the following batches
+ * are being read and split.
+ */
+struct opensex_batch
+{
+	mowgli_node_t node;             // in batches of struct opensex
+	struct opensex *rs;
+	struct workqueue_job *job;      // reading or splitting it; NULL once it is split
+	char *buf;
+	size_t len;
+	size_t size;
+	unsigned int *words;            // offsets of the NUL-terminated words in buf
+	unsigned int *rows;             // index in words of the first word of each row, and one past the end
+	unsigned int nrows;
+	unsigned int nwords;
+	const char *error;              // why it could not be read; errnum is set instead for system errors
+	int errnum;
+	unsigned long read_usec;
+	unsigned long split_usec;
+};
+
 struct opensex
 {
-	// Lexing state
+	// Reading state; buf holds the start of a row that did not fit in the last batch read
 	char *buf;
-	unsigned int bufsize;
-	char *token;
+	size_t bufsize;
+	size_t buflen;
+	bool eof;               // (reading job)
 	FILE *f;
+	mowgli_list_t batches;  // being read, being split or waiting to be applied, in file order
+	struct workqueue_job *readjob;
+	struct opensex_batch *cur;      // whose rows are being applied
+	unsigned int row;       // next row of cur
+	unsigned int word;      // next word of the current row
+	unsigned int wordend;   // one past the last word of the current row
+	unsigned long read_usec;        // in the reading jobs
+	unsigned long split_usec;       // in the splitting jobs
+	unsigned long wait_usec;        // waiting for them on the main thread
+
+	// Writing state
+	int fd;
+	char *wbuf;
+	size_t wlen;
+	size_t wsize;
+	struct db_snapshot *snap;       // if set, wbuf grows to hold the whole (uncompressed) database
+	unsigned long written;  // bytes written out so far
+	bool werror;
+
+#ifdef HAVE_LIBZ
+	// Compression state; zs is NULL if the database is not compressed
+	z_stream *zs;
+	unsigned char *zbuf;    // compressed data read from or going to the file
+	size_t zlen;
+	size_t zsize;
+	bool zend;              // seen the end of the compressed stream
+	unsigned long raw;      // uncompressed bytes given to the compressor
+	clock_t zclock;         // CPU time spent in zlib when writing
+	unsigned long zusecs;   // time spent in zlib when reading (reading job)
+#endif /* HAVE_LIBZ */
 
 	// Interpreting state
 	unsigned int grver;
 };
 
+// Time spent loading each type of row, for the startup log
+struct opensex_rowstats
+{
+	unsigned long rows;
+	unsigned long usecs;
+};
+
 #ifdef HAVE_FLOCK
 static int lockfd;
 #endif
 
+static void
+opensex_rowstats_log(const char *type, void *data, void ATHEME_VATTR_UNUSED *privdata)
+{
+	struct opensex_rowstats *const st = data;
+
+	slog(LG_INFO, "opensex: loaded %lu %s rows in %lu ms", st->rows, type, st->usecs / 1000UL);
+	sfree(st);
+}
+
 static void
 opensex_db_parse(struct database_handle *db)
 {
 	const char *cmd;
+	mowgli_patricia_t *rowstats = mowgli_patricia_create(NULL);
+	struct opensex_rowstats *st = NULL;
+	char lasttype[BUFSIZE] = "";
+	struct timeval start, ts, te;
+	unsigned long applied = 0;      // usecs spent in the row handlers
+
+	s_time(&start);
+
 	while (db_read_next_row(db))
 	{
 		cmd = db_read_word(db);
 		if (!cmd || !*cmd || strchr("#\n\t \r", *cmd)) continue;
+
+		// rows of one type tend to come in runs; only look up the counters when it changes
+		if (st == NULL || strcmp(cmd, lasttype))
+		{
+			mowgli_strlcpy(lasttype, cmd, sizeof lasttype);
+
+			if ((st = mowgli_patricia_retrieve(rowstats, lasttype)) == NULL)
+			{
+				st = smalloc(sizeof *st);
+				mowgli_patricia_add(rowstats, lasttype, st);
+			}
+		}
+
+		s_time(&ts);
 		db_process(db, cmd);
+		e_time(ts, &te);
+
+		const unsigned long usecs = (unsigned long) te.tv_sec * 1000000UL + (unsigned long) te.tv_usec;
+
+		st->rows++;
+		st->usecs += usecs;
+		applied += usecs;
 	}
+
+	e_time(start, &te);
+
+	/* reading the file and splitting it into rows happens on the work queue
+	 * while the rows are applied; the handlers change global state, so they
+	 * stay on the main thread, which only waits when it gets ahead
+	 */
+	const struct opensex *const rs = db->priv;
+
+	slog(LG_INFO, "opensex: loaded %u lines from %s in %d ms (reading %lu ms, splitting %lu ms, waiting for "
+	     "them %lu ms, applying rows %lu ms)", db->line, db->file, tv2ms(&te), rs->read_usec / 1000UL,
+	     rs->split_usec / 1000UL, rs->wait_usec / 1000UL, applied / 1000UL);
+
+#ifdef HAVE_LIBZ
+	if (rs->zs != NULL)
+		slog(LG_INFO, "opensex: decompressed %lu bytes from %lu in %lu ms", rs->zs->total_out,
+		     rs->zs->total_in, rs->zusecs / 1000UL);
+#endif /* HAVE_LIBZ */
+
+	mowgli_patricia_destroy(rowstats, opensex_rowstats_log, NULL);
 }
 
 static void
@@ -51,34 +190,334 @@ opensex_h_grver(struct database_handle *db, const char *type)
 		slog(LG_ERROR, "opensex: grammar version %u is unsupported.  dazed and confused, but trying to continue.", rs->grver);
 }
 
-static bool
-opensex_read_next_row(struct database_handle *hdl)
+/* Fills buf with up to len bytes of the (decompressed) database. Returns
+ * 0 at the end of it, or -1 with either errno or *error set if it cannot
+ * be read. This runs in a work queue job, so it must not log.
+ */
+static ssize_t
+opensex_fill(struct opensex *rs, char *buf, size_t len, const char **error)
 {
-	int c = 0;
-	unsigned int n = 0;
-	struct opensex *rs = (struct opensex *)hdl->priv;
+#ifdef HAVE_LIBZ
+	if (rs->zs != NULL)
+	{
+		z_stream *const zs = rs->zs;
 
-	while ((c = getc(rs->f)) != EOF && c != '\n')
+		zs->next_out = (Bytef *) buf;
+		zs->avail_out = (uInt) len;
+
+		// return as soon as there is something to return
+		while (zs->avail_out == len && ! rs->zend)
+		{
+			if (zs->avail_in == 0)
+			{
+				const ssize_t n = read(fileno(rs->f), rs->zbuf, rs->zsize);
+
+				if (n < 0)
+					return -1;
+
+				if (n == 0)
+				{
+					*error = "the compressed data is truncated";
+					return -1;
+				}
+
+				zs->next_in = rs->zbuf;
+				zs->avail_in = (uInt) n;
+			}
+
+			struct timeval start, elapsed;
+
+			s_time(&start);
+			const int ret = inflate(zs, Z_NO_FLUSH);
+			e_time(start, &elapsed);
+
+			rs->zusecs += (unsigned long) elapsed.tv_sec * 1000000UL + (unsigned long) elapsed.tv_usec;
+
+			if (ret == Z_STREAM_END)
+				rs->zend = true;
+			else if (ret != Z_OK)
+			{
+				*error = (zs->msg != NULL) ? zs->msg : "the compressed data is corrupt";
+				return -1;
+			}
+		}
+
+		return (ssize_t) (len - zs->avail_out);
+	}
+#endif /* HAVE_LIBZ */
+
+	return read(fileno(rs->f), buf, len);
+}
+
+/* Reads the next batch: what was left over from the last one, and then at
+ * least OPENSEX_READ_BLOCK bytes more, up to the end of the last whole row.
+ * Batches are read one at a time, as this carries on where the last one
+ * stopped.
+ */
+static void *
+opensex_batch_read(const void *input)
+{
+	struct opensex_batch *const b = (struct opensex_batch *) input;
+	struct opensex *const rs = b->rs;
+	struct timeval start, elapsed;
+	size_t scanned;         // no newline in buf before this
+	char *nl = NULL;
+
+	s_time(&start);
+
+	b->size = rs->buflen + OPENSEX_READ_BLOCK;
+	b->buf = smalloc(b->size);
+	memcpy(b->buf, rs->buf, rs->buflen);
+	b->len = scanned = rs->buflen;
+	rs->buflen = 0;
+
+	while (! rs->eof)
 	{
-		rs->buf[n++] = c;
-		if (n == rs->bufsize)
+		if (b->size - b->len < OPENSEX_READ_BLOCK / 2)
 		{
-			rs->bufsize *= 2;
+			b->size *= 2;
+			b->buf = srealloc(b->buf, b->size);
+		}
+
+		// leave room for the NUL of an unterminated last row
+		const ssize_t n = opensex_fill(rs, b->buf + b->len, b->size - b->len - 1, &b->error);
+
+		if (n < 0)
+		{
+			if (b->error == NULL && errno == EINTR)
+				continue;
+
+			b->errnum = (b->error == NULL) ? errno : 0;
+			return NULL;
+		}
+
+		if (n == 0)
+		{
+			rs->eof = true;
+			break;
+		}
+
+		b->len += (size_t) n;
+
+		if (b->len - scanned < OPENSEX_READ_BLOCK)
+			continue;
+
+		for (size_t i = b->len; i > scanned && nl == NULL; i--)
+			if (b->buf[i - 1] == '\n')
+				nl = b->buf + i - 1;
+
+		if (nl != NULL)
+			break;
+
+		scanned = b->len;
+	}
+
+	// the start of a row that continues in the next batch
+	if (nl != NULL)
+	{
+		const size_t rest = b->len - (size_t) (nl + 1 - b->buf);
+
+		if (rest > rs->bufsize)
+		{
+			rs->bufsize = rest;
 			rs->buf = srealloc(rs->buf, rs->bufsize);
 		}
+
+		memcpy(rs->buf, nl + 1, rest);
+		rs->buflen = rest;
+		b->len -= rest;
 	}
-	rs->buf[n] = '\0';
-	rs->token = rs->buf;
 
-	if (c == EOF && ferror(rs->f))
+	e_time(start, &elapsed);
+	b->read_usec = (unsigned long) elapsed.tv_sec * 1000000UL + (unsigned long) elapsed.tv_usec;
+
+	return NULL;
+}
+
+/* Splits a batch into rows and the rows into words, NUL-terminating them
+ * in place. Every row has at least one word, which is empty for an empty row.
+ */
+static void *
+opensex_batch_split(const void *input)
+{
+	struct opensex_batch *const b = (struct opensex_batch *) input;
+	struct timeval start, elapsed;
+	size_t wsize = 4096, rsize = 1024;
+	char *p = b->buf;
+	char *const end = b->buf + b->len;
+
+	s_time(&start);
+
+	b->words = smalloc(wsize * sizeof *b->words);
+	b->rows = smalloc(rsize * sizeof *b->rows);
+
+	while (p < end)
+	{
+		char *nl = memchr(p, '\n', (size_t) (end - p));
+
+		// last row without a trailing newline
+		if (nl == NULL)
+			nl = end;
+
+		*nl = '\0';
+
+		if (b->nrows + 1 >= rsize)
+		{
+			rsize *= 2;
+			b->rows = srealloc(b->rows, rsize * sizeof *b->rows);
+		}
+
+		b->rows[b->nrows++] = b->nwords;
+
+		for (char *word = p; word != NULL; /* nothing */)
+		{
+			char *const sp = memchr(word, ' ', (size_t) (nl - word));
+
+			if (b->nwords == wsize)
+			{
+				wsize *= 2;
+				b->words = srealloc(b->words, wsize * sizeof *b->words);
+			}
+
+			b->words[b->nwords++] = (unsigned int) (word - b->buf);
+
+			if (sp != NULL)
+			{
+				*sp = '\0';
+				word = sp + 1;
+			}
+			else
+				word = NULL;
+		}
+
+		p = nl + 1;
+	}
+
+	b->rows[b->nrows] = b->nwords;
+
+	e_time(start, &elapsed);
+	b->split_usec = (unsigned long) elapsed.tv_sec * 1000000UL + (unsigned long) elapsed.tv_usec;
+
+	return NULL;
+}
+
+static void
+opensex_batch_free(struct opensex_batch *b)
+{
+	sfree(b->buf);
+	sfree(b->words);
+	sfree(b->rows);
+	sfree(b);
+}
+
+static void
+opensex_batch_split_done(void ATHEME_VATTR_UNUSED *result, const void ATHEME_VATTR_UNUSED *input, void *priv,
+                         bool ATHEME_VATTR_UNUSED cancelled)
+{
+	struct opensex_batch *const b = priv;
+
+	b->job = NULL;
+	b->rs->split_usec += b->split_usec;
+}
+
+static void opensex_batch_read_done(void *result, const void *input, void *priv, bool cancelled);
+
+// Starts reading the next batch, unless one is being read already or enough are waiting
+static void
+opensex_read_ahead(struct opensex *rs)
+{
+	if (rs->readjob != NULL || rs->eof || MOWGLI_LIST_LENGTH(&rs->batches) >= OPENSEX_READ_AHEAD)
+		return;
+
+	struct opensex_batch *const b = smalloc(sizeof *b);
+
+	b->rs = rs;
+	mowgli_node_add(b, &b->node, &rs->batches);
+
+	b->job = rs->readjob = workqueue_submit("opensex_read", &opensex_batch_read, b, NULL,
+	                                        &opensex_batch_read_done, rs, b);
+}
+
+static void
+opensex_batch_read_done(void ATHEME_VATTR_UNUSED *result, const void ATHEME_VATTR_UNUSED *input, void *priv,
+                        bool cancelled)
+{
+	struct opensex_batch *const b = priv;
+	struct opensex *const rs = b->rs;
+
+	b->job = rs->readjob = NULL;
+	rs->read_usec += b->read_usec;
+
+	// the database is being closed
+	if (cancelled)
+		return;
+
+	if (b->error != NULL || b->errnum != 0)
 	{
-		slog(LG_ERROR, "opensex-read-next-row: error at %s line %u: %s", hdl->file, hdl->line, strerror(errno));
+		slog(LG_ERROR, "opensex-read-next-row: cannot read the database: %s",
+		     (b->error != NULL) ? b->error : strerror(b->errnum));
 		slog(LG_ERROR, "opensex-read-next-row: exiting to avoid data loss");
 		exit(EXIT_FAILURE);
 	}
 
-	if (c == EOF && n == 0)
-		return false;
+	b->job = workqueue_submit("opensex_split", &opensex_batch_split, b, NULL, &opensex_batch_split_done, rs, b);
+
+	opensex_read_ahead(rs);
+}
+
+// Waits for the next batch to be read and split, and takes it off the list
+static struct opensex_batch *
+opensex_next_batch(struct opensex *rs)
+{
+	struct timeval start, elapsed;
+
+	opensex_read_ahead(rs);
+
+	if (rs->batches.head == NULL)
+		return NULL;
+
+	struct opensex_batch *const b = rs->batches.head->data;
+
+	s_time(&start);
+
+	// the reading job's done() hands it to a splitting job
+	while (b->job != NULL)
+		workqueue_wait_job(b->job);
+
+	e_time(start, &elapsed);
+	rs->wait_usec += (unsigned long) elapsed.tv_sec * 1000000UL + (unsigned long) elapsed.tv_usec;
+
+	mowgli_node_delete(&b->node, &rs->batches);
+
+	return b;
+}
+
+/* Rows are handed out in place, as the batch they are in was split. A row
+ * stays valid until the next call.
+ */
+static bool
+opensex_read_next_row(struct database_handle *hdl)
+{
+	struct opensex *rs = (struct opensex *)hdl->priv;
+
+	while (rs->cur == NULL || rs->row == rs->cur->nrows)
+	{
+		if (rs->cur != NULL)
+			opensex_batch_free(rs->cur);
+
+		rs->row = 0;
+
+		if ((rs->cur = opensex_next_batch(rs)) == NULL)
+			return false;
+	}
+
+	// the event loop does not run while loading, so keep the reading going from here
+	if (hdl->line % OPENSEX_READ_POLL == 0 && rs->readjob != NULL && workqueue_job_finished(rs->readjob))
+		workqueue_wait_job(rs->readjob);
+
+	rs->word = rs->cur->rows[rs->row];
+	rs->wordend = rs->cur->rows[rs->row + 1];
+	rs->row++;
 
 	hdl->line++;
 	hdl->token = 0;
@@ -89,38 +528,29 @@ static const char *
 opensex_read_word(struct database_handle *db)
 {
 	struct opensex *rs = (struct opensex *)db->priv;
-	char *ptr;
-	char *res;
-	static char buf[BUFSIZE];
 
-	res = rs->token;
-	if (res == NULL)
+	if (rs->word == rs->wordend)
 		return NULL;
 
-	ptr = strchr(res, ' ');
-	if (ptr != NULL)
-	{
-		*ptr++ = '\0';
-		rs->token = ptr;
-	}
-	else
-		rs->token = NULL;
-
 	db->token++;
 
-	return res;
+	return rs->cur->buf + rs->cur->words[rs->word++];
 }
 
 static const char *
 opensex_read_str(struct database_handle *db)
 {
 	struct opensex *rs = (struct opensex *)db->priv;
-	char *res;
 
-	res = rs->token;
+	if (rs->word == rs->wordend)
+		return NULL;
+
+	// put the rest of the row back together
+	for (unsigned int i = rs->word + 1; i < rs->wordend; i++)
+		rs->cur->buf[rs->cur->words[i] - 1] = ' ';
 
 	db->token++;
-	return res;
+	return rs->cur->buf + rs->cur->words[rs->word];
 }
 
 static bool
@@ -159,16 +589,269 @@ opensex_read_time(struct database_handle *db, time_t *res)
 	return *s && !*rp;
 }
 
+/* Writing goes through a private buffer that is emptied with large write()
+ * calls; stdio's per-cell varargs formatting dominated save times.
+ */
+static void
+opensex_write_out(struct database_handle *db, const char *data, size_t len)
+{
+	struct opensex *rs = (struct opensex *)db->priv;
+	size_t done = 0;
+
+	while (done < len && !rs->werror)
+	{
+		const ssize_t n = write(rs->fd, data + done, len - done);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			slog(LG_ERROR, "opensex-flush: cannot write to %s: %s", db->file, strerror(errno));
+			rs->werror = true;
+			break;
+		}
+
+		done += (size_t) n;
+	}
+
+	rs->written += done;
+}
+
+#ifdef HAVE_LIBZ
+/* Runs data through the compressor. A normal save writes the compressed
+ * data out whenever zbuf fills up; a snapshot being written out collects
+ * what a slice compresses to in zbuf instead.
+ */
+static void
+opensex_deflate_piece(struct database_handle *db, const char *data, size_t len, int flush)
+{
+	struct opensex *rs = (struct opensex *)db->priv;
+	z_stream *const zs = rs->zs;
+
+	rs->raw += len;
+	zs->next_in = (Bytef *) data;
+	zs->avail_in = (uInt) len;
+
+	for (;;)
+	{
+		if (rs->zlen == rs->zsize)
+		{
+			if (rs->snap != NULL)
+			{
+				rs->zsize *= 2;
+				rs->zbuf = srealloc(rs->zbuf, rs->zsize);
+			}
+			else
+			{
+				opensex_write_out(db, (const char *) rs->zbuf, rs->zlen);
+				rs->zlen = 0;
+			}
+		}
+
+		const size_t room = rs->zsize - rs->zlen;
+
+		zs->next_out = rs->zbuf + rs->zlen;
+		zs->avail_out = (uInt) ((room > UINT_MAX) ? UINT_MAX : room);
+
+		const clock_t start = clock();
+		const int ret = deflate(zs, flush);
+		rs->zclock += clock() - start;
+
+		rs->zlen = (size_t) (zs->next_out - rs->zbuf);
+
+		if (ret == Z_STREAM_ERROR)
+		{
+			// a snapshot is compressed on a worker thread; opensex_snapshot_encode_free() logs it
+			if (rs->snap == NULL)
+				slog(LG_ERROR, "opensex-flush: cannot compress %s", db->file);
+
+			rs->werror = true;
+			break;
+		}
+
+		// without Z_FINISH, deflate() has taken all input if it did not fill the output
+		if (flush == Z_FINISH ? ret == Z_STREAM_END : zs->avail_out != 0)
+			break;
+	}
+}
+
+// avail_in is only a uInt; the rest of a snapshot can be more than that
+static void
+opensex_deflate(struct database_handle *db, const char *data, size_t len, int flush)
+{
+	do
+	{
+		const size_t piece = (len > UINT_MAX) ? UINT_MAX : len;
+
+		opensex_deflate_piece(db, data, piece, (piece == len) ? flush : Z_NO_FLUSH);
+
+		data += piece;
+		len -= piece;
+	} while (len != 0);
+}
+#endif /* HAVE_LIBZ */
+
+static void
+opensex_flush(struct database_handle *db)
+{
+	struct opensex *rs = (struct opensex *)db->priv;
+
+#ifdef HAVE_LIBZ
+	if (rs->zs != NULL)
+		opensex_deflate(db, rs->wbuf, rs->wlen, Z_NO_FLUSH);
+	else
+#endif /* HAVE_LIBZ */
+		opensex_write_out(db, rs->wbuf, rs->wlen);
+
+	rs->wlen = 0;
+}
+
+#ifdef HAVE_LIBZ
+static void
+opensex_compressed_stats(const struct opensex *rs, unsigned long packed)
+{
+	db_save_stats.raw_bytes = rs->raw;
+	db_save_stats.compress_msecs = (unsigned int) (((unsigned long) rs->zclock * 1000UL) / CLOCKS_PER_SEC);
+
+	slog(LG_DEBUG, "opensex: compressed %lu bytes to %lu (%lu%%) using %u ms of CPU time", rs->raw, packed,
+	     rs->raw ? (packed * 100UL) / rs->raw : 0UL, db_save_stats.compress_msecs);
+}
+
+/* A compressed snapshot is serialized as it is, and compressed a slice at a
+ * time on the work queue as it is written out, so that services does not have
+ * to wait for the compression. The handle that was used to serialize it is
+ * kept for that.
+ */
 static bool
-opensex_start_row(struct database_handle *db, const char *type)
+opensex_snapshot_encode(struct db_snapshot *snap, const char *in, size_t len, bool last, const char **out,
+                        size_t *outlen)
 {
-	struct opensex *rs;
+	struct database_handle *const db = snap->encode_priv;
+	struct opensex *const rs = (struct opensex *)db->priv;
+
+	rs->zlen = 0;
+	opensex_deflate(db, in, len, last ? Z_FINISH : Z_NO_FLUSH);
+
+	*out = (const char *) rs->zbuf;
+	*outlen = rs->zlen;
+
+	return ! rs->werror;
+}
+
+static void
+opensex_snapshot_encode_free(struct db_snapshot *snap)
+{
+	struct database_handle *const db = snap->encode_priv;
+	struct opensex *const rs = (struct opensex *)db->priv;
+
+	if (rs->werror)
+		slog(LG_ERROR, "opensex-flush: cannot compress %s", db->file);
+	else if (! snap->error)
+		opensex_compressed_stats(rs, snap->written);
+
+	(void) deflateEnd(rs->zs);
+	sfree(rs->zs);
+	sfree(rs->zbuf);
+	sfree(rs);
+	sfree(db->file);
+	sfree(db);
+}
+#endif /* HAVE_LIBZ */
+
+/* Pushes out whatever is still buffered at the end of a save. A snapshot
+ * keeps it in wbuf, which is then the complete database, compressed later.
+ */
+static void
+opensex_finish(struct database_handle *db)
+{
+	struct opensex *rs = (struct opensex *)db->priv;
+
+	db_save_stats.raw_bytes = 0;
+	db_save_stats.compress_msecs = 0;
+
+	if (rs->snap != NULL)
+		return;
+
+#ifdef HAVE_LIBZ
+	if (rs->zs != NULL)
+	{
+		opensex_deflate(db, rs->wbuf, rs->wlen, Z_FINISH);
+		rs->wlen = 0;
+		(void) deflateEnd(rs->zs);
+		sfree(rs->zs);
+		rs->zs = NULL;
+
+		opensex_write_out(db, (const char *) rs->zbuf, rs->zlen);
+		opensex_compressed_stats(rs, rs->written);
+		return;
+	}
+#endif /* HAVE_LIBZ */
+
+	opensex_flush(db);
+}
+
+static inline void
+opensex_put(struct database_handle *db, const char *data, size_t len)
+{
+	struct opensex *rs = (struct opensex *)db->priv;
+
+	while (len > 0)
+	{
+		if (rs->wlen == rs->wsize)
+		{
+			// a snapshot is built up in wbuf itself
+			if (rs->snap != NULL)
+			{
+				rs->wsize *= 2;
+				rs->wbuf = srealloc(rs->wbuf, rs->wsize);
+			}
+			else
+				opensex_flush(db);
+		}
+
+		size_t l = rs->wsize - rs->wlen;
+		if (l > len)
+			l = len;
+
+		memcpy(rs->wbuf + rs->wlen, data, l);
+		rs->wlen += l;
+		data += l;
+		len -= l;
+	}
+}
+
+static bool
+opensex_write_number(struct database_handle *db, unsigned long num, bool negative)
+{
+	char buf[32];
+	char *p = buf + sizeof buf;
 
+	return_val_if_fail(db != NULL, false);
+
+	*--p = ' ';
+	do
+	{
+		*--p = (char) ('0' + (num % 10U));
+		num /= 10U;
+	} while (num != 0);
+
+	if (negative)
+		*--p = '-';
+
+	opensex_put(db, p, (size_t) (buf + sizeof buf - p));
+
+	return true;
+}
+
+static bool
+opensex_start_row(struct database_handle *db, const char *type)
+{
 	return_val_if_fail(db != NULL, false);
 	return_val_if_fail(type != NULL, false);
-	rs = (struct opensex *)db->priv;
 
-	fprintf(rs->f, "%s ", type);
+	opensex_put(db, type, strlen(type));
+	opensex_put(db, " ", 1);
 
 	return true;
 }
@@ -176,14 +859,14 @@ opensex_start_row(struct database_handle *db, const char *type)
 static bool
 opensex_write_cell(struct database_handle *db, const char *data, bool multiword)
 {
-	struct opensex *rs;
-	char buf[BUFSIZE], *bi;
-	const char *i;
-
 	return_val_if_fail(db != NULL, false);
-	rs = (struct opensex *)db->priv;
 
-	fprintf(rs->f, "%s%s", data != NULL ? data : "*", !multiword ? " " : "");
+	if (data == NULL)
+		data = "*";
+
+	opensex_put(db, data, strlen(data));
+	if (!multiword)
+		opensex_put(db, " ", 1);
 
 	return true;
 }
@@ -203,36 +886,30 @@ opensex_write_str(struct database_handle *db, const char *word)
 static bool
 opensex_write_int(struct database_handle *db, int num)
 {
-	char buf[32];
-	snprintf(buf, sizeof buf, "%d", num);
-	return opensex_write_cell(db, buf, false);
+	if (num < 0)
+		return opensex_write_number(db, 0UL - (unsigned long) (long) num, true);
+
+	return opensex_write_number(db, (unsigned long) num, false);
 }
 
 static bool
 opensex_write_uint(struct database_handle *db, unsigned int num)
 {
-	char buf[32];
-	snprintf(buf, sizeof buf, "%u", num);
-	return opensex_write_cell(db, buf, false);
+	return opensex_write_number(db, num, false);
 }
 
 static bool
 opensex_write_time(struct database_handle *db, time_t tm)
 {
-	char buf[32];
-	snprintf(buf, sizeof buf, "%lu", (unsigned long) tm);
-	return opensex_write_cell(db, buf, false);
+	return opensex_write_number(db, (unsigned long) tm, false);
 }
 
 static bool
 opensex_commit_row(struct database_handle *db)
 {
-	struct opensex *rs;
-
 	return_val_if_fail(db != NULL, false);
-	rs = (struct opensex *)db->priv;
 
-	fprintf(rs->f, "\n");
+	opensex_put(db, "\n", 1);
 
 	return true;
 }
@@ -296,10 +973,32 @@ opensex_db_open_read(const char *filename)
 
 	rs = smalloc(sizeof *rs);
 	rs->grver = 1;
-	rs->bufsize = 512;
+	rs->bufsize = OPENSEX_READ_BLOCK;
 	rs->buf = smalloc(rs->bufsize);
 	rs->f = f;
 
+	// compressed databases are recognised by their contents, not their name
+	unsigned char magic[2];
+
+	if (pread(fileno(f), magic, sizeof magic, 0) == (ssize_t) sizeof magic &&
+	    memcmp(magic, OPENSEX_GZIP_MAGIC, sizeof magic) == 0)
+	{
+#ifdef HAVE_LIBZ
+		rs->zs = smalloc(sizeof *rs->zs);
+		rs->zsize = OPENSEX_READ_BLOCK;
+		rs->zbuf = smalloc(rs->zsize);
+
+		if (inflateInit2(rs->zs, 15 + 16) != Z_OK)
+		{
+			slog(LG_ERROR, "db-open-read: cannot set up decompression for '%s'", path);
+			exit(EXIT_FAILURE);
+		}
+#else /* HAVE_LIBZ */
+		slog(LG_ERROR, "db-open-read: database '%s' is compressed, but services was built without zlib", path);
+		exit(EXIT_FAILURE);
+#endif /* !HAVE_LIBZ */
+	}
+
 	db = smalloc(sizeof *db);
 	db->priv = rs;
 	db->vt = &opensex_vt;
@@ -315,7 +1014,6 @@ opensex_db_open_write(const char *filename)
 	struct database_handle *db;
 	struct opensex *rs;
 	int fd;
-	FILE *f;
 	int errno1;
 	char bpath[BUFSIZE], path[BUFSIZE];
 #ifdef HAVE_FLOCK
@@ -336,8 +1034,8 @@ opensex_db_open_write(const char *filename)
 	flock(lockfd, LOCK_EX);
 #endif
 
-	fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-	if (fd < 0 || ! (f = fdopen(fd, "w")))
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (fd < 0)
 	{
 		errno1 = errno;
 		slog(LG_ERROR, "db-open-write: cannot open '%s' for writing: %s", path, strerror(errno1));
@@ -349,9 +1047,32 @@ opensex_db_open_write(const char *filename)
 	}
 
 	rs = smalloc(sizeof *rs);
-	rs->f = f;
+	rs->fd = fd;
+	rs->wsize = OPENSEX_WRITE_BLOCK;
+	rs->wbuf = smalloc(rs->wsize);
+	rs->snap = db_snapshot;
 	rs->grver = 1;
 
+#ifdef HAVE_LIBZ
+	if (config_options.db_compression == DB_COMPRESSION_GZIP)
+	{
+		rs->zs = smalloc(sizeof *rs->zs);
+		rs->zsize = OPENSEX_WRITE_BLOCK;
+		rs->zbuf = smalloc(rs->zsize);
+
+		// windowBits + 16 asks for a gzip header and trailer
+		if (deflateInit2(rs->zs, (int) config_options.db_compression_level, Z_DEFLATED, 15 + 16, 8,
+		                 Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			slog(LG_ERROR, "db-open-write: cannot set up compression, writing '%s' uncompressed", path);
+			sfree(rs->zs);
+			sfree(rs->zbuf);
+			rs->zs = NULL;
+			rs->zbuf = NULL;
+		}
+	}
+#endif /* HAVE_LIBZ */
+
 	db = smalloc(sizeof *db);
 	db->priv = rs;
 	db->vt = &opensex_vt;
@@ -388,25 +1109,100 @@ opensex_db_close(struct database_handle *db)
 
 	mowgli_strlcpy(newpath, db->file, sizeof newpath);
 
-	fclose(rs->f);
+	if (db->txn == DB_WRITE && rs->snap != NULL)
+	{
+		struct db_snapshot *const snap = rs->snap;
+
+		opensex_finish(db);
 
-	if (db->txn == DB_WRITE)
+		snap->buf = rs->wbuf;
+		snap->len = rs->wlen;
+		snap->fd = rs->fd;
+#ifdef HAVE_FLOCK
+		snap->lockfd = lockfd;
+#else
+		snap->lockfd = -1;
+#endif
+		mowgli_strlcpy(snap->tmppath, oldpath, sizeof snap->tmppath);
+		mowgli_strlcpy(snap->path, newpath, sizeof snap->path);
+
+		rs->wbuf = NULL;
+
+#ifdef HAVE_LIBZ
+		if (rs->zs != NULL)
+		{
+			snap->encode = &opensex_snapshot_encode;
+			snap->encode_free = &opensex_snapshot_encode_free;
+			snap->encode_priv = db;
+			db_snapshot_commit(snap);
+			return;
+		}
+#endif /* HAVE_LIBZ */
+
+		db_snapshot_commit(snap);
+	}
+	else if (db->txn == DB_WRITE)
 	{
+		opensex_finish(db);
+
+		if (close(rs->fd) < 0 && !rs->werror)
+		{
+			slog(LG_ERROR, "db_save(): cannot close %s: %s", oldpath, strerror(errno));
+			rs->werror = true;
+		}
+
+		db_save_stats.bytes = 0;
+
+		// a partial database must never replace the previous one
+		if (rs->werror)
+		{
+			wallops("\2DATABASE ERROR\2: db_save(): cannot write %s, keeping the previous database", oldpath);
+		}
 		// now, replace the old database with the new one, using an atomic rename
-		if (srename(oldpath, newpath) < 0)
+		else if (srename(oldpath, newpath) < 0)
 		{
 			errno1 = errno;
 			slog(LG_ERROR, "db_save(): cannot rename services.db.new to services.db: %s", strerror(errno1));
 			wallops("\2DATABASE ERROR\2: db_save(): cannot rename services.db.new to services.db: %s", strerror(errno1));
 		}
+		else
+			db_save_stats.bytes = rs->written;
 
-		hook_call_db_saved();
 #ifdef HAVE_FLOCK
 		close(lockfd);
 #endif
 	}
+	else
+	{
+		mowgli_node_t *n, *tn;
+
+		// nothing may still be reading the file or splitting what was read
+		workqueue_cancel_wait(rs, NULL);
+
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, rs->batches.head)
+		{
+			mowgli_node_delete(n, &rs->batches);
+			opensex_batch_free(n->data);
+		}
+
+		if (rs->cur != NULL)
+			opensex_batch_free(rs->cur);
+
+#ifdef HAVE_LIBZ
+		if (rs->zs != NULL)
+			(void) inflateEnd(rs->zs);
+#endif /* HAVE_LIBZ */
+
+		fclose(rs->f);
+	}
+
+#ifdef HAVE_LIBZ
+	sfree(rs->zs);
+	sfree(rs->zbuf);
+#endif /* HAVE_LIBZ */
 
 	sfree(rs->buf);
+	sfree(rs->wbuf);
 	sfree(rs);
 	sfree(db->file);
 	sfree(db);
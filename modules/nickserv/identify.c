@@ -20,15 +20,104 @@
 #define COMMAND_DESC	N_("Identifies to services for a nickname.")
 #endif
 
+static void
+ns_login_complete(struct sourceinfo *const restrict si, struct myuser *const restrict mu, const bool verified)
+{
+	struct user *const u = si->su;
+	mowgli_node_t *n, *tn;
+	char lau[BUFSIZE];
+
+	if (verified)
+	{
+		// They may have logged in some other way while their password was being checked
+		if (u->myuser == mu)
+		{
+			command_fail(si, fault_nochange, _("You are already logged in as \2%s\2."), entity(u->myuser)->name);
+			return;
+		}
+
+		if (user_loginmaxed(mu))
+		{
+			command_fail(si, fault_toomany, _("There are already \2%zu\2 sessions logged in to \2%s\2 (maximum allowed: %u)."), MOWGLI_LIST_LENGTH(&mu->logins), entity(mu)->name, me.maxlogins);
+			lau[0] = '\0';
+			MOWGLI_ITER_FOREACH(n, mu->logins.head)
+			{
+				if (lau[0] != '\0')
+					mowgli_strlcat(lau, ", ", sizeof lau);
+				mowgli_strlcat(lau, ((struct user *)n->data)->nick, sizeof lau);
+			}
+			command_fail(si, fault_toomany, _("Logged in nicks are: %s"), lau);
+			logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (too many logins)", entity(mu)->name);
+			return;
+		}
+
+		// if they are identified to another account, nuke their session first
+		if (u->myuser)
+		{
+			command_success_nodata(si, _("You have been logged out of \2%s\2."), entity(u->myuser)->name);
+
+			if (ircd_on_logout(u, entity(u->myuser)->name))
+				// logout killed the user...
+				return;
+		        u->myuser->lastlogin = CURRTIME;
+		        MOWGLI_ITER_FOREACH_SAFE(n, tn, u->myuser->logins.head)
+		        {
+			        if (n->data == u)
+		                {
+		                        mowgli_node_delete(n, &u->myuser->logins);
+		                        mowgli_node_free(n);
+		                        break;
+		                }
+		        }
+		        u->myuser = NULL;
+		}
+
+		command_success_nodata(si, nicksvs.no_nick_ownership ? _("You are now logged in as \2%s\2.") : _("You are now identified for \2%s\2."), entity(mu)->name);
+		myuser_login(si->service, u, mu, true);
+		logcommand(si, CMDLOG_LOGIN, COMMAND_UC);
+
+		return;
+	}
+
+	logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (bad password)", entity(mu)->name);
+
+	command_fail(si, fault_authfail, _("Invalid password for \2%s\2."), entity(mu)->name);
+	bad_password(si, mu);
+}
+
+static void
+ns_login_verified(struct myuser *const mu, const enum password_async_result result, void *const priv)
+{
+	struct sourceinfo *const si = priv;
+
+	switch (result)
+	{
+		case PWASYNC_OK:
+		case PWASYNC_FAILED:
+			if (mu)
+				ns_login_complete(si, mu, result == PWASYNC_OK);
+			else
+				command_fail(si, fault_nosuch_target, _("That account was dropped while you were logging in."));
+			break;
+
+		case PWASYNC_ERROR:
+			command_fail(si, fault_internalerror, _("Your password could not be checked. Please try again."));
+			break;
+
+		case PWASYNC_CANCELLED:
+			break;
+	}
+
+	atheme_object_unref(si);
+}
+
 static void
 ns_cmd_login(struct sourceinfo *si, int parc, char *parv[])
 {
 	struct user *u = si->su;
 	struct myuser *mu;
-	mowgli_node_t *n, *tn;
 	const char *target = parv[0];
 	const char *password = parv[1];
-	char lau[BUFSIZE];
 
 	if (si->su == NULL)
 	{
@@ -42,6 +131,12 @@ ns_cmd_login(struct sourceinfo *si, int parc, char *parv[])
 		return;
 	}
 
+	if (password_async_pending(u))
+	{
+		command_fail(si, fault_toomany, _("Your previous request is still being processed. Please wait a moment."));
+		return;
+	}
+
 #ifndef NICKSERV_LOGIN
 	if (!nicksvs.no_nick_ownership && target && !password)
 	{
@@ -118,55 +213,22 @@ ns_cmd_login(struct sourceinfo *si, int parc, char *parv[])
 		return;
 	}
 
-	if (verify_password(mu, password))
+	switch (verify_password_async(mu, password, u, u->ip ? u->ip : u->host, &ns_login_verified, si))
 	{
-		if (user_loginmaxed(mu))
-		{
-			command_fail(si, fault_toomany, _("There are already \2%zu\2 sessions logged in to \2%s\2 (maximum allowed: %u)."), MOWGLI_LIST_LENGTH(&mu->logins), entity(mu)->name, me.maxlogins);
-			lau[0] = '\0';
-			MOWGLI_ITER_FOREACH(n, mu->logins.head)
-			{
-				if (lau[0] != '\0')
-					mowgli_strlcat(lau, ", ", sizeof lau);
-				mowgli_strlcat(lau, ((struct user *)n->data)->nick, sizeof lau);
-			}
-			command_fail(si, fault_toomany, _("Logged in nicks are: %s"), lau);
-			logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (too many logins)", entity(mu)->name);
+		case PWASYNC_QUEUED:
+			// ns_login_verified() carries on from here
+			atheme_object_ref(si);
 			return;
-		}
-
-		// if they are identified to another account, nuke their session first
-		if (u->myuser)
-		{
-			command_success_nodata(si, _("You have been logged out of \2%s\2."), entity(u->myuser)->name);
-
-			if (ircd_on_logout(u, entity(u->myuser)->name))
-				// logout killed the user...
-				return;
-		        u->myuser->lastlogin = CURRTIME;
-		        MOWGLI_ITER_FOREACH_SAFE(n, tn, u->myuser->logins.head)
-		        {
-			        if (n->data == u)
-		                {
-		                        mowgli_node_delete(n, &u->myuser->logins);
-		                        mowgli_node_free(n);
-		                        break;
-		                }
-		        }
-		        u->myuser = NULL;
-		}
 
-		command_success_nodata(si, nicksvs.no_nick_ownership ? _("You are now logged in as \2%s\2.") : _("You are now identified for \2%s\2."), entity(mu)->name);
-		myuser_login(si->service, u, mu, true);
-		logcommand(si, CMDLOG_LOGIN, COMMAND_UC);
+		case PWASYNC_BUSY:
+			command_fail(si, fault_toomany, _("Services is too busy to check your password right now. Please try again in a moment."));
+			logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (crypt queue full)", entity(mu)->name);
+			return;
 
-		return;
+		case PWASYNC_SYNC:
+			ns_login_complete(si, mu, verify_password(mu, password));
+			return;
 	}
-
-	logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (bad password)", entity(mu)->name);
-
-	command_fail(si, fault_authfail, _("Invalid password for \2%s\2."), entity(mu)->name);
-	bad_password(si, mu);
 }
 
 static struct command ns_login = {
@@ -189,6 +251,7 @@ mod_init(struct module *const restrict m)
 static void
 mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
+	password_async_cancel(NULL, &ns_login_verified);
 	service_named_unbind_command("nickserv", &ns_login);
 }
 
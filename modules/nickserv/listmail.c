@@ -17,6 +17,17 @@ struct listmail_state
 	unsigned int matches;
 };
 
+static void
+listmail_show(struct listmail_state *state, struct myuser *mu)
+{
+	// in the future we could add a LIMIT parameter
+	if (state->matches == 0)
+		command_success_nodata(state->origin, _("Accounts matching e-mail address \2%s\2:"), state->pattern);
+
+	command_success_nodata(state->origin, "- %s (%s)", entity(mu)->name, mu->email);
+	state->matches++;
+}
+
 static int
 listmail_foreach_cb(struct myentity *mt, void *privdata)
 {
@@ -24,14 +35,7 @@ listmail_foreach_cb(struct myentity *mt, void *privdata)
 	struct myuser *mu = user(mt);
 
 	if (state->email_canonical == mu->email_canonical || !match(state->pattern, mu->email))
-	{
-		// in the future we could add a LIMIT parameter
-		if (state->matches == 0)
-			command_success_nodata(state->origin, _("Accounts matching e-mail address \2%s\2:"), state->pattern);
-
-		command_success_nodata(state->origin, "- %s (%s)", entity(mu)->name, mu->email);
-		state->matches++;
-	}
+		listmail_show(state, mu);
 
 	return 0;
 }
@@ -53,7 +57,22 @@ ns_cmd_listmail(struct sourceinfo *si, int parc, char *parv[])
 	state.pattern = email;
 	state.email_canonical = canonicalize_email(email);
 	state.origin = si;
-	myentity_foreach_t(ENT_USER, listmail_foreach_cb, &state);
+
+	/* Without match() metacharacters (the same set compiled_mask_init() looks
+	 * for), the accounts using the address are all that can match
+	 */
+	if (strpbrk(email, "*?\\&#%") == NULL)
+	{
+		const mowgli_list_t *accounts = email_index_find(state.email_canonical);
+		mowgli_node_t *n;
+
+		if (accounts != NULL)
+			MOWGLI_ITER_FOREACH(n, accounts->head)
+				listmail_show(&state, n->data);
+	}
+	else
+		myentity_foreach_t(ENT_USER, listmail_foreach_cb, &state);
+
 	strshare_unref(state.email_canonical);
 
 	logcommand(si, CMDLOG_ADMIN, "LISTMAIL: \2%s\2 (\2%u\2 matches)", email, state.matches);
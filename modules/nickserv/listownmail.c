@@ -14,8 +14,8 @@ static bool listownmail_canon = false;
 static void
 ns_cmd_listownmail(struct sourceinfo *si, int parc, char *parv[])
 {
-	struct myentity *mt;
-	struct myentity_iteration_state state;
+	const mowgli_list_t *accounts;
+	mowgli_node_t *n;
 	unsigned int matches = 0;
 
 	if (si->smu->flags & MU_WAITAUTH)
@@ -37,9 +37,14 @@ ns_cmd_listownmail(struct sourceinfo *si, int parc, char *parv[])
 
 	command_add_flood(si, FLOOD_HEAVY);
 
-	MYENTITY_FOREACH_T(mt, &state, ENT_USER)
+	/* Addresses that are equal apart from case are also equal once
+	 * canonicalized, so every match is in the index entry for ours.
+	 */
+	accounts = email_index_find(si->smu->email_canonical);
+
+	MOWGLI_ITER_FOREACH(n, accounts ? accounts->head : NULL)
 	{
-		struct myuser *mu = user(mt);
+		struct myuser *mu = n->data;
 
 		continue_if_fail(mu != NULL);
 
@@ -12,6 +12,38 @@
 
 static mowgli_patricia_t **ns_set_cmdtree = NULL;
 
+static void
+ns_set_password_finish(struct sourceinfo *const restrict si, struct myuser *const restrict mu, const bool done)
+{
+	if (! done)
+	{
+		(void) command_fail(si, fault_internalerror, _("There was an error setting your password. Please "
+		                                               "check it for any invalid characters and contact "
+		                                               "network staff if the issue persists."));
+		return;
+	}
+
+	logcommand(si, CMDLOG_SET, "SET:PASSWORD");
+
+	command_success_nodata(si, _("The password for \2%s\2 has been successfully changed."), entity(mu)->name);
+}
+
+static void
+ns_set_password_done(struct myuser *const mu, const enum password_async_result result, void *const priv)
+{
+	struct sourceinfo *const si = priv;
+
+	if (result != PWASYNC_CANCELLED)
+	{
+		if (mu)
+			ns_set_password_finish(si, mu, result == PWASYNC_OK);
+		else
+			(void) command_fail(si, fault_nosuch_target, _("Your account was dropped while its password was being changed."));
+	}
+
+	atheme_object_unref(si);
+}
+
 // SET PASSWORD <password>
 static void
 ns_cmd_set_password(struct sourceinfo *si, int parc, char *parv[])
@@ -30,6 +62,12 @@ ns_cmd_set_password(struct sourceinfo *si, int parc, char *parv[])
 		return;
 	}
 
+	if (si->su && password_async_pending(si->su))
+	{
+		command_fail(si, fault_toomany, _("Your previous request is still being processed. Please wait a moment."));
+		return;
+	}
+
 	if (strlen(password) > PASSLEN)
 	{
 		command_fail(si, fault_badparams, STR_INVALID_PARAMS, "SET PASSWORD");
@@ -56,17 +94,27 @@ ns_cmd_set_password(struct sourceinfo *si, int parc, char *parv[])
 	if (! hdata.allowed)
 		return;
 
-	if (! set_password(si->smu, password))
+	if (si->su)
 	{
-		(void) command_fail(si, fault_internalerror, _("There was an error setting your password. Please "
-		                                               "check it for any invalid characters and contact "
-		                                               "network staff if the issue persists."));
-		return;
+		switch (set_password_async(si->smu, password, si->su, si->su->ip ? si->su->ip : si->su->host,
+		                           &ns_set_password_done, si))
+		{
+			case PWASYNC_QUEUED:
+				// ns_set_password_done() carries on from here
+				atheme_object_ref(si);
+				return;
+
+			case PWASYNC_BUSY:
+				(void) command_fail(si, fault_toomany, _("Services is too busy to change your password "
+				                                         "right now. Please try again in a moment."));
+				return;
+
+			case PWASYNC_SYNC:
+				break;
+		}
 	}
 
-	logcommand(si, CMDLOG_SET, "SET:PASSWORD");
-
-	command_success_nodata(si, _("The password for \2%s\2 has been successfully changed."), entity(si->smu)->name);
+	ns_set_password_finish(si, si->smu, set_password(si->smu, password));
 }
 
 static struct command ns_set_password = {
@@ -89,6 +137,7 @@ mod_init(struct module *const restrict m)
 static void
 mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
+	password_async_cancel(NULL, &ns_set_password_done);
 	command_delete(&ns_set_password, *ns_set_cmdtree);
 }
 
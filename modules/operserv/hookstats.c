@@ -0,0 +1,51 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2026 Atheme Development Group (https://atheme.github.io/)
+ *
+ * This file contains code for OS HOOKSTATS
+ */
+
+#include <atheme.h>
+
+static void
+os_hookstats_cb(const char *const restrict line, void *const restrict privdata)
+{
+	(void) command_success_nodata(privdata, "%s", line);
+}
+
+static void
+os_cmd_hookstats_func(struct sourceinfo *const restrict si, const int ATHEME_VATTR_UNUSED parc,
+                      char ATHEME_VATTR_UNUSED **const restrict parv)
+{
+	(void) logcommand(si, CMDLOG_GET, "HOOKSTATS");
+
+	(void) hook_stats(&os_hookstats_cb, si);
+	(void) command_success_nodata(si, _("End of hook statistics."));
+}
+
+static struct command os_cmd_hookstats = {
+	.name           = "HOOKSTATS",
+	.desc           = N_("Shows how often each hook was called and the time spent in it."),
+	.access         = PRIV_SERVER_AUSPEX,
+	.maxparc        = 0,
+	.cmd            = &os_cmd_hookstats_func,
+	.help           = { .path = "oservice/hookstats" },
+};
+
+static void
+mod_init(struct module *const restrict m)
+{
+	MODULE_TRY_REQUEST_DEPENDENCY(m, "operserv/main")
+
+	(void) service_named_bind_command("operserv", &os_cmd_hookstats);
+}
+
+static void
+mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
+{
+	(void) service_named_unbind_command("operserv", &os_cmd_hookstats);
+}
+
+SIMPLE_DECLARE_MODULE_V1("operserv/hookstats", MODULE_UNLOAD_CAPABILITY_OK)
@@ -10,6 +10,12 @@
 
 #include <atheme.h>
 
+static void
+os_info_stats_cb(const char *const restrict line, void *const restrict privdata)
+{
+	command_success_nodata(privdata, "%s", line);
+}
+
 static void
 os_cmd_info(struct sourceinfo *si, int parc, char *parv[])
 {
@@ -70,6 +76,9 @@ os_cmd_info(struct sourceinfo *si, int parc, char *parv[])
 		command_success_nodata(si, _("user@host mask(s) that are autokline exempt: %s"), (char *)n2->data);
 	}
 
+	log_stats(os_info_stats_cb, si);
+	workqueue_stats(os_info_stats_cb, si);
+
 	hook_call_operserv_info(si);
 }
 
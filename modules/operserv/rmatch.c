@@ -15,14 +15,50 @@
 
 #define MAXMATCHES_DEF 1000
 
+struct rmatch_request
+{
+	struct sourceinfo *si;
+	char *pattern;
+	unsigned int matches;
+	unsigned int maxmatches;
+};
+
+static void
+rmatch_match(const struct user_snapshot *snap, unsigned int user, void *priv)
+{
+	struct rmatch_request *req = priv;
+
+	req->matches++;
+	if (req->matches <= req->maxmatches)
+		command_success_nodata(req->si, _("\2Match:\2  %s"), USER_SNAPSHOT_MASK(snap, user));
+	else if (req->matches == req->maxmatches + 1)
+	{
+		command_success_nodata(req->si, _("Too many matches, not displaying any more"));
+		command_success_nodata(req->si, _("Add the FORCE keyword to see them all"));
+	}
+}
+
+static void
+rmatch_done(const struct user_snapshot ATHEME_VATTR_UNUSED *snap, void ATHEME_VATTR_UNUSED *result,
+            bool cancelled, void *priv)
+{
+	struct rmatch_request *req = priv;
+
+	if (!cancelled)
+		command_success_nodata(req->si, ngettext(N_("\2%u\2 match for pattern \2%s\2"),
+		                                         N_("\2%u\2 matches for pattern \2%s\2"),
+		                                         req->matches), req->matches, req->pattern);
+
+	atheme_object_unref(req->si);
+	sfree(req->pattern);
+	sfree(req);
+}
+
 static void
 os_cmd_rmatch(struct sourceinfo *si, int parc, char *parv[])
 {
-	struct atheme_regex *regex;
-	char usermask[512];
-	unsigned int matches = 0, maxmatches;
-	mowgli_patricia_iteration_state_t state;
-	struct user *u;
+	struct rmatch_request *req;
+	unsigned int maxmatches;
 	char *args = parv[0];
 	char *pattern;
 	int flags = 0;
@@ -56,37 +92,32 @@ os_cmd_rmatch(struct sourceinfo *si, int parc, char *parv[])
 		return;
 	}
 
-	regex = regex_create(pattern, flags);
-
-	if (regex == NULL)
+	if (si->su != NULL && user_scan_pending(si->su))
 	{
-		command_fail(si, fault_badparams, _("The provided regex \2%s\2 is invalid."), pattern);
+		command_fail(si, fault_toomany, _("Your previous scan is still running. Please wait a moment."));
 		return;
 	}
 
-	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
+	req = smalloc(sizeof *req);
+	req->si = si;
+	req->pattern = sstrdup(pattern);
+	req->maxmatches = maxmatches;
+
+	/* Matches are sent as the scan goes; without a user to send them to
+	 * later (e.g. over XMLRPC), the scan runs right here.
+	 */
+	atheme_object_ref(si);
+
+	if (!user_scan_regex(pattern, flags, si->su, &rmatch_match, &rmatch_done, req))
 	{
-		sprintf(usermask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
-
-		if (regex_match(regex, usermask))
-		{
-			matches++;
-			if (matches <= maxmatches)
-				command_success_nodata(si, _("\2Match:\2  %s!%s@%s %s"), u->nick, u->user, u->host, u->gecos);
-			else if (matches == maxmatches + 1)
-			{
-				command_success_nodata(si, _("Too many matches, not displaying any more"));
-				command_success_nodata(si, _("Add the FORCE keyword to see them all"));
-			}
-		}
+		command_fail(si, fault_badparams, _("The provided regex \2%s\2 is invalid."), pattern);
+		atheme_object_unref(si);
+		sfree(req->pattern);
+		sfree(req);
+		return;
 	}
 
-	regex_destroy(regex);
-	command_success_nodata(si, ngettext(N_("\2%u\2 match for pattern \2%s\2"),
-	                                    N_("\2%u\2 matches for pattern \2%s\2"),
-	                                    matches), matches, pattern);
-
-	logcommand(si, CMDLOG_ADMIN, "RMATCH: \2%s\2 (\2%u\2 matches)", pattern, matches);
+	logcommand(si, CMDLOG_ADMIN, "RMATCH: \2%s\2", pattern);
 }
 
 static struct command os_rmatch = {
@@ -109,6 +140,7 @@ mod_init(struct module *const restrict m)
 static void
 mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
+	user_scan_cancel(NULL, &rmatch_done);
 	service_named_unbind_command("operserv", &os_rmatch);
 }
 
@@ -15,69 +15,116 @@ struct rnc
 	unsigned int count;
 };
 
-static void
-os_cmd_rnc(struct sourceinfo *si, int parc, char *parv[])
+struct rnc_result
 {
-	char *param = parv[0];
-	unsigned int count = 20;
+	struct rnc *realnames; // most frequent first
+	unsigned int count;
+};
 
-	if (param && ! string_to_uint(param, &count))
-		count = 20;
+struct rnc_request
+{
+	struct sourceinfo *si;
+	unsigned int count;
+};
 
-	struct user *u;
-	struct rnc *rnc, *biggest;
-	mowgli_patricia_t *realnames;
-	unsigned int i, found = 0;
-	mowgli_patricia_iteration_state_t state;
+static int
+rnc_compare_gecos(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+static int
+rnc_compare_count(const void *a, const void *b)
+{
+	const struct rnc *ra = a, *rb = b;
 
-	realnames = mowgli_patricia_create(noopcanon);
+	if (ra->count != rb->count)
+		return (ra->count < rb->count) ? 1 : -1;
 
-	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
+	return strcmp(ra->gecos, rb->gecos);
+}
+
+// Runs on a worker thread: sorts the realnames, so that equal ones are adjacent, and counts them
+static void *
+rnc_count(const struct user_snapshot *snap)
+{
+	struct rnc_result *res = smalloc(sizeof *res);
+	const char **gecos = smalloc((snap->count + 1) * sizeof *gecos);
+	unsigned int i;
+
+	res->realnames = smalloc((snap->count + 1) * sizeof *res->realnames);
+
+	for (i = 0; i < snap->count; i++)
+		gecos[i] = USER_SNAPSHOT_GECOS(snap, i);
+
+	qsort(gecos, snap->count, sizeof *gecos, &rnc_compare_gecos);
+
+	for (i = 0; i < snap->count; i++)
 	{
-		rnc = mowgli_patricia_retrieve(realnames, u->gecos);
-		if (rnc != NULL)
-			rnc->count++;
-		else
+		if (res->count && !strcmp(res->realnames[res->count - 1].gecos, gecos[i]))
 		{
-			rnc = smalloc(sizeof *rnc);
-			rnc->gecos = u->gecos;
-			rnc->count = 1;
-			mowgli_patricia_add(realnames, rnc->gecos, rnc);
+			res->realnames[res->count - 1].count++;
+			continue;
 		}
+
+		res->realnames[res->count].gecos = gecos[i];
+		res->realnames[res->count].count = 1;
+		res->count++;
 	}
 
-	// this is ugly to the max :P
-	for (i = 1; i <= count; i++)
-	{
-		found = 0;
-		biggest = NULL;
-		MOWGLI_PATRICIA_FOREACH(rnc, &state, realnames)
-		{
-			if (rnc->count > found)
-			{
-				found = rnc->count;
-				biggest = rnc;
-			}
-		}
+	qsort(res->realnames, res->count, sizeof *res->realnames, &rnc_compare_count);
 
-		if (biggest == NULL)
-			break;
+	sfree(gecos);
+	return res;
+}
+
+static void
+rnc_done(const struct user_snapshot ATHEME_VATTR_UNUSED *snap, void *result, bool cancelled, void *priv)
+{
+	struct rnc_request *req = priv;
+	struct rnc_result *res = result;
+	unsigned int i;
 
-		command_success_nodata(si, ngettext(N_("\2%u\2: \2%u\2 match for realname \2%s\2"),
-		                                    N_("\2%u\2: \2%u\2 matches for realname \2%s\2"),
-		                                    biggest->count), i, biggest->count, biggest->gecos);
+	for (i = 0; !cancelled && res != NULL && i < req->count && i < res->count; i++)
+		command_success_nodata(req->si, ngettext(N_("\2%u\2: \2%u\2 match for realname \2%s\2"),
+		                                         N_("\2%u\2: \2%u\2 matches for realname \2%s\2"),
+		                                         res->realnames[i].count), i + 1, res->realnames[i].count,
+		                       res->realnames[i].gecos);
 
-		mowgli_patricia_delete(realnames, biggest->gecos);
-		sfree(biggest);
+	if (res != NULL)
+	{
+		sfree(res->realnames);
+		sfree(res);
 	}
 
-	// cleanup
-	MOWGLI_PATRICIA_FOREACH(rnc, &state, realnames)
+	atheme_object_unref(req->si);
+	sfree(req);
+}
+
+static void
+os_cmd_rnc(struct sourceinfo *si, int parc, char *parv[])
+{
+	char *param = parv[0];
+	unsigned int count = 20;
+
+	if (param && ! string_to_uint(param, &count))
+		count = 20;
+
+	if (si->su != NULL && user_scan_pending(si->su))
 	{
-		mowgli_patricia_delete(realnames, rnc->gecos);
-		sfree(rnc);
+		command_fail(si, fault_toomany, _("Your previous scan is still running. Please wait a moment."));
+		return;
 	}
-	mowgli_patricia_destroy(realnames, NULL, NULL);
+
+	struct rnc_request *req = smalloc(sizeof *req);
+
+	req->si = si;
+	req->count = count;
+
+	atheme_object_ref(si);
+
+	// The counting is done on a copy of the user list; without a user to reply to later, right here
+	user_scan_run("rnc_count", &rnc_count, si->su, &rnc_done, req);
 
 	logcommand(si, CMDLOG_ADMIN, "RNC: \2%u\2", count);
 }
@@ -102,6 +149,7 @@ mod_init(struct module *const restrict m)
 static void
 mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
+	user_scan_cancel_wait(NULL, &rnc_done);
 	service_named_unbind_command("operserv", &os_rnc);
 }
 
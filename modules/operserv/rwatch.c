@@ -13,6 +13,14 @@
 #define RWACT_KLINE 		2
 #define RWACT_QUARANTINE	4
 
+// Shorter literals would let most usermasks through anyway
+#define RWATCH_MIN_LITERAL	3
+
+#define RWATCH_MASKLEN		(NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1 + GECOSLEN + 1)
+
+// Connected clients listed when a pattern is added; RMATCH shows them all
+#define RWATCH_BACKFILL_SHOW	10
+
 struct rwatch
 {
 	char *regex;
@@ -20,6 +28,10 @@ struct rwatch
 	char *reason;
 	int actions; // RWACT_*
 	struct atheme_regex *re;
+	unsigned long hits; // matches since the module was loaded
+	bool prefiltered; // only tried on usermasks containing its literal
+	unsigned long seen; // check it was last a candidate in
+	struct rwatch *next; // with the same literal
 };
 
 static struct rwatch *rwread = NULL;
@@ -28,6 +40,92 @@ static FILE *f;
 static mowgli_patricia_t *os_rwatch_cmds;
 static mowgli_list_t rwatch_list;
 
+/* The required literals of all patterns (see regex_required_literal()), so
+ * that one pass over a usermask finds the patterns worth trying on it.
+ */
+static struct literal_set *rwatch_literals = NULL;
+static bool rwatch_dirty = true;
+static unsigned long rwatch_generation = 0;
+
+static unsigned long rwatch_checks = 0;
+static unsigned long long rwatch_usecs = 0;
+
+static void
+rwatch_rebuild(void)
+{
+	char lit[BUFSIZE];
+	mowgli_node_t *n;
+
+	literal_set_clear(rwatch_literals);
+
+	MOWGLI_ITER_FOREACH(n, rwatch_list.head)
+	{
+		struct rwatch *const rw = n->data;
+		size_t len;
+
+		rw->prefiltered = false;
+		rw->next = NULL;
+
+		if (rw->re == NULL)
+			continue;
+
+		if ((len = regex_required_literal(rw->regex, rw->reflags, lit, sizeof lit)) < RWATCH_MIN_LITERAL)
+			continue;
+
+		const unsigned int id = literal_set_add(rwatch_literals, lit, len);
+
+		rw->next = literal_set_get(rwatch_literals, id);
+		rw->prefiltered = true;
+		literal_set_set(rwatch_literals, id, rw);
+	}
+
+	literal_set_compile(rwatch_literals);
+	rwatch_dirty = false;
+}
+
+static void
+rwatch_mark(void *const restrict data, void *const restrict privdata)
+{
+	for (struct rwatch *rw = data; rw != NULL; rw = rw->next)
+		rw->seen = rwatch_generation;
+}
+
+/* Marks the patterns whose literal is in usermask; rwatch_candidate() then
+ * tells which patterns to try, so that they are still tried in list order.
+ */
+static void
+rwatch_prefilter(const char *const restrict usermask)
+{
+	char folded[RWATCH_MASKLEN];
+
+	if (rwatch_dirty)
+		rwatch_rebuild();
+
+	rwatch_generation++;
+
+	const size_t len = regex_fold(folded, usermask, sizeof folded);
+
+	literal_set_search(rwatch_literals, folded, (len < sizeof folded) ? len : (sizeof folded - 1), &rwatch_mark,
+	                   NULL);
+}
+
+static inline bool
+rwatch_candidate(const struct rwatch *const restrict rw)
+{
+	return rw->re != NULL && (! rw->prefiltered || rw->seen == rwatch_generation);
+}
+
+static void
+rwatch_account(const struct timeval *const restrict start)
+{
+	struct timeval elapsed;
+
+	e_time(*start, &elapsed);
+
+	rwatch_checks++;
+	rwatch_usecs += ((unsigned long long) elapsed.tv_sec * 1000000ULL) + (unsigned long long) elapsed.tv_usec;
+}
+
 static void
 write_rwatchdb(struct database_handle *db)
 {
@@ -93,6 +191,7 @@ load_rwatchdb(char *path)
 				rw->actions = atoi(actionstr);
 				rw->reason = sstrdup(reason);
 				mowgli_node_add(rw, mowgli_node_create(), &rwatch_list);
+				rwatch_dirty = true;
 				rw = NULL;
 			}
 		}
@@ -141,6 +240,7 @@ db_h_rr(struct database_handle *db, const char *type)
 	rwread->actions = actions;
 	rwread->reason = sstrdup(reason);
 	mowgli_node_add(rwread, mowgli_node_create(), &rwatch_list);
+	rwatch_dirty = true;
 	rwread = NULL;
 }
 
@@ -157,6 +257,64 @@ os_cmd_rwatch(struct sourceinfo *const restrict si, const int parc, char **const
 	(void) subcommand_dispatch_simple(si->service, si, parc, parv, os_rwatch_cmds, "RWATCH");
 }
 
+struct rwatch_backfill
+{
+	struct sourceinfo *si;
+	char *pattern;
+	unsigned int matches;
+};
+
+static void
+rwatch_backfill_match(const struct user_snapshot *snap, unsigned int user, void *priv)
+{
+	struct rwatch_backfill *bf = priv;
+
+	if (++bf->matches <= RWATCH_BACKFILL_SHOW)
+		command_success_nodata(bf->si, _("\2Match:\2  %s"), USER_SNAPSHOT_MASK(snap, user));
+}
+
+static void
+rwatch_backfill_done(const struct user_snapshot ATHEME_VATTR_UNUSED *snap, void ATHEME_VATTR_UNUSED *result,
+                     bool cancelled, void *priv)
+{
+	struct rwatch_backfill *bf = priv;
+
+	if (!cancelled)
+	{
+		command_success_nodata(bf->si, ngettext(N_("\2%u\2 connected client matches \2%s\2."),
+		                                        N_("\2%u\2 connected clients match \2%s\2."),
+		                                        bf->matches), bf->matches, bf->pattern);
+
+		if (bf->matches > RWATCH_BACKFILL_SHOW)
+			command_success_nodata(bf->si, _("Use RMATCH to see them all."));
+	}
+
+	atheme_object_unref(bf->si);
+	sfree(bf->pattern);
+	sfree(bf);
+}
+
+/* Patterns only act on clients connecting from now on; show the oper which
+ * connected clients a new pattern would have caught.
+ */
+static void
+rwatch_backfill(struct sourceinfo *si, const char *pattern, int flags)
+{
+	struct rwatch_backfill *bf = smalloc(sizeof *bf);
+
+	bf->si = si;
+	bf->pattern = sstrdup(pattern);
+
+	atheme_object_ref(si);
+
+	if (!user_scan_regex(pattern, flags, si->su, &rwatch_backfill_match, &rwatch_backfill_done, bf))
+	{
+		atheme_object_unref(si);
+		sfree(bf->pattern);
+		sfree(bf);
+	}
+}
+
 static void
 os_cmd_rwatch_add(struct sourceinfo *si, int parc, char *parv[])
 {
@@ -218,8 +376,11 @@ os_cmd_rwatch_add(struct sourceinfo *si, int parc, char *parv[])
 	rw->re = regex;
 
 	mowgli_node_add(rw, mowgli_node_create(), &rwatch_list);
+	rwatch_dirty = true;
 	command_success_nodata(si, _("Added \2%s\2 to regex watch list."), pattern);
 	logcommand(si, CMDLOG_ADMIN, "RWATCH:ADD: \2%s\2 (reason: \2%s\2)", pattern, reason);
+
+	rwatch_backfill(si, pattern, flags);
 }
 
 static void
@@ -276,6 +437,7 @@ os_cmd_rwatch_del(struct sourceinfo *si, int parc, char *parv[])
 			sfree(rw);
 			mowgli_node_delete(n, &rwatch_list);
 			mowgli_node_free(n);
+			rwatch_dirty = true;
 			command_success_nodata(si, _("Removed \2%s\2 from regex watch list."), pattern);
 			logcommand(si, CMDLOG_ADMIN, "RWATCH:DEL: \2%s\2", pattern);
 			return;
@@ -289,19 +451,34 @@ static void
 os_cmd_rwatch_list(struct sourceinfo *si, int parc, char *parv[])
 {
 	mowgli_node_t *n;
+	size_t prefiltered = 0;
+
+	if (rwatch_dirty)
+		rwatch_rebuild();
 
 	MOWGLI_ITER_FOREACH(n, rwatch_list.head)
 	{
 		struct rwatch *rw = n->data;
 
-		command_success_nodata(si, "%s (%s%s%s%s) - %s",
+		command_success_nodata(si, "%s (%s%s%s%s) - %s [%lu]",
 				rw->regex,
 				rw->reflags & AREGEX_ICASE ? "i" : "",
 				rw->reflags & AREGEX_PCRE ? "p" : "",
 				rw->actions & RWACT_SNOOP ? "S" : "",
 				rw->actions & RWACT_KLINE ? "\2K\2" : "",
-				rw->reason);
+				rw->reason, rw->hits);
+
+		if (rw->prefiltered)
+			prefiltered++;
 	}
+
+	command_success_nodata(si, _("%zu of %zu patterns are only tried on clients containing a fixed part of them."),
+	                       prefiltered, MOWGLI_LIST_LENGTH(&rwatch_list));
+
+	if (rwatch_checks != 0)
+		command_success_nodata(si, _("%lu clients checked in %llu ms (%llu us per client)."), rwatch_checks,
+		                       rwatch_usecs / 1000ULL, rwatch_usecs / rwatch_checks);
+
 	command_success_nodata(si, _("End of RWATCH LIST"));
 	logcommand(si, CMDLOG_GET, "RWATCH:LIST");
 }
@@ -439,7 +616,8 @@ static void
 rwatch_newuser(struct hook_user_nick *data)
 {
 	struct user *u = data->u;
-	char usermask[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1 + GECOSLEN + 1];
+	char usermask[RWATCH_MASKLEN];
+	struct timeval start;
 	mowgli_node_t *n;
 	struct rwatch *rw;
 
@@ -450,15 +628,23 @@ rwatch_newuser(struct hook_user_nick *data)
 	if (is_internal_client(u))
 		return;
 
+	if (MOWGLI_LIST_LENGTH(&rwatch_list) == 0)
+		return;
+
+	s_time(&start);
+
 	snprintf(usermask, sizeof usermask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
+	rwatch_prefilter(usermask);
 
 	MOWGLI_ITER_FOREACH(n, rwatch_list.head)
 	{
 		rw = n->data;
-		if (!rw->re)
+		if (!rwatch_candidate(rw))
 			continue;
 		if (regex_match(rw->re, usermask))
 		{
+			rw->hits++;
+
 			if (rw->actions & RWACT_SNOOP)
 			{
 				slog(LG_INFO, "RWATCH:%s \2%s\2 matches \2%s\2 (reason: \2%s\2)",
@@ -498,14 +684,17 @@ rwatch_newuser(struct hook_user_nick *data)
 			}
 		}
 	}
+
+	rwatch_account(&start);
 }
 
 static void
 rwatch_nickchange(struct hook_user_nick *data)
 {
 	struct user *u = data->u;
-	char usermask[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1 + GECOSLEN + 1];
-	char oldusermask[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1 + GECOSLEN + 1];
+	char usermask[RWATCH_MASKLEN];
+	char oldusermask[RWATCH_MASKLEN];
+	struct timeval start;
 	mowgli_node_t *n;
 	struct rwatch *rw;
 
@@ -516,19 +705,28 @@ rwatch_nickchange(struct hook_user_nick *data)
 	if (is_internal_client(u))
 		return;
 
+	if (MOWGLI_LIST_LENGTH(&rwatch_list) == 0)
+		return;
+
+	s_time(&start);
+
 	snprintf(usermask, sizeof usermask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
 	snprintf(oldusermask, sizeof oldusermask, "%s!%s@%s %s", data->oldnick, u->user, u->host, u->gecos);
+	rwatch_prefilter(usermask);
 
 	MOWGLI_ITER_FOREACH(n, rwatch_list.head)
 	{
 		rw = n->data;
-		if (!rw->re)
+		if (!rwatch_candidate(rw))
 			continue;
 		if (regex_match(rw->re, usermask))
 		{
 			// Only process if they did not match before.
 			if (regex_match(rw->re, oldusermask))
 				continue;
+
+			rw->hits++;
+
 			if (rw->actions & RWACT_SNOOP)
 			{
 				slog(LG_INFO, "RWATCH:NICKCHANGE:%s \2%s\2 -> \2%s\2 matches \2%s\2 (reason: \2%s\2)",
@@ -568,6 +766,8 @@ rwatch_nickchange(struct hook_user_nick *data)
 			}
 		}
 	}
+
+	rwatch_account(&start);
 }
 
 static struct command os_rwatch = {
@@ -635,6 +835,8 @@ mod_init(struct module *const restrict m)
 
 	(void) service_named_bind_command("operserv", &os_rwatch);
 
+	rwatch_literals = literal_set_create();
+
 	(void) hook_add_user_add(&rwatch_newuser);
 	(void) hook_add_user_nickchange(&rwatch_nickchange);
 	(void) hook_add_db_write(&write_rwatchdb);
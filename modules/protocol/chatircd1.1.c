@@ -108,18 +108,14 @@ extgecos_match(const char *mask, struct user *u)
 static bool
 unidentified_match(const char *mask, struct user *u)
 {
-	char hostbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char realbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-
 	// Is identified, so just bail.
 	if (u->myuser != NULL)
 		return false;
 
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(realbuf, sizeof realbuf, "%s!%s@%s", u->nick, u->user, u->host);
+	const struct user_masks *const um = user_masks(u);
 
 	// If here, not identified to services so just check if the given hostmask matches.
-	if (!match(mask, hostbuf) || !match(mask, realbuf))
+	if (!match(mask, um->vhostmask.str) || !match(mask, um->hostmask.str))
 		return true;
 
 	return false;
@@ -130,20 +126,14 @@ chatircd_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_n
 {
 	struct chanban *cb;
 	mowgli_node_t *n;
-	char hostbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char realbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char ipbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
 	char strippedmask[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1 + CHANNELLEN + 3];
-	char *p;
+	const char *mask, *p;
 	bool negate, matched;
 	int exttype;
 	struct channel *target_c;
 
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(realbuf, sizeof realbuf, "%s!%s@%s", u->nick, u->user, u->host);
-
-	// will be nick!user@ if ip unknown, doesn't matter
-	snprintf(ipbuf, sizeof ipbuf, "%s!%s@%s", u->nick, u->user, u->ip);
+	// ipmask will be nick!user@ if ip unknown, doesn't matter
+	const struct user_masks *const um = user_masks(u);
 
 	bool check_realhost = (config_options.masks_through_vhost || u->host == u->vhost);
 
@@ -160,19 +150,34 @@ chatircd_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_n
 		 * one day.
 		 *   --nenolod
 		 */
-		mowgli_strlcpy(strippedmask, cb->mask, sizeof strippedmask);
-		p = strrchr(strippedmask, '$');
-		if (p != NULL && p != strippedmask)
-			*p = 0;
+		mask = cb->mask;
+		p = strrchr(mask, '$');
+		if (p != NULL && p != mask)
+		{
+			mowgli_strlcpy(strippedmask, mask, sizeof strippedmask);
+			if ((size_t) (p - mask) < sizeof strippedmask)
+				strippedmask[p - mask] = '\0';
+			mask = strippedmask;
+		}
 
-		if (!match(strippedmask, hostbuf))
-			return n;
-		if (check_realhost && (!match(strippedmask, realbuf) || !match(strippedmask, ipbuf) || !match_cidr(strippedmask, ipbuf)))
-			return n;
+		if (mask == cb->mask)
+		{
+			if (user_mask_form_match(&cb->cmask, &um->vhostmask))
+				return n;
+			if (check_realhost && (user_mask_form_match(&cb->cmask, &um->hostmask) || user_mask_form_match(&cb->cmask, &um->ipmask) || user_masks_match_cidr(um, mask)))
+				return n;
+		}
+		else
+		{
+			if (!match(mask, um->vhostmask.str))
+				return n;
+			if (check_realhost && (!match(mask, um->hostmask.str) || !match(mask, um->ipmask.str) || user_masks_match_cidr(um, mask)))
+				return n;
+		}
 
-		if (strippedmask[0] == '$')
+		if (mask[0] == '$')
 		{
-			p = strippedmask + 1;
+			p = mask + 1;
 			negate = *p == '~';
 			if (negate)
 				p++;
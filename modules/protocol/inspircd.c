@@ -113,16 +113,10 @@ inspircd_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_n
 {
 	struct chanban *cb;
 	mowgli_node_t *n;
-	char hostbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char realbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char ipbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
 	char *p;
 
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(realbuf, sizeof realbuf, "%s!%s@%s", u->nick, u->user, u->host);
-
-	// will be nick!user@ if ip unknown, doesn't matter
-	snprintf(ipbuf, sizeof ipbuf, "%s!%s@%s", u->nick, u->user, u->ip);
+	// ipmask will be nick!user@ if ip unknown, doesn't matter
+	const struct user_masks *const um = user_masks(u);
 
 	bool check_realhost = (config_options.masks_through_vhost || u->host == u->vhost);
 
@@ -135,9 +129,9 @@ inspircd_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_n
 		if (cb->type != type)
 			continue;
 
-		if (!match(cb->mask, hostbuf))
+		if (user_mask_form_match(&cb->cmask, &um->vhostmask))
 			return n;
-		if (check_realhost && (!match(cb->mask, realbuf) || !match(cb->mask, ipbuf) || !match_cidr(cb->mask, ipbuf)))
+		if (check_realhost && (user_mask_form_match(&cb->cmask, &um->hostmask) || user_mask_form_match(&cb->cmask, &um->ipmask) || user_masks_match_cidr(um, cb->mask)))
 			return n;
 
 		if (cb->mask[1] == ':' && strchr("MRUjrm", cb->mask[0]))
@@ -171,9 +165,9 @@ inspircd_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_n
 				matched = !match(p, u->gecos);
 				break;
 			case 'm':
-				matched = !match(p, hostbuf);
+				matched = !match(p, um->vhostmask.str);
 				if (check_realhost && !matched)
-					matched = !match(p, realbuf) || !match(p, ipbuf) || !match_cidr(p, ipbuf);
+					matched = !match(p, um->hostmask.str) || !match(p, um->ipmask.str) || user_masks_match_cidr(um, p);
 				break;
 			default:
 				continue;
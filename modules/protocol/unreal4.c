@@ -219,19 +219,13 @@ unreal_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_nod
 {
 	struct chanban *cb;
 	mowgli_node_t *n;
-	char hostbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char realbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
-	char ipbuf[NICKLEN + 1 + USERLEN + 1 + HOSTLEN + 1];
 	char *p;
 	bool matched;
 	int exttype;
 	struct channel *target_c;
 
-	snprintf(hostbuf, sizeof hostbuf, "%s!%s@%s", u->nick, u->user, u->vhost);
-	snprintf(realbuf, sizeof realbuf, "%s!%s@%s", u->nick, u->user, u->host);
-
-	// will be nick!user@ if ip unknown, doesn't matter
-	snprintf(ipbuf, sizeof ipbuf, "%s!%s@%s", u->nick, u->user, u->ip);
+	// ipmask will be nick!user@ if ip unknown, doesn't matter
+	const struct user_masks *const um = user_masks(u);
 
 	bool check_realhost = (config_options.masks_through_vhost || u->host == u->vhost);
 
@@ -242,9 +236,9 @@ unreal_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_nod
 		if (cb->type != type)
 			continue;
 
-		if (!match(cb->mask, hostbuf))
+		if (user_mask_form_match(&cb->cmask, &um->vhostmask))
 			return n;
-		if (check_realhost && (!match(cb->mask, realbuf) || !match(cb->mask, ipbuf)))
+		if (check_realhost && (user_mask_form_match(&cb->cmask, &um->hostmask) || user_mask_form_match(&cb->cmask, &um->ipmask)))
 			return n;
 
 		if (cb->mask[0] == '~')
@@ -281,9 +275,9 @@ unreal_next_matching_ban(struct channel *c, struct user *u, int type, mowgli_nod
 					matched = should_reg_umode(u);
 					break;
 				case 'q':
-					matched = !match(p, hostbuf);
+					matched = !match(p, um->vhostmask.str);
 					if (check_realhost && !matched)
-						matched = !match(p, ipbuf);
+						matched = !match(p, um->ipmask.str);
 					break;
 				default:
 					continue;
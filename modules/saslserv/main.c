@@ -17,12 +17,24 @@
 #define ASASL_OUTFLAGS_WIPE_FREE_BUF    (ASASL_OUTFLAG_WIPE_BUF | ASASL_OUTFLAG_FREE_BUF)
 #define LOGIN_CANCELLED_STR             "There was a problem logging you in; login cancelled"
 
+/* Sessions that make no progress for SASL_SESSION_TIMEOUT seconds are
+ * destroyed. They are kept in a timer wheel with one slot per tick; a
+ * session is put in the slot that the wheel is on when it makes progress,
+ * and is destroyed when the wheel comes round to that slot again.
+ */
+#define SASL_SESSION_TIMEOUT            SECONDS_PER_MINUTE
+#define SASL_EXPIRY_TICK                5U
+#define SASL_EXPIRY_SLOTS               (SASL_SESSION_TIMEOUT / SASL_EXPIRY_TICK)
+
 static mowgli_list_t sasl_sessions;
+static mowgli_patricia_t *sasl_sessions_by_uid = NULL;
+static mowgli_list_t sasl_expiry_wheel[SASL_EXPIRY_SLOTS];
+static unsigned int sasl_expiry_slot = 0;
 static mowgli_list_t sasl_mechanisms;
 static char sasl_mechlist_string[SASL_S2S_MAXLEN_ATONCE_B64];
 static bool sasl_hide_server_names;
 
-static mowgli_eventloop_timer_t *sasl_delete_stale_timer = NULL;
+static mowgli_eventloop_timer_t *sasl_expiry_timer = NULL;
 static struct service *saslsvs = NULL;
 
 static const char *
@@ -108,17 +120,21 @@ sasl_session_find(const char *const restrict uid)
 	if (! uid || ! *uid)
 		return NULL;
 
-	mowgli_node_t *n;
+	return mowgli_patricia_retrieve(sasl_sessions_by_uid, uid);
+}
 
-	MOWGLI_ITER_FOREACH(n, sasl_sessions.head)
-	{
-		struct sasl_session *const p = n->data;
+// Some progress has been made; (re)start the session's timeout
+static void
+sasl_session_touch(struct sasl_session *const restrict p)
+{
+	if (p->expslot == sasl_expiry_slot)
+		return;
 
-		if (strcmp(p->uid, uid) == 0)
-			return p;
-	}
+	(void) mowgli_node_delete(&p->expnode, &sasl_expiry_wheel[p->expslot]);
 
-	return NULL;
+	p->expslot = sasl_expiry_slot;
+
+	(void) mowgli_node_add(p, &p->expnode, &sasl_expiry_wheel[p->expslot]);
 }
 
 static struct sasl_session *
@@ -134,6 +150,11 @@ sasl_session_find_or_make(const struct sasl_message *const restrict smsg)
 
 		(void) mowgli_strlcpy(p->uid, smsg->uid, sizeof p->uid);
 		(void) mowgli_node_add(p, &p->node, &sasl_sessions);
+		(void) mowgli_patricia_add(sasl_sessions_by_uid, p->uid, p);
+
+		p->expslot = sasl_expiry_slot;
+
+		(void) mowgli_node_add(p, &p->expnode, &sasl_expiry_wheel[p->expslot]);
 	}
 
 	return p;
@@ -316,6 +337,13 @@ sasl_user_can_login(struct sasl_session *const restrict p)
 static void
 sasl_session_reset(struct sasl_session *const restrict p)
 {
+	if (p->flags & ASASL_SFLAG_RESULT_PENDING)
+	{
+		// Nobody is going to act on the result anymore
+		p->flags &= ~ASASL_SFLAG_RESULT_PENDING;
+		(void) password_async_cancel(p, NULL);
+	}
+
 	if (p->mechptr && p->mechptr->mech_finish)
 		(void) p->mechptr->mech_finish(p);
 	p->mechptr = NULL;
@@ -329,18 +357,11 @@ sasl_session_reset(struct sasl_session *const restrict p)
 static void
 sasl_session_destroy(struct sasl_session *const restrict p)
 {
-	mowgli_node_t *n;
-
 	sasl_session_reset(p);
 
-	MOWGLI_ITER_FOREACH(n, sasl_sessions.head)
-	{
-		if (n == &p->node && n->data == p)
-		{
-			(void) mowgli_node_delete(n, &sasl_sessions);
-			break;
-		}
-	}
+	(void) mowgli_node_delete(&p->node, &sasl_sessions);
+	(void) mowgli_node_delete(&p->expnode, &sasl_expiry_wheel[p->expslot]);
+	(void) mowgli_patricia_delete(sasl_sessions_by_uid, p->uid);
 
 	if (p->si)
 		(void) atheme_object_unref(p->si);
@@ -577,58 +598,13 @@ sasl_process_output(struct sasl_session *const restrict p, struct sasl_output_bu
 	return true;
 }
 
-/* given an entire sasl message, advance session by passing data to mechanism
- * and feeding returned data back to client.
+/* act on what the mechanism made of the client's data; called again by
+ * sasl_mech_resume() for mechanisms that returned ASASL_MRESULT_ASYNC.
  */
 static bool ATHEME_FATTR_WUR
-sasl_process_packet(struct sasl_session *const restrict p, char *const restrict buf, const size_t len)
+sasl_process_result(struct sasl_session *const restrict p, const enum sasl_mechanism_result rc,
+                    const bool have_responded)
 {
-	struct sasl_output_buf outbuf = {
-		.buf    = NULL,
-		.len    = 0,
-		.flags  = ASASL_OUTFLAG_NONE,
-	};
-
-	enum sasl_mechanism_result rc;
-	bool have_responded = false;
-
-	if (! p->mechptr && ! len)
-	{
-		// First piece of data in a session is the name of the SASL mechanism that will be used
-		if (! (p->mechptr = sasl_mechanism_find(buf)))
-		{
-			(void) sasl_sts(p->uid, 'M', sasl_mechlist_string);
-			return false;
-		}
-
-		(void) sasl_sourceinfo_recreate(p);
-
-		if (p->mechptr->mech_start)
-			rc = p->mechptr->mech_start(p, &outbuf);
-		else
-			rc = ASASL_MRESULT_CONTINUE;
-	}
-	else if (! p->mechptr)
-	{
-		(void) slog(LG_DEBUG, "%s: session has no mechanism?", MOWGLI_FUNC_NAME);
-		return false;
-	}
-	else
-	{
-		rc = sasl_process_input(p, buf, len, &outbuf);
-	}
-
-	if (outbuf.buf && outbuf.len)
-	{
-		if (! sasl_process_output(p, &outbuf))
-			return false;
-
-		have_responded = true;
-	}
-
-	// Some progress has been made, reset timeout.
-	p->flags &= ~ASASL_SFLAG_MARKED_FOR_DELETION;
-
 	switch (rc)
 	{
 		case ASASL_MRESULT_CONTINUE:
@@ -691,6 +667,11 @@ sasl_process_packet(struct sasl_session *const restrict p, char *const restrict
 			return false;
 		}
 
+		case ASASL_MRESULT_ASYNC:
+			// The mechanism will call sasl_mech_resume() once it knows
+			p->flags |= ASASL_SFLAG_RESULT_PENDING;
+			return true;
+
 		case ASASL_MRESULT_ERROR:
 			return false;
 	}
@@ -702,6 +683,61 @@ sasl_process_packet(struct sasl_session *const restrict p, char *const restrict
 	return false;
 }
 
+/* given an entire sasl message, advance session by passing data to mechanism
+ * and feeding returned data back to client.
+ */
+static bool ATHEME_FATTR_WUR
+sasl_process_packet(struct sasl_session *const restrict p, char *const restrict buf, const size_t len)
+{
+	struct sasl_output_buf outbuf = {
+		.buf    = NULL,
+		.len    = 0,
+		.flags  = ASASL_OUTFLAG_NONE,
+	};
+
+	enum sasl_mechanism_result rc;
+	bool have_responded = false;
+
+	if (! p->mechptr && ! len)
+	{
+		// First piece of data in a session is the name of the SASL mechanism that will be used
+		if (! (p->mechptr = sasl_mechanism_find(buf)))
+		{
+			(void) sasl_sts(p->uid, 'M', sasl_mechlist_string);
+			return false;
+		}
+
+		(void) sasl_sourceinfo_recreate(p);
+
+		if (p->mechptr->mech_start)
+			rc = p->mechptr->mech_start(p, &outbuf);
+		else
+			rc = ASASL_MRESULT_CONTINUE;
+	}
+	else if (! p->mechptr)
+	{
+		(void) slog(LG_DEBUG, "%s: session has no mechanism?", MOWGLI_FUNC_NAME);
+		return false;
+	}
+	else
+	{
+		rc = sasl_process_input(p, buf, len, &outbuf);
+	}
+
+	if (outbuf.buf && outbuf.len)
+	{
+		if (! sasl_process_output(p, &outbuf))
+			return false;
+
+		have_responded = true;
+	}
+
+	// Some progress has been made, reset timeout.
+	(void) sasl_session_touch(p);
+
+	return sasl_process_result(p, rc, have_responded);
+}
+
 static bool ATHEME_FATTR_WUR
 sasl_process_buffer(struct sasl_session *const restrict p)
 {
@@ -866,12 +902,18 @@ sasl_input(struct sasl_message *const restrict smsg)
 
 		case 'S':
 			// (S)tart authentication
-			ret = sasl_input_startauth(smsg, p);
+			if (p->flags & ASASL_SFLAG_RESULT_PENDING)
+				ret = false;
+			else
+				ret = sasl_input_startauth(smsg, p);
 			break;
 
 		case 'C':
-			// (C)lient data
-			ret = sasl_input_clientdata(smsg, p);
+			// (C)lient data; there should be none while we are still checking what they sent
+			if (p->flags & ASASL_SFLAG_RESULT_PENDING)
+				ret = false;
+			else
+				ret = sasl_input_clientdata(smsg, p);
 			break;
 
 		case 'D':
@@ -902,19 +944,15 @@ sasl_user_add(struct hook_user_nick *const restrict data)
 }
 
 static void
-sasl_delete_stale(void ATHEME_VATTR_UNUSED *const restrict vptr)
+sasl_expire_sessions(void ATHEME_VATTR_UNUSED *const restrict vptr)
 {
 	mowgli_node_t *n, *tn;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sasl_sessions.head)
-	{
-		struct sasl_session *const p = n->data;
+	sasl_expiry_slot = (sasl_expiry_slot + 1U) % SASL_EXPIRY_SLOTS;
 
-		if (p->flags & ASASL_SFLAG_MARKED_FOR_DELETION)
-			(void) sasl_session_destroy(p);
-		else
-			p->flags |= ASASL_SFLAG_MARKED_FOR_DELETION;
-	}
+	// Everything in this slot has made no progress for a full turn of the wheel
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, sasl_expiry_wheel[sasl_expiry_slot].head)
+		(void) sasl_session_destroy(n->data);
 }
 
 static void
@@ -978,6 +1016,25 @@ sasl_mech_unregister(const struct sasl_mechanism *const restrict mech)
 	}
 }
 
+static void
+sasl_mech_resume(struct sasl_session *const restrict p, const enum sasl_mechanism_result rc)
+{
+	return_if_fail(p != NULL);
+
+	if (! (p->flags & ASASL_SFLAG_RESULT_PENDING))
+	{
+		(void) slog(LG_ERROR, "%s: session %s is not waiting for a result (BUG)", MOWGLI_FUNC_NAME, p->uid);
+		return;
+	}
+
+	p->flags &= ~ASASL_SFLAG_RESULT_PENDING;
+
+	(void) sasl_session_touch(p);
+
+	if (! sasl_process_result(p, rc, false))
+		(void) sasl_session_abort(p);
+}
+
 static inline bool ATHEME_FATTR_WUR
 sasl_authxid_can_login(struct sasl_session *const restrict p, const enum hook_user_login_method method,
                        const char *const restrict authxid, struct myuser **const restrict muo,
@@ -1061,6 +1118,7 @@ const struct sasl_core_functions sasl_core_functions = {
 	.authcid_can_login  = &sasl_authcid_can_login,
 	.authzid_can_login  = &sasl_authzid_can_login,
 	.recalc_mechlist    = &sasl_mechlist_string_build,
+	.mech_resume        = &sasl_mech_resume,
 };
 
 static void
@@ -1108,7 +1166,9 @@ mod_init(struct module *const restrict m)
 	(void) hook_add_user_add(&sasl_user_add);
 	(void) hook_add_server_eob(&sasl_server_eob);
 
-	sasl_delete_stale_timer = mowgli_timer_add(base_eventloop, "sasl_delete_stale", &sasl_delete_stale, NULL, SECONDS_PER_MINUTE / 2);
+	sasl_sessions_by_uid = mowgli_patricia_create(noopcanon);
+	sasl_expiry_timer = mowgli_timer_add(base_eventloop, "sasl_expire_sessions", &sasl_expire_sessions, NULL,
+	                                     SASL_EXPIRY_TICK);
 	authservice_loaded++;
 
 	(void) add_bool_conf_item("HIDE_SERVER_NAMES", &saslsvs->conf_table, 0, &sasl_hide_server_names, false);
@@ -1121,7 +1181,7 @@ mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 	(void) hook_del_user_add(&sasl_user_add);
 	(void) hook_del_server_eob(&sasl_server_eob);
 
-	(void) mowgli_timer_destroy(base_eventloop, sasl_delete_stale_timer);
+	(void) mowgli_timer_destroy(base_eventloop, sasl_expiry_timer);
 
 	(void) del_conf_item("HIDE_SERVER_NAMES", &saslsvs->conf_table);
 	(void) service_delete(saslsvs);
@@ -1131,6 +1191,8 @@ mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 	if (sasl_sessions.head)
 		(void) slog(LG_ERROR, "saslserv/main: shutting down with a non-empty session list; "
 		                      "a mechanism did not unregister itself! (BUG)");
+	else
+		(void) mowgli_patricia_destroy(sasl_sessions_by_uid, NULL, NULL);
 }
 
 SIMPLE_DECLARE_MODULE_V1("saslserv/main", MODULE_UNLOAD_CAPABILITY_OK)
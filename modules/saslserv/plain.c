@@ -12,6 +12,31 @@
 
 static const struct sasl_core_functions *sasl_core_functions = NULL;
 
+static void
+sasl_mech_plain_verified(struct myuser ATHEME_VATTR_UNUSED *const mu, const enum password_async_result result,
+                         void *const priv)
+{
+	struct sasl_session *const p = priv;
+
+	switch (result)
+	{
+		case PWASYNC_OK:
+			(void) sasl_core_functions->mech_resume(p, ASASL_MRESULT_SUCCESS);
+			break;
+
+		case PWASYNC_FAILED:
+			(void) sasl_core_functions->mech_resume(p, ASASL_MRESULT_FAILURE);
+			break;
+
+		case PWASYNC_ERROR:
+			(void) sasl_core_functions->mech_resume(p, ASASL_MRESULT_ERROR);
+			break;
+
+		case PWASYNC_CANCELLED:
+			break;
+	}
+}
+
 static enum sasl_mechanism_result ATHEME_FATTR_WUR
 sasl_mech_plain_step(struct sasl_session *const restrict p, const struct sasl_input_buf *const restrict in,
                      struct sasl_output_buf ATHEME_VATTR_UNUSED *const restrict out)
@@ -56,6 +81,19 @@ sasl_mech_plain_step(struct sasl_session *const restrict p, const struct sasl_in
 	if (! sasl_core_functions->authcid_can_login(p, HULM_PASSWORD, authcid, &mu))
 		return ASASL_MRESULT_ERROR;
 
+	switch (verify_password_async(mu, secret, p, p->ip ? p->ip : p->uid, &sasl_mech_plain_verified, p))
+	{
+		case PWASYNC_QUEUED:
+			return ASASL_MRESULT_ASYNC;
+
+		case PWASYNC_BUSY:
+			(void) slog(LG_DEBUG, "%s: crypt queue is full; aborting session %s", MOWGLI_FUNC_NAME, p->uid);
+			return ASASL_MRESULT_ERROR;
+
+		case PWASYNC_SYNC:
+			break;
+	}
+
 	if (! verify_password(mu, secret))
 		return ASASL_MRESULT_FAILURE;
 
@@ -82,6 +120,7 @@ static void
 mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
 	(void) sasl_core_functions->mech_unregister(&sasl_mech_plain);
+	(void) password_async_cancel(NULL, &sasl_mech_plain_verified);
 }
 
 SIMPLE_DECLARE_MODULE_V1("saslserv/plain", MODULE_UNLOAD_CAPABILITY_OK)
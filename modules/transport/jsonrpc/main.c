@@ -110,6 +110,72 @@ static struct sourceinfo_vtable jsonrpc_vtable = {
 
 // These taken from modules/transport/xmlrpc/main.c
 
+// atheme.login waiting for the crypt workers
+struct jsonrpc_login
+{
+	struct connection *     cptr;
+	char *                  sourceip;
+	char *                  id;
+};
+
+static void
+jsonrpc_login_complete(void *conn, struct myuser *mu, char *sourceip, char *id, bool verified)
+{
+	struct authcookie *ac;
+
+	if (!verified)
+	{
+		struct sourceinfo *si;
+
+		logcommand_external(nicksvs.me, "jsonrpc", conn, sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
+		jsonrpc_failure_string(conn, fault_authfail, "The password is incorrect.", id);
+
+		si = sourceinfo_create();
+
+		struct jsonrpc_sourceinfo *jsi = (struct jsonrpc_sourceinfo *)si;
+
+		si->service = NULL;
+		si->sourcedesc = sourceip;
+		si->connection = conn;
+		si->v = &jsonrpc_vtable;
+		si->force_language = language_find("en");
+
+		jsi->base = si;
+		jsi->id = id;
+
+		bad_password(si, mu);
+
+		atheme_object_unref(si);
+
+		return;
+	}
+
+	mu->lastlogin = CURRTIME;
+
+	ac = authcookie_create(mu);
+
+	logcommand_external(nicksvs.me, "jsonrpc", conn, sourceip, mu, CMDLOG_LOGIN, "LOGIN");
+
+	jsonrpc_success_string(conn, ac->ticket, id);
+}
+
+static void
+jsonrpc_login_verified(struct myuser *const mu, const enum password_async_result result, void *const priv)
+{
+	struct jsonrpc_login *const req = priv;
+
+	if (result == PWASYNC_ERROR)
+		jsonrpc_failure_string(req->cptr, fault_internalerror, "The password could not be checked. Please try again.", req->id);
+	else if (result != PWASYNC_CANCELLED && !mu)
+		jsonrpc_failure_string(req->cptr, fault_nosuch_source, "The account is not registered.", req->id);
+	else if (result != PWASYNC_CANCELLED)
+		jsonrpc_login_complete(req->cptr, mu, req->sourceip, req->id, result == PWASYNC_OK);
+
+	sfree(req->sourceip);
+	sfree(req->id);
+	sfree(req);
+}
+
 /* atheme.login
  *
  * Parameters:
@@ -120,6 +186,7 @@ static struct sourceinfo_vtable jsonrpc_vtable = {
  *       fault 3 - account is not registered
  *       fault 5 - invalid username and password
  *       fault 6 - account is frozen
+ *       fault 9 - too many logins are being processed
  *       default - success (authcookie)
  *
  * Side Effects:
@@ -130,7 +197,7 @@ static bool
 jsonrpcmethod_login(void *conn, mowgli_list_t *params, char *id)
 {
 	struct myuser *mu;
-	struct authcookie *ac;
+	struct jsonrpc_login *req;
 	char *sourceip, *accountname, *password;
 
 	size_t len = MOWGLI_LIST_LENGTH(params);
@@ -158,40 +225,29 @@ jsonrpcmethod_login(void *conn, mowgli_list_t *params, char *id)
 		return false;
 	}
 
-	if (!verify_password(mu, password))
-	{
-		struct sourceinfo *si;
-
-		logcommand_external(nicksvs.me, "jsonrpc", conn, sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
-		jsonrpc_failure_string(conn, fault_authfail, "The password is incorrect.", id);
-
-		si = sourceinfo_create();
-
-		struct jsonrpc_sourceinfo *jsi = (struct jsonrpc_sourceinfo *)si;
-
-		si->service = NULL;
-		si->sourcedesc = sourceip;
-		si->connection = conn;
-		si->v = &jsonrpc_vtable;
-		si->force_language = language_find("en");
-
-		jsi->base = si;
-		jsi->id = id;
+	req = smalloc(sizeof *req);
+	req->cptr = conn;
+	req->sourceip = sstrdup(sourceip);
+	req->id = sstrdup(id);
 
-		bad_password(si, mu);
+	switch (verify_password_async(mu, password, conn, sourceip ? sourceip : req->cptr->name, &jsonrpc_login_verified, req))
+	{
+		case PWASYNC_QUEUED:
+			// jsonrpc_login_verified() sends the reply
+			return true;
 
-		atheme_object_unref(si);
+		case PWASYNC_BUSY:
+			jsonrpc_failure_string(conn, fault_toomany, "Too many logins are being processed. Please try again later.", id);
+			break;
 
-		return false;
+		case PWASYNC_SYNC:
+			jsonrpc_login_complete(conn, mu, sourceip, id, verify_password(mu, password));
+			break;
 	}
 
-	mu->lastlogin = CURRTIME;
-
-	ac = authcookie_create(mu);
-
-	logcommand_external(nicksvs.me, "jsonrpc", conn, sourceip, mu, CMDLOG_LOGIN, "LOGIN");
-
-	jsonrpc_success_string(conn, ac->ticket, id);
+	sfree(req->sourceip);
+	sfree(req->id);
+	sfree(req);
 
 	return true;
 }
@@ -676,6 +732,8 @@ mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
 	mowgli_node_t *n;
 
+	password_async_cancel(NULL, &jsonrpc_login_verified);
+
 	jsonrpc_unregister_method("atheme.login");
 	jsonrpc_unregister_method("atheme.logout");
 	jsonrpc_unregister_method("atheme.command");
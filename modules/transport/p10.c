@@ -25,6 +25,7 @@ p10_parse(char *line)
 	char *message = NULL;
 	char *parv[MAXPARC + 1];
 	static char coreLine[BUFSIZE];
+	static struct sourceinfo *si_reuse = NULL;
 	int parc = 0;
 	unsigned int i;
 	struct proto_cmd *pcmd;
@@ -33,7 +34,7 @@ p10_parse(char *line)
 	for (i = 0; i <= MAXPARC; i++)
 		parv[i] = NULL;
 
-	si = sourceinfo_create();
+	si = si_reuse = sourceinfo_recycle(si_reuse);
 	si->connection = curr_uplink->conn;
 	si->output_limit = MAX_IRC_OUTPUT_LINES;
 
@@ -47,9 +48,13 @@ p10_parse(char *line)
 		if (*line == '\000')
 			goto cleanup;
 
-		// copy the original line so we know what we crashed on
-		memset((char *)&coreLine, '\0', BUFSIZE);
-		mowgli_strlcpy(coreLine, line, BUFSIZE);
+		/* copy the original line so we know what we crashed on;
+		 * only worth it when someone is debugging
+		 */
+		if (log_active_mask & (LG_DEBUG | LG_RAWDATA))
+			mowgli_strlcpy(coreLine, line, BUFSIZE);
+		else
+			coreLine[0] = '\0';
 
 		slog(LG_RAWDATA, "-> %s", line);
 
@@ -104,12 +109,12 @@ p10_parse(char *line)
                 }
 		if (si->s == me.me)
 		{
-                        slog(LG_INFO, "p10_parse(): got message supposedly from myself %s: %s", si->s->name, coreLine);
+                        slog(LG_INFO, "p10_parse(): got message supposedly from myself %s: %s", si->s->name, *coreLine ? coreLine : command);
                         goto cleanup;
 		}
 		if (si->su != NULL && si->su->server == me.me)
 		{
-                        slog(LG_INFO, "p10_parse(): got message supposedly from my own client %s: %s", si->su->nick, coreLine);
+                        slog(LG_INFO, "p10_parse(): got message supposedly from my own client %s: %s", si->su->nick, *coreLine ? coreLine : command);
                         goto cleanup;
 		}
 		si->smu = si->su != NULL ? si->su->myuser : NULL;
@@ -172,7 +177,8 @@ p10_parse(char *line)
 	}
 
 cleanup:
-	atheme_object_unref(si);
+	// si stays with si_reuse; handlers that need it later take their own reference
+	return;
 }
 
 static void
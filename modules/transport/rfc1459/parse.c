@@ -26,6 +26,7 @@ irc_parse(char *line)
 	char *message = NULL;
 	char *parv[MAXPARC + 1];
 	static char coreLine[BUFSIZE];
+	static struct sourceinfo *si_reuse = NULL;
 	int parc = 0;
 	unsigned int i;
 	struct proto_cmd *pcmd;
@@ -34,7 +35,7 @@ irc_parse(char *line)
 	for (i = 0; i <= MAXPARC; i++)
 		parv[i] = NULL;
 
-	si = sourceinfo_create();
+	si = si_reuse = sourceinfo_recycle(si_reuse);
 	si->connection = curr_uplink->conn;
 	si->output_limit = MAX_IRC_OUTPUT_LINES;
 
@@ -48,9 +49,13 @@ irc_parse(char *line)
 		if (*line == '\000')
 			goto cleanup;
 
-		// copy the original line so we know what we crashed on
-		memset((char *)&coreLine, '\0', BUFSIZE);
-		mowgli_strlcpy(coreLine, line, BUFSIZE);
+		/* copy the original line so we know what we crashed on;
+		 * only worth it when someone is debugging
+		 */
+		if (log_active_mask & (LG_DEBUG | LG_RAWDATA))
+			mowgli_strlcpy(coreLine, line, BUFSIZE);
+		else
+			coreLine[0] = '\0';
 
 		slog(LG_RAWDATA, "-> %s", line);
 
@@ -125,12 +130,12 @@ irc_parse(char *line)
                 }
 		if (si->s == me.me)
 		{
-                        slog(LG_INFO, "irc_parse(): got message supposedly from myself %s: %s", si->s->name, coreLine);
+                        slog(LG_INFO, "irc_parse(): got message supposedly from myself %s: %s", si->s->name, *coreLine ? coreLine : command);
                         goto cleanup;
 		}
 		if (si->su != NULL && si->su->server == me.me)
 		{
-                        slog(LG_INFO, "irc_parse(): got message supposedly from my own client %s: %s", si->su->nick, coreLine);
+                        slog(LG_INFO, "irc_parse(): got message supposedly from my own client %s: %s", si->su->nick, *coreLine ? coreLine : command);
                         goto cleanup;
 		}
 		si->smu = si->su != NULL ? si->su->myuser : NULL;
@@ -184,5 +189,6 @@ irc_parse(char *line)
 	}
 
 cleanup:
-	atheme_object_unref(si);
+	// si stays with si_reuse; handlers that need it later take their own reference
+	return;
 }
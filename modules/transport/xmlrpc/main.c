@@ -152,6 +152,72 @@ static struct sourceinfo_vtable xmlrpc_vtable = {
 
 // These taken from the old modules/xmlrpc/account.c
 
+// atheme.login waiting for the crypt workers
+struct xmlrpc_login
+{
+	struct connection *     cptr;
+	char *                  sourceip;
+};
+
+static void
+xmlrpc_login_complete(struct connection *const restrict conn, struct myuser *const restrict mu,
+                      const char *const restrict sourceip, const bool verified)
+{
+	struct authcookie *ac;
+
+	if (!verified)
+	{
+		struct sourceinfo *si;
+
+		logcommand_external(nicksvs.me, "xmlrpc", conn, sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
+		xmlrpc_generic_error(fault_authfail, "The password is not valid for this account.");
+
+		si = sourceinfo_create();
+		si->service = NULL;
+		si->sourcedesc = sourceip;
+		si->connection = conn;
+		si->v = &xmlrpc_vtable;
+		si->force_language = language_find("en");
+
+		bad_password(si, mu);
+
+		atheme_object_unref(si);
+
+		return;
+	}
+
+	mu->lastlogin = CURRTIME;
+
+	ac = authcookie_create(mu);
+
+	logcommand_external(nicksvs.me, "xmlrpc", conn, sourceip, mu, CMDLOG_LOGIN, "LOGIN");
+
+	xmlrpc_send_string(ac->ticket);
+}
+
+static void
+xmlrpc_login_verified(struct myuser *const mu, const enum password_async_result result, void *const priv)
+{
+	struct xmlrpc_login *const req = priv;
+
+	if (result != PWASYNC_CANCELLED)
+	{
+		current_cptr = req->cptr;
+
+		if (result == PWASYNC_ERROR)
+			xmlrpc_generic_error(fault_internalerror, "The password could not be checked. Please try again.");
+		else if (!mu)
+			xmlrpc_generic_error(fault_nosuch_source, "The account is not registered.");
+		else
+			xmlrpc_login_complete(req->cptr, mu, req->sourceip, result == PWASYNC_OK);
+
+		current_cptr = NULL;
+	}
+
+	sfree(req->sourceip);
+	sfree(req);
+}
+
 /* atheme.login
  *
  * XML Inputs:
@@ -162,6 +228,7 @@ static struct sourceinfo_vtable xmlrpc_vtable = {
  *       fault 3 - account is not registered
  *       fault 5 - invalid username and password
  *       fault 6 - account is frozen
+ *       fault 9 - too many logins are being processed
  *       default - success (authcookie)
  *
  * Side Effects:
@@ -172,7 +239,7 @@ static int
 xmlrpcmethod_login(void *conn, int parc, char *parv[])
 {
 	struct myuser *mu;
-	struct authcookie *ac;
+	struct xmlrpc_login *req;
 	const char *sourceip;
 
 	if (parc < 2)
@@ -196,34 +263,27 @@ xmlrpcmethod_login(void *conn, int parc, char *parv[])
 		return 0;
 	}
 
-	if (!verify_password(mu, parv[1]))
-	{
-		struct sourceinfo *si;
+	req = smalloc(sizeof *req);
+	req->cptr = conn;
+	req->sourceip = sstrdup(sourceip);
 
-		logcommand_external(nicksvs.me, "xmlrpc", conn, sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
-		xmlrpc_generic_error(fault_authfail, "The password is not valid for this account.");
-
-		si = sourceinfo_create();
-		si->service = NULL;
-		si->sourcedesc = parv[2] != NULL && *parv[2] ? parv[2] : NULL;
-		si->connection = conn;
-		si->v = &xmlrpc_vtable;
-		si->force_language = language_find("en");
-
-		bad_password(si, mu);
+	switch (verify_password_async(mu, parv[1], conn, sourceip ? sourceip : req->cptr->name, &xmlrpc_login_verified, req))
+	{
+		case PWASYNC_QUEUED:
+			// xmlrpc_login_verified() sends the reply
+			return 0;
 
-		atheme_object_unref(si);
+		case PWASYNC_BUSY:
+			xmlrpc_generic_error(fault_toomany, "Too many logins are being processed. Please try again later.");
+			break;
 
-		return 0;
+		case PWASYNC_SYNC:
+			xmlrpc_login_complete(conn, mu, sourceip, verify_password(mu, parv[1]));
+			break;
 	}
 
-	mu->lastlogin = CURRTIME;
-
-	ac = authcookie_create(mu);
-
-	logcommand_external(nicksvs.me, "xmlrpc", conn, sourceip, mu, CMDLOG_LOGIN, "LOGIN");
-
-	xmlrpc_send_string(ac->ticket);
+	sfree(req->sourceip);
+	sfree(req);
 
 	return 0;
 }
@@ -586,6 +646,8 @@ mod_deinit(const enum module_unload_intent ATHEME_VATTR_UNUSED intent)
 {
 	mowgli_node_t *n;
 
+	password_async_cancel(NULL, &xmlrpc_login_verified);
+
 	xmlrpc_unregister_method("atheme.login");
 	xmlrpc_unregister_method("atheme.logout");
 	xmlrpc_unregister_method("atheme.command");
@@ -0,0 +1,100 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Converts a services database between backends, e.g. from OpenSEX to
+ * binsnap and back.
+ */
+
+#include <atheme.h>
+#include <atheme/libathemecore.h>
+
+static void
+handle_mdep(struct database_handle *db, const char *type)
+{
+	const char *modname = db_sread_word(db);
+
+	if (! module_request(modname))
+		exit(EXIT_FAILURE);
+}
+
+static const struct database_module *
+load_backend(const char *name, struct module **mptr)
+{
+	char modname[BUFSIZE];
+
+	(void) snprintf(modname, sizeof modname, "backend/%s", name);
+
+	if (! (*mptr = module_load(modname)))
+		return NULL;
+
+	return db_mod;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct database_module *from_mod, *to_mod;
+	struct module *from_m, *to_m;
+
+	if (argc < 3)
+	{
+		(void) fprintf(stderr, "Usage: %s <from-backend> <to-backend> [<infile> [<outfile>]]\n", argv[0]);
+		(void) fprintf(stderr, "Example: %s opensex binsnap services.db services.bsnap\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (! strcmp(argv[1], argv[2]))
+	{
+		(void) fprintf(stderr, "%s: the source and target backends must differ\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (! libathemecore_early_init())
+		return EXIT_FAILURE;
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/dbconvert.log");
+	atheme_setup();
+
+	runflags = RF_LIVE;
+	datadir = DATADIR;
+	strict_mode = false;
+	offline_mode = true;
+
+	const char *const infile = argc > 3 ? argv[3] : NULL;
+	const char *const outfile = argc > 4 ? argv[4] : NULL;
+
+	slog(LG_INFO, "dbconvert is converting %s (%s) to %s (%s)", infile ? infile : "the default database",
+	     argv[1], outfile ? outfile : "the default database", argv[2]);
+
+	if (! (from_mod = load_backend(argv[1], &from_m)))
+		return EXIT_FAILURE;
+
+	db_unregister_type_handler("MDEP");
+	db_register_type_handler("MDEP", handle_mdep);
+
+	slog(LG_INFO, "*** phase 1: reading %s datastore", argv[1]);
+
+	runflags &= ~RF_LIVE;
+	db_mod = from_mod;
+	db_load(infile);
+	runflags |= RF_LIVE;
+
+	if (! (to_mod = load_backend(argv[2], &to_m)))
+		return EXIT_FAILURE;
+
+	/* Only the target backend may end up in the MDEP rows of the new
+	 * database, or services would load both backends on startup.
+	 */
+	from_m->mflags &= ~MODFLAG_DBHANDLER;
+
+	slog(LG_INFO, "*** phase 2: writing %s datastore", argv[2]);
+
+	db_mod = to_mod;
+	db_save(outfile, DB_SAVE_BLOCKING);
+
+	return EXIT_SUCCESS;
+}
@@ -77,6 +77,7 @@ verify_channel_registrations(void)
 			mowgli_patricia_add(known, key, ca);
 		}
 
+		chanacs_index_invalidate(mc);
 		mowgli_patricia_destroy(known, NULL, NULL);
 	}
 }
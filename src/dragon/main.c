@@ -43,11 +43,84 @@ build_world(void)
 {
 	int i;
 	char userbuf[BUFSIZE];
+	char ipbuf[HOSTLEN + 1];
 
 	for (i = 100000; i > 0; i--)
 	{
 		snprintf(userbuf, sizeof userbuf, "User%d", i);
-		user_add(userbuf, "user", "localhost", NULL, NULL, ircd->uses_uid ? uid_get() : NULL, "User", me.me, CURRTIME);
+		snprintf(ipbuf, sizeof ipbuf, "10.%d.%d.%d", (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+		user_add(userbuf, "user", "localhost", NULL, ipbuf, ircd->uses_uid ? uid_get() : NULL, "User", me.me, CURRTIME);
+	}
+}
+
+void
+build_klines(void)
+{
+	int i;
+	char hostbuf[HOSTLEN + 1];
+
+	/* mostly exact-IP and CIDR AKILLs, with a minority of wildcard hosts */
+	for (i = 0; i < 40000; i++)
+	{
+		if (i % 100 == 0)
+			snprintf(hostbuf, sizeof hostbuf, "*.abuser%d.example", i);
+		else if (i % 10 == 0)
+			snprintf(hostbuf, sizeof hostbuf, "172.%d.%d.0/24", (i >> 8) & 0xFF, i & 0xFF);
+		else
+			snprintf(hostbuf, sizeof hostbuf, "192.168.%d.%d", (i >> 8) & 0xFF, i & 0xFF);
+
+		kline_add("*", hostbuf, "dragon", 0, "dragon");
+	}
+}
+
+void
+check_klines(void)
+{
+	mowgli_node_t *n;
+	unsigned int hits = 0;
+
+	MOWGLI_ITER_FOREACH(n, me.me->userlist.head)
+		if (kline_find_user(n->data) != NULL)
+			hits++;
+
+	slog(LG_INFO, "%u users matched an AKILL", hits);
+}
+
+void
+build_channels(void)
+{
+	int i;
+	char chanbuf[BUFSIZE];
+	struct channel *c;
+	mowgli_node_t *n;
+
+	for (i = 50000; i > 0; i--)
+	{
+		snprintf(chanbuf, sizeof chanbuf, "#chan%d", i);
+		channel_add(chanbuf, CURRTIME, me.me);
+	}
+
+	/* a handful of very large channels, plus a few small ones per user */
+	i = 0;
+	MOWGLI_ITER_FOREACH(n, me.me->userlist.head)
+	{
+		struct user *u = n->data;
+
+		snprintf(chanbuf, sizeof chanbuf, "#big%d", i % 5);
+		if ((c = channel_find(chanbuf)) == NULL)
+			c = channel_add(chanbuf, CURRTIME, me.me);
+		chanuser_add(c, CLIENT_NAME(u));
+
+		snprintf(chanbuf, sizeof chanbuf, "#chan%d", (i % 50000) + 1);
+		chanuser_add(channel_find(chanbuf), CLIENT_NAME(u));
+
+		snprintf(chanbuf, sizeof chanbuf, "#chan%d", ((i * 7) % 50000) + 1);
+		chanuser_add(channel_find(chanbuf), CLIENT_NAME(u));
+
+		snprintf(chanbuf, sizeof chanbuf, "#chan%d", ((i * 13) % 50000) + 1);
+		chanuser_add(channel_find(chanbuf), CLIENT_NAME(u));
+
+		i++;
 	}
 }
 
@@ -79,6 +152,20 @@ phase_buildworld(void)
 	e_time(ts, &te);
 
 	slog(LG_INFO, "world created in %d msec", tv2ms(&te));
+
+	build_klines();
+
+	s_time(&ts);
+	check_klines();
+	e_time(ts, &te);
+
+	slog(LG_INFO, "%u users checked against %u AKILLs in %d msec", cnt.user, cnt.kline, tv2ms(&te));
+
+	s_time(&ts);
+	build_channels();
+	e_time(ts, &te);
+
+	slog(LG_INFO, "%u channels with %u memberships created in %d msec", cnt.chan, cnt.chanuser, tv2ms(&te));
 }
 
 static void
@@ -0,0 +1,218 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * Compares match() with compiled masks on a generated list of channel bans.
+ */
+
+#include <atheme/constants.h>       // BUFSIZE
+#include <atheme/match.h>           // match(), compiled_mask_*(), folded_name_*()
+#include <atheme/memory.h>          // smalloc(), sfree()
+#include <atheme/stdheaders.h>      // (everything else)
+#include <atheme/tools.h>           // string_to_uint()
+
+#define DEFAULT_MASKS   500U
+#define DEFAULT_NAMES   1000U
+#define DEFAULT_ROUNDS  10U
+
+static uint32_t bench_seed = 0x5EED1234U;
+
+// Deterministic, so that runs are comparable
+static unsigned int
+bench_rand(const unsigned int bound)
+{
+	bench_seed = (bench_seed * 1103515245U) + 12345U;
+
+	return (unsigned int) ((bench_seed >> 8) % bound);
+}
+
+static char *
+bench_make_mask(void)
+{
+	char buf[BUFSIZE];
+	const unsigned int a = bench_rand(5000), b = bench_rand(256);
+
+	switch (bench_rand(10))
+	{
+		case 0:
+			(void) snprintf(buf, sizeof buf, "*!*@host%u.isp%u.example.com", a, b % 16);
+			break;
+		case 1:
+			(void) snprintf(buf, sizeof buf, "*!*@*.isp%u.example.com", b % 16);
+			break;
+		case 2:
+			(void) snprintf(buf, sizeof buf, "Nick%u*!*@*", a);
+			break;
+		case 3:
+			(void) snprintf(buf, sizeof buf, "*!*ident%u@*", a);
+			break;
+		case 4:
+			(void) snprintf(buf, sizeof buf, "*!*@192.0.%u.*", b);
+			break;
+		case 5:
+			(void) snprintf(buf, sizeof buf, "*!*@2001:db8:%x:*", a);
+			break;
+		case 6:
+			(void) snprintf(buf, sizeof buf, "Nick%u!~ident%u@host%u.isp%u.example.com", a, a, a, b % 16);
+			break;
+		case 7:
+			(void) snprintf(buf, sizeof buf, "*!*@*spam%u*", a);
+			break;
+		case 8:
+			(void) snprintf(buf, sizeof buf, "*!?ident%u@*.example.???", a);
+			break;
+		default:
+			(void) snprintf(buf, sizeof buf, "*%u*!*@*", a);
+			break;
+	}
+
+	return sstrdup(buf);
+}
+
+static char *
+bench_make_name(void)
+{
+	char buf[BUFSIZE];
+	const unsigned int a = bench_rand(5000), b = bench_rand(256);
+
+	switch (bench_rand(3))
+	{
+		case 0:
+			(void) snprintf(buf, sizeof buf, "Nick%u!~ident%u@host%u.isp%u.Example.COM", a, a, a, b % 16);
+			break;
+		case 1:
+			(void) snprintf(buf, sizeof buf, "Nick%u!~ident%u@192.0.%u.%u", a, a, b, a % 256);
+			break;
+		default:
+			(void) snprintf(buf, sizeof buf, "Nick%u!ident%u@2001:db8:%x::%x", a, a, a, b);
+			break;
+	}
+
+	return sstrdup(buf);
+}
+
+static double
+bench_elapsed(const struct timeval *const restrict begin, const struct timeval *const restrict end)
+{
+	return ((double) (end->tv_sec - begin->tv_sec)) + (((double) (end->tv_usec - begin->tv_usec)) / 1000000.0);
+}
+
+static bool
+bench_get_arg(const int argc, char **const restrict argv, const int idx, unsigned int *const restrict val)
+{
+	if (argc <= idx)
+		return true;
+
+	if (! string_to_uint(argv[idx], val) || ! *val)
+	{
+		(void) fprintf(stderr, "%s: '%s' is not a positive number\n", argv[0], argv[idx]);
+		return false;
+	}
+
+	return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int nmasks = DEFAULT_MASKS;
+	unsigned int nnames = DEFAULT_NAMES;
+	unsigned int rounds = DEFAULT_ROUNDS;
+
+	if (argc > 4)
+	{
+		(void) fprintf(stderr, "Usage: %s [masks [names [rounds]]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (! bench_get_arg(argc, argv, 1, &nmasks) || ! bench_get_arg(argc, argv, 2, &nnames) ||
+	    ! bench_get_arg(argc, argv, 3, &rounds))
+		return EXIT_FAILURE;
+
+	char **const masks = smalloc(nmasks * sizeof *masks);
+	char **const names = smalloc(nnames * sizeof *names);
+	struct compiled_mask *const cmasks = smalloc(nmasks * sizeof *cmasks);
+	struct folded_name *const fnames = smalloc(nnames * sizeof *fnames);
+
+	for (unsigned int i = 0; i < nmasks; i++)
+		masks[i] = bench_make_mask();
+
+	for (unsigned int i = 0; i < nnames; i++)
+		names[i] = bench_make_name();
+
+	struct timeval begin, end;
+	unsigned long mismatches = 0, matched = 0, cmatched = 0;
+
+	(void) gettimeofday(&begin, NULL);
+
+	for (unsigned int i = 0; i < nmasks; i++)
+		compiled_mask_init(&cmasks[i], masks[i]);
+
+	for (unsigned int i = 0; i < nnames; i++)
+		folded_name_init(&fnames[i], names[i]);
+
+	(void) gettimeofday(&end, NULL);
+
+	const double preptime = bench_elapsed(&begin, &end);
+
+	for (unsigned int i = 0; i < nnames; i++)
+		for (unsigned int j = 0; j < nmasks; j++)
+			if ((match(masks[j], names[i]) == 0) != compiled_mask_match_name(&cmasks[j], &fnames[i]))
+				mismatches++;
+
+	(void) gettimeofday(&begin, NULL);
+
+	for (unsigned int r = 0; r < rounds; r++)
+		for (unsigned int i = 0; i < nnames; i++)
+			for (unsigned int j = 0; j < nmasks; j++)
+				if (match(masks[j], names[i]) == 0)
+					matched++;
+
+	(void) gettimeofday(&end, NULL);
+
+	const double matchtime = bench_elapsed(&begin, &end);
+
+	(void) gettimeofday(&begin, NULL);
+
+	for (unsigned int r = 0; r < rounds; r++)
+		for (unsigned int i = 0; i < nnames; i++)
+			for (unsigned int j = 0; j < nmasks; j++)
+				if (compiled_mask_match_name(&cmasks[j], &fnames[i]))
+					cmatched++;
+
+	(void) gettimeofday(&end, NULL);
+
+	const double cmatchtime = bench_elapsed(&begin, &end);
+	const double tests = ((double) rounds) * ((double) nnames) * ((double) nmasks);
+
+	(void) printf("%u masks, %u names, %u rounds (%.0f tests, %lu matches)\n", nmasks, nnames, rounds, tests,
+	              matched / rounds);
+	(void) printf("match():          %8.3f s, %8.1f ns/test\n", matchtime, (matchtime * 1e9) / tests);
+	(void) printf("compiled masks:   %8.3f s, %8.1f ns/test (%.2fx), %.3f s to compile and fold\n", cmatchtime,
+	              (cmatchtime * 1e9) / tests, (cmatchtime > 0) ? (matchtime / cmatchtime) : 0, preptime);
+
+	if (mismatches != 0 || matched != cmatched)
+		(void) printf("WARNING: %lu results differ from match()\n", mismatches);
+
+	for (unsigned int i = 0; i < nmasks; i++)
+	{
+		compiled_mask_free(&cmasks[i]);
+		sfree(masks[i]);
+	}
+
+	for (unsigned int i = 0; i < nnames; i++)
+		sfree(names[i]);
+
+	sfree(masks);
+	sfree(names);
+	sfree(cmasks);
+	sfree(fnames);
+
+	return (mismatches == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,521 @@
+/*
+ * SPDX-License-Identifier: ISC
+ * SPDX-URL: https://spdx.org/licenses/ISC.html
+ *
+ * Copyright (C) 2024 Atheme Development Group (https://atheme.github.io/)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * A SASL load generator. It opens many concurrent PLAIN and SCRAM-SHA-256
+ * sessions by feeding SaslServ the messages a protocol module passes on from
+ * the ircd (through the sasl_input hook), takes every one of them through to
+ * a successful login, then introduces the users so that the logins complete,
+ * and times each of these steps.
+ *
+ * Replies that would go to the ircd are intercepted and answered instead.
+ * PLAIN passwords are checked through the auth_user_custom hook, and SCRAM
+ * credentials are made up directly, so that password hashing (which would
+ * otherwise dominate) does not get in the way of what is being measured.
+ * SCRAM needs services to have been built with GNU libidn.
+ */
+
+#include <atheme.h>
+#include <atheme/libathemecore.h>
+
+#define DEFAULT_SESSIONS        50000U
+#define DEFAULT_ACCOUNTS        1000U
+#define DEFAULT_CONFIG          "./sasl-benchmark.conf"
+
+#define BENCH_PASSWORD          "benchmark"
+#define BENCH_SERVER_NAME       "irc.benchmark.example"
+#define BENCH_SERVER_SID        "0AB"
+#define BENCH_SCRAM_ITERCNT     PBKDF2_ITERCNT_MIN
+#define BENCH_SCRAM_SALTLEN     16U
+#define BENCH_SCRAM_DIGLEN      DIGEST_MDLEN_SHA2_256
+
+struct bench_account
+{
+	unsigned char           clientkey[BENCH_SCRAM_DIGLEN];
+	unsigned char           storedkey[BENCH_SCRAM_DIGLEN];
+};
+
+struct bench_session
+{
+	char                    uid[IDLEN + 1];
+	char                    client_first[BUFSIZE];  // client-first-message-bare (SCRAM)
+	char                    reply[BUFSIZE];         // the last data SaslServ sent, decoded
+	unsigned int            account;
+	unsigned int            replies;
+	bool                    scram;
+	bool                    succeeded;
+	bool                    failed;
+};
+
+static struct bench_account *bench_accounts = NULL;
+static struct bench_session *bench_sessions = NULL;
+static unsigned int bench_nsessions = 0;
+static struct server *bench_server = NULL;
+
+static uint32_t bench_seed = 0x5EED1234U;
+
+// Deterministic, so that runs are comparable
+static unsigned int
+bench_rand(const unsigned int bound)
+{
+	bench_seed = (bench_seed * 1103515245U) + 12345U;
+
+	return (unsigned int) ((bench_seed >> 8) % bound);
+}
+
+static double
+bench_elapsed(const struct timeval *const restrict begin, const struct timeval *const restrict end)
+{
+	return ((double) (end->tv_sec - begin->tv_sec)) + (((double) (end->tv_usec - begin->tv_usec)) / 1000000.0);
+}
+
+static bool
+bench_get_arg(const int argc, char **const restrict argv, const int idx, unsigned int *const restrict val)
+{
+	if (argc <= idx)
+		return true;
+
+	if (! string_to_uint(argv[idx], val) || ! *val)
+	{
+		(void) fprintf(stderr, "%s: '%s' is not a positive number\n", argv[0], argv[idx]);
+		return false;
+	}
+
+	return true;
+}
+
+// UIDs are our SID followed by the session's index, in base 36
+static void
+bench_make_uid(char *const restrict buf, unsigned int idx)
+{
+	static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	(void) memcpy(buf, BENCH_SERVER_SID, 3);
+
+	for (int i = 8; i >= 3; i--, idx /= 36U)
+		buf[i] = digits[idx % 36U];
+
+	buf[IDLEN] = 0x00;
+}
+
+static struct bench_session *
+bench_find_session(const char *const restrict uid)
+{
+	unsigned int idx = 0;
+
+	if (strlen(uid) != IDLEN || strncmp(uid, BENCH_SERVER_SID, 3) != 0)
+		return NULL;
+
+	for (size_t i = 3; i < IDLEN; i++)
+	{
+		const char c = uid[i];
+
+		idx = (idx * 36U) + (unsigned int) (isdigit((unsigned char) c) ? (c - '0') : (c - 'A' + 10));
+	}
+
+	return (idx < bench_nsessions) ? &bench_sessions[idx] : NULL;
+}
+
+static void
+bench_sasl_sts(const char *const restrict target, const char mode, const char *const restrict data)
+{
+	struct bench_session *const bs = bench_find_session(target);
+
+	if (! bs)
+		return;
+
+	switch (mode)
+	{
+		case 'C':
+			bs->replies++;
+			bs->reply[0] = 0x00;
+
+			if (strcmp(data, "+") != 0)
+			{
+				const size_t len = base64_decode(data, bs->reply, sizeof bs->reply - 1);
+
+				if (len == BASE64_FAIL)
+					bs->failed = true;
+				else
+					bs->reply[len] = 0x00;
+			}
+			break;
+
+		case 'D':
+			if (strcmp(data, "S") == 0)
+				bs->succeeded = true;
+			else
+				bs->failed = true;
+			break;
+
+		default:
+			// 'M' (the mechanism list) means the mechanism we asked for is not available
+			bs->failed = true;
+			break;
+	}
+}
+
+static void
+bench_svslogin_sts(const char ATHEME_VATTR_UNUSED *const restrict target,
+                   const char ATHEME_VATTR_UNUSED *const restrict nick,
+                   const char ATHEME_VATTR_UNUSED *const restrict user,
+                   const char ATHEME_VATTR_UNUSED *const restrict host,
+                   struct myuser ATHEME_VATTR_UNUSED *const restrict account)
+{
+
+}
+
+static bool
+bench_auth_user(struct myuser ATHEME_VATTR_UNUSED *const restrict mu, const char *const restrict password)
+{
+	return strcmp(password, BENCH_PASSWORD) == 0;
+}
+
+static void
+bench_send(struct bench_session *const restrict bs, const char mode, const char *const restrict arg1,
+           const char *const restrict arg2, const char *const restrict arg3)
+{
+	struct sasl_message smsg;
+
+	(void) memset(&smsg, 0x00, sizeof smsg);
+
+	smsg.server = bench_server;
+	smsg.uid = bs->uid;
+	smsg.mode = mode;
+
+	if (arg1)
+		smsg.parv[smsg.parc++] = (char *) arg1;
+	if (arg2)
+		smsg.parv[smsg.parc++] = (char *) arg2;
+	if (arg3)
+		smsg.parv[smsg.parc++] = (char *) arg3;
+
+	(void) hook_call_sasl_input(&smsg);
+}
+
+// Sends client data the way an ircd does, in 400-character pieces
+static void
+bench_send_data(struct bench_session *const restrict bs, const void *const restrict data, const size_t len)
+{
+	char buf[BUFSIZE * 2];
+
+	if (base64_encode(data, len, buf, sizeof buf) == BASE64_FAIL)
+	{
+		bs->failed = true;
+		return;
+	}
+
+	const size_t total = strlen(buf);
+
+	for (size_t done = 0; done < total; done += SASL_S2S_MAXLEN_ATONCE_B64)
+	{
+		char piece[SASL_S2S_MAXLEN_ATONCE_B64 + 1];
+
+		(void) mowgli_strlcpy(piece, buf + done, sizeof piece);
+		(void) bench_send(bs, 'C', piece, NULL, NULL);
+	}
+
+	if (! (total % SASL_S2S_MAXLEN_ATONCE_B64))
+		(void) bench_send(bs, 'C', "+", NULL, NULL);
+}
+
+static bool
+bench_make_accounts(const unsigned int naccounts)
+{
+	bench_accounts = smalloc(naccounts * sizeof *bench_accounts);
+
+	for (unsigned int i = 0; i < naccounts; i++)
+	{
+		struct bench_account *const ba = &bench_accounts[i];
+		unsigned char salted[BENCH_SCRAM_DIGLEN];
+		unsigned char salt[BENCH_SCRAM_SALTLEN];
+		unsigned char serverkey[BENCH_SCRAM_DIGLEN];
+		char salt64[BASE64_SIZE_STR(sizeof salt)];
+		char serverkey64[BASE64_SIZE_STR(sizeof serverkey)];
+		char storedkey64[BASE64_SIZE_STR(sizeof ba->storedkey)];
+		char name[NICKLEN + 1];
+		char pass[PASSLEN + 1];
+
+		/* Nobody needs to know the password that would lead to these keys, so there is no
+		 * need to spend BENCH_SCRAM_ITERCNT rounds of PBKDF2 on deriving them from one.
+		 */
+		(void) atheme_random_buf(salted, sizeof salted);
+		(void) atheme_random_buf(salt, sizeof salt);
+
+		if (! digest_oneshot_hmac(DIGALG_SHA2_256, salted, sizeof salted, "Client Key", 10U,
+		                          ba->clientkey, NULL) ||
+		    ! digest_oneshot_hmac(DIGALG_SHA2_256, salted, sizeof salted, "Server Key", 10U,
+		                          serverkey, NULL) ||
+		    ! digest_oneshot(DIGALG_SHA2_256, ba->clientkey, sizeof ba->clientkey, ba->storedkey, NULL))
+			return false;
+
+		if (base64_encode(salt, sizeof salt, salt64, sizeof salt64) == BASE64_FAIL ||
+		    base64_encode(serverkey, sizeof serverkey, serverkey64, sizeof serverkey64) == BASE64_FAIL ||
+		    base64_encode(ba->storedkey, sizeof ba->storedkey, storedkey64, sizeof storedkey64) == BASE64_FAIL)
+			return false;
+
+		(void) snprintf(name, sizeof name, "bench%u", i);
+		(void) snprintf(pass, sizeof pass, PBKDF2_FS_SAVEHASH, PBKDF2_PRF_SCRAM_SHA2_256_S64,
+		                BENCH_SCRAM_ITERCNT, salt64, serverkey64, storedkey64);
+
+		if (! myuser_add(name, pass, "bench@example.com", MU_CRYPTPASS))
+			return false;
+	}
+
+	return true;
+}
+
+static void
+bench_client_first(struct bench_session *const restrict bs)
+{
+	if (! bs->scram)
+	{
+		char buf[BUFSIZE];
+		const int len = snprintf(buf, sizeof buf, "%c%s%u%c%s", 0x00, "bench", bs->account, 0x00,
+		                         BENCH_PASSWORD);
+
+		(void) bench_send_data(bs, buf, (size_t) len);
+		return;
+	}
+
+	char buf[BUFSIZE];
+
+	(void) snprintf(bs->client_first, sizeof bs->client_first, "n=bench%u,r=nonce%s%u", bs->account, bs->uid,
+	                bench_rand(1000000U));
+	(void) snprintf(buf, sizeof buf, "n,,%s", bs->client_first);
+	(void) bench_send_data(bs, buf, strlen(buf));
+}
+
+static void
+bench_client_final(struct bench_session *const restrict bs)
+{
+	const struct bench_account *const ba = &bench_accounts[bs->account];
+	const char *nonce = bs->reply;
+
+	// server-first-message: r=<nonce>,s=<salt>,i=<iterations>
+	if (strncmp(nonce, "r=", 2) != 0 || ! strchr(nonce, ','))
+	{
+		bs->failed = true;
+		return;
+	}
+
+	char server_first[BUFSIZE];
+	char without_proof[BUFSIZE];
+	char authmsg[BUFSIZE * 3];
+	char final[BUFSIZE];
+	char proof64[BASE64_SIZE_STR(BENCH_SCRAM_DIGLEN)];
+	unsigned char signature[BENCH_SCRAM_DIGLEN];
+	unsigned char proof[BENCH_SCRAM_DIGLEN];
+
+	(void) mowgli_strlcpy(server_first, bs->reply, sizeof server_first);
+	(void) snprintf(without_proof, sizeof without_proof, "c=biws,r=%.*s", (int) (strchr(nonce, ',') - nonce - 2),
+	                nonce + 2);
+	(void) snprintf(authmsg, sizeof authmsg, "%s,%s,%s", bs->client_first, server_first, without_proof);
+
+	if (! digest_oneshot_hmac(DIGALG_SHA2_256, ba->storedkey, sizeof ba->storedkey, authmsg, strlen(authmsg),
+	                          signature, NULL))
+	{
+		bs->failed = true;
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof proof; i++)
+		proof[i] = ba->clientkey[i] ^ signature[i];
+
+	if (base64_encode(proof, sizeof proof, proof64, sizeof proof64) == BASE64_FAIL)
+	{
+		bs->failed = true;
+		return;
+	}
+
+	(void) snprintf(final, sizeof final, "%s,p=%s", without_proof, proof64);
+	(void) bench_send_data(bs, final, strlen(final));
+}
+
+static void
+bench_report(const char *const restrict phase, const struct timeval *const restrict begin,
+             const unsigned int messages)
+{
+	struct timeval end;
+
+	(void) gettimeofday(&end, NULL);
+
+	const double elapsed = bench_elapsed(begin, &end);
+
+	(void) printf("%-14s %8.3f s, %6u messages, %8.2f us/message\n", phase, elapsed, messages,
+	              messages ? ((elapsed * 1e6) / messages) : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int nsessions = DEFAULT_SESSIONS;
+	unsigned int naccounts = DEFAULT_ACCOUNTS;
+
+	if (argc > 4)
+	{
+		(void) fprintf(stderr, "Usage: %s [sessions [accounts [config]]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (! bench_get_arg(argc, argv, 1, &nsessions) || ! bench_get_arg(argc, argv, 2, &naccounts))
+		return EXIT_FAILURE;
+
+	if (! libathemecore_early_init())
+		return EXIT_FAILURE;
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/sasl-benchmark.log");
+	atheme_setup();
+
+	runflags = RF_LIVE;
+	datadir = DATADIR;
+	strict_mode = false;
+	offline_mode = true;
+
+	conf_init();
+
+	if (! conf_parse((argc > 3) ? argv[3] : DEFAULT_CONFIG))
+	{
+		(void) fprintf(stderr, "%s: cannot load the configuration file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// The protocol module is loaded by now; take over what it would send to the ircd
+	sasl_sts = &bench_sasl_sts;
+	svslogin_sts = &bench_svslogin_sts;
+
+	auth_user_custom = &bench_auth_user;
+	auth_module_loaded = true;
+
+	if (! (bench_server = server_add(BENCH_SERVER_NAME, 1, me.me, BENCH_SERVER_SID, "SASL benchmark")))
+		return EXIT_FAILURE;
+
+	struct timeval begin;
+	(void) gettimeofday(&begin, NULL);
+
+	if (! bench_make_accounts(naccounts))
+	{
+		(void) fprintf(stderr, "%s: cannot create the accounts\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bench_report("accounts", &begin, 0);
+
+	bench_nsessions = nsessions;
+	bench_sessions = smalloc(nsessions * sizeof *bench_sessions);
+
+	// every other session uses SCRAM-SHA-256; all of them use a random account
+	for (unsigned int i = 0; i < nsessions; i++)
+	{
+		struct bench_session *const bs = &bench_sessions[i];
+
+		(void) bench_make_uid(bs->uid, i);
+
+		bs->account = bench_rand(naccounts);
+		bs->scram = (i % 2U) != 0;
+	}
+
+	// the order in which the sessions proceed, so that they do not do so in the order they started
+	unsigned int *const order = smalloc(nsessions * sizeof *order);
+	unsigned int scram = 0;
+
+	for (unsigned int i = 0; i < nsessions; i++)
+		order[i] = i;
+
+	for (unsigned int i = nsessions - 1; i > 0; i--)
+	{
+		const unsigned int j = bench_rand(i + 1);
+		const unsigned int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	(void) gettimeofday(&begin, NULL);
+
+	for (unsigned int i = 0; i < nsessions; i++)
+	{
+		struct bench_session *const bs = &bench_sessions[i];
+		char ip[HOSTIPLEN + 1];
+
+		(void) snprintf(ip, sizeof ip, "10.%u.%u.%u", (i >> 16) & 0xFFU, (i >> 8) & 0xFFU, i & 0xFFU);
+		(void) bench_send(bs, 'H', ip, ip, "P");
+		(void) bench_send(bs, 'S', bs->scram ? "SCRAM-SHA-256" : "PLAIN", NULL, NULL);
+
+		if (bs->scram)
+			scram++;
+	}
+
+	bench_report("start", &begin, 2U * nsessions);
+	(void) gettimeofday(&begin, NULL);
+
+	for (unsigned int i = 0; i < nsessions; i++)
+		(void) bench_client_first(&bench_sessions[order[i]]);
+
+	bench_report("client-first", &begin, nsessions);
+	(void) gettimeofday(&begin, NULL);
+
+	for (unsigned int i = 0; i < nsessions; i++)
+		if (bench_sessions[order[i]].scram && ! bench_sessions[order[i]].failed)
+			(void) bench_client_final(&bench_sessions[order[i]]);
+
+	bench_report("client-final", &begin, scram);
+	(void) gettimeofday(&begin, NULL);
+
+	// the server-final-message needs acknowledging before SaslServ reports success
+	for (unsigned int i = 0; i < nsessions; i++)
+		if (bench_sessions[order[i]].scram && ! bench_sessions[order[i]].failed)
+			(void) bench_send(&bench_sessions[order[i]], 'C', "+", NULL, NULL);
+
+	bench_report("server-final", &begin, scram);
+	(void) gettimeofday(&begin, NULL);
+
+	unsigned int loggedin = 0;
+
+	for (unsigned int i = 0; i < nsessions; i++)
+	{
+		const struct bench_session *const bs = &bench_sessions[order[i]];
+		char nick[NICKLEN + 1];
+		struct user *u;
+
+		(void) snprintf(nick, sizeof nick, "Bench%s", bs->uid);
+
+		if (! (u = user_add(nick, "bench", "bench.example", NULL, NULL, bs->uid, "SASL benchmark",
+		                    bench_server, CURRTIME)))
+			continue;
+
+		if (u->myuser != NULL)
+			loggedin++;
+
+		(void) user_delete(u, "SASL benchmark");
+	}
+
+	bench_report("connect", &begin, nsessions);
+
+	unsigned int succeeded = 0, failed = 0;
+
+	for (unsigned int i = 0; i < nsessions; i++)
+	{
+		if (bench_sessions[i].succeeded && ! bench_sessions[i].failed)
+			succeeded++;
+		else
+			failed++;
+	}
+
+	(void) printf("%u sessions (%u PLAIN, %u SCRAM-SHA-256) over %u accounts: %u succeeded, %u failed, "
+	              "%u logged in on connect\n", nsessions, nsessions - scram, scram, naccounts, succeeded,
+	              failed, loggedin);
+
+	sfree(order);
+	sfree(bench_sessions);
+	sfree(bench_accounts);
+
+	return (failed == 0 && loggedin == nsessions) ? EXIT_SUCCESS : EXIT_FAILURE;
+}